@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+#
+# xrgears
+#
+# Copyright 2020 Collabora Ltd.
+#
+# Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+# SPDX-License-Identifier: MIT
+#
+# Writes assets into a pack read by asset_pack.c:
+#
+#   header:  magic "XRGPACK\0", uint32 version, uint32 entry count
+#   entries: char name[56], uint64 offset, uint64 size, sorted by name
+#   payloads, uncompressed, each starting on a page boundary
+#
+# All integers are little endian.
+
+import os
+import struct
+import sys
+
+MAGIC = b"XRGPACK\0"
+VERSION = 1
+NAME_SIZE = 56
+ALIGNMENT = 4096
+
+
+def align(offset):
+    return (offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("Usage: %s OUTPUT ASSET..." % sys.argv[0], file=sys.stderr)
+        return 1
+
+    paths = sorted(sys.argv[2:], key=os.path.basename)
+    names = [os.path.basename(path).encode() for path in paths]
+    for name in names:
+        if len(name) >= NAME_SIZE:
+            print("Asset name too long: %s" % name.decode(), file=sys.stderr)
+            return 1
+
+    offset = align(16 + len(paths) * (NAME_SIZE + 16))
+    entries = []
+    for path, name in zip(paths, names):
+        size = os.path.getsize(path)
+        entries.append((name, offset, size))
+        offset = align(offset + size)
+
+    with open(sys.argv[1], "wb") as pack:
+        pack.write(struct.pack("<8sII", MAGIC, VERSION, len(entries)))
+        for name, offset, size in entries:
+            pack.write(struct.pack("<%dsQQ" % NAME_SIZE, name, offset, size))
+        for path, (name, offset, size) in zip(paths, entries):
+            pack.seek(offset)
+            with open(path, "rb") as asset:
+                pack.write(asset.read())
+        pack.truncate(align(pack.tell()))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -10,26 +10,65 @@
 
 #version 450
 
+#extension GL_EXT_control_flow_attributes : require
+
 layout(location = 0) in vec3 inNormal;
 layout(location = 1) in vec4 inWorldPos;
+layout(location = 2) in vec4 inClipPos;
+layout(location = 3) flat in uint inMaterial;
+layout(location = 4) in vec2 inUV;
 
 layout(location = 0) out vec4 outColor;
 
-layout(push_constant) uniform PushConsts
+// Pipeline variant options, see pipeline_gears::variant.
+layout(constant_id = 0) const uint MAX_LIGHTS = 64;
+layout(constant_id = 1) const bool METALLIC_ONLY = false;
+layout(constant_id = 2) const uint GAMMA_MODE = 1;
+layout(constant_id = 3) const bool REFLECTION = false;
+layout(constant_id = 4) const uint TEXTURE_CAPACITY = 8;
+// Without shaderSampledImageArrayDynamicIndexing the array is never indexed
+layout(constant_id = 5) const bool TEXTURE_INDEXING = true;
+
+const uint GAMMA_NONE = 0;
+const uint GAMMA_LEGACY = 1;
+const uint GAMMA_SRGB = 2;
+
+const uint NO_TEXTURE = 0xffffffffu;
+
+struct Material
 {
-  layout(offset = 12) float roughness;
-  layout(offset = 16) float metallic;
-  layout(offset = 20) float r;
-  layout(offset = 24) float g;
-  layout(offset = 28) float b;
-}
-material;
+  vec3 color;
+  float roughness;
+  float metallic;
+  uint textureIndex;
+};
 
-layout(binding = 1) uniform UBOLights
+layout(std430, binding = 6) readonly buffer Materials
 {
-  vec4 lights[4];
-}
-uboLights;
+  Material materials[];
+};
+
+/*
+ * Bindless texture array, see vulkan_bindless. Each draw has one instance,
+ * so the material and texture index are dynamically uniform.
+ */
+layout(binding = 7) uniform sampler2D textures[TEXTURE_CAPACITY];
+
+Material material;
+vec3 albedo;
+
+struct Light
+{
+  // xyz: position, w: radius
+  vec4 position;
+  // rgb: color, a: intensity
+  vec4 color;
+};
+
+layout(std430, binding = 1) readonly buffer Lights
+{
+  Light lights[];
+};
 
 layout(binding = 2) uniform UBOCamera
 {
@@ -40,13 +79,29 @@ uboCamera;
 
 layout(binding = 3) uniform samplerCube samplerCubeMap;
 
+// Froxel grid built by light_clusters.cpp for the current view.
+layout(std430, binding = 4) readonly buffer Clusters
+{
+  // x: slice scale, y: slice bias, z: near, w: far
+  vec4 depthParams;
+  // xyz: grid dimensions, w: written light indices
+  uvec4 grid;
+  // x: offset into clusterLights, y: light count
+  uvec2 ranges[];
+};
+
+layout(std430, binding = 5) readonly buffer ClusterLights
+{
+  uint clusterLights[];
+};
+
 
 const float PI = 3.14159265359;
 
 vec3
 materialcolor()
 {
-  return vec3(material.r, material.g, material.b);
+  return albedo;
 }
 
 // Normal Distribution function
@@ -74,7 +129,8 @@ G_SchlicksmithGGX(float dotNL, float dotNV, float roughness)
 vec3
 F_Schlick(float cosTheta, float metallic)
 {
-  vec3 F0 = mix(vec3(0.04), materialcolor(), metallic);
+  vec3 F0 =
+    METALLIC_ONLY ? materialcolor() : mix(vec3(0.04), materialcolor(), metallic);
   vec3 F = F0 + (1.0 - F0) * pow(1.0 - cosTheta, 5.0);
   return F;
 }
@@ -82,7 +138,7 @@ F_Schlick(float cosTheta, float metallic)
 // Specular BRDF composition
 
 vec3
-BRDF(vec3 L, vec3 V, vec3 N, float metallic, float roughness)
+BRDF(vec3 L, vec3 V, vec3 N, vec3 lightColor, float metallic, float roughness)
 {
   // Precalculate vectors and dot products
   vec3 H = normalize(V + L);
@@ -91,10 +147,6 @@ BRDF(vec3 L, vec3 V, vec3 N, float metallic, float roughness)
   float dotLH = clamp(dot(L, H), 0.0, 1.0);
   float dotNH = clamp(dot(N, H), 0.0, 1.0);
 
-  // Light color fixed
-  vec3 lightColor = vec3(1.0);
-  // vec3 lightColor = reflectionColor;
-
   vec3 color = vec3(0.0);
 
   if (dotNL > 0.0) {
@@ -114,28 +166,72 @@ BRDF(vec3 L, vec3 V, vec3 N, float metallic, float roughness)
   return color;
 }
 
+// Smooth window that reaches zero at the light radius
+float
+attenuation(float dist, float radius)
+{
+  float x = dist / radius;
+  float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+  return window * window;
+}
+
+uint
+clusterIndex()
+{
+  vec2 ndc = inClipPos.xy / inClipPos.w;
+  uvec2 tile = uvec2(clamp((ndc * 0.5 + 0.5) * vec2(grid.xy), vec2(0.0),
+                           vec2(grid.xy) - 1.0));
+  float slice = log(inClipPos.w) * depthParams.x + depthParams.y;
+  uint z = uint(clamp(slice, 0.0, float(grid.z) - 1.0));
+  return (z * grid.y + tile.y) * grid.x + tile.x;
+}
+
 void
 main()
 {
+  material = materials[inMaterial];
+  albedo = material.color;
+  if (TEXTURE_INDEXING && material.textureIndex != NO_TEXTURE &&
+      material.textureIndex < TEXTURE_CAPACITY)
+    albedo *= texture(textures[material.textureIndex], inUV).rgb;
+
   vec3 N = normalize(inNormal);
   vec3 V = normalize(uboCamera.position.xyz - inWorldPos.xyz);
 
   float roughness = material.roughness;
+  float metallic = METALLIC_ONLY ? 1.0 : material.metallic;
 
   // Specular contribution
   vec3 Lo = vec3(0.0);
-  for (int i = 0; i < uboLights.lights.length(); i++) {
-    vec3 L = normalize(uboLights.lights[i].xyz - inWorldPos.xyz);
-    Lo += BRDF(L, V, N, material.metallic, roughness);
-  };
+  uvec2 range = ranges[clusterIndex()];
+  // Constant bound, light_clusters.cpp caps the clusters at MAX_LIGHTS
+  [[unroll]] for (uint i = 0; i < MAX_LIGHTS; i++) {
+    if (i >= range.y)
+      break;
+    Light light = lights[clusterLights[range.x + i]];
+    vec3 toLight = light.position.xyz - inWorldPos.xyz;
+    float falloff = attenuation(length(toLight), light.position.w);
+    vec3 L = normalize(toLight);
+    Lo += BRDF(L, V, N, light.color.rgb * light.color.a * falloff, metallic,
+               roughness);
+  }
+
+  if (REFLECTION) {
+    vec3 R = reflect(-V, N);
+    float lod = roughness * float(textureQueryLevels(samplerCubeMap) - 1);
+    vec3 reflection = textureLod(samplerCubeMap, R, lod).rgb;
+    Lo += reflection * F_Schlick(clamp(dot(N, V), 0.0, 1.0), metallic);
+  }
 
   // Combine with ambient
   vec3 color = materialcolor() * 0.02;
   color += Lo;
 
   // Gamma correct
-  //color = pow(color, vec3(0.4545));
-  color = pow(color, vec3(0.9));
+  if (GAMMA_MODE == GAMMA_LEGACY)
+    color = pow(color, vec3(0.9));
+  else if (GAMMA_MODE == GAMMA_SRGB)
+    color = pow(color, vec3(0.4545));
 
   outColor = vec4(color, 1.0);
 }
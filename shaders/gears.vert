@@ -13,12 +13,18 @@
 layout(location = 0) in vec3 inPos;
 layout(location = 1) in vec3 inNormal;
 
-layout(binding = 0) uniform UBOMatrices
+struct Object
 {
   mat4 normal;
   mat4 model;
-}
-uboModel;
+  uint material;
+};
+
+// Indexed by firstInstance, see Gear::draw.
+layout(std430, binding = 0) readonly buffer Objects
+{
+  Object objects[];
+};
 
 layout(binding = 2) uniform UBOCamera
 {
@@ -29,6 +35,9 @@ uboCamera;
 
 layout(location = 0) out vec3 outNormal;
 layout(location = 1) out vec4 outWorldPos;
+layout(location = 2) out vec4 outClipPos;
+layout(location = 3) flat out uint outMaterial;
+layout(location = 4) out vec2 outUV;
 
 out gl_PerVertex
 {
@@ -38,7 +47,12 @@ out gl_PerVertex
 void
 main()
 {
-  outNormal = mat3(uboModel.normal) * inNormal;
-  outWorldPos = uboModel.model * vec4(inPos.xyz, 1.0);
+  Object object = objects[gl_InstanceIndex];
+  outNormal = mat3(object.normal) * inNormal;
+  outWorldPos = object.model * vec4(inPos.xyz, 1.0);
   gl_Position = uboCamera.vp * outWorldPos;
+  outClipPos = gl_Position;
+  outMaterial = object.material;
+  // Gears have no texture coordinates, project along their axis
+  outUV = inPos.xy * 0.25;
 }
@@ -0,0 +1,33 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#version 450
+
+layout(set = 0, binding = 0) uniform UBO
+{
+  mat4 vp;
+}
+ubo;
+// The panorama resampled by equirect_to_cube.comp or xrgears-bake
+layout(set = 0, binding = 1) uniform samplerCube map;
+
+layout(location = 0) in vec2 in_uv;
+
+layout(location = 0) out vec4 out_color;
+
+void
+main()
+{
+  vec2 frag_coord = vec2(in_uv) * 2 - 1;
+  // Cube lookups do not need a normalized direction
+  vec4 view_dir = ubo.vp * vec4(frag_coord, 1, 1);
+
+  out_color = texture(map, view_dir.xyz);
+  out_color.w = 1.0f;
+}
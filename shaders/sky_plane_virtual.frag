@@ -0,0 +1,96 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#version 450
+
+layout(set = 0, binding = 0) uniform UBO
+{
+  mat4 vp;
+}
+ubo;
+// Slots of streamed tiles, each with a one texel border
+layout(set = 0, binding = 1) uniform sampler2D cache;
+// See vulkan_virtual_texture_header
+layout(std430, set = 0, binding = 2) readonly buffer PageTable
+{
+  uint level_count;
+  uint tile_size;
+  uint slot_size;
+  uint slots_per_side;
+  // width, height, tiles per row, first entry
+  uvec4 levels[16];
+  uint entries[];
+}
+page_table;
+
+layout(location = 0) in vec2 in_uv;
+
+layout(location = 0) out vec4 out_color;
+
+const float PI = 3.1416;
+const uint RESIDENT_BIT = 0x80000000u;
+const float BORDER = 1.0;
+
+// Difference across the seam of the panorama
+float
+wrap(float du)
+{
+  return du - round(du);
+}
+
+void
+main()
+{
+  vec2 frag_coord = vec2(in_uv) * 2 - 1;
+  vec4 view_dir = normalize(ubo.vp * vec4(frag_coord, 1, 1));
+
+  float u = atan(view_dir.x, -view_dir.z) / (2 * PI) + 0.5;
+  float v = acos(-view_dir.y) / PI;
+  vec2 uv = vec2(u, v);
+
+  // Same level selection as vulkan_virtual_texture_request_view
+  vec2 size = vec2(page_table.levels[0].xy);
+  vec2 dx = vec2(wrap(dFdx(u)), dFdx(v)) * size;
+  vec2 dy = vec2(wrap(dFdy(u)), dFdy(v)) * size;
+  float lod = floor(log2(max(length(dx), length(dy))));
+  uint level = uint(clamp(lod, 0.0, float(page_table.level_count - 1u)));
+
+  uvec4 info = page_table.levels[level];
+  uvec2 tiles = uvec2(info.z, (info.y + page_table.tile_size - 1u) /
+                                page_table.tile_size);
+  uvec2 tile = min(uvec2(uv * vec2(info.xy)) / page_table.tile_size,
+                   tiles - 1u);
+  uint entry = page_table.entries[info.w + tile.y * info.z + tile.x];
+
+  if ((entry & RESIDENT_BIT) == 0u) {
+    out_color = vec4(0, 0, 0, 1);
+    return;
+  }
+
+  // The entry can point to a coarser tile
+  uint slot = entry & 0xffffu;
+  uint resident_level = (entry >> 16) & 0x7fffu;
+  uvec4 resident = page_table.levels[resident_level];
+  uvec2 resident_tiles =
+    uvec2(resident.z, (resident.y + page_table.tile_size - 1u) /
+                        page_table.tile_size);
+
+  vec2 texel = uv * vec2(resident.xy);
+  uvec2 resident_tile =
+    min(uvec2(texel) / page_table.tile_size, resident_tiles - 1u);
+  vec2 local = texel - vec2(resident_tile * page_table.tile_size);
+
+  uvec2 slot_xy = uvec2(slot % page_table.slots_per_side,
+                        slot / page_table.slots_per_side);
+  vec2 cache_texel = vec2(slot_xy * page_table.slot_size) + BORDER + local;
+  float cache_size = float(page_table.slots_per_side * page_table.slot_size);
+
+  out_color = textureLod(cache, cache_texel / cache_size, 0.0);
+  out_color.w = 1.0f;
+}
@@ -0,0 +1,195 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "asset_pack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef XR_OS_ANDROID
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "log.h"
+
+#define ASSET_PACK_MAGIC "XRGPACK"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_HEADER_SIZE 16
+
+#define ASSET_PACK_FILE_NAME "textures.pack"
+
+static bool
+_init_index(asset_pack *self)
+{
+  uint32_t version;
+
+  if (self->size < ASSET_PACK_HEADER_SIZE ||
+      memcmp(self->data, ASSET_PACK_MAGIC, sizeof(ASSET_PACK_MAGIC)) != 0) {
+    xrg_log_e("Asset pack has no valid header.");
+    return false;
+  }
+
+  memcpy(&version, self->data + 8, sizeof(version));
+  memcpy(&self->entry_count, self->data + 12, sizeof(self->entry_count));
+
+  if (version != ASSET_PACK_VERSION) {
+    xrg_log_e("Asset pack has unknown version %d.", version);
+    return false;
+  }
+
+  self->entries =
+    (const asset_pack_entry *)(self->data + ASSET_PACK_HEADER_SIZE);
+
+  if (self->entry_count >
+      (self->size - ASSET_PACK_HEADER_SIZE) / sizeof(asset_pack_entry)) {
+    xrg_log_e("Asset pack index is truncated.");
+    return false;
+  }
+
+  for (uint32_t i = 0; i < self->entry_count; i++) {
+    const asset_pack_entry *entry = &self->entries[i];
+    if (entry->name[ASSET_PACK_NAME_SIZE - 1] != '\0' ||
+        entry->offset > self->size ||
+        entry->size > self->size - entry->offset) {
+      xrg_log_e("Asset pack entry %d is invalid.", i);
+      return false;
+    }
+  }
+
+  xrg_log_d("Opened asset pack with %d assets (%zu bytes).",
+            self->entry_count, self->size);
+
+  return true;
+}
+
+#ifdef XR_OS_ANDROID
+
+bool
+asset_pack_open(asset_pack *self, AAssetManager *manager)
+{
+  *self = (asset_pack){ 0 };
+
+  self->asset =
+    AAssetManager_open(manager, ASSET_PACK_FILE_NAME, AASSET_MODE_BUFFER);
+  if (!self->asset) {
+    xrg_log_e("Cannot open asset pack '%s'.", ASSET_PACK_FILE_NAME);
+    return false;
+  }
+
+  // Maps the APK when the pack is stored uncompressed
+  self->data = AAsset_getBuffer(self->asset);
+  self->size = AAsset_getLength(self->asset);
+  if (!self->data || !_init_index(self)) {
+    asset_pack_close(self);
+    return false;
+  }
+
+  return true;
+}
+
+#else
+
+static bool
+_map_file(asset_pack *self, const char *path)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  self->data = data;
+  self->size = st.st_size;
+
+  xrg_log_d("Mapped asset pack %s.", path);
+
+  return true;
+}
+
+bool
+asset_pack_open(asset_pack *self, const char *path)
+{
+  *self = (asset_pack){ 0 };
+
+  const char *env_path = getenv("XRGEARS_ASSET_PACK");
+  const char *paths[] = {
+    path,
+    env_path,
+    XRGEARS_BUILD_ASSET_DIR "/" ASSET_PACK_FILE_NAME,
+    XRGEARS_ASSET_DIR "/" ASSET_PACK_FILE_NAME,
+  };
+
+  for (uint32_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+    if (!paths[i] || !_map_file(self, paths[i]))
+      continue;
+    if (_init_index(self))
+      return true;
+    asset_pack_close(self);
+    return false;
+  }
+
+  xrg_log_e("Cannot find asset pack '%s'.", ASSET_PACK_FILE_NAME);
+  return false;
+}
+
+#endif
+
+static int
+_compare_entry(const void *name, const void *entry)
+{
+  return strcmp(name, ((const asset_pack_entry *)entry)->name);
+}
+
+bool
+asset_pack_contains(asset_pack *self, const char *name)
+{
+  return bsearch(name, self->entries, self->entry_count,
+                 sizeof(asset_pack_entry), _compare_entry) != NULL;
+}
+
+const uint8_t *
+asset_pack_get(asset_pack *self, const char *name, size_t *size)
+{
+  const asset_pack_entry *entry =
+    bsearch(name, self->entries, self->entry_count, sizeof(asset_pack_entry),
+            _compare_entry);
+  if (!entry) {
+    xrg_log_e("Asset pack has no asset '%s'.", name);
+    *size = 0;
+    return NULL;
+  }
+
+  *size = entry->size;
+  return self->data + entry->offset;
+}
+
+void
+asset_pack_close(asset_pack *self)
+{
+#ifdef XR_OS_ANDROID
+  if (self->asset)
+    AAsset_close(self->asset);
+#else
+  if (self->data)
+    munmap((void *)self->data, self->size);
+#endif
+  *self = (asset_pack){ 0 };
+}
@@ -0,0 +1,77 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef XR_OS_ANDROID
+#include <android/asset_manager.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASSET_PACK_NAME_SIZE 56
+
+// Layout written by scripts/pack_assets.py, little endian
+typedef struct
+{
+  char name[ASSET_PACK_NAME_SIZE];
+  uint64_t offset;
+  uint64_t size;
+} asset_pack_entry;
+
+/*
+ * Read only mapping of the asset pack. Payloads are stored uncompressed and
+ * page aligned, so they can be read in place until the pack is closed.
+ */
+typedef struct
+{
+  const uint8_t *data;
+  size_t size;
+
+  const asset_pack_entry *entries;
+  uint32_t entry_count;
+
+#ifdef XR_OS_ANDROID
+  AAsset *asset;
+#endif
+} asset_pack;
+
+#ifdef XR_OS_ANDROID
+// Opens the pack from the APK, where it needs to be stored uncompressed
+bool
+asset_pack_open(asset_pack *self, AAssetManager *manager);
+#else
+/*
+ * path may be NULL, in which case $XRGEARS_ASSET_PACK, the build directory
+ * and the install directory are tried in that order.
+ */
+bool
+asset_pack_open(asset_pack *self, const char *path);
+#endif
+
+// For optional assets, without logging an error when they are missing
+bool
+asset_pack_contains(asset_pack *self, const char *name);
+
+// Returns NULL if there is no asset with this name
+const uint8_t *
+asset_pack_get(asset_pack *self, const char *name, size_t *size);
+
+void
+asset_pack_close(asset_pack *self);
+
+#ifdef __cplusplus
+}
+#endif
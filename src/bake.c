@@ -0,0 +1,1084 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * xrgears-bake: prepares textures offline, so the renderer can upload them
+ * as they are. Writes KTX files with a full mip chain, which the loader no
+ * longer needs to blit, either as RGBA8 the virtual texture can stream in
+ * place or block compressed as BC7 for desktop or ETC2 for mobile GPUs.
+ * Panoramas can be resampled into cube maps on the way.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ktx_texture.h"
+#include "log.h"
+#include "settings.h"
+
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_RGBA 0x1908
+#define GL_RGBA8 0x8058
+#define GL_SRGB8_ALPHA8 0x8C43
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC 0x9279
+
+#define MAX_THREADS 64
+#define MAX_LEVELS 32
+
+#define PI 3.14159265358979f
+
+// Linear RGBA texels
+typedef struct
+{
+  uint32_t width, height;
+  float *texels;
+} _image;
+
+// Encodes 4x4 RGBA8 texels in row major order into a block
+typedef void (*_block_func)(const uint8_t texels[16][4], uint8_t *block);
+
+typedef struct
+{
+  const char *name;
+  uint32_t gl_unorm, gl_srgb;
+  // NULL for uncompressed texels
+  _block_func encode_block;
+  uint32_t block_size;
+} _format;
+
+typedef struct
+{
+  uint32_t thread_count;
+  bool linear;
+  uint32_t cube_size;
+  const _format *format;
+
+  // Decodes 8 bit sRGB
+  float srgb_to_linear[256];
+} _baker;
+
+static const char *
+_help_string()
+{
+  return "Bakes textures into the KTX files xrgears uploads as they are\n"
+         "\n"
+         "Usage: xrgears-bake [OPTIONS] INPUT OUTPUT\n"
+         "\n"
+         "INPUT is an uncompressed 8 bit RGB or RGBA KTX1 or KTX2 file or a "
+         "binary PPM image.\n"
+         "OUTPUT is a KTX file with a full mip chain.\n"
+         "\n"
+         "Options:\n"
+         "  -f FORMAT  Output format: rgba8, bc7 or etc2 (default: rgba8)\n"
+         "  -c SIZE    Resample an equirectangular panorama into a cube map\n"
+         "             with faces of SIZE texels\n"
+         "  -l         Texels are linear instead of sRGB\n"
+         "  -j THREADS Threads to use (default: one per core)\n"
+         "  -h         Show this help\n";
+}
+
+/*
+ * Runs func for rows of an image in parallel. Rows are split into one
+ * contiguous range per thread, each row costs about the same.
+ */
+typedef void (*_row_func)(_baker *self, void *data, uint32_t row);
+
+typedef struct
+{
+  _baker *baker;
+  _row_func func;
+  void *data;
+  uint32_t first, end;
+} _row_range;
+
+static void *
+_run_rows(void *data)
+{
+  _row_range *range = data;
+  for (uint32_t row = range->first; row < range->end; row++)
+    range->func(range->baker, range->data, row);
+  return NULL;
+}
+
+static void
+_parallel_rows(_baker *self, _row_func func, void *data, uint32_t rows)
+{
+  uint32_t count = self->thread_count < rows ? self->thread_count : rows;
+
+  pthread_t threads[MAX_THREADS];
+  _row_range ranges[MAX_THREADS];
+  for (uint32_t i = 0; i < count; i++) {
+    ranges[i] = (_row_range){
+      .baker = self,
+      .func = func,
+      .data = data,
+      .first = (uint32_t)((uint64_t)rows * i / count),
+      .end = (uint32_t)((uint64_t)rows * (i + 1) / count),
+    };
+    // The calling thread takes the first range
+    if (i > 0)
+      xrg_log_f_if(pthread_create(&threads[i], NULL, _run_rows, &ranges[i]),
+                   "Could not start a bake thread.");
+  }
+
+  _run_rows(&ranges[0]);
+  for (uint32_t i = 1; i < count; i++)
+    pthread_join(threads[i], NULL);
+}
+
+static void
+_image_init(_image *self, uint32_t width, uint32_t height)
+{
+  self->width = width;
+  self->height = height;
+  self->texels = malloc(sizeof(float) * 4 * width * height);
+  xrg_log_f_if(self->texels == NULL, "Could not allocate a %dx%d image.",
+               width, height);
+}
+
+static uint8_t *
+_read_file(const char *path, size_t *size)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    xrg_log_e("Could not open %s.", path);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  *size = (size_t)ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  uint8_t *bytes = malloc(*size);
+  if (fread(bytes, 1, *size, file) != *size) {
+    xrg_log_e("Could not read %s.", path);
+    free(bytes);
+    bytes = NULL;
+  }
+
+  fclose(file);
+  return bytes;
+}
+
+// Rows of 8 bit texels with channels components each
+typedef struct
+{
+  const uint8_t *data;
+  size_t row_pitch;
+  uint32_t channels;
+  _image *image;
+} _decode_job;
+
+static void
+_decode_row(_baker *self, void *data, uint32_t row)
+{
+  _decode_job *job = data;
+  const uint8_t *src = job->data + job->row_pitch * row;
+  float *dst = job->image->texels + (size_t)row * job->image->width * 4;
+
+  for (uint32_t x = 0; x < job->image->width; x++) {
+    for (uint32_t c = 0; c < 3; c++)
+      dst[c] = self->linear ? src[c] / 255.0f : self->srgb_to_linear[src[c]];
+    dst[3] = job->channels == 4 ? src[3] / 255.0f : 1.0f;
+    src += job->channels;
+    dst += 4;
+  }
+}
+
+static bool
+_load_ktx(_baker *self, const uint8_t *bytes, size_t size, _image *image)
+{
+  ktxTexture *tex;
+  if (ktxTexture_CreateFromMemory(bytes, size, KTX_TEXTURE_CREATE_NO_FLAGS,
+                                  &tex) != KTX_SUCCESS) {
+    xrg_log_e("Could not read the KTX file.");
+    return false;
+  }
+
+  // Valid for KTX1 and KTX2, unlike the GL format
+  VkFormat format = ktxTexture_GetVkFormat(tex);
+  uint32_t channels = 0;
+  switch (format) {
+  case VK_FORMAT_R8G8B8_UNORM:
+  case VK_FORMAT_R8G8B8_SRGB: channels = 3; break;
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB: channels = 4; break;
+  default: break;
+  }
+
+  if (channels == 0) {
+    xrg_log_e("Can not bake KTX format %d, only 8 bit RGB and RGBA UNORM "
+              "and SRGB textures are baked.",
+              format);
+    ktxTexture_Destroy(tex);
+    return false;
+  }
+
+  if (tex->numDimensions != 2 || tex->numFaces != 1 || tex->numLayers != 1 ||
+      !ktxTexture_CanReadImageData(tex)) {
+    xrg_log_e("Only single 2D images are baked.");
+    ktxTexture_Destroy(tex);
+    return false;
+  }
+
+  ktx_size_t image_size = ktxTexture_GetImageSize(tex, 0);
+  uint8_t *data = malloc(image_size);
+  KTX_error_code result =
+    ktxTexture_ReadImageData(tex, 0, 0, 0, 0, data, image_size);
+  if (result == KTX_SUCCESS) {
+    _image_init(image, tex->baseWidth, tex->baseHeight);
+    _decode_job job = {
+      .data = data,
+      .row_pitch = ktxTexture_GetRowPitch(tex, 0),
+      .channels = channels,
+      .image = image,
+    };
+    _parallel_rows(self, _decode_row, &job, image->height);
+  } else {
+    xrg_log_e("Could not read the base level of the KTX file.");
+  }
+
+  free(data);
+  ktxTexture_Destroy(tex);
+  return result == KTX_SUCCESS;
+}
+
+// Skips whitespace and comments between the fields of a PPM header
+static const uint8_t *
+_ppm_field(const uint8_t *p, const uint8_t *end, uint32_t *value)
+{
+  while (p < end && (*p == '#' || *p == ' ' || *p == '\t' || *p == '\r' ||
+                     *p == '\n')) {
+    if (*p == '#')
+      while (p < end && *p != '\n')
+        p++;
+    else
+      p++;
+  }
+
+  *value = 0;
+  const uint8_t *start = p;
+  while (p < end && *p >= '0' && *p <= '9')
+    *value = *value * 10 + (uint32_t)(*p++ - '0');
+
+  return p == start ? NULL : p;
+}
+
+static bool
+_load_ppm(_baker *self, const uint8_t *bytes, size_t size, _image *image)
+{
+  const uint8_t *end = bytes + size;
+  uint32_t width, height, max_value;
+
+  const uint8_t *p = bytes + 2;
+  if ((p = _ppm_field(p, end, &width)) == NULL ||
+      (p = _ppm_field(p, end, &height)) == NULL ||
+      (p = _ppm_field(p, end, &max_value)) == NULL || max_value != 255 ||
+      width == 0 || height == 0) {
+    xrg_log_e("Only 8 bit binary PPM images are baked.");
+    return false;
+  }
+
+  // A single whitespace separates the header from the texels
+  if (p == end || (size_t)(end - ++p) < (size_t)width * height * 3) {
+    xrg_log_e("The PPM image is truncated.");
+    return false;
+  }
+
+  _image_init(image, width, height);
+  _decode_job job = {
+    .data = p,
+    .row_pitch = (size_t)width * 3,
+    .channels = 3,
+    .image = image,
+  };
+  _parallel_rows(self, _decode_row, &job, height);
+
+  return true;
+}
+
+static bool
+_load(_baker *self, const char *path, _image *image)
+{
+  size_t size;
+  uint8_t *bytes = _read_file(path, &size);
+  if (bytes == NULL)
+    return false;
+
+  static const uint8_t ktx1[12] = KTX_IDENTIFIER_REF;
+  static const uint8_t ktx2[12] = KTX2_IDENTIFIER_REF;
+
+  bool loaded = false;
+  if (size >= 12 &&
+      (memcmp(bytes, ktx1, 12) == 0 || memcmp(bytes, ktx2, 12) == 0))
+    loaded = _load_ktx(self, bytes, size, image);
+  else if (size >= 2 && bytes[0] == 'P' && bytes[1] == '6')
+    loaded = _load_ppm(self, bytes, size, image);
+  else
+    xrg_log_e("%s is neither a KTX file nor a binary PPM image.", path);
+
+  free(bytes);
+  return loaded;
+}
+
+// Averages 2x2 texels in linear light, odd edges repeat the last texel
+static void
+_downsample_row(_baker *self, void *data, uint32_t row)
+{
+  (void)self;
+  _image *levels = data;
+  _image *src = &levels[0];
+  _image *dst = &levels[1];
+
+  uint32_t y0 = row * 2 < src->height ? row * 2 : src->height - 1;
+  uint32_t y1 = y0 + 1 < src->height ? y0 + 1 : y0;
+  const float *rows[2] = {
+    src->texels + (size_t)y0 * src->width * 4,
+    src->texels + (size_t)y1 * src->width * 4,
+  };
+
+  float *out = dst->texels + (size_t)row * dst->width * 4;
+  for (uint32_t x = 0; x < dst->width; x++) {
+    uint32_t x0 = x * 2 < src->width ? x * 2 : src->width - 1;
+    uint32_t x1 = x0 + 1 < src->width ? x0 + 1 : x0;
+    for (uint32_t c = 0; c < 4; c++)
+      out[x * 4 + c] = 0.25f * (rows[0][x0 * 4 + c] + rows[0][x1 * 4 + c] +
+                                rows[1][x0 * 4 + c] + rows[1][x1 * 4 + c]);
+  }
+}
+
+// Fills levels after the base level, returns the level count
+static uint32_t
+_generate_mipmaps(_baker *self, _image *levels)
+{
+  uint32_t count = 1;
+  while (levels[count - 1].width > 1 || levels[count - 1].height > 1) {
+    _image *src = &levels[count - 1];
+    _image_init(&levels[count], src->width > 1 ? src->width / 2 : 1,
+                src->height > 1 ? src->height / 2 : 1);
+    _parallel_rows(self, _downsample_row, &levels[count - 1],
+                   levels[count].height);
+    count++;
+  }
+  return count;
+}
+
+// Bilinear, wrapping around horizontally like the panorama does
+static void
+_sample_equirect(const _image *image, float u, float v, float *out)
+{
+  float x = u * (float)image->width - 0.5f;
+  float y = v * (float)image->height - 0.5f;
+  float fx = floorf(x);
+  float fy = floorf(y);
+  float wx = x - fx;
+  float wy = y - fy;
+
+  int32_t w = (int32_t)image->width;
+  int32_t h = (int32_t)image->height;
+  int32_t x0 = (((int32_t)fx % w) + w) % w;
+  int32_t x1 = (x0 + 1) % w;
+  int32_t y0 = (int32_t)fy < 0 ? 0 : ((int32_t)fy >= h ? h - 1 : (int32_t)fy);
+  int32_t y1 = y0 + 1 < h ? y0 + 1 : h - 1;
+
+  const float *t00 = image->texels + ((size_t)y0 * w + x0) * 4;
+  const float *t10 = image->texels + ((size_t)y0 * w + x1) * 4;
+  const float *t01 = image->texels + ((size_t)y1 * w + x0) * 4;
+  const float *t11 = image->texels + ((size_t)y1 * w + x1) * 4;
+
+  for (uint32_t c = 0; c < 4; c++) {
+    float top = t00[c] + (t10[c] - t00[c]) * wx;
+    float bottom = t01[c] + (t11[c] - t01[c]) * wx;
+    out[c] = top + (bottom - top) * wy;
+  }
+}
+
+// Face order and orientation of Vulkan and KTX cube maps
+static void
+_face_direction(uint32_t face, float s, float t, float *dir)
+{
+  switch (face) {
+  case 0: dir[0] = 1; dir[1] = -t; dir[2] = -s; break;
+  case 1: dir[0] = -1; dir[1] = -t; dir[2] = s; break;
+  case 2: dir[0] = s; dir[1] = 1; dir[2] = t; break;
+  case 3: dir[0] = s; dir[1] = -1; dir[2] = -t; break;
+  case 4: dir[0] = s; dir[1] = -t; dir[2] = 1; break;
+  default: dir[0] = -s; dir[1] = -t; dir[2] = -1; break;
+  }
+}
+
+typedef struct
+{
+  const _image *panorama;
+  uint32_t panorama_levels;
+  uint32_t face;
+  _image *image;
+} _face_job;
+
+/*
+ * Same projection as equirect_to_cube.comp. Texels are sampled trilinearly
+ * from the panorama levels matching their size.
+ */
+static void
+_resample_face_row(_baker *self, void *data, uint32_t row)
+{
+  (void)self;
+  _face_job *job = data;
+  uint32_t size = job->image->width;
+
+  float lod = log2f((float)job->panorama[0].width / (float)(4 * size));
+  if (lod < 0.0f)
+    lod = 0.0f;
+  if (lod > (float)(job->panorama_levels - 1))
+    lod = (float)(job->panorama_levels - 1);
+  uint32_t level = (uint32_t)lod;
+  uint32_t next = level + 1 < job->panorama_levels ? level + 1 : level;
+  float blend = lod - (float)level;
+
+  float t = ((float)row + 0.5f) / (float)size * 2.0f - 1.0f;
+  float *out = job->image->texels + (size_t)row * size * 4;
+  for (uint32_t x = 0; x < size; x++) {
+    float s = ((float)x + 0.5f) / (float)size * 2.0f - 1.0f;
+    float dir[3];
+    _face_direction(job->face, s, t, dir);
+    float length = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+
+    float u = atan2f(dir[0], -dir[2]) / (2.0f * PI) + 0.5f;
+    float v = acosf(-dir[1] / length) / PI;
+
+    float a[4], b[4];
+    _sample_equirect(&job->panorama[level], u, v, a);
+    _sample_equirect(&job->panorama[next], u, v, b);
+    for (uint32_t c = 0; c < 4; c++)
+      out[x * 4 + c] = a[c] + (b[c] - a[c]) * blend;
+  }
+}
+
+typedef struct
+{
+  const _image *image;
+  uint8_t *data;
+} _encode_job;
+
+static uint8_t
+_to_unorm(float value)
+{
+  if (value <= 0.0f)
+    return 0;
+  if (value >= 1.0f)
+    return 255;
+  return (uint8_t)(value * 255.0f + 0.5f);
+}
+
+static float
+_linear_to_srgb(float value)
+{
+  if (value <= 0.0031308f)
+    return value * 12.92f;
+  return 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+static void
+_encode_row(_baker *self, void *data, uint32_t row)
+{
+  _encode_job *job = data;
+  size_t offset = (size_t)row * job->image->width * 4;
+  const float *src = job->image->texels + offset;
+  uint8_t *dst = job->data + offset;
+
+  for (uint32_t i = 0; i < job->image->width * 4; i++) {
+    bool color = (i & 3) != 3;
+    dst[i] = _to_unorm(color && !self->linear ? _linear_to_srgb(src[i])
+                                              : src[i]);
+  }
+}
+
+static void
+_put_bits(uint8_t *block, uint32_t *offset, uint32_t value, uint32_t count)
+{
+  for (uint32_t i = 0; i < count; i++, (*offset)++)
+    if ((value >> i) & 1)
+      block[*offset / 8] |= (uint8_t)(1 << (*offset % 8));
+}
+
+static uint32_t
+_squared_error(const uint8_t *a, const int32_t *b, uint32_t channels)
+{
+  uint32_t error = 0;
+  for (uint32_t c = 0; c < channels; c++)
+    error += (uint32_t)((a[c] - b[c]) * (a[c] - b[c]));
+  return error;
+}
+
+// Rounds an endpoint to 7 bits per channel and the p-bit fitting it best
+static void
+_bc7_quantize(const float *endpoint, uint32_t *q, uint32_t *p_bit)
+{
+  float best = INFINITY;
+  for (uint32_t p = 0; p < 2; p++) {
+    uint32_t candidate[4];
+    float error = 0.0f;
+    for (uint32_t c = 0; c < 4; c++) {
+      float value = (endpoint[c] - (float)p) / 2.0f + 0.5f;
+      candidate[c] = value <= 0.0f ? 0 : (value >= 127.0f ? 127 : value);
+      float d = (float)((candidate[c] << 1) | p) - endpoint[c];
+      error += d * d;
+    }
+    if (error < best) {
+      best = error;
+      memcpy(q, candidate, sizeof(candidate));
+      *p_bit = p;
+    }
+  }
+}
+
+/*
+ * BC7 mode 6: one subset with 7 bit RGBA endpoints, a p-bit each and 4 bit
+ * indices. The endpoints span the texels along their principal axis.
+ */
+static void
+_encode_bc7(const uint8_t texels[16][4], uint8_t *block)
+{
+  float mean[4] = { 0 };
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t c = 0; c < 4; c++)
+      mean[c] += texels[i][c] / 16.0f;
+
+  float covariance[4][4] = { { 0 } };
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t a = 0; a < 4; a++)
+      for (uint32_t b = 0; b < 4; b++)
+        covariance[a][b] +=
+          (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+
+  // Power iteration
+  float axis[4] = { 1, 1, 1, 1 };
+  for (uint32_t iteration = 0; iteration < 8; iteration++) {
+    float next[4] = { 0 };
+    float length = 0.0f;
+    for (uint32_t a = 0; a < 4; a++) {
+      for (uint32_t b = 0; b < 4; b++)
+        next[a] += covariance[a][b] * axis[b];
+      length += next[a] * next[a];
+    }
+    if (length < 1e-6f)
+      break;
+    length = sqrtf(length);
+    for (uint32_t a = 0; a < 4; a++)
+      axis[a] = next[a] / length;
+  }
+
+  float t_min = INFINITY, t_max = -INFINITY;
+  for (uint32_t i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (uint32_t c = 0; c < 4; c++)
+      t += (texels[i][c] - mean[c]) * axis[c];
+    t_min = fminf(t_min, t);
+    t_max = fmaxf(t_max, t);
+  }
+
+  float endpoints[2][4];
+  for (uint32_t c = 0; c < 4; c++) {
+    endpoints[0][c] = fminf(fmaxf(mean[c] + axis[c] * t_min, 0.0f), 255.0f);
+    endpoints[1][c] = fminf(fmaxf(mean[c] + axis[c] * t_max, 0.0f), 255.0f);
+  }
+
+  uint32_t q[2][4], p[2];
+  for (uint32_t e = 0; e < 2; e++)
+    _bc7_quantize(endpoints[e], q[e], &p[e]);
+
+  static const int32_t weights[16] = { 0,  4,  9,  13, 17, 21, 26, 30,
+                                       34, 38, 43, 47, 51, 55, 60, 64 };
+  int32_t palette[16][4];
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t c = 0; c < 4; c++) {
+      int32_t e0 = (int32_t)((q[0][c] << 1) | p[0]);
+      int32_t e1 = (int32_t)((q[1][c] << 1) | p[1]);
+      palette[i][c] = ((64 - weights[i]) * e0 + weights[i] * e1 + 32) >> 6;
+    }
+
+  uint32_t indices[16];
+  for (uint32_t i = 0; i < 16; i++) {
+    uint32_t best = UINT32_MAX;
+    for (uint32_t j = 0; j < 16; j++) {
+      uint32_t error = _squared_error(texels[i], palette[j], 4);
+      if (error < best) {
+        best = error;
+        indices[i] = j;
+      }
+    }
+  }
+
+  // The first index is stored without its top bit
+  bool swap = indices[0] >= 8;
+  uint32_t first = swap ? 1 : 0;
+
+  memset(block, 0, 16);
+  uint32_t offset = 0;
+  _put_bits(block, &offset, 1 << 6, 7);
+  for (uint32_t c = 0; c < 4; c++) {
+    _put_bits(block, &offset, q[first][c], 7);
+    _put_bits(block, &offset, q[1 - first][c], 7);
+  }
+  _put_bits(block, &offset, p[first], 1);
+  _put_bits(block, &offset, p[1 - first], 1);
+  for (uint32_t i = 0; i < 16; i++)
+    _put_bits(block, &offset, swap ? 15 - indices[i] : indices[i],
+              i == 0 ? 3 : 4);
+}
+
+static void
+_put_big_endian(uint8_t *block, uint64_t value)
+{
+  for (uint32_t i = 0; i < 8; i++)
+    block[i] = (uint8_t)(value >> (56 - 8 * i));
+}
+
+static int32_t
+_clamp_unorm(int32_t value)
+{
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// ETC texels are indexed in column major order
+static bool
+_etc_in_subblock(uint32_t texel, bool flip, uint32_t subblock)
+{
+  uint32_t x = texel % 4, y = texel / 4;
+  return (flip ? y : x) / 2 == subblock;
+}
+
+/*
+ * Picks the modifier table and per texel modifiers for a half block with
+ * base color base, returns the error.
+ */
+static uint32_t
+_etc_fit_subblock(const uint8_t texels[16][4],
+                  bool flip,
+                  uint32_t subblock,
+                  const int32_t *base,
+                  uint32_t *table,
+                  uint64_t *indices)
+{
+  static const int32_t modifiers[8][2] = {
+    { 2, 8 },   { 5, 17 },  { 9, 29 },  { 13, 42 },
+    { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 },
+  };
+
+  uint32_t best = UINT32_MAX;
+  for (uint32_t t = 0; t < 8; t++) {
+    // Index values 0 to 3 select +a, +b, -a and -b
+    int32_t colors[4][3];
+    for (uint32_t m = 0; m < 4; m++)
+      for (uint32_t c = 0; c < 3; c++) {
+        int32_t modifier = modifiers[t][m & 1];
+        colors[m][c] = _clamp_unorm(base[c] + (m & 2 ? -modifier : modifier));
+      }
+
+    uint32_t error = 0;
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < 16; i++) {
+      if (!_etc_in_subblock(i, flip, subblock))
+        continue;
+      uint32_t texel_best = UINT32_MAX, index = 0;
+      for (uint32_t m = 0; m < 4; m++) {
+        uint32_t texel_error = _squared_error(texels[i], colors[m], 3);
+        if (texel_error < texel_best) {
+          texel_best = texel_error;
+          index = m;
+        }
+      }
+      error += texel_best;
+      uint32_t position = (i % 4) * 4 + i / 4;
+      bits |= (uint64_t)(index >> 1) << (position + 16);
+      bits |= (uint64_t)(index & 1) << position;
+    }
+
+    if (error < best) {
+      best = error;
+      *table = t;
+      *indices = bits;
+    }
+  }
+  return best;
+}
+
+/*
+ * ETC2 RGB in the individual and differential modes it shares with ETC1.
+ * Both halves of the block get a base color, in either orientation.
+ */
+static uint64_t
+_encode_etc2_color(const uint8_t texels[16][4])
+{
+  uint32_t best = UINT32_MAX;
+  uint64_t best_block = 0;
+
+  for (uint32_t flip = 0; flip < 2; flip++) {
+    float mean[2][3] = { { 0 } };
+    for (uint32_t i = 0; i < 16; i++)
+      for (uint32_t c = 0; c < 3; c++)
+        mean[_etc_in_subblock(i, flip, 1)][c] += texels[i][c] / 8.0f;
+
+    for (uint32_t differential = 0; differential < 2; differential++) {
+      int32_t q[2][3], base[2][3];
+      bool valid = true;
+      for (uint32_t s = 0; s < 2; s++)
+        for (uint32_t c = 0; c < 3; c++) {
+          if (differential) {
+            q[s][c] = (int32_t)(mean[s][c] * 31.0f / 255.0f + 0.5f);
+            base[s][c] = (q[s][c] << 3) | (q[s][c] >> 2);
+          } else {
+            q[s][c] = (int32_t)(mean[s][c] * 15.0f / 255.0f + 0.5f);
+            base[s][c] = q[s][c] * 17;
+          }
+          if (differential && s == 1)
+            valid &= q[1][c] - q[0][c] >= -4 && q[1][c] - q[0][c] <= 3;
+        }
+      if (!valid)
+        continue;
+
+      uint32_t tables[2];
+      uint64_t indices[2];
+      uint32_t error = 0;
+      for (uint32_t s = 0; s < 2; s++)
+        error += _etc_fit_subblock(texels, flip, s, base[s], &tables[s],
+                                   &indices[s]);
+      if (error >= best)
+        continue;
+
+      uint64_t colors = 0;
+      for (uint32_t c = 0; c < 3; c++) {
+        uint32_t shift = 59 - 8 * c;
+        if (differential)
+          colors |= (uint64_t)q[0][c] << shift |
+                    (uint64_t)((q[1][c] - q[0][c]) & 7) << (shift - 3);
+        else
+          colors |= (uint64_t)q[0][c] << (shift + 1) |
+                    (uint64_t)q[1][c] << (shift - 3);
+      }
+
+      best = error;
+      best_block = colors | (uint64_t)tables[0] << 37 |
+                   (uint64_t)tables[1] << 34 | (uint64_t)differential << 33 |
+                   (uint64_t)flip << 32 | indices[0] | indices[1];
+    }
+  }
+
+  return best_block;
+}
+
+// EAC alpha: a base value plus one of 8 modifiers, scaled per block
+static uint64_t
+_encode_eac_alpha(const uint8_t texels[16][4])
+{
+  static const int32_t modifiers[16][8] = {
+    { -3, -6, -9, -15, 2, 5, 8, 14 }, { -3, -7, -10, -13, 2, 6, 9, 12 },
+    { -2, -5, -8, -13, 1, 4, 7, 12 }, { -2, -4, -6, -13, 1, 3, 5, 12 },
+    { -3, -6, -8, -12, 2, 5, 7, 11 }, { -3, -7, -9, -11, 2, 6, 8, 10 },
+    { -4, -7, -8, -11, 3, 6, 7, 10 }, { -3, -5, -8, -11, 2, 4, 7, 10 },
+    { -2, -6, -8, -10, 1, 5, 7, 9 },  { -2, -5, -8, -10, 1, 4, 7, 9 },
+    { -2, -4, -8, -10, 1, 3, 7, 9 },  { -2, -5, -7, -10, 1, 4, 6, 9 },
+    { -3, -4, -7, -10, 2, 3, 6, 9 },  { -1, -2, -3, -10, 0, 1, 2, 9 },
+    { -4, -6, -8, -9, 3, 5, 7, 8 },   { -3, -5, -7, -9, 2, 4, 6, 8 },
+  };
+
+  int32_t min = 255, max = 0;
+  for (uint32_t i = 0; i < 16; i++) {
+    min = texels[i][3] < min ? texels[i][3] : min;
+    max = texels[i][3] > max ? texels[i][3] : max;
+  }
+
+  uint32_t best = UINT32_MAX;
+  uint64_t best_block = 0;
+  for (uint32_t t = 0; t < 16; t++) {
+    // The largest modifier is last and the smallest the fourth
+    int32_t range = modifiers[t][7] - modifiers[t][3];
+    int32_t estimate = ((max - min) + range / 2) / range;
+    for (int32_t multiplier = estimate - 1; multiplier <= estimate + 1;
+         multiplier++) {
+      if (multiplier < 1 || multiplier > 15)
+        continue;
+
+      int32_t center = (modifiers[t][7] + modifiers[t][3]) * multiplier;
+      int32_t base = _clamp_unorm((min + max - center + 1) / 2);
+
+      uint32_t error = 0;
+      uint64_t bits = 0;
+      for (uint32_t i = 0; i < 16; i++) {
+        uint32_t texel_best = UINT32_MAX, index = 0;
+        for (uint32_t m = 0; m < 8; m++) {
+          int32_t d = _clamp_unorm(base + modifiers[t][m] * multiplier) -
+                      texels[i][3];
+          if ((uint32_t)(d * d) < texel_best) {
+            texel_best = (uint32_t)(d * d);
+            index = m;
+          }
+        }
+        error += texel_best;
+        uint32_t position = (i % 4) * 4 + i / 4;
+        bits |= (uint64_t)index << (45 - 3 * position);
+      }
+
+      if (error < best) {
+        best = error;
+        best_block = (uint64_t)base << 56 | (uint64_t)multiplier << 52 |
+                     (uint64_t)t << 48 | bits;
+      }
+    }
+  }
+
+  return best_block;
+}
+
+// ETC2 RGBA8: an EAC alpha block followed by an ETC2 color block
+static void
+_encode_etc2(const uint8_t texels[16][4], uint8_t *block)
+{
+  _put_big_endian(block, _encode_eac_alpha(texels));
+  _put_big_endian(block + 8, _encode_etc2_color(texels));
+}
+
+static const _format _formats[] = {
+  { "rgba8", GL_RGBA8, GL_SRGB8_ALPHA8, NULL, 0 },
+  { "bc7", GL_COMPRESSED_RGBA_BPTC_UNORM, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM,
+    _encode_bc7, 16 },
+  { "etc2", GL_COMPRESSED_RGBA8_ETC2_EAC, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC,
+    _encode_etc2, 16 },
+};
+
+typedef struct
+{
+  // RGBA8 texels of the image
+  const uint8_t *texels;
+  uint32_t width, height;
+  uint8_t *blocks;
+} _compress_job;
+
+// Encodes a row of blocks, edges of partial blocks are repeated
+static void
+_compress_row(_baker *self, void *data, uint32_t row)
+{
+  _compress_job *job = data;
+  uint32_t blocks_x = (job->width + 3) / 4;
+
+  for (uint32_t bx = 0; bx < blocks_x; bx++) {
+    uint8_t texels[16][4];
+    for (uint32_t i = 0; i < 16; i++) {
+      uint32_t x = bx * 4 + i % 4;
+      uint32_t y = row * 4 + i / 4;
+      x = x < job->width ? x : job->width - 1;
+      y = y < job->height ? y : job->height - 1;
+      memcpy(texels[i], job->texels + ((size_t)y * job->width + x) * 4, 4);
+    }
+    size_t block = (size_t)row * blocks_x + bx;
+    self->format->encode_block(
+      (const uint8_t(*)[4])texels,
+      job->blocks + block * self->format->block_size);
+  }
+}
+
+/*
+ * Writes a KTX1 file with face_count faces per level. RGBA8 rows and blocks
+ * of 16 bytes need no padding.
+ */
+static bool
+_write_ktx(_baker *self,
+           const char *path,
+           _image *levels,
+           uint32_t level_count,
+           uint32_t face_count)
+{
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    xrg_log_e("Could not create %s.", path);
+    return false;
+  }
+
+  // Compressed formats have no GL type and format
+  const _format *format = self->format;
+  bool compressed = format->encode_block != NULL;
+  KTX_header header = {
+    .identifier = KTX_IDENTIFIER_REF,
+    .endianness = KTX_ENDIAN_REF,
+    .glType = compressed ? 0 : GL_UNSIGNED_BYTE,
+    .glTypeSize = 1,
+    .glFormat = compressed ? 0 : GL_RGBA,
+    .glInternalformat = self->linear ? format->gl_unorm : format->gl_srgb,
+    .glBaseInternalformat = GL_RGBA,
+    .pixelWidth = levels[0].width,
+    .pixelHeight = levels[0].height,
+    .pixelDepth = 0,
+    .numberOfArrayElements = 0,
+    .numberOfFaces = face_count,
+    .numberOfMipmapLevels = level_count,
+    .bytesOfKeyValueData = 0,
+  };
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+  for (uint32_t level = 0; level < level_count && written; level++) {
+    _image *face = &levels[level * face_count];
+    uint32_t block_rows = (face->height + 3) / 4;
+    uint32_t face_size = compressed ? (face->width + 3) / 4 * block_rows *
+                                        format->block_size
+                                    : face->width * face->height * 4;
+    uint8_t *data = malloc(face->width * face->height * 4);
+    uint8_t *blocks = compressed ? malloc(face_size) : data;
+
+    written = fwrite(&face_size, sizeof(face_size), 1, file) == 1;
+    for (uint32_t i = 0; i < face_count && written; i++) {
+      _encode_job job = { .image = &face[i], .data = data };
+      _parallel_rows(self, _encode_row, &job, face[i].height);
+      if (compressed) {
+        _compress_job compress = {
+          .texels = data,
+          .width = face[i].width,
+          .height = face[i].height,
+          .blocks = blocks,
+        };
+        _parallel_rows(self, _compress_row, &compress, block_rows);
+      }
+      written = fwrite(blocks, face_size, 1, file) == 1;
+    }
+
+    if (compressed)
+      free(blocks);
+    free(data);
+  }
+
+  if (fclose(file) != 0)
+    written = false;
+  if (!written)
+    xrg_log_e("Could not write %s.", path);
+
+  return written;
+}
+
+static bool
+_bake(_baker *self, const char *input, const char *output)
+{
+  _image panorama[MAX_LEVELS];
+  if (!_load(self, input, &panorama[0]))
+    return false;
+
+  uint32_t panorama_levels = _generate_mipmaps(self, panorama);
+
+  if (self->cube_size == 0) {
+    bool written = _write_ktx(self, output, panorama, panorama_levels, 1);
+    if (written)
+      xrg_log_i("Baked %s into %dx%d %s with %d levels.", input,
+                panorama[0].width, panorama[0].height, self->format->name,
+                panorama_levels);
+    for (uint32_t i = 0; i < panorama_levels; i++)
+      free(panorama[i].texels);
+    return written;
+  }
+
+  uint32_t cube_levels = 1;
+  while ((self->cube_size >> cube_levels) > 0)
+    cube_levels++;
+
+  // Faces of each level are resampled from the panorama directly
+  _image faces[MAX_LEVELS * 6];
+  for (uint32_t level = 0; level < cube_levels; level++) {
+    uint32_t size = self->cube_size >> level;
+    for (uint32_t face = 0; face < 6; face++) {
+      _image *image = &faces[level * 6 + face];
+      _image_init(image, size, size);
+      _face_job job = {
+        .panorama = panorama,
+        .panorama_levels = panorama_levels,
+        .face = face,
+        .image = image,
+      };
+      _parallel_rows(self, _resample_face_row, &job, size);
+    }
+  }
+
+  bool written = _write_ktx(self, output, faces, cube_levels, 6);
+  if (written)
+    xrg_log_i("Baked %s into a %dx%d %s cube map with %d levels.", input,
+              self->cube_size, self->cube_size, self->format->name,
+              cube_levels);
+
+  for (uint32_t i = 0; i < panorama_levels; i++)
+    free(panorama[i].texels);
+  for (uint32_t i = 0; i < cube_levels * 6; i++)
+    free(faces[i].texels);
+
+  return written;
+}
+
+static const _format *
+_parse_format(const char *str)
+{
+  for (uint32_t i = 0; i < sizeof(_formats) / sizeof(_formats[0]); i++)
+    if (strcmp(str, _formats[i].name) == 0)
+      return &_formats[i];
+  xrg_log_e("%s is not an output format", str);
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  _baker baker = {
+    .thread_count = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN),
+    .format = &_formats[0],
+  };
+
+  int opt;
+  while ((opt = getopt(argc, argv, "hf:c:lj:")) != -1) {
+    if (opt == '?' || opt == ':')
+      return EXIT_FAILURE;
+
+    if (opt == 'h') {
+      printf("%s\n", _help_string());
+      return EXIT_SUCCESS;
+    } else if (opt == 'f') {
+      baker.format = _parse_format(optarg);
+      if (baker.format == NULL)
+        return EXIT_FAILURE;
+    } else if (opt == 'c') {
+      baker.cube_size = (uint32_t)settings_parse_id(optarg);
+    } else if (opt == 'l') {
+      baker.linear = true;
+    } else if (opt == 'j') {
+      baker.thread_count = (uint32_t)settings_parse_id(optarg);
+    }
+  }
+
+  if (optind + 2 != argc) {
+    fprintf(stderr, "%s", _help_string());
+    return EXIT_FAILURE;
+  }
+
+  if (baker.thread_count < 1)
+    baker.thread_count = 1;
+  if (baker.thread_count > MAX_THREADS)
+    baker.thread_count = MAX_THREADS;
+
+  for (uint32_t i = 0; i < 256; i++) {
+    float value = (float)i / 255.0f;
+    baker.srgb_to_linear[i] = value <= 0.04045f
+                                ? value / 12.92f
+                                : powf((value + 0.055f) / 1.055f, 2.4f);
+  }
+
+  return _bake(&baker, argv[optind], argv[optind + 1]) ? EXIT_SUCCESS
+                                                       : EXIT_FAILURE;
+}
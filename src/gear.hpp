@@ -15,16 +15,20 @@
 #include "glm_inc.hpp"
 #include "vulkan_buffer.h"
 #include "vulkan_device.h"
+#include "vulkan_submit.h"
 #include "log.h"
 
 struct Material
 {
-  // Parameter block used as push constant block
-  struct PushBlock
+  // Entry of the material storage buffer, std430 layout of gears.frag
+  struct Params
   {
+    float r, g, b;
     float roughness;
     float metallic;
-    float r, g, b;
+    // Index into the bindless texture array
+    uint32_t texture;
+    uint32_t padding[2];
   } params;
   std::string name;
   Material() {}
@@ -35,9 +39,19 @@ struct Material
     params.r = c.r;
     params.g = c.g;
     params.b = c.b;
+    params.texture = UINT32_MAX;
   }
 };
 
+// Entry of the object storage buffer, indexed by the instance index
+struct ObjectData
+{
+  glm::mat4 normal;
+  glm::mat4 model;
+  uint32_t material;
+  uint32_t padding[3];
+};
+
 struct Vertex
 {
   float pos[3];
@@ -67,14 +81,6 @@ struct GearInfo
 class Gear
 {
 public:
-  struct UBO
-  {
-    glm::mat4 normal;
-    glm::mat4 model;
-  } ubo;
-
-  VkDescriptorSet descriptor_sets[2];
-
   struct NodeInfo
   {
     glm::vec3 position;
@@ -83,7 +89,9 @@ public:
     Material material;
   } info;
 
-  vulkan_buffer uniformBuffer;
+  // Entry in the material storage buffer
+  uint32_t material_index;
+
   vulkan_buffer vertexBuffer;
   vulkan_buffer indexBuffer;
   uint32_t indexCount;
@@ -92,7 +100,6 @@ public:
 
   virtual ~Gear()
   {
-    vulkan_buffer_destroy(&uniformBuffer);
     vulkan_buffer_destroy(&vertexBuffer);
     vulkan_buffer_destroy(&indexBuffer);
   }
@@ -119,90 +126,34 @@ public:
   }
 
   void
-  create_descriptor_set(const VkDevice& device,
-                        const VkDescriptorPool& descriptorPool,
-                        const VkDescriptorSetLayout& descriptorSetLayout,
-                        VkDescriptorBufferInfo* lightsDescriptor,
-                        VkDescriptorBufferInfo* cameraDescriptor,
-                        uint32_t eye)
+  update_object(float timer, ObjectData* object)
   {
-    VkDescriptorSetAllocateInfo allocInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-      .descriptorPool = descriptorPool,
-      .descriptorSetCount = 1,
-      .pSetLayouts = &descriptorSetLayout
-    };
-    vk_check(
-      vkAllocateDescriptorSets(device, &allocInfo, &descriptor_sets[eye]));
-
-    std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
-      (VkWriteDescriptorSet){ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                              .dstSet = descriptor_sets[eye],
-                              .dstBinding = 0,
-                              .descriptorCount = 1,
-                              .descriptorType =
-                                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                              .pBufferInfo = &uniformBuffer.descriptor },
-      (VkWriteDescriptorSet){ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                              .dstSet = descriptor_sets[eye],
-                              .dstBinding = 1,
-                              .descriptorCount = 1,
-                              .descriptorType =
-                                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                              .pBufferInfo = lightsDescriptor },
-      (VkWriteDescriptorSet){ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                              .dstSet = descriptor_sets[eye],
-                              .dstBinding = 2,
-                              .descriptorCount = 1,
-                              .descriptorType =
-                                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                              .pBufferInfo = cameraDescriptor }
-    };
-
-    vkUpdateDescriptorSets(device,
-                           static_cast<uint32_t>(writeDescriptorSets.size()),
-                           writeDescriptorSets.data(), 0, nullptr);
-  }
+    glm::mat4 model = glm::mat4();
 
-  void
-  update_uniform_buffer(float timer)
-  {
-    ubo.model = glm::mat4();
-
-    ubo.model = glm::translate(ubo.model, info.position);
+    model = glm::translate(model, info.position);
     float rotation_z =
       (info.rotation_speed * timer * 360.0f) + info.rotation_offset;
-    ubo.model = glm::rotate(ubo.model, glm::radians(rotation_z),
-                            glm::vec3(0.0f, 0.0f, 1.0f));
+    model = glm::rotate(model, glm::radians(rotation_z),
+                        glm::vec3(0.0f, 0.0f, 1.0f));
 
-    ubo.normal = glm::inverseTranspose(ubo.model);
-    memcpy(uniformBuffer.mapped, &ubo, sizeof(ubo));
+    object->model = model;
+    object->normal = glm::inverseTranspose(model);
+    object->material = material_index;
   }
 
+  /*
+   * Transforms and material are looked up with the instance index, so the
+   * draw only needs the geometry bound.
+   */
   void
-  init_uniform_buffer(vulkan_device* vulkanDevice)
-  {
-    vulkan_device_create_and_map(vulkanDevice, &uniformBuffer, sizeof(ubo));
-  }
-
-  void
-  draw(VkCommandBuffer command_buffer,
-       VkPipelineLayout pipeline_layout,
-       uint32_t eye)
+  draw(VkCommandBuffer command_buffer, uint32_t object_index)
   {
     VkDeviceSize offsets[1] = { 0 };
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            pipeline_layout, 0, 1, &descriptor_sets[eye], 0,
-                            NULL);
     vkCmdBindVertexBuffers(command_buffer, 0, 1, &vertexBuffer.buffer, offsets);
     vkCmdBindIndexBuffer(command_buffer, indexBuffer.buffer, 0,
                          VK_INDEX_TYPE_UINT32);
 
-    vkCmdPushConstants(command_buffer, pipeline_layout,
-                       VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(glm::vec3),
-                       sizeof(Material::PushBlock), &info.material);
-
-    vkCmdDrawIndexed(command_buffer, indexCount, 1, 0, 0, 1);
+    vkCmdDrawIndexed(command_buffer, indexCount, 1, 0, 0, object_index);
   }
 
   int32_t
@@ -226,7 +177,9 @@ public:
   }
 
   void
-  generate(vulkan_device* vulkanDevice, GearInfo* gearinfo)
+  generate(vulkan_device* vulkanDevice,
+           vulkan_submit* submit,
+           GearInfo* gearinfo)
   {
     std::vector<Vertex> vBuffer;
     std::vector<uint32_t> iBuffer;
@@ -402,15 +355,23 @@ public:
     size_t indexBufferSize = iBuffer.size() * sizeof(uint32_t);
 
     // Vertex buffer
-    vulkan_device_create_buffer(vulkanDevice, &vertexBuffer,
-                                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                                vertexBufferSize, (void*)vBuffer.data());
+    vulkan_device_create_buffer(
+      vulkanDevice, &vertexBuffer,
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBufferSize, nullptr);
+    vulkan_submit_upload_buffer(submit, &vertexBuffer, vBuffer.data(),
+                                vertexBufferSize,
+                                VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR,
+                                VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR);
     // Index buffer
-    vulkan_device_create_buffer(vulkanDevice, &indexBuffer,
-                                VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                                indexBufferSize, (void*)iBuffer.data());
+    vulkan_device_create_buffer(
+      vulkanDevice, &indexBuffer,
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBufferSize, nullptr);
+    vulkan_submit_upload_buffer(submit, &indexBuffer, iBuffer.data(),
+                                indexBufferSize,
+                                VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR,
+                                VK_ACCESS_2_INDEX_READ_BIT_KHR);
 
     indexCount = iBuffer.size();
   }
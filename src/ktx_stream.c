@@ -289,6 +289,36 @@ ktxMemStream_getpos(ktxStream* str, ktx_off_t* const pos)
   return KTX_SUCCESS;
 }
 
+/**
+ * @internal
+ * @~English
+ * @brief Set the current read/write position in a ktxMemStream.
+ *
+ * Offset values larger than the size of the data are an error.
+ *
+ * @param [in] str      pointer to the ktxStream whose position is to be set.
+ * @param [in] off      pointer to the offset value to set.
+ *
+ * @return      KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_INVALID_VALUE @p str is @c NULL.
+ * @exception KTX_INVALID_OPERATION @p pos > size of the data.
+ */
+static KTX_error_code
+ktxMemStream_setpos(ktxStream* str, ktx_off_t const pos)
+{
+  if (!str)
+    return KTX_INVALID_VALUE;
+
+  assert(str->type == eStreamTypeMemory);
+
+  if (pos > str->data.mem->used_size)
+    return KTX_INVALID_OPERATION;
+
+  str->data.mem->pos = pos;
+  return KTX_SUCCESS;
+}
+
 /**
  * @internal
  * @~English
@@ -353,6 +383,7 @@ ktxMemStream_setup(ktxStream* str)
   str->type = eStreamTypeMemory;
   str->read = ktxMemStream_read;
   str->getpos = ktxMemStream_getpos;
+  str->setpos = ktxMemStream_setpos;
   str->getsize = ktxMemStream_getsize;
   str->destruct = ktxMemStream_destruct;
 }
@@ -52,12 +52,14 @@
 
 typedef size_t ktx_off_t;
 typedef struct ktxMem ktxMem;
+typedef struct ktxZ ktxZ;
 typedef struct ktxStream ktxStream;
 
 enum streamType
 {
   eStreamTypeFile = 1,
-  eStreamTypeMemory = 2
+  eStreamTypeMemory = 2,
+  eStreamTypeZ = 3
 };
 
 /**
@@ -85,6 +87,14 @@ typedef KTX_error_code (*ktxStream_write)(ktxStream* str,
 typedef KTX_error_code (*ktxStream_getpos)(ktxStream* str,
                                            ktx_off_t* const offset);
 
+/**
+ * @internal
+ * @~English
+ * @brief type for a pointer to a stream position set function
+ */
+typedef KTX_error_code (*ktxStream_setpos)(ktxStream* str,
+                                           ktx_off_t const offset);
+
 /**
  * @internal
  * @~English
@@ -110,6 +120,8 @@ struct ktxStream
   ktxStream_read read; /*!< @internal pointer to function for reading bytes. */
   ktxStream_getpos getpos; /*!< @internal pointer to function for getting
                               current position in stream. */
+  ktxStream_setpos setpos; /*!< @internal pointer to function for setting
+                              current position in stream. */
   ktxStream_getsize
     getsize; /*!< @internal pointer to function for querying size. */
   ktxStream_destruct destruct; /*!< @internal destruct the stream. */
@@ -118,6 +130,7 @@ struct ktxStream
   union {
     FILE* file;
     ktxMem* mem;
+    ktxZ* z;
   } data;                     /**< @internal pointer to the stream data. */
   ktx_bool_t closeOnDestruct; /**< @internal Close FILE* or dispose of memory on
                                  destruct. */
@@ -143,4 +156,23 @@ ktxMemStream_destruct(ktxStream* str);
 KTX_error_code
 ktxMemStream_getdata(ktxStream* str, ktx_uint8_t** ppBytes);
 
+/*
+ * Initialize a ktxStream to a read-only ktxZStream decompressing a
+ * supercompressed level from an array of bytes as it is read.
+ */
+KTX_error_code
+ktxZStream_construct(ktxStream* str,
+                     ktx_uint32_t scheme,
+                     const ktx_uint8_t* bytes,
+                     const ktx_size_t size,
+                     const ktx_size_t uncompressedSize);
+void
+ktxZStream_destruct(ktxStream* str);
+
+/*
+ * Returns KTX_TRUE if ktxZStream can decompress the supercompression scheme.
+ */
+ktx_bool_t
+ktxZStream_isSupported(ktx_uint32_t scheme);
+
 #endif /* MEMSTREAM_H */
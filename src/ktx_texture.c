@@ -34,6 +34,11 @@
 #include "ktx_texture.h"
 #include "ktx_stream.h"
 
+#ifdef XRGEARS_HAVE_ZSTD
+#include <pthread.h>
+#include <zstd.h>
+#endif
+
 typedef enum GlFormatSizeFlagBits
 {
   GL_FORMAT_SIZE_PACKED_BIT = 0x00000001,
@@ -67,11 +72,243 @@ typedef struct _ktxTextureInt
 {
   ktxTexture super;        /*!< Base ktxTexture class. */
   GlFormatSize formatInfo; /*!< Info about the image data format. */
+  VkFormat vkFormat;       /*!< Matching Vulkan format, if there is one. */
   // The following are needed because image data reading can be delayed.
   ktx_uint32_t glTypeSize; /*!< Size of the image data type in bytes. */
+  ktx_bool_t needSwap;     /*!< Source endianness differs from ours. */
+  ktx_bool_t isKtx2;       /*!< KTX2 source, rows are not padded. */
+  ktx_uint32_t supercompressionScheme; /*!< KTX2 supercompression. */
+  ktxLevelIndexEntry* levelIndex; /*!< Location of the levels in the source.
+                                     Always set for KTX2, for KTX1 only when
+                                     the levels can be read in place. */
+  const ktx_uint8_t* srcBytes; /*!< Source memory, if created from memory. */
   ktxStream stream;        /*!< Stream connected to KTX source. */
+  ktxStream levelStream;   /*!< Stream decompressing a supercompressed level
+                                of srcBytes, for ktxTexture_ReadImageData. */
+  ktx_uint32_t levelStreamLevel; /*!< Level levelStream decompresses. */
 } ktxTextureInt;
 
+/*
+ * OpenGL enums of the formats we can upload, to avoid depending on GL
+ * headers.
+ */
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_RGB 0x1907
+#define GL_RGBA 0x1908
+#define GL_LUMINANCE 0x1909
+#define GL_LUMINANCE_ALPHA 0x190A
+#define GL_RED 0x1903
+#define GL_RG 0x8227
+
+#define GL_RGB8 0x8051
+#define GL_RGB10_A2 0x8059
+#define GL_RGBA8 0x8058
+#define GL_R8 0x8229
+#define GL_RG8 0x822B
+#define GL_R16F 0x822D
+#define GL_R32F 0x822E
+#define GL_RG16F 0x822F
+#define GL_RG32F 0x8230
+#define GL_RGBA32F 0x8814
+#define GL_RGB32F 0x8815
+#define GL_RGBA16F 0x881A
+#define GL_RGB16F 0x881B
+#define GL_R11F_G11F_B10F 0x8C3A
+#define GL_RGB9_E5 0x8C3D
+#define GL_SRGB8 0x8C41
+#define GL_SRGB8_ALPHA8 0x8C43
+#define GL_RGB565 0x8D62
+
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#define GL_COMPRESSED_SIGNED_RED_RGTC1 0x8DBC
+#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#define GL_COMPRESSED_SIGNED_RG_RGTC2 0x8DBE
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#define GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT 0x8E8E
+#define GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT 0x8E8F
+#define GL_ETC1_RGB8_OES 0x8D64
+#define GL_COMPRESSED_R11_EAC 0x9270
+#define GL_COMPRESSED_SIGNED_R11_EAC 0x9271
+#define GL_COMPRESSED_RG11_EAC 0x9272
+#define GL_COMPRESSED_SIGNED_RG11_EAC 0x9273
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#define GL_COMPRESSED_SRGB8_ETC2 0x9275
+#define GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 0x9276
+#define GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2 0x9277
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC 0x9279
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR 0x93B0
+#define GL_COMPRESSED_RGBA_ASTC_12x12_KHR 0x93BD
+#define GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR 0x93D0
+#define GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR 0x93DD
+
+typedef struct ktxFormat
+{
+  ktx_uint32_t glInternalformat;
+  VkFormat vkFormat;
+  ktx_uint32_t blockSizeInBytes;
+  ktx_uint32_t blockWidth;
+  ktx_uint32_t blockHeight;
+} ktxFormat;
+
+static const ktxFormat ktxFormats[] = {
+  { GL_R8, VK_FORMAT_R8_UNORM, 1, 1, 1 },
+  { GL_RG8, VK_FORMAT_R8G8_UNORM, 2, 1, 1 },
+  { GL_RGB8, VK_FORMAT_R8G8B8_UNORM, 3, 1, 1 },
+  { GL_RGBA8, VK_FORMAT_R8G8B8A8_UNORM, 4, 1, 1 },
+  { GL_SRGB8, VK_FORMAT_R8G8B8_SRGB, 3, 1, 1 },
+  { GL_SRGB8_ALPHA8, VK_FORMAT_R8G8B8A8_SRGB, 4, 1, 1 },
+  { GL_RGB565, VK_FORMAT_R5G6B5_UNORM_PACK16, 2, 1, 1 },
+  { GL_RGB10_A2, VK_FORMAT_A2B10G10R10_UNORM_PACK32, 4, 1, 1 },
+  { GL_R16F, VK_FORMAT_R16_SFLOAT, 2, 1, 1 },
+  { GL_RG16F, VK_FORMAT_R16G16_SFLOAT, 4, 1, 1 },
+  { GL_RGB16F, VK_FORMAT_R16G16B16_SFLOAT, 6, 1, 1 },
+  { GL_RGBA16F, VK_FORMAT_R16G16B16A16_SFLOAT, 8, 1, 1 },
+  { GL_R32F, VK_FORMAT_R32_SFLOAT, 4, 1, 1 },
+  { GL_RG32F, VK_FORMAT_R32G32_SFLOAT, 8, 1, 1 },
+  { GL_RGB32F, VK_FORMAT_R32G32B32_SFLOAT, 12, 1, 1 },
+  { GL_RGBA32F, VK_FORMAT_R32G32B32A32_SFLOAT, 16, 1, 1 },
+  { GL_R11F_G11F_B10F, VK_FORMAT_B10G11R11_UFLOAT_PACK32, 4, 1, 1 },
+  { GL_RGB9_E5, VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, 4, 1, 1 },
+
+  { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, VK_FORMAT_BC1_RGB_UNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, VK_FORMAT_BC2_UNORM_BLOCK, 16, 4, 4 },
+  { GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, VK_FORMAT_BC3_UNORM_BLOCK, 16, 4, 4 },
+  { GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, VK_FORMAT_BC1_RGB_SRGB_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 8, 4,
+    4 },
+  { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, VK_FORMAT_BC2_SRGB_BLOCK, 16, 4,
+    4 },
+  { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, VK_FORMAT_BC3_SRGB_BLOCK, 16, 4,
+    4 },
+  { GL_COMPRESSED_RED_RGTC1, VK_FORMAT_BC4_UNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_SIGNED_RED_RGTC1, VK_FORMAT_BC4_SNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_RG_RGTC2, VK_FORMAT_BC5_UNORM_BLOCK, 16, 4, 4 },
+  { GL_COMPRESSED_SIGNED_RG_RGTC2, VK_FORMAT_BC5_SNORM_BLOCK, 16, 4, 4 },
+  { GL_COMPRESSED_RGBA_BPTC_UNORM, VK_FORMAT_BC7_UNORM_BLOCK, 16, 4, 4 },
+  { GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, VK_FORMAT_BC7_SRGB_BLOCK, 16, 4, 4 },
+  { GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, VK_FORMAT_BC6H_SFLOAT_BLOCK, 16, 4,
+    4 },
+  { GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, VK_FORMAT_BC6H_UFLOAT_BLOCK, 16, 4,
+    4 },
+
+  // ETC2 decoders read ETC1 data
+  { GL_ETC1_RGB8_OES, VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_RGB8_ETC2, VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_SRGB8_ETC2, VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+    VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+    VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_RGBA8_ETC2_EAC, VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, 16, 4,
+    4 },
+  { GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK, 16,
+    4, 4 },
+  { GL_COMPRESSED_R11_EAC, VK_FORMAT_EAC_R11_UNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_SIGNED_R11_EAC, VK_FORMAT_EAC_R11_SNORM_BLOCK, 8, 4, 4 },
+  { GL_COMPRESSED_RG11_EAC, VK_FORMAT_EAC_R11G11_UNORM_BLOCK, 16, 4, 4 },
+  { GL_COMPRESSED_SIGNED_RG11_EAC, VK_FORMAT_EAC_R11G11_SNORM_BLOCK, 16, 4, 4 },
+};
+
+// ASTC enums and Vulkan formats both go through the block sizes in order
+static const ktx_uint8_t ktxAstcBlocks[][2] = {
+  { 4, 4 },   { 5, 4 },   { 5, 5 },  { 6, 5 },  { 6, 6 },
+  { 8, 5 },   { 8, 6 },   { 8, 8 },  { 10, 5 }, { 10, 6 },
+  { 10, 8 },  { 10, 10 }, { 12, 10 }, { 12, 12 },
+};
+
+/*
+ * Fills the format info from the internal format, or from format and type
+ * for files using unsized internal formats.
+ */
+static KTX_error_code
+ktxTextureInt_initFormatInfo(ktxTextureInt* This)
+{
+  ktxTexture* super = (ktxTexture*)This;
+  GlFormatSize* info = &This->formatInfo;
+  ktx_uint32_t internalformat = super->glInternalformat;
+
+  if (super->glType == GL_UNSIGNED_BYTE) {
+    switch (internalformat) {
+    case GL_RED:
+    case GL_LUMINANCE: internalformat = GL_R8; break;
+    case GL_RG:
+    case GL_LUMINANCE_ALPHA: internalformat = GL_RG8; break;
+    case GL_RGB: internalformat = GL_RGB8; break;
+    case GL_RGBA: internalformat = GL_RGBA8; break;
+    }
+  }
+
+  memset(info, 0, sizeof(*info));
+  info->blockDepth = 1;
+
+  if (internalformat >= GL_COMPRESSED_RGBA_ASTC_4x4_KHR &&
+      internalformat <= GL_COMPRESSED_RGBA_ASTC_12x12_KHR) {
+    ktx_uint32_t i = internalformat - GL_COMPRESSED_RGBA_ASTC_4x4_KHR;
+    This->vkFormat = VK_FORMAT_ASTC_4x4_UNORM_BLOCK + 2 * i;
+    info->blockWidth = ktxAstcBlocks[i][0];
+    info->blockHeight = ktxAstcBlocks[i][1];
+    info->blockSizeInBits = 128;
+    info->flags = GL_FORMAT_SIZE_COMPRESSED_BIT;
+    return KTX_SUCCESS;
+  }
+
+  if (internalformat >= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR &&
+      internalformat <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR) {
+    ktx_uint32_t i = internalformat - GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR;
+    This->vkFormat = VK_FORMAT_ASTC_4x4_SRGB_BLOCK + 2 * i;
+    info->blockWidth = ktxAstcBlocks[i][0];
+    info->blockHeight = ktxAstcBlocks[i][1];
+    info->blockSizeInBits = 128;
+    info->flags = GL_FORMAT_SIZE_COMPRESSED_BIT;
+    return KTX_SUCCESS;
+  }
+
+  for (ktx_uint32_t i = 0; i < sizeof(ktxFormats) / sizeof(ktxFormats[0]);
+       i++) {
+    const ktxFormat* format = &ktxFormats[i];
+    if (format->glInternalformat != internalformat)
+      continue;
+
+    This->vkFormat = format->vkFormat;
+    info->blockWidth = format->blockWidth;
+    info->blockHeight = format->blockHeight;
+    info->blockSizeInBits = format->blockSizeInBytes * 8;
+    if (format->blockWidth > 1)
+      info->flags = GL_FORMAT_SIZE_COMPRESSED_BIT;
+    return KTX_SUCCESS;
+  }
+
+  return KTX_UNSUPPORTED_TEXTURE_TYPE;
+}
+
+static void
+ktxSwapEndian32(ktx_uint32_t* data, ktx_size_t count)
+{
+  for (ktx_size_t i = 0; i < count; i++) {
+    ktx_uint32_t x = data[i];
+    data[i] = (x << 24) | ((x & 0xFF00) << 8) | ((x & 0xFF0000) >> 8) |
+              (x >> 24);
+  }
+}
+
+static void
+ktxSwapEndian16(ktx_uint16_t* data, ktx_size_t count)
+{
+  for (ktx_size_t i = 0; i < count; i++)
+    data[i] = (ktx_uint16_t)((data[i] << 8) | (data[i] >> 8));
+}
+
 ktx_size_t
 ktxTexture_GetSize(ktxTexture* This);
 KTX_error_code
@@ -81,7 +318,273 @@ ktxTexture_LoadImageData(ktxTexture* This,
 
 static ktx_uint32_t
 padRow(ktx_uint32_t* rowBytes);
+static inline ktx_size_t
+ktxTexture_dataSize(ktxTexture* This, ktx_uint32_t levels);
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+/**
+ * @memberof ktxTexture @private
+ * @~English
+ * @brief Fill the format info from the basic block of a KTX2 data format
+ *        descriptor.
+ *
+ * Only the texel block extent and size are needed, the Vulkan format is in
+ * the header.
+ *
+ * @param[in] This pointer to the ktxTextureInt to initialize.
+ * @param[in] dfd  pointer to the descriptor, starting with its total size.
+ * @param[in] size length of the descriptor in bytes.
+ */
+static KTX_error_code
+ktxTextureInt_initFormatInfoFromDfd(ktxTextureInt* This,
+                                    const ktx_uint32_t* dfd,
+                                    ktx_uint32_t size)
+{
+  GlFormatSize* info = &This->formatInfo;
+
+  // Total size and the first 5 words of the basic descriptor block
+  if (size < 6 * sizeof(ktx_uint32_t) || dfd[0] != size)
+    return KTX_FILE_DATA_ERROR;
+
+  const ktx_uint32_t* bdb = dfd + 1;
+  ktx_uint32_t bytesPlane0 = bdb[4] & 0xFF;
+  if (bytesPlane0 == 0)
+    return KTX_FILE_DATA_ERROR;
 
+  memset(info, 0, sizeof(*info));
+  info->blockWidth = (bdb[3] & 0xFF) + 1;
+  info->blockHeight = ((bdb[3] >> 8) & 0xFF) + 1;
+  info->blockDepth = ((bdb[3] >> 16) & 0xFF) + 1;
+  info->blockSizeInBits = bytesPlane0 * 8;
+  if (info->blockWidth > 1 || info->blockHeight > 1 || info->blockDepth > 1)
+    info->flags = GL_FORMAT_SIZE_COMPRESSED_BIT;
+
+  return KTX_SUCCESS;
+}
+
+/**
+ * @memberof ktxTexture @private
+ * @brief Construct a ktxTexture from a ktxStream reading from a KTX2 source.
+ *
+ * The identifier has already been read from the stream. Unlike KTX1, rows
+ * are not padded and each level can be supercompressed on its own.
+ *
+ * @param[in] This pointer to a ktxTextureInt-sized block of memory to
+ *                 initialize.
+ * @param[in] createFlags bitmask requesting specific actions during creation.
+ *
+ * @return      KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_UNSUPPORTED_FEATURE
+ *                              The source is Basis Universal, or uses a
+ *                              supercompression scheme not in this build.
+ *
+ * For other exceptions, see ktxTextureInt_constructFromStream().
+ */
+static KTX_error_code
+ktxTextureInt_constructFromStream2(ktxTextureInt* This,
+                                   ktxTextureCreateFlags createFlags)
+{
+  ktxTexture* super = (ktxTexture*)This;
+  ktxStream* stream = &This->stream;
+  KTX_error_code result;
+  KTX_header2 header;
+
+  result = stream->read(stream, (ktx_uint8_t*)&header + 12,
+                        KTX2_HEADER_SIZE - 12);
+  if (result != KTX_SUCCESS)
+    return result;
+
+  // Basis Universal needs a transcoder
+  if (header.vkFormat == VK_FORMAT_UNDEFINED)
+    return KTX_UNSUPPORTED_FEATURE;
+
+  if (header.supercompressionScheme != KTX_SS_NONE &&
+      !ktxZStream_isSupported(header.supercompressionScheme))
+    return KTX_UNSUPPORTED_FEATURE;
+
+  if (header.pixelWidth == 0 ||
+      (header.pixelDepth > 0 && header.pixelHeight == 0))
+    return KTX_FILE_DATA_ERROR;
+  if (header.pixelDepth > 0 &&
+      (header.layerCount > 0 || header.faceCount > 1))
+    return KTX_UNSUPPORTED_TEXTURE_TYPE;
+  if (header.faceCount != 1 && header.faceCount != 6)
+    return KTX_FILE_DATA_ERROR;
+  if (header.faceCount == 6 && header.pixelWidth != header.pixelHeight)
+    return KTX_FILE_DATA_ERROR;
+
+  super->numDimensions = 1;
+  if (header.pixelHeight > 0)
+    super->numDimensions = 2;
+  if (header.pixelDepth > 0)
+    super->numDimensions = 3;
+
+  super->baseWidth = header.pixelWidth;
+  super->baseHeight = MAX(1, header.pixelHeight);
+  super->baseDepth = MAX(1, header.pixelDepth);
+  super->isArray = header.layerCount > 0;
+  super->numLayers = MAX(1, header.layerCount);
+  super->numFaces = header.faceCount;
+  super->generateMipmaps = header.levelCount == 0;
+  super->numLevels = MAX(1, header.levelCount);
+
+  ktx_uint32_t max_dim = MAX(MAX(header.pixelWidth, header.pixelHeight),
+                             header.pixelDepth);
+  ktx_uint32_t max_levels = 1;
+  while (max_dim >>= 1)
+    max_levels++;
+  if (super->numLevels > max_levels)
+    return KTX_FILE_DATA_ERROR;
+
+  This->vkFormat = header.vkFormat;
+  This->isKtx2 = KTX_TRUE;
+  This->supercompressionScheme = header.supercompressionScheme;
+
+  This->levelIndex = malloc(super->numLevels * sizeof(ktxLevelIndexEntry));
+  if (This->levelIndex == NULL)
+    return KTX_OUT_OF_MEMORY;
+  result = stream->read(stream, This->levelIndex,
+                        super->numLevels * sizeof(ktxLevelIndexEntry));
+  if (result != KTX_SUCCESS)
+    return result;
+
+  ktx_uint32_t* dfd = malloc(header.dfdByteLength);
+  if (dfd == NULL)
+    return KTX_OUT_OF_MEMORY;
+  result = stream->setpos(stream, header.dfdByteOffset);
+  if (result == KTX_SUCCESS)
+    result = stream->read(stream, dfd, header.dfdByteLength);
+  if (result == KTX_SUCCESS)
+    result =
+      ktxTextureInt_initFormatInfoFromDfd(This, dfd, header.dfdByteLength);
+  free(dfd);
+  if (result != KTX_SUCCESS)
+    return result;
+
+  super->isCompressed =
+    (This->formatInfo.flags & GL_FORMAT_SIZE_COMPRESSED_BIT) != 0;
+
+  if (header.kvdByteLength > 0) {
+    super->kvData = malloc(header.kvdByteLength);
+    if (super->kvData == NULL)
+      return KTX_OUT_OF_MEMORY;
+    super->kvDataLen = header.kvdByteLength;
+    result = stream->setpos(stream, header.kvdByteOffset);
+    if (result == KTX_SUCCESS)
+      result = stream->read(stream, super->kvData, super->kvDataLen);
+    if (result != KTX_SUCCESS)
+      return result;
+  }
+
+  ktx_size_t srcSize;
+  result = stream->getsize(stream, &srcSize);
+  if (result != KTX_SUCCESS)
+    return result;
+
+  // The index has to agree with the sizes we compute the offsets from
+  for (ktx_uint32_t level = 0; level < super->numLevels; level++) {
+    const ktxLevelIndexEntry* entry = &This->levelIndex[level];
+    ktx_uint64_t size = header.supercompressionScheme == KTX_SS_NONE
+                          ? entry->byteLength
+                          : entry->uncompressedByteLength;
+    if (size != ktxTexture_levelSize(super, level))
+      return KTX_FILE_DATA_ERROR;
+    if (entry->byteOffset > srcSize ||
+        entry->byteLength > srcSize - entry->byteOffset)
+      return KTX_FILE_UNEXPECTED_EOF;
+  }
+
+  super->dataSize = ktxTexture_dataSize(super, super->numLevels);
+
+  if (createFlags & KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT)
+    result = ktxTexture_LoadImageData(super, NULL, 0);
+
+  return result;
+}
+
+
+
+/**
+ * @memberof ktxTexture @private
+ * @~English
+ * @brief Build the level index of a KTX1 source, for reading the images in
+ *        place.
+ *
+ * Each level is preceded by its image size. Swapped sources and cube faces
+ * followed by padding can not be read in place, those get no index. The
+ * stream is left at the start of the image data.
+ *
+ * @param[in] This pointer to the ktxTextureInt, with the stream at the start
+ *                 of the image data.
+ */
+static KTX_error_code
+ktxTextureInt_indexLevels(ktxTextureInt* This)
+{
+  ktxTexture* super = (ktxTexture*)This;
+  ktxStream* stream = &This->stream;
+  KTX_error_code result;
+  ktx_off_t start, pos;
+
+  if (This->needSwap)
+    return KTX_SUCCESS;
+
+  result = stream->getpos(stream, &start);
+  if (result != KTX_SUCCESS)
+    return result;
+
+  This->levelIndex = malloc(super->numLevels * sizeof(ktxLevelIndexEntry));
+  if (This->levelIndex == NULL)
+    return KTX_OUT_OF_MEMORY;
+
+  pos = start;
+  for (ktx_uint32_t level = 0; level < super->numLevels; level++) {
+    ktx_uint32_t imageSize;
+    ktx_uint32_t images = 1;
+    result = stream->read(stream, &imageSize, sizeof(imageSize));
+    if (result != KTX_SUCCESS)
+      break;
+    pos += sizeof(imageSize);
+
+    if (super->numFaces == 6 && !super->isArray)
+      images = 6;
+    if (images * (ktx_size_t)imageSize != ktxTexture_levelSize(super, level)) {
+      result = KTX_FILE_DATA_ERROR;
+      break;
+    }
+    // Padding between faces breaks up the level
+    if (images > 1 && imageSize % 4 != 0) {
+      result = KTX_INVALID_OPERATION;
+      break;
+    }
+
+    This->levelIndex[level] = (ktxLevelIndexEntry){
+      .byteOffset = pos,
+      .byteLength = images * (ktx_size_t)imageSize,
+    };
+
+    pos += images * (imageSize + 3 - ((imageSize + 3) & 3));
+    result = stream->setpos(stream, pos);
+    if (result != KTX_SUCCESS)
+      break;
+  }
+
+  if (result != KTX_SUCCESS) {
+    free(This->levelIndex);
+    This->levelIndex = NULL;
+  }
+
+  // Loading the images later still works, failing here is not fatal
+  if (result == KTX_INVALID_OPERATION)
+    result = KTX_SUCCESS;
+  if (stream->setpos(stream, start) != KTX_SUCCESS)
+    result = KTX_FILE_SEEK_ERROR;
+
+  return result;
+}
 
 /**
  * @memberof ktxTexture @private
@@ -129,8 +632,6 @@ ktxTextureInt_constructFromStream(ktxTextureInt* This,
   KTX_header header;
   KTX_supplemental_info suppInfo;
   ktxStream* stream;
-  ktx_off_t pos;
-  ktx_size_t size;
 
   assert(This != NULL);
   assert(This->stream.data.mem != NULL);
@@ -138,15 +639,73 @@ ktxTextureInt_constructFromStream(ktxTextureInt* This,
          This->stream.type == eStreamTypeMemory);
   stream = &This->stream;
 
-  // Read header.
-  result = stream->read(stream, &header, KTX_HEADER_SIZE);
+  // Read the identifier first, it tells KTX and KTX2 apart
+  result = stream->read(stream, &header.identifier, 12);
+  if (result != KTX_SUCCESS)
+    return result;
+
+  static const ktx_uint8_t identifier2[12] = KTX2_IDENTIFIER_REF;
+  if (memcmp(header.identifier, identifier2, sizeof(identifier2)) == 0)
+    return ktxTextureInt_constructFromStream2(This, createFlags);
+
+  static const ktx_uint8_t identifier[12] = KTX_IDENTIFIER_REF;
+  if (memcmp(header.identifier, identifier, sizeof(identifier)) != 0)
+    return KTX_UNKNOWN_FILE_FORMAT;
+
+  result = stream->read(stream, (ktx_uint8_t*)&header + 12,
+                        KTX_HEADER_SIZE - 12);
   if (result != KTX_SUCCESS)
     return result;
 
-  // Hardcode header info for xrgears
-  suppInfo.textureDimension = 2;
-  suppInfo.compressed = 1;
-  header.numberOfMipmapLevels = 1;
+  if (header.endianness == KTX_ENDIAN_REF_REV) {
+    // Everything after the identifier is a 32 bit word
+    ktxSwapEndian32(&header.glType, 12);
+    This->needSwap = KTX_TRUE;
+  } else if (header.endianness != KTX_ENDIAN_REF) {
+    return KTX_FILE_DATA_ERROR;
+  }
+
+  if (header.glTypeSize != 1 && header.glTypeSize != 2 &&
+      header.glTypeSize != 4)
+    return KTX_FILE_DATA_ERROR;
+
+  // Compressed data has no type, uncompressed needs one
+  suppInfo.compressed = header.glType == 0 || header.glFormat == 0;
+  if (suppInfo.compressed && (header.glType != 0 || header.glFormat != 0))
+    return KTX_FILE_DATA_ERROR;
+
+  if (header.pixelWidth == 0 ||
+      (header.pixelDepth > 0 && header.pixelHeight == 0))
+    return KTX_FILE_DATA_ERROR;
+
+  suppInfo.textureDimension = 1;
+  if (header.pixelHeight > 0)
+    suppInfo.textureDimension = 2;
+  if (header.pixelDepth > 0)
+    suppInfo.textureDimension = 3;
+
+  // No 3D arrays or 3D cube maps in Vulkan
+  if (suppInfo.textureDimension == 3 &&
+      (header.numberOfArrayElements > 0 || header.numberOfFaces > 1))
+    return KTX_UNSUPPORTED_TEXTURE_TYPE;
+
+  if (header.numberOfFaces != 1 && header.numberOfFaces != 6)
+    return KTX_FILE_DATA_ERROR;
+  if (header.numberOfFaces == 6 && header.pixelWidth != header.pixelHeight)
+    return KTX_FILE_DATA_ERROR;
+
+  // 0 levels asks the loader to generate the mip chain from the base level
+  suppInfo.generateMipmaps = header.numberOfMipmapLevels == 0;
+  if (suppInfo.generateMipmaps)
+    header.numberOfMipmapLevels = 1;
+
+  ktx_uint32_t max_dim = MAX(MAX(header.pixelWidth, header.pixelHeight),
+                             header.pixelDepth);
+  ktx_uint32_t max_levels = 1;
+  while (max_dim >>= 1)
+    max_levels++;
+  if (header.numberOfMipmapLevels > max_levels)
+    return KTX_FILE_DATA_ERROR;
 
   /*
    * Initialize from header info.
@@ -171,34 +730,45 @@ ktxTextureInt_constructFromStream(ktxTextureInt* This,
   }
   if (header.numberOfArrayElements > 0) {
     super->numLayers = header.numberOfArrayElements;
+    super->isArray = KTX_TRUE;
   } else {
     super->numLayers = 1;
+    super->isArray = KTX_FALSE;
   }
   super->numFaces = header.numberOfFaces;
   super->numLevels = header.numberOfMipmapLevels;
   super->isCompressed = suppInfo.compressed;
+  super->generateMipmaps = suppInfo.generateMipmaps;
   This->glTypeSize = header.glTypeSize;
 
+  result = ktxTextureInt_initFormatInfo(This);
+  if (result != KTX_SUCCESS)
+    return result;
+
   /*
-   * Get the size of the image data.
+   * Key value data is kept raw, nothing here needs to look it up.
    */
-  result = stream->getsize(stream, &size);
-  if (result == KTX_SUCCESS) {
-    result = stream->getpos(stream, &pos);
-    if (result == KTX_SUCCESS)
-      super->dataSize = size -
-                        pos
-                        /* Remove space for faceLodSize fields */
-                        - super->numLevels * sizeof(ktx_uint32_t);
+  if (header.bytesOfKeyValueData > 0) {
+    super->kvData = malloc(header.bytesOfKeyValueData);
+    if (super->kvData == NULL)
+      return KTX_OUT_OF_MEMORY;
+    super->kvDataLen = header.bytesOfKeyValueData;
+    result = stream->read(stream, super->kvData, super->kvDataLen);
+    if (result != KTX_SUCCESS)
+      return result;
   }
 
+  super->dataSize = ktxTexture_dataSize(super, super->numLevels);
+
   /*
-   * Load the images, if requested.
+   * Load the images, if requested, otherwise find out if they can be used
+   * in place.
    */
-  if (result == KTX_SUCCESS &&
-      (createFlags & KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT)) {
+  if (createFlags & KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT)
     result = ktxTexture_LoadImageData((ktxTexture*)super, NULL, 0);
-  }
+  else
+    result = ktxTextureInt_indexLevels(This);
+
   return result;
 }
 
@@ -233,6 +803,8 @@ ktxTextureInt_constructFromMemory(ktxTextureInt* This,
 
   memset(This, 0, sizeof(*This));
 
+  This->srcBytes = bytes;
+
   result = ktxMemStream_construct_ro(&This->stream, bytes, size);
   if (result == KTX_SUCCESS)
     result = ktxTextureInt_constructFromStream(This, createFlags);
@@ -254,12 +826,15 @@ ktxTextureInt_destruct(ktxTextureInt* This)
   ktxTexture* super = (ktxTexture*)This;
   if (This->stream.data.file != NULL)
     This->stream.destruct(&This->stream);
+  if (This->levelStream.data.z != NULL)
+    This->levelStream.destruct(&This->levelStream);
   // if (super->kvDataHead != NULL)
   //      ktxHashList_Destruct(&super->kvDataHead);
   if (super->kvData != NULL)
     free(super->kvData);
   if (super->pData != NULL)
     free(super->pData);
+  free(This->levelIndex);
 }
 
 /**
@@ -315,6 +890,9 @@ ktxTexture_CreateFromMemory(const ktx_uint8_t* bytes,
   if (result == KTX_SUCCESS)
     *newTex = (ktxTexture*)tex;
   else {
+    free(((ktxTexture*)tex)->kvData);
+    free(((ktxTexture*)tex)->pData);
+    free(tex->levelIndex);
     free(tex);
     *newTex = NULL;
   }
@@ -381,8 +959,11 @@ ktxTexture_GetImageSize(ktxTexture* This, ktx_uint32_t level)
   assert(This != NULL);
 
   formatInfo = &((ktxTextureInt*)This)->formatInfo;
-  blockCount.x = MAX(1, (This->baseWidth / formatInfo->blockWidth) >> level);
-  blockCount.y = MAX(1, (This->baseHeight / formatInfo->blockHeight) >> level);
+  // Partial blocks at the edges of a level are stored whole
+  blockCount.x = (MAX(1, This->baseWidth >> level) + formatInfo->blockWidth -
+                  1) / formatInfo->blockWidth;
+  blockCount.y = (MAX(1, This->baseHeight >> level) + formatInfo->blockHeight -
+                  1) / formatInfo->blockHeight;
   blockSizeInBytes = formatInfo->blockSizeInBits / 8;
 
   if (formatInfo->flags & GL_FORMAT_SIZE_COMPRESSED_BIT) {
@@ -390,11 +971,266 @@ ktxTexture_GetImageSize(ktxTexture* This, ktx_uint32_t level)
     return blockCount.x * blockCount.y * blockSizeInBytes;
   } else {
     rowBytes = blockCount.x * blockSizeInBytes;
-    (void)padRow(&rowBytes);
+    if (!((ktxTextureInt*)This)->isKtx2)
+      (void)padRow(&rowBytes);
     return rowBytes * blockCount.y;
   }
 }
 
+/**
+ * @memberof ktxTexture
+ * @~English
+ * @brief Return the Vulkan format matching the texture's GL internal format.
+ *
+ * @param[in]     This     pointer to the ktxTexture object of interest.
+ */
+VkFormat
+ktxTexture_GetVkFormat(ktxTexture* This)
+{
+  assert(This != NULL);
+  return ((ktxTextureInt*)This)->vkFormat;
+}
+
+/**
+ * @memberof ktxTexture
+ * @~English
+ * @brief Return the size in bytes of a block, or of a pixel for uncompressed
+ *        formats.
+ *
+ * @param[in]     This     pointer to the ktxTexture object of interest.
+ */
+ktx_uint32_t
+ktxTexture_GetElementSize(ktxTexture* This)
+{
+  assert(This != NULL);
+  return ((ktxTextureInt*)This)->formatInfo.blockSizeInBits / 8;
+}
+
+/**
+ * @memberof ktxTexture
+ * @~English
+ * @brief Return the width and height in pixels of a compression block, 1x1
+ *        for uncompressed formats.
+ *
+ * @param[in]     This     pointer to the ktxTexture object of interest.
+ * @param[out]    width    location to store the block width.
+ * @param[out]    height   location to store the block height.
+ */
+void
+ktxTexture_GetBlockExtent(ktxTexture* This,
+                          ktx_uint32_t* width,
+                          ktx_uint32_t* height)
+{
+  assert(This != NULL);
+  GlFormatSize* formatInfo = &((ktxTextureInt*)This)->formatInfo;
+  *width = formatInfo->blockWidth;
+  *height = formatInfo->blockHeight;
+}
+
+/**
+ * @memberof ktxTexture
+ * @~English
+ * @brief Return the size in bytes of a row of blocks at the specified mip
+ *        level, including the padding to KTX_GL_UNPACK_ALIGNMENT.
+ *
+ * @param[in]     This     pointer to the ktxTexture object of interest.
+ * @param[in]     level    level of interest.
+ */
+ktx_uint32_t
+ktxTexture_GetRowPitch(ktxTexture* This, ktx_uint32_t level)
+{
+  GlFormatSize* formatInfo;
+  ktx_uint32_t blockCountX;
+  ktx_uint32_t rowBytes;
+
+  assert(This != NULL);
+
+  formatInfo = &((ktxTextureInt*)This)->formatInfo;
+  blockCountX = (MAX(1, This->baseWidth >> level) + formatInfo->blockWidth -
+                 1) / formatInfo->blockWidth;
+  rowBytes = blockCountX * (formatInfo->blockSizeInBits / 8);
+
+  // Compressed rows are never padded, neither are any KTX2 rows
+  if (!(formatInfo->flags & GL_FORMAT_SIZE_COMPRESSED_BIT) &&
+      !((ktxTextureInt*)This)->isKtx2)
+    (void)padRow(&rowBytes);
+
+  return rowBytes;
+}
+
+#ifdef XRGEARS_HAVE_ZSTD
+
+#define KTX_ZSTD_MAX_THREADS 4
+
+typedef struct ktxZstdJob
+{
+  const ktx_uint8_t* src;
+  ktx_uint8_t* srcCopy;
+  ktx_size_t srcSize;
+  ktx_uint8_t* dst;
+  ktx_size_t dstSize;
+  KTX_error_code result;
+} ktxZstdJob;
+
+typedef struct ktxZstdQueue
+{
+  ktxZstdJob* jobs;
+  ktx_uint32_t jobCount;
+  ktx_uint32_t next;
+  pthread_mutex_t mutex;
+} ktxZstdQueue;
+
+static void*
+ktxZstdWorker(void* data)
+{
+  ktxZstdQueue* queue = data;
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+
+  while (true) {
+    pthread_mutex_lock(&queue->mutex);
+    ktx_uint32_t i = queue->next++;
+    pthread_mutex_unlock(&queue->mutex);
+    if (i >= queue->jobCount)
+      break;
+
+    ktxZstdJob* job = &queue->jobs[i];
+    size_t size = ZSTD_decompressDCtx(dctx, job->dst, job->dstSize, job->src,
+                                      job->srcSize);
+    if (ZSTD_isError(size))
+      job->result = KTX_FILE_DATA_ERROR;
+    else if (size != job->dstSize)
+      job->result = KTX_DECOMPRESS_LENGTH_ERROR;
+  }
+
+  ZSTD_freeDCtx(dctx);
+  return NULL;
+}
+
+/**
+ * @memberof ktxTexture @private
+ * @~English
+ * @brief Decompress the Zstandard supercompressed levels of a KTX2 source.
+ *
+ * Levels are independent, so they are decoded on a few threads. Level 0
+ * is queued first as it holds most of the data. Sources in memory are
+ * decoded in place, others are read into a copy first.
+ *
+ * @param[in] This  pointer to the ktxTextureInt to load.
+ * @param[in] pDest pointer to the buffer for the image data.
+ */
+static KTX_error_code
+ktxTextureInt_loadZstdLevels(ktxTextureInt* This, ktx_uint8_t* pDest)
+{
+  ktxTexture* super = (ktxTexture*)This;
+  KTX_error_code result = KTX_SUCCESS;
+
+  ktxZstdQueue queue = {
+    .jobs = calloc(super->numLevels, sizeof(ktxZstdJob)),
+    .jobCount = super->numLevels,
+  };
+  if (queue.jobs == NULL)
+    return KTX_OUT_OF_MEMORY;
+  pthread_mutex_init(&queue.mutex, NULL);
+
+  for (ktx_uint32_t level = 0; level < super->numLevels; level++) {
+    const ktxLevelIndexEntry* entry = &This->levelIndex[level];
+    ktxZstdJob* job = &queue.jobs[level];
+    job->srcSize = entry->byteLength;
+    job->dst = pDest + ktxTexture_dataSize(super, level);
+    job->dstSize = entry->uncompressedByteLength;
+    if (This->srcBytes != NULL) {
+      job->src = This->srcBytes + entry->byteOffset;
+      continue;
+    }
+    job->srcCopy = malloc(job->srcSize);
+    if (job->srcCopy == NULL) {
+      result = KTX_OUT_OF_MEMORY;
+      goto cleanup;
+    }
+    job->src = job->srcCopy;
+    result = This->stream.setpos(&This->stream, entry->byteOffset);
+    if (result == KTX_SUCCESS)
+      result = This->stream.read(&This->stream, job->srcCopy, job->srcSize);
+    if (result != KTX_SUCCESS)
+      goto cleanup;
+  }
+
+  pthread_t threads[KTX_ZSTD_MAX_THREADS];
+  ktx_uint32_t threadCount = 0;
+  while (threadCount < MIN(super->numLevels, KTX_ZSTD_MAX_THREADS) - 1 &&
+         pthread_create(&threads[threadCount], NULL, ktxZstdWorker, &queue) ==
+           0)
+    threadCount++;
+
+  // This thread decodes too, so failing to spawn threads only costs time
+  ktxZstdWorker(&queue);
+  for (ktx_uint32_t i = 0; i < threadCount; i++)
+    pthread_join(threads[i], NULL);
+
+  for (ktx_uint32_t level = 0; level < super->numLevels; level++)
+    if (queue.jobs[level].result != KTX_SUCCESS)
+      result = queue.jobs[level].result;
+
+cleanup:
+  for (ktx_uint32_t level = 0; level < super->numLevels; level++)
+    free(queue.jobs[level].srcCopy);
+  free(queue.jobs);
+  pthread_mutex_destroy(&queue.mutex);
+  return result;
+}
+
+#endif
+
+/**
+ * @memberof ktxTexture @private
+ * @~English
+ * @brief Load the image data of a KTX2 source.
+ *
+ * Levels are stored smallest first in the file, they are loaded in the
+ * order of ktxTexture_GetImageOffset().
+ *
+ * @param[in] This  pointer to the ktxTextureInt to load.
+ * @param[in] pDest pointer to the buffer for the image data.
+ */
+static KTX_error_code
+ktxTextureInt_loadImageData2(ktxTextureInt* This, ktx_uint8_t* pDest)
+{
+  ktxTexture* super = (ktxTexture*)This;
+  KTX_error_code result = KTX_SUCCESS;
+
+#ifdef XRGEARS_HAVE_ZSTD
+  if (This->supercompressionScheme == KTX_SS_ZSTD)
+    return ktxTextureInt_loadZstdLevels(This, pDest);
+#endif
+
+  for (ktx_uint32_t level = 0; level < super->numLevels; level++) {
+    const ktxLevelIndexEntry* entry = &This->levelIndex[level];
+    ktx_uint8_t* levelDest = pDest + ktxTexture_dataSize(super, level);
+    if (This->supercompressionScheme != KTX_SS_NONE &&
+        This->srcBytes != NULL) {
+      ktxStream z;
+      result = ktxZStream_construct(
+        &z, This->supercompressionScheme, This->srcBytes + entry->byteOffset,
+        entry->byteLength, entry->uncompressedByteLength);
+      if (result == KTX_SUCCESS) {
+        result = z.read(&z, levelDest, entry->uncompressedByteLength);
+        z.destruct(&z);
+      }
+    } else if (This->supercompressionScheme != KTX_SS_NONE) {
+      result = KTX_UNSUPPORTED_FEATURE;
+    } else {
+      result = This->stream.setpos(&This->stream, entry->byteOffset);
+      if (result == KTX_SUCCESS)
+        result = This->stream.read(&This->stream, levelDest,
+                                   entry->byteLength);
+    }
+    if (result != KTX_SUCCESS)
+      break;
+  }
+
+  return result;
+}
+
 /**
  * @memberof ktxTexture
  * @~English
@@ -444,29 +1280,64 @@ ktxTexture_LoadImageData(ktxTexture* This,
     pDest = pBuffer;
   }
 
-  // Need to loop through for correct byte swapping
+  if (subthis->isKtx2) {
+    result = ktxTextureInt_loadImageData2(subthis, pDest);
+    goto cleanup;
+  }
+
   for (miplevel = 0; miplevel < This->numLevels; ++miplevel) {
     ktx_uint32_t faceLodSize;
-    ktx_uint32_t faceLodSizePadded;
-    ktx_uint32_t face;
     ktx_uint32_t innerIterations;
+    ktx_size_t expectedSize;
+    ktx_uint8_t padding[3];
 
     result = subthis->stream.read(&subthis->stream, &faceLodSize,
                                   sizeof(ktx_uint32_t));
     if (result != KTX_SUCCESS) {
       goto cleanup;
     }
+    if (subthis->needSwap)
+      ktxSwapEndian32(&faceLodSize, 1);
+
+    /*
+     * Non-array cube maps store each face on its own with cubePadding,
+     * everything else stores the whole level at once.
+     */
+    if (This->numFaces == 6 && !This->isArray) {
+      innerIterations = 6;
+      expectedSize = ktxTexture_GetImageSize(This, miplevel);
+    } else {
+      innerIterations = 1;
+      expectedSize = ktxTexture_levelSize(This, miplevel);
+    }
 
-    faceLodSizePadded = faceLodSize;
+    if (faceLodSize != expectedSize) {
+      result = KTX_FILE_DATA_ERROR;
+      goto cleanup;
+    }
 
-    innerIterations = 1;
-    for (face = 0; face < innerIterations; ++face) {
-      result = subthis->stream.read(&subthis->stream, pDest, faceLodSizePadded);
+    for (ktx_uint32_t face = 0; face < innerIterations; ++face) {
+      result = subthis->stream.read(&subthis->stream, pDest, faceLodSize);
       if (result != KTX_SUCCESS) {
         goto cleanup;
       }
 
-      pDest += faceLodSizePadded;
+      if (subthis->needSwap && subthis->glTypeSize == 2)
+        ktxSwapEndian16((ktx_uint16_t*)pDest, faceLodSize / 2);
+      else if (subthis->needSwap && subthis->glTypeSize == 4)
+        ktxSwapEndian32((ktx_uint32_t*)pDest, faceLodSize / 4);
+
+      pDest += faceLodSize;
+
+      // cubePadding and mipPadding both align to 4 bytes
+      ktx_uint32_t paddingSize = 3 - ((faceLodSize + 3) & 3);
+      if (paddingSize > 0) {
+        result =
+          subthis->stream.read(&subthis->stream, padding, paddingSize);
+        if (result != KTX_SUCCESS) {
+          goto cleanup;
+        }
+      }
     }
   }
 
@@ -531,7 +1402,7 @@ ktxTexture_layerSize(ktxTexture* This, ktx_uint32_t level)
   assert(This != NULL);
 
   formatInfo = &((ktxTextureInt*)This)->formatInfo;
-  blockCountZ = MAX(1, (This->baseDepth / formatInfo->blockDepth) >> level);
+  blockCountZ = MAX(1, This->baseDepth >> level) / formatInfo->blockDepth;
   imageSize = ktxTexture_GetImageSize(This, level);
   layerSize = imageSize * blockCountZ;
   return layerSize * This->numFaces;
@@ -619,7 +1490,8 @@ ktxTexture_GetImageOffset(ktxTexture* This,
     return KTX_INVALID_OPERATION;
 
 
-  ktx_uint32_t maxSlice = MAX(1, This->baseDepth >> level);
+  ktx_uint32_t maxSlice =
+    This->numFaces == 6 ? 6 : MAX(1, This->baseDepth >> level);
   if (faceSlice >= maxSlice)
     return KTX_INVALID_OPERATION;
 
@@ -641,3 +1513,172 @@ ktxTexture_GetImageOffset(ktxTexture* This,
 
   return KTX_SUCCESS;
 }
+
+/**
+ * @memberof ktxTexture
+ * @~English
+ * @brief Find the data of an image, without copying it.
+ *
+ * Points into the loaded image data, or, when the image data was not
+ * loaded, into the memory the texture was created from. That memory needs
+ * to outlive the use of the pointer. Images are laid out as by
+ * ktxTexture_GetImageOffset() within a level either way.
+ *
+ * @param[in]     This      pointer to the ktxTexture object of interest.
+ * @param[in]     level     mip level of the image.
+ * @param[in]     layer     array layer of the image.
+ * @param[in]     faceSlice cube map face or depth slice of the image.
+ * @param[in,out] ppData    pointer to location to store the data pointer.
+ *
+ * @return  KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_INVALID_OPERATION
+ *                         The image data is not loaded and can not be read
+ *                         in place, e.g. because it is supercompressed or
+ *                         needs byte swapping. See ktxTexture_GetImageOffset()
+ *                         for other causes.
+ */
+KTX_error_code
+ktxTexture_GetImageData(ktxTexture* This,
+                        ktx_uint32_t level,
+                        ktx_uint32_t layer,
+                        ktx_uint32_t faceSlice,
+                        const ktx_uint8_t** ppData)
+{
+  ktxTextureInt* subthis = (ktxTextureInt*)This;
+  KTX_error_code result;
+  ktx_size_t offset;
+
+  result = ktxTexture_GetImageOffset(This, level, layer, faceSlice, &offset);
+  if (result != KTX_SUCCESS)
+    return result;
+
+  if (This->pData != NULL) {
+    *ppData = This->pData + offset;
+    return KTX_SUCCESS;
+  }
+
+  if (subthis->srcBytes == NULL || subthis->levelIndex == NULL ||
+      subthis->needSwap || subthis->supercompressionScheme != KTX_SS_NONE)
+    return KTX_INVALID_OPERATION;
+
+  *ppData = subthis->srcBytes + subthis->levelIndex[level].byteOffset +
+            (offset - ktxTexture_dataSize(This, level));
+  return KTX_SUCCESS;
+}
+
+/**
+ * @memberof ktxTexture
+ * @~English
+ * @brief Check if ktxTexture_ReadImageData() can read the image data.
+ *
+ * That is the case when ktxTexture_GetImageData() can find it, or when the
+ * texture was created from memory holding supercompressed levels this build
+ * can decompress. Otherwise the image data needs to be loaded first.
+ *
+ * @param[in]     This      pointer to the ktxTexture object of interest.
+ */
+ktx_bool_t
+ktxTexture_CanReadImageData(ktxTexture* This)
+{
+  ktxTextureInt* subthis = (ktxTextureInt*)This;
+  const ktx_uint8_t* data;
+
+  if (ktxTexture_GetImageData(This, 0, 0, 0, &data) == KTX_SUCCESS)
+    return KTX_TRUE;
+
+  return subthis->srcBytes != NULL && subthis->isKtx2 &&
+         ktxZStream_isSupported(subthis->supercompressionScheme);
+}
+
+/**
+ * @memberof ktxTexture
+ * @~English
+ * @brief Copy part of an image into @p pDest.
+ *
+ * Supercompressed levels are decompressed straight into @p pDest, without
+ * loading the level anywhere else. Decoding continues where the previous
+ * read ended, so reading the images of a level from start to end decodes
+ * it exactly once. Reading backwards restarts decoding the level.
+ *
+ * @param[in]     This      pointer to the ktxTexture object of interest.
+ * @param[in]     level     mip level of the image.
+ * @param[in]     layer     array layer of the image.
+ * @param[in]     faceSlice cube map face or depth slice of the image.
+ * @param[in]     offset    offset of the first byte to read in the image.
+ * @param[in,out] pDest     pointer to the buffer to copy the data into.
+ * @param[in]     size      number of bytes to copy.
+ *
+ * @return  KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_INVALID_VALUE @p offset and @p size reach past the image.
+ * @exception KTX_INVALID_OPERATION
+ *                         See ktxTexture_CanReadImageData().
+ * @exception KTX_FILE_DATA_ERROR
+ *                         The supercompressed data is corrupt.
+ */
+KTX_error_code
+ktxTexture_ReadImageData(ktxTexture* This,
+                         ktx_uint32_t level,
+                         ktx_uint32_t layer,
+                         ktx_uint32_t faceSlice,
+                         ktx_size_t offset,
+                         ktx_uint8_t* pDest,
+                         ktx_size_t size)
+{
+  ktxTextureInt* subthis = (ktxTextureInt*)This;
+  ktxStream* stream = &subthis->levelStream;
+  KTX_error_code result;
+  ktx_size_t imageOffset;
+  const ktx_uint8_t* data;
+
+  result =
+    ktxTexture_GetImageOffset(This, level, layer, faceSlice, &imageOffset);
+  if (result != KTX_SUCCESS)
+    return result;
+
+  if (offset > ktxTexture_GetImageSize(This, level) ||
+      size > ktxTexture_GetImageSize(This, level) - offset)
+    return KTX_INVALID_VALUE;
+
+  if (ktxTexture_GetImageData(This, level, layer, faceSlice, &data) ==
+      KTX_SUCCESS) {
+    memcpy(pDest, data + offset, size);
+    return KTX_SUCCESS;
+  }
+
+  if (!ktxTexture_CanReadImageData(This))
+    return KTX_INVALID_OPERATION;
+
+  ktx_off_t levelOffset =
+    imageOffset - ktxTexture_dataSize(This, level) + offset;
+  ktx_off_t pos = 0;
+
+  if (stream->data.z != NULL &&
+      (subthis->levelStreamLevel != level ||
+       stream->getpos(stream, &pos) != KTX_SUCCESS || pos > levelOffset)) {
+    stream->destruct(stream);
+    pos = 0;
+  }
+
+  if (stream->data.z == NULL) {
+    const ktxLevelIndexEntry* entry = &subthis->levelIndex[level];
+    result = ktxZStream_construct(
+      stream, subthis->supercompressionScheme,
+      subthis->srcBytes + entry->byteOffset, entry->byteLength,
+      entry->uncompressedByteLength);
+    if (result != KTX_SUCCESS)
+      return result;
+    subthis->levelStreamLevel = level;
+  }
+
+  result = stream->setpos(stream, levelOffset);
+  if (result == KTX_SUCCESS)
+    result = stream->read(stream, pDest, size);
+
+  // A failed decoder can not be resumed, start over on the next read
+  if (result != KTX_SUCCESS)
+    stream->destruct(stream);
+
+  return result;
+}
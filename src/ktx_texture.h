@@ -43,6 +43,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <vulkan/vulkan.h>
+
 /* To avoid including <KHR/khrplatform.h> define our own types. */
 typedef unsigned char ktx_uint8_t;
 typedef bool ktx_bool_t;
@@ -50,6 +52,7 @@ typedef uint16_t ktx_uint16_t;
 typedef int16_t ktx_int16_t;
 typedef uint32_t ktx_uint32_t;
 typedef int32_t ktx_int32_t;
+typedef uint64_t ktx_uint64_t;
 typedef size_t ktx_size_t;
 
 
@@ -130,6 +133,10 @@ typedef enum KTX_error_code_t
   KTX_UNKNOWN_FILE_FORMAT,      /*!< The file not a KTX file */
   KTX_UNSUPPORTED_TEXTURE_TYPE, /*!< The KTX file specifies an unsupported
                                    texture type. */
+  KTX_UNSUPPORTED_FEATURE,      /*!< Feature not included in this build, e.g.
+                                   a supercompression scheme. */
+  KTX_DECOMPRESS_LENGTH_ERROR,  /*!< Supercompressed data does not decompress
+                                   to the expected length. */
 } KTX_error_code;
 
 #define KTX_IDENTIFIER_REF                                                     \
@@ -171,6 +178,11 @@ typedef struct
   ktx_uint32_t glType; /*!< Type of the texture data, e.g, GL_UNSIGNED_BYTE.*/
   ktx_bool_t isCompressed; /*!< KTX_TRUE if @c glInternalFormat is that of
                                     a compressed texture. */
+  ktx_bool_t isArray;      /*!< KTX_TRUE if the texture is an array texture,
+                                    even with a single layer. */
+  ktx_bool_t generateMipmaps; /*!< KTX_TRUE if the file holds only the base
+                                     level and the mip chain should be
+                                     generated when uploading. */
 
   ktx_uint32_t baseWidth;     /*!< Width of the base level of the texture. */
   ktx_uint32_t baseHeight;    /*!< Height of the base level of the texture. */
@@ -331,6 +343,38 @@ ktxTexture_GetImageOffset(ktxTexture* This,
                           ktx_uint32_t faceSlice,
                           ktx_size_t* pOffset);
 
+/*
+ * Returns a pointer to the image for the specified mip level, array layer
+ * and face or depth slice, in the loaded image data or in place in the
+ * source memory.
+ */
+KTX_error_code
+ktxTexture_GetImageData(ktxTexture* This,
+                        ktx_uint32_t level,
+                        ktx_uint32_t layer,
+                        ktx_uint32_t faceSlice,
+                        const ktx_uint8_t** ppData);
+
+/*
+ * Returns KTX_TRUE if ktxTexture_ReadImageData can read the image data
+ * without loading it first.
+ */
+ktx_bool_t
+ktxTexture_CanReadImageData(ktxTexture* This);
+
+/*
+ * Copies part of the image for the specified mip level, array layer and
+ * face or depth slice into a buffer, decompressing it on the way if needed.
+ */
+KTX_error_code
+ktxTexture_ReadImageData(ktxTexture* This,
+                         ktx_uint32_t level,
+                         ktx_uint32_t layer,
+                         ktx_uint32_t faceSlice,
+                         ktx_size_t offset,
+                         ktx_uint8_t* pDest,
+                         ktx_size_t size);
+
 /*
  * Returns the size of all the image data of a ktxTexture object in bytes.
  */
@@ -343,6 +387,33 @@ ktxTexture_GetSize(ktxTexture* This);
 ktx_size_t
 ktxTexture_GetImageSize(ktxTexture* This, ktx_uint32_t level);
 
+/*
+ * Returns the Vulkan format of the image data, VK_FORMAT_UNDEFINED if there
+ * is no matching one.
+ */
+VkFormat
+ktxTexture_GetVkFormat(ktxTexture* This);
+
+/*
+ * Returns the size of a block, or of a pixel for uncompressed formats.
+ */
+ktx_uint32_t
+ktxTexture_GetElementSize(ktxTexture* This);
+
+/*
+ * Returns the pixel extent of a block, 1x1 for uncompressed formats.
+ */
+void
+ktxTexture_GetBlockExtent(ktxTexture* This,
+                          ktx_uint32_t* width,
+                          ktx_uint32_t* height);
+
+/*
+ * Returns the padded size of a row of blocks at the specified level.
+ */
+ktx_uint32_t
+ktxTexture_GetRowPitch(ktxTexture* This, ktx_uint32_t level);
+
 /*
  * Loads the image data into a ktxTexture object from the KTX-formatted source.
  * Used when the image data was not loaded during ktxTexture_CreateFrom*.
@@ -360,7 +431,59 @@ ktxTexture_LoadImageData(ktxTexture* This,
   {                                                                            \
     0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A     \
   }
-#define KTX2_HEADER_SIZE (64)
+#define KTX2_HEADER_SIZE (80)
+
+/**
+ * @internal
+ * @~English
+ * @brief Supercompression schemes of KTX2 files.
+ */
+typedef enum ktxSupercmpScheme
+{
+  KTX_SS_NONE = 0,
+  KTX_SS_BASIS_LZ = 1,
+  KTX_SS_ZSTD = 2,
+  KTX_SS_ZLIB = 3,
+} ktxSupercmpScheme;
+
+/**
+ * @internal
+ * @~English
+ * @brief KTX2 file header
+ *
+ * All values are little endian. See the KTX2 specification for descriptions.
+ */
+typedef struct KTX_header2
+{
+  ktx_uint8_t identifier[12];
+  ktx_uint32_t vkFormat;
+  ktx_uint32_t typeSize;
+  ktx_uint32_t pixelWidth;
+  ktx_uint32_t pixelHeight;
+  ktx_uint32_t pixelDepth;
+  ktx_uint32_t layerCount;
+  ktx_uint32_t faceCount;
+  ktx_uint32_t levelCount;
+  ktx_uint32_t supercompressionScheme;
+  ktx_uint32_t dfdByteOffset;
+  ktx_uint32_t dfdByteLength;
+  ktx_uint32_t kvdByteOffset;
+  ktx_uint32_t kvdByteLength;
+  ktx_uint64_t sgdByteOffset;
+  ktx_uint64_t sgdByteLength;
+} KTX_header2;
+
+/**
+ * @internal
+ * @~English
+ * @brief Entry of the KTX2 level index, following the header.
+ */
+typedef struct ktxLevelIndexEntry
+{
+  ktx_uint64_t byteOffset;
+  ktx_uint64_t byteLength;
+  ktx_uint64_t uncompressedByteLength;
+} ktxLevelIndexEntry;
 
 /**
  * @internal
@@ -428,7 +551,7 @@ typedef struct KTX_supplemental_info
  * Calculate bytes of of padding needed to reach next multiple of n.
  */
 /* Equivalent to (n * ceil(nbytes / n)) - nbytes */
-#define _KTX_PADN_LEN(n, nbytes) ((n - 1) - (nbytes + ((n - 1) & (n - 1))))
+#define _KTX_PADN_LEN(n, nbytes) (((n)-1) - (((nbytes) + ((n)-1)) & ((n)-1)))
 
 /*
  * Calculate bytes of of padding needed to reach KTX_GL_UNPACK_ALIGNMENT.
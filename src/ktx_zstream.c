@@ -0,0 +1,378 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @internal
+ * @file
+ * @~English
+ *
+ * @brief Implementation of ktxStream decompressing supercompressed levels.
+ *
+ * Data is decoded in chunks straight into the buffer passed to read, so a
+ * level is never held in memory uncompressed unless the caller wants it.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "ktx_texture.h"
+#include "ktx_stream.h"
+
+#ifdef XRGEARS_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef XRGEARS_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/**
+ * @internal
+ * @brief Size of the scratch buffer used to decode skipped bytes.
+ */
+#define KTX_Z_SKIP_CHUNK_SIZE 4096
+
+/**
+ * @internal
+ * @brief Structure to store the decoder state of a ktxZStream.
+ */
+struct ktxZ
+{
+  ktx_uint32_t scheme;      /*!< supercompression scheme of the source. */
+  const ktx_uint8_t* bytes; /*!< pointer to the compressed data. */
+  ktx_size_t size;          /*!< size of the compressed data. */
+  ktx_size_t uncompressedSize; /*!< size of the decompressed data. */
+  ktx_off_t pos; /*!< read position in the decompressed data. */
+#ifdef XRGEARS_HAVE_ZSTD
+  ZSTD_DStream* zstd; /*!< zstd decoder. */
+  ZSTD_inBuffer zstdIn; /*!< compressed data left to the zstd decoder. */
+#endif
+#ifdef XRGEARS_HAVE_ZLIB
+  z_stream zlib; /*!< zlib decoder. */
+#endif
+};
+
+/**
+ * @internal
+ * @~English
+ * @brief Return KTX_TRUE if a ktxZStream can decompress @p scheme.
+ *
+ * @param [in] scheme   a ktxSupercmpScheme value.
+ */
+ktx_bool_t
+ktxZStream_isSupported(ktx_uint32_t scheme)
+{
+  switch (scheme) {
+#ifdef XRGEARS_HAVE_ZSTD
+  case KTX_SS_ZSTD: return KTX_TRUE;
+#endif
+#ifdef XRGEARS_HAVE_ZLIB
+  case KTX_SS_ZLIB: return KTX_TRUE;
+#endif
+  default: return KTX_FALSE;
+  }
+}
+
+#ifdef XRGEARS_HAVE_ZSTD
+static KTX_error_code
+ktxZ_decodeZstd(ktxZ* z, ktx_uint8_t* dst, ktx_size_t count)
+{
+  ZSTD_outBuffer out = { dst, count, 0 };
+
+  while (out.pos < out.size) {
+    size_t lastOut = out.pos;
+    size_t lastIn = z->zstdIn.pos;
+    size_t ret = ZSTD_decompressStream(z->zstd, &out, &z->zstdIn);
+    if (ZSTD_isError(ret))
+      return KTX_FILE_DATA_ERROR;
+    // The frame ended early, or the data ran out within it
+    if (out.pos < out.size &&
+        (ret == 0 || (out.pos == lastOut && z->zstdIn.pos == lastIn)))
+      return KTX_DECOMPRESS_LENGTH_ERROR;
+  }
+
+  return KTX_SUCCESS;
+}
+#endif
+
+#ifdef XRGEARS_HAVE_ZLIB
+static KTX_error_code
+ktxZ_decodeZlib(ktxZ* z, ktx_uint8_t* dst, ktx_size_t count)
+{
+  z->zlib.next_out = dst;
+
+  // avail_out is a uInt, so very large reads go in several steps
+  while (count > 0) {
+    uInt chunk = count > 0x40000000 ? 0x40000000 : (uInt)count;
+    z->zlib.avail_out = chunk;
+    while (z->zlib.avail_out > 0) {
+      int ret = inflate(&z->zlib, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END && z->zlib.avail_out > 0)
+        return KTX_DECOMPRESS_LENGTH_ERROR;
+      if (ret == Z_BUF_ERROR)
+        return KTX_DECOMPRESS_LENGTH_ERROR;
+      if (ret != Z_OK && ret != Z_STREAM_END)
+        return KTX_FILE_DATA_ERROR;
+    }
+    count -= chunk;
+  }
+
+  return KTX_SUCCESS;
+}
+#endif
+
+static KTX_error_code
+ktxZ_decode(ktxZ* z, ktx_uint8_t* dst, ktx_size_t count)
+{
+  switch (z->scheme) {
+#ifdef XRGEARS_HAVE_ZSTD
+  case KTX_SS_ZSTD: return ktxZ_decodeZstd(z, dst, count);
+#endif
+#ifdef XRGEARS_HAVE_ZLIB
+  case KTX_SS_ZLIB: return ktxZ_decodeZlib(z, dst, count);
+#endif
+  default: return KTX_UNSUPPORTED_FEATURE;
+  }
+}
+
+/**
+ * @internal
+ * @~English
+ * @brief Read bytes from a ktxZStream, decompressing them into @p dst.
+ *
+ * If @p dst is @c NULL the bytes are decoded and dropped, to skip ahead.
+ *
+ * @param [in] str      pointer to the ktxStream to read from.
+ * @param [in] dst      pointer to the location to write the data or @c NULL.
+ * @param [in] count    number of bytes to read.
+ *
+ * @return      KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_INVALID_VALUE @p str is @c NULL.
+ * @exception KTX_FILE_UNEXPECTED_EOF not enough data to satisfy the request.
+ * @exception KTX_FILE_DATA_ERROR the compressed data is corrupt.
+ * @exception KTX_DECOMPRESS_LENGTH_ERROR
+ *                              the compressed data does not hold the
+ *                              uncompressed size of the level.
+ */
+static KTX_error_code
+ktxZStream_read(ktxStream* str, void* dst, const ktx_size_t count)
+{
+  ktxZ* z;
+  KTX_error_code result = KTX_SUCCESS;
+
+  if (!str || !(z = str->data.z))
+    return KTX_INVALID_VALUE;
+
+  assert(str->type == eStreamTypeZ);
+
+  if (count > z->uncompressedSize - z->pos)
+    return KTX_FILE_UNEXPECTED_EOF;
+
+  if (dst != NULL) {
+    result = ktxZ_decode(z, dst, count);
+  } else {
+    ktx_uint8_t scratch[KTX_Z_SKIP_CHUNK_SIZE];
+    for (ktx_size_t skipped = 0; skipped < count && result == KTX_SUCCESS;
+         skipped += sizeof(scratch)) {
+      ktx_size_t chunk = count - skipped;
+      if (chunk > sizeof(scratch))
+        chunk = sizeof(scratch);
+      result = ktxZ_decode(z, scratch, chunk);
+    }
+  }
+
+  if (result == KTX_SUCCESS)
+    z->pos += count;
+
+  return result;
+}
+
+/**
+ * @internal
+ * @~English
+ * @brief Get the current read position in the decompressed data.
+ *
+ * @param [in] str      pointer to the ktxStream to query.
+ * @param [in,out] pos  pointer to variable to receive the offset value.
+ *
+ * @return      KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_INVALID_VALUE @p str or @p pos is @c NULL.
+ */
+static KTX_error_code
+ktxZStream_getpos(ktxStream* str, ktx_off_t* const pos)
+{
+  if (!str || !pos)
+    return KTX_INVALID_VALUE;
+
+  assert(str->type == eStreamTypeZ);
+
+  *pos = str->data.z->pos;
+  return KTX_SUCCESS;
+}
+
+/**
+ * @internal
+ * @~English
+ * @brief Move the read position of a ktxZStream forward.
+ *
+ * The data in between is decoded and dropped. Compressed data cannot be
+ * read backwards, to go back construct a new stream.
+ *
+ * @param [in] str      pointer to the ktxStream whose position is to be set.
+ * @param [in] pos      the offset value to set.
+ *
+ * @return      KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_INVALID_VALUE @p str is @c NULL.
+ * @exception KTX_INVALID_OPERATION @p pos is before the current position
+ *                                  or past the end of the data.
+ */
+static KTX_error_code
+ktxZStream_setpos(ktxStream* str, ktx_off_t const pos)
+{
+  if (!str)
+    return KTX_INVALID_VALUE;
+
+  assert(str->type == eStreamTypeZ);
+
+  ktxZ* z = str->data.z;
+  if (pos < z->pos || pos > z->uncompressedSize)
+    return KTX_INVALID_OPERATION;
+
+  return ktxZStream_read(str, NULL, pos - z->pos);
+}
+
+/**
+ * @internal
+ * @~English
+ * @brief Get the decompressed size of a ktxZStream in bytes.
+ *
+ * @param [in] str       pointer to the ktxStream whose size is to be queried.
+ * @param [in,out] size  pointer to a variable in which size will be written.
+ *
+ * @return      KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_INVALID_VALUE @p str or @p pSize is @c NULL.
+ */
+static KTX_error_code
+ktxZStream_getsize(ktxStream* str, ktx_size_t* pSize)
+{
+  if (!str || !pSize)
+    return KTX_INVALID_VALUE;
+
+  assert(str->type == eStreamTypeZ);
+
+  *pSize = str->data.z->uncompressedSize;
+  return KTX_SUCCESS;
+}
+
+/**
+ * @internal
+ * @~English
+ * @brief Initialize a ktxZStream.
+ *
+ * The compressed bytes are not copied and must outlive the stream.
+ *
+ * @param [in] str      pointer to a ktxStream struct to initialize.
+ * @param [in] scheme   supercompression scheme of @p bytes.
+ * @param [in] bytes    pointer to the compressed data.
+ * @param [in] size     size of the compressed data.
+ * @param [in] uncompressedSize size of the data once decompressed.
+ *
+ * @return      KTX_SUCCESS on success, other KTX_* enum values on error.
+ *
+ * @exception KTX_INVALID_VALUE     @p str or @p bytes is @c NULL or @p size
+ *                                  is 0.
+ * @exception KTX_UNSUPPORTED_FEATURE @p scheme is not in this build.
+ * @exception KTX_OUT_OF_MEMORY     system failed to allocate sufficient memory.
+ */
+KTX_error_code
+ktxZStream_construct(ktxStream* str,
+                     ktx_uint32_t scheme,
+                     const ktx_uint8_t* bytes,
+                     const ktx_size_t size,
+                     const ktx_size_t uncompressedSize)
+{
+  if (!str || !bytes || size == 0)
+    return KTX_INVALID_VALUE;
+
+  if (!ktxZStream_isSupported(scheme))
+    return KTX_UNSUPPORTED_FEATURE;
+
+  ktxZ* z = calloc(1, sizeof(ktxZ));
+  if (z == NULL)
+    return KTX_OUT_OF_MEMORY;
+
+  z->scheme = scheme;
+  z->bytes = bytes;
+  z->size = size;
+  z->uncompressedSize = uncompressedSize;
+
+  switch (scheme) {
+#ifdef XRGEARS_HAVE_ZSTD
+  case KTX_SS_ZSTD:
+    z->zstd = ZSTD_createDStream();
+    if (z->zstd == NULL) {
+      free(z);
+      return KTX_OUT_OF_MEMORY;
+    }
+    z->zstdIn = (ZSTD_inBuffer){ bytes, size, 0 };
+    break;
+#endif
+#ifdef XRGEARS_HAVE_ZLIB
+  case KTX_SS_ZLIB:
+    // zlib takes a uInt input size, levels are far smaller in practice
+    if (size > UINT32_MAX || inflateInit(&z->zlib) != Z_OK) {
+      free(z);
+      return KTX_OUT_OF_MEMORY;
+    }
+    z->zlib.next_in = (Bytef*)bytes;
+    z->zlib.avail_in = (uInt)size;
+    break;
+#endif
+  default: break;
+  }
+
+  str->type = eStreamTypeZ;
+  str->read = ktxZStream_read;
+  str->getpos = ktxZStream_getpos;
+  str->setpos = ktxZStream_setpos;
+  str->getsize = ktxZStream_getsize;
+  str->destruct = ktxZStream_destruct;
+  str->data.z = z;
+  str->closeOnDestruct = KTX_FALSE;
+
+  return KTX_SUCCESS;
+}
+
+/**
+ * @internal
+ * @~English
+ * @brief Free the decoder of a ktxZStream.
+ *
+ * @param [in] str pointer to the ktxStream to destruct.
+ */
+void
+ktxZStream_destruct(ktxStream* str)
+{
+  assert(str && str->type == eStreamTypeZ);
+
+  ktxZ* z = str->data.z;
+#ifdef XRGEARS_HAVE_ZSTD
+  if (z->zstd != NULL)
+    ZSTD_freeDStream(z->zstd);
+#endif
+#ifdef XRGEARS_HAVE_ZLIB
+  if (z->scheme == KTX_SS_ZLIB)
+    inflateEnd(&z->zlib);
+#endif
+  free(z);
+  str->data.z = NULL;
+}
@@ -0,0 +1,196 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "light_clusters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "log.h"
+
+static void
+_create_storage_buffer(vulkan_device *vk_device,
+                       vulkan_buffer *buffer,
+                       VkDeviceSize size)
+{
+  VkMemoryPropertyFlags memory_flags =
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  vk_check(vulkan_device_create_buffer(vk_device, buffer,
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                       memory_flags, size, NULL));
+  // Map persistent
+  vk_check(vulkan_buffer_map(buffer));
+}
+
+light_clusters::light_clusters(vulkan_device *vk_device, uint32_t max_lights)
+  : max_lights(max_lights)
+{
+  for (uint32_t i = 0; i < 2; i++) {
+    _create_storage_buffer(vk_device, &grid_buffers[i],
+                           sizeof(header) +
+                             sizeof(glm::uvec2) * LIGHT_CLUSTERS_COUNT);
+    _create_storage_buffer(vk_device, &index_buffers[i],
+                           sizeof(uint32_t) * LIGHT_CLUSTERS_MAX_INDICES);
+    memset(grid_buffers[i].mapped, 0, sizeof(header));
+  }
+
+  counts.resize(LIGHT_CLUSTERS_COUNT);
+  ranges.resize(LIGHT_CLUSTERS_COUNT);
+}
+
+light_clusters::~light_clusters()
+{
+  for (uint32_t i = 0; i < 2; i++) {
+    vulkan_buffer_destroy(&grid_buffers[i]);
+    vulkan_buffer_destroy(&index_buffers[i]);
+  }
+}
+
+static int
+_tile(float ndc, int count)
+{
+  int tile = (int)floorf((ndc * 0.5f + 0.5f) * (float)count);
+  return std::clamp(tile, 0, count - 1);
+}
+
+static int
+_slice(float depth, const light_clusters::header &h)
+{
+  int slice = (int)floorf(logf(depth) * h.depth_params.x + h.depth_params.y);
+  return std::clamp(slice, 0, LIGHT_CLUSTERS_Z - 1);
+}
+
+bool
+light_clusters::_bin_light(const point_light &light,
+                           const glm::mat4 &projection,
+                           const glm::mat4 &view,
+                           const header &h,
+                           light_bin *bin)
+{
+  float near_z = h.depth_params.z;
+  float far_z = h.depth_params.w;
+  float radius = light.position.w;
+
+  glm::vec4 center = view * glm::vec4(glm::vec3(light.position), 1.0f);
+  float depth = -center.z;
+
+  if (depth + radius < near_z || depth - radius > far_z)
+    return false;
+
+  bin->min.z = _slice(std::max(depth - radius, near_z), h);
+  bin->max.z = _slice(std::min(depth + radius, far_z), h);
+
+  // The sphere intersects the near plane, be conservative.
+  if (depth - radius <= near_z) {
+    bin->min.x = 0;
+    bin->min.y = 0;
+    bin->max.x = LIGHT_CLUSTERS_X - 1;
+    bin->max.y = LIGHT_CLUSTERS_Y - 1;
+    return true;
+  }
+
+  // Project the view space bounding box, all corners are in front of near.
+  glm::vec2 ndc_min = glm::vec2(1.0f);
+  glm::vec2 ndc_max = glm::vec2(-1.0f);
+  for (uint32_t i = 0; i < 8; i++) {
+    glm::vec4 corner = center + glm::vec4((i & 1) ? radius : -radius,
+                                          (i & 2) ? radius : -radius,
+                                          (i & 4) ? radius : -radius, 0.0f);
+    glm::vec4 clip = projection * corner;
+    glm::vec2 ndc = glm::vec2(clip) / clip.w;
+    ndc_min = glm::min(ndc_min, ndc);
+    ndc_max = glm::max(ndc_max, ndc);
+  }
+
+  if (ndc_max.x < -1.0f || ndc_min.x > 1.0f || ndc_max.y < -1.0f ||
+      ndc_min.y > 1.0f)
+    return false;
+
+  bin->min.x = _tile(ndc_min.x, LIGHT_CLUSTERS_X);
+  bin->min.y = _tile(ndc_min.y, LIGHT_CLUSTERS_Y);
+  bin->max.x = _tile(ndc_max.x, LIGHT_CLUSTERS_X);
+  bin->max.y = _tile(ndc_max.y, LIGHT_CLUSTERS_Y);
+
+  return true;
+}
+
+static inline uint32_t
+_cluster_index(int x, int y, int z)
+{
+  return (z * LIGHT_CLUSTERS_Y + y) * LIGHT_CLUSTERS_X + x;
+}
+
+void
+light_clusters::update(uint32_t eye,
+                       const std::vector<point_light> &lights,
+                       const glm::mat4 &projection,
+                       const glm::mat4 &view)
+{
+  header h;
+
+  // Near and far planes are encoded in the projection matrix.
+  float near_z = projection[3][2] / projection[2][2];
+  float far_z = projection[3][2] / (projection[2][2] + 1.0f);
+  float scale = LIGHT_CLUSTERS_Z / logf(far_z / near_z);
+  h.depth_params = glm::vec4(scale, -logf(near_z) * scale, near_z, far_z);
+
+  bins.clear();
+  std::fill(counts.begin(), counts.end(), 0);
+
+  for (uint32_t i = 0; i < lights.size(); i++) {
+    light_bin bin;
+    if (!_bin_light(lights[i], projection, view, h, &bin))
+      continue;
+    bin.light = i;
+    for (int z = bin.min.z; z <= bin.max.z; z++)
+      for (int y = bin.min.y; y <= bin.max.y; y++)
+        for (int x = bin.min.x; x <= bin.max.x; x++)
+          counts[_cluster_index(x, y, z)]++;
+    bins.push_back(bin);
+  }
+
+  uint32_t offset = 0;
+  uint32_t dropped = 0;
+  uint32_t fullest = 0;
+  for (uint32_t i = 0; i < LIGHT_CLUSTERS_COUNT; i++) {
+    fullest = std::max(fullest, counts[i]);
+    uint32_t count = std::min(
+      { counts[i], max_lights, (uint32_t)LIGHT_CLUSTERS_MAX_INDICES - offset });
+    dropped += counts[i] - count;
+    ranges[i] = glm::uvec2(offset, 0);
+    counts[i] = count;
+    offset += count;
+  }
+
+  if (dropped > 0 && !overflow_warned) {
+    xrg_log_w("Dropped %u light references. Clusters hold %u lights, the "
+              "fullest one has %u. The index list holds %u.",
+              dropped, max_lights, fullest, LIGHT_CLUSTERS_MAX_INDICES);
+    overflow_warned = true;
+  }
+
+  uint32_t *indices = (uint32_t *)index_buffers[eye].mapped;
+  for (const light_bin &bin : bins)
+    for (int z = bin.min.z; z <= bin.max.z; z++)
+      for (int y = bin.min.y; y <= bin.max.y; y++)
+        for (int x = bin.min.x; x <= bin.max.x; x++) {
+          uint32_t c = _cluster_index(x, y, z);
+          if (ranges[c].y < counts[c])
+            indices[ranges[c].x + ranges[c].y++] = bin.light;
+        }
+
+  h.grid =
+    glm::uvec4(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z, offset);
+
+  uint8_t *grid = (uint8_t *)grid_buffers[eye].mapped;
+  memcpy(grid, &h, sizeof(h));
+  memcpy(grid + sizeof(h), ranges.data(),
+         sizeof(glm::uvec2) * LIGHT_CLUSTERS_COUNT);
+}
@@ -0,0 +1,92 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "glm_inc.hpp"
+
+#include "vulkan_buffer.h"
+#include "vulkan_device.h"
+
+// Froxel grid dimensions, x and y tiles are in NDC, z slices are logarithmic.
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 8
+#define LIGHT_CLUSTERS_Z 24
+#define LIGHT_CLUSTERS_COUNT                                                   \
+  (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+
+// Average light references per cluster we reserve space for.
+#define LIGHT_CLUSTERS_MAX_INDICES (LIGHT_CLUSTERS_COUNT * 32)
+
+// Upper bound of the light loop gears.frag unrolls.
+#define LIGHT_CLUSTERS_MAX_LIGHTS 128
+
+struct point_light
+{
+  // xyz: world position, w: radius of influence
+  glm::vec4 position;
+  // rgb: color, a: intensity
+  glm::vec4 color;
+};
+
+/*
+ * Bins point lights into view space froxels for clustered forward shading.
+ *
+ * Each view has its own cluster grid and light index list, which are
+ * rebuilt on the CPU when the view changes and read by gears.frag.
+ */
+class light_clusters
+{
+public:
+  // Matches the header of the Clusters buffer in gears.frag (std430).
+  struct header
+  {
+    // x: slice scale, y: slice bias, z: near, w: far
+    glm::vec4 depth_params;
+    // xyz: grid dimensions, w: number of written light indices
+    glm::uvec4 grid;
+  };
+
+  vulkan_buffer grid_buffers[2];
+  vulkan_buffer index_buffers[2];
+
+  // Lights per cluster, further ones are dropped.
+  uint32_t max_lights;
+
+  light_clusters(vulkan_device *vk_device, uint32_t max_lights);
+  ~light_clusters();
+
+  void
+  update(uint32_t eye,
+         const std::vector<point_light> &lights,
+         const glm::mat4 &projection,
+         const glm::mat4 &view);
+
+private:
+  struct light_bin
+  {
+    uint32_t light;
+    glm::ivec3 min;
+    glm::ivec3 max;
+  };
+
+  std::vector<light_bin> bins;
+  std::vector<uint32_t> counts;
+  std::vector<glm::uvec2> ranges;
+  bool overflow_warned = false;
+
+  static bool
+  _bin_light(const point_light &light,
+             const glm::mat4 &projection,
+             const glm::mat4 &view,
+             const header &h,
+             light_bin *bin);
+};
@@ -8,7 +8,14 @@
  */
 
 #include <csignal>
-
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asset_pack.h"
 #include "gear.hpp"
 #include "vulkan_framebuffer.h"
 #include "log.h"
@@ -17,7 +24,13 @@
 #include "pipeline_gears.hpp"
 #include "glm_inc.hpp"
 #include "settings.h"
+#include "vulkan_attachment.h"
 #include "vulkan_context.h"
+#include "vulkan_pipeline_cache.h"
+#include "vulkan_render_pass.h"
+#include "vulkan_render_target.h"
+#include "vulkan_submit.h"
+#include "vulkan_texture_loader.h"
 
 #include "textures.h"
 
@@ -47,25 +60,81 @@ public:
   // gears layer
   vulkan_pipeline *gears;
   vulkan_framebuffer **gears_buffers[2];
+  vulkan_render_target *gears_targets[2];
+  // Per view depth when it is not submitted to the compositor
+  vulkan_attachment gears_depth[2];
+  bool gears_transient_depth = false;
+  // Per view multisampled color, resolved into the swapchain images
+  vulkan_attachment gears_color[2];
+  bool gears_msaa = false;
   VkCommandBuffer *gears_draw_cmd;
 
 
 
   vulkan_pipeline *equirect;
   vulkan_framebuffer **sky_buffers[2];
+  vulkan_render_target *sky_targets[2];
   VkCommandBuffer *sky_draw_cmd;
 
   VkCommandPool cmd_pool;
   VkQueue queue;
+  // Signaled once the graphics queue finished the work up to the last frame
+  VkFence frame_fence = VK_NULL_HANDLE;
+  // One shot uploads, batched into few submissions
+  vulkan_submit submit;
+  // Copies on a dedicated transfer queue, only used when the device has one
+  VkQueue transfer_queue;
+  vulkan_submit transfer_submit;
   VkPhysicalDeviceFeatures device_features;
-  VkPipelineCache pipeline_cache;
-
-
-  // quad layers
-  vulkan_texture quad_texture[3];
-
+  // Mapped for the lifetime of the app, textures are staged from it
+  asset_pack assets = {};
+  // Loads textures in the background while the session already renders
+  vulkan_texture_loader loader;
+
+  struct shared_texture;
+
+  /*
+   * Quad and equirect layers show a single image. Their swapchain is filled
+   * on a loader thread once the texture is uploaded, the layer is only
+   * submitted after that.
+   */
+  struct static_layer
+  {
+    shared_texture *texture;
+    const XrSwapchainImageVulkanKHR *images;
+    uint32_t length;
+    std::function<bool(uint32_t *)> acquire;
+    std::function<bool()> release;
+    bool *ready;
+    // The layer stays hidden
+    bool failed = false;
+  };
+  std::vector<std::unique_ptr<static_layer>> static_layers;
+
+  /*
+   * Each asset is uploaded once, copied into the static layers showing it
+   * and kept for the gears if they sample it. Released after the copies
+   * otherwise.
+   */
+  struct shared_texture
+  {
+    vulkan_texture_request request = {};
+    xrgears *app;
+    std::vector<static_layer *> layers;
+    bool sampled = false;
+  };
+  std::map<std::string, std::unique_ptr<shared_texture>> shared_textures;
+  vulkan_pipeline_cache pipeline_cache;
+  vulkan_render_pass_cache render_passes;
+  vulkan_render_pass_info gears_pass_info;
+  vulkan_render_pass_info sky_pass_info;
+  // VK_NULL_HANDLE when using dynamic rendering
+  VkRenderPass gears_render_pass = VK_NULL_HANDLE;
+  VkRenderPass sky_render_pass = VK_NULL_HANDLE;
+
+  // Render with VK_KHR_dynamic_rendering instead of framebuffers
+  bool dynamic_rendering = false;
 
-  vulkan_texture equirect_texture;
 
   xrgears(int argc, char *argv[])
   {
@@ -81,37 +150,53 @@ public:
 
   ~xrgears()
   {
+    // Textures still loading are dropped, the running ones finish first
+    vulkan_texture_loader_destroy(&loader);
+
+    // The virtual texture streams tiles on its own thread
+    if (xr.sky_type == SKY_TYPE_PROJECTION)
+      ((pipeline_equirect *)equirect)->stop_streaming();
+
+    // Uploads may still be in flight
+    vulkan_submit_destroy(&submit);
+    if (submit.source)
+      vulkan_submit_destroy(&transfer_submit);
+
+    asset_pack_close(&assets);
 
     if (settings.enable_gears) {
-      for (uint32_t i = 0; i < 2; i++) {
-        for (uint32_t j = 0; j < xr.gears.swapchain_length[i]; j++)
-          if (gears_buffers[i][j]) {
-            vulkan_framebuffer_destroy(gears_buffers[i][j]);
-            delete gears_buffers[i][j];
-          }
-        free(gears_buffers[i]);
+      for (uint32_t i = 0; i < 2; i++)
+        destroy_targets(gears_buffers[i], gears_targets[i],
+                        xr.gears.swapchain_length[i]);
+      for (uint32_t i = 0; i < xr.view_count; i++) {
+        if (gears_transient_depth)
+          vulkan_attachment_destroy(&gears_depth[i]);
+        if (gears_msaa)
+          vulkan_attachment_destroy(&gears_color[i]);
       }
       free(gears_draw_cmd);
       delete gears;
     }
 
+    // The others were released once copied into their layers
+    for (auto &it : shared_textures)
+      if (it.second->sampled && it.second->request.loaded)
+        vulkan_texture_destroy(&it.second->request.texture);
+
     if (xr.sky_type == SKY_TYPE_PROJECTION) {
-      for (uint32_t i = 0; i < 2; i++) {
-        for (uint32_t j = 0; j < xr.sky.swapchain_length[i]; j++)
-          if (sky_buffers[i][j]) {
-            vulkan_framebuffer_destroy(sky_buffers[i][j]);
-            delete sky_buffers[i][j];
-          }
-        free(sky_buffers[i]);
-      }
+      for (uint32_t i = 0; i < 2; i++)
+        destroy_targets(sky_buffers[i], sky_targets[i],
+                        xr.sky.swapchain_length[i]);
       free(sky_draw_cmd);
       delete equirect;
     }
 
     xr_cleanup(&xr);
 
-    vkDestroyPipelineCache(vk_device->device, pipeline_cache, nullptr);
+    vulkan_render_pass_cache_destroy(&render_passes);
+    vulkan_pipeline_cache_destroy(&pipeline_cache);
 
+    vkDestroyFence(vk_device->device, frame_fence, nullptr);
     vkDestroyCommandPool(vk_device->device, cmd_pool, nullptr);
 
     vulkan_device_destroy(vk_device);
@@ -120,12 +205,53 @@ public:
     xrg_log_d("Shut down xrgears");
   }
 
+  void
+  destroy_targets(vulkan_framebuffer **buffers,
+                  vulkan_render_target *targets,
+                  uint32_t count)
+  {
+    for (uint32_t j = 0; j < count; j++) {
+      if (buffers && buffers[j]) {
+        vulkan_framebuffer_destroy(buffers[j]);
+        delete buffers[j];
+      }
+      if (targets)
+        vulkan_render_target_destroy(&targets[j]);
+    }
+    free(buffers);
+    free(targets);
+  }
+
   void
   loop()
   {
     while (!quit)
       render();
+    wait_idle();
+  }
+
+  /*
+   * Frames reuse their command and uniform buffers. Only the graphics queue
+   * is waited for, uploads on the transfer queue keep running.
+   */
+  void
+  wait_frame()
+  {
+    vk_check(vkWaitForFences(vk_device->device, 1, &frame_fence, VK_TRUE,
+                             UINT64_MAX));
+  }
+
+  // Waiting for the device accesses all queues, loader threads submit too
+  void
+  wait_idle()
+  {
+    vulkan_submit_lock_queue(&submit);
+    if (submit.source)
+      vulkan_submit_lock_queue(&transfer_submit);
     vkDeviceWaitIdle(vk_device->device);
+    if (submit.source)
+      vulkan_submit_unlock_queue(&transfer_submit);
+    vulkan_submit_unlock_queue(&submit);
   }
 
   void
@@ -156,6 +282,77 @@ public:
     vk_check(vkEndCommandBuffer(*cb));
   }
 
+  void
+  build_dynamic_command_buffer(VkCommandBuffer *cb,
+                               vulkan_render_target **targets,
+                               uint32_t view_count,
+                               uint32_t swapchain_index,
+                               vulkan_pipeline *pipe,
+                               const vulkan_render_pass_info *info)
+  {
+    *cb = create_command_buffer();
+
+    VkCommandBufferBeginInfo command_buffer_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+    };
+    vk_check(vkBeginCommandBuffer(*cb, &command_buffer_info));
+
+    for (uint32_t view_index = 0; view_index < view_count; view_index++) {
+      vulkan_render_target *target = &targets[view_index][swapchain_index];
+      vulkan_render_target_begin(target, *cb, info);
+      vulkan_render_target_set_viewport_and_scissor(target, *cb);
+
+      pipe->draw(*cb, view_index);
+
+      vulkan_render_target_end(target, *cb);
+    }
+
+    vk_check(vkEndCommandBuffer(*cb));
+  }
+
+  /*
+   * With dynamic rendering the image views and command buffers of a swapchain
+   * image are only created once the image is acquired for the first time.
+   */
+  void
+  record_acquired_images()
+  {
+    if (settings.enable_gears) {
+      uint32_t index = xr.gears.last_acquired[0];
+      if (gears_draw_cmd[index] == VK_NULL_HANDLE) {
+        struct timespec record_start;
+        clock_gettime(CLOCK_MONOTONIC, &record_start);
+        build_dynamic_command_buffer(&gears_draw_cmd[index], gears_targets,
+                                     xr.view_count, index, gears,
+                                     &gears_pass_info);
+        xrg_log_d("Recorded gears image %u in %.2f ms.", index,
+                  _ms_since(record_start));
+      }
+    }
+
+    if (xr.sky_type == SKY_TYPE_PROJECTION) {
+      uint32_t index = xr.sky.last_acquired[0];
+      if (sky_draw_cmd[index] == VK_NULL_HANDLE) {
+        struct timespec record_start;
+        clock_gettime(CLOCK_MONOTONIC, &record_start);
+        build_dynamic_command_buffer(&sky_draw_cmd[index], sky_targets,
+                                     xr.view_count, index, equirect,
+                                     &sky_pass_info);
+        xrg_log_d("Recorded sky image %u in %.2f ms.", index,
+                  _ms_since(record_start));
+      }
+    }
+  }
+
+  static double
+  _ms_since(struct timespec start)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start.tv_sec) * 1000.0 +
+           (double)(now.tv_nsec - start.tv_nsec) / 1000000.0;
+  }
+
   static glm::mat4
   _create_projection_from_fov(const XrFovf fov,
                               const float near_z,
@@ -205,11 +402,87 @@ public:
     return view_glm_inv;
   }
 
+  /*
+   * Shows what the loader finished since the last frame. Runs while no
+   * frame is in flight, so descriptors can be updated.
+   */
+  void
+  update_textures()
+  {
+    // Uploads recorded on loader threads are only submitted here
+    vulkan_submit_flush(&submit);
+
+    for (auto &layer : static_layers) {
+      if (*layer->ready || layer->failed)
+        continue;
+      vulkan_texture_request *request = &layer->texture->request;
+      if (vulkan_texture_loader_has_failed(&loader, request))
+        layer->failed = true;
+      else if (vulkan_texture_loader_is_resident(&loader, request))
+        *layer->ready = true;
+    }
+
+    bool gears_changed =
+      settings.enable_gears &&
+      ((pipeline_gears *)gears)->update_textures(&submit, &loader);
+
+    if (xr.sky_type == SKY_TYPE_PROJECTION) {
+      pipeline_equirect *sky = (pipeline_equirect *)equirect;
+      if (sky->update_texture(&submit, &loader)) {
+        rerecord(sky_draw_cmd, xr.sky.swapchain_length[0], sky_buffers,
+                 equirect);
+
+        // Metallic gears reflect the sky once it is a cube map
+        VkDescriptorImageInfo cube;
+        if (settings.enable_gears && sky->get_reflection(&cube)) {
+          ((pipeline_gears *)gears)->set_reflection(&cube);
+          gears_changed = true;
+        }
+      }
+    }
+
+    if (gears_changed)
+      rerecord(gears_draw_cmd, xr.gears.swapchain_length[0], gears_buffers,
+               gears);
+  }
+
+  // The descriptors of pipe changed, which invalidates its command buffers
+  void
+  rerecord(VkCommandBuffer *cmds,
+           uint32_t count,
+           vulkan_framebuffer ***fb,
+           vulkan_pipeline *pipe)
+  {
+    for (uint32_t i = 0; i < count; i++) {
+      if (cmds[i] != VK_NULL_HANDLE)
+        vkFreeCommandBuffers(vk_device->device, cmd_pool, 1, &cmds[i]);
+      cmds[i] = VK_NULL_HANDLE;
+
+      // Dynamic rendering records on the next acquire
+      if (!dynamic_rendering)
+        build_command_buffer(&cmds[i], fb, xr.view_count, i, pipe);
+    }
+  }
+
   void
   draw()
   {
+    // Frees staging memory of uploads that have completed
+    vulkan_submit_poll(&submit);
+
+    update_textures();
+
     xr_begin_frame(&xr);
 
+    // The runtime uses the queue in the swapchain calls and xrEndFrame
+    vulkan_submit_lock_queue(&submit);
+    draw_views();
+    vulkan_submit_unlock_queue(&submit);
+  }
+
+  void
+  draw_views()
+  {
     for (uint32_t i = 0; i < 2; i++) {
 
       if (settings.enable_gears) {
@@ -241,14 +514,22 @@ public:
       }
 
 
-      if (xr.sky_type == SKY_TYPE_PROJECTION)
-        ((pipeline_equirect *)equirect)->update_vp(projection, view, i);
+      if (xr.sky_type == SKY_TYPE_PROJECTION) {
+        pipeline_equirect *sky = (pipeline_equirect *)equirect;
+        sky->update_vp(projection, view, i);
+        sky->request_tiles(
+          i, xr.configuration_views[i].recommendedImageRectWidth,
+          xr.configuration_views[i].recommendedImageRectHeight);
+      }
     }
 
     if (settings.enable_gears) {
       ((pipeline_gears *)gears)->update_time(animation_timer);
     }
 
+    if (dynamic_rendering)
+      record_acquired_images();
+
     VkPipelineStageFlags stage_flags[1] = {
       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
     };
@@ -271,6 +552,10 @@ public:
       vk_check(vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
     }
 
+    // Without batches the fence covers all work submitted to the queue so far
+    vk_check(vkResetFences(vk_device->device, 1, &frame_fence));
+    vk_check(vkQueueSubmit(queue, 0, nullptr, frame_fence));
+
     for (uint32_t i = 0; i < 2; i++) {
       if (settings.enable_gears) {
         if (!xr_proj_release_swapchain(&xr, &xr.gears, i)) {
@@ -294,6 +579,129 @@ public:
     }
   }
 
+  // Quad and equirect swapchains are RGBA8 images owned by the runtime
+  void
+  add_swapchain_estimate(XrExtent2Di extent, uint32_t length)
+  {
+    vulkan_memory_add_estimate(&vk_device->memory, VULKAN_MEMORY_SWAPCHAIN,
+                               (VkDeviceSize)extent.width * extent.height * 4 *
+                                 length);
+  }
+
+  /*
+   * Copies the uploaded layer content into each swapchain image on the GPU.
+   * Static swapchains only have a single image. Runs on a loader thread,
+   * which shares the queue with the frames.
+   */
+  static void
+  fill_static_swapchain(static_layer *layer,
+                        vulkan_texture *source,
+                        vulkan_submit *submit)
+  {
+    for (uint32_t i = 0; i < layer->length; i++) {
+      uint32_t buffer_index;
+      vulkan_submit_lock_queue(submit);
+      bool acquired = layer->acquire(&buffer_index);
+      vulkan_submit_unlock_queue(submit);
+      if (!acquired) {
+        xrg_log_e("Could not acquire static swapchain.");
+        break;
+      }
+
+      // Released anyway, the runtime waits for a release after an acquire
+      if (!vulkan_texture_copy_to_image(
+            source, submit, layer->images[buffer_index].image,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL))
+        xrg_log_e("Could not fill static swapchain with %s.",
+                  layer->texture->request.name);
+      // The runtime needs the copy submitted, not completed, on release
+      vulkan_submit_flush(submit);
+
+      vulkan_submit_lock_queue(submit);
+      bool released = layer->release();
+      vulkan_submit_unlock_queue(submit);
+      if (!released)
+        xrg_log_e("Could not release static swapchain.");
+    }
+  }
+
+  static void
+  fill_static_swapchains(vulkan_texture *source, void *data)
+  {
+    shared_texture *texture = (shared_texture *)data;
+    vulkan_submit *submit = &texture->app->submit;
+
+    for (auto &layer : texture->layers)
+      fill_static_swapchain(layer, source, submit);
+
+    if (!texture->sampled)
+      vulkan_texture_release(source, submit);
+  }
+
+  // Queued by load_shared_textures, once all users are known
+  shared_texture *
+  get_shared_texture(const char *asset)
+  {
+    auto &texture = shared_textures[asset];
+    if (!texture) {
+      texture = std::make_unique<shared_texture>();
+      texture->app = this;
+    }
+    return texture.get();
+  }
+
+  vulkan_texture_request *
+  get_sampled_texture(const char *asset)
+  {
+    shared_texture *texture = get_shared_texture(asset);
+    texture->sampled = true;
+    return &texture->request;
+  }
+
+  /*
+   * Sampled textures get mip maps and end up readable by shaders, the copy
+   * into static layers transitions them for the transfer.
+   */
+  void
+  load_shared_textures()
+  {
+    for (auto &it : shared_textures) {
+      shared_texture *texture = it.second.get();
+      vulkan_texture_request *request = &texture->request;
+      request->name = it.first.c_str();
+      request->bytes = asset_pack_get(&assets, request->name, &request->size);
+      request->format = VK_FORMAT_R8G8B8A8_SRGB;
+      request->dest_layout = texture->sampled
+                               ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                               : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      request->generate_mipmaps = texture->sampled;
+      request->uploaded = fill_static_swapchains;
+      request->data = texture;
+      vulkan_texture_loader_load_ktx(&loader, request);
+    }
+  }
+
+  // Shows asset in a static swapchain, sets ready once shown
+  void
+  load_static_layer(const char *asset,
+                    const XrSwapchainImageVulkanKHR *images,
+                    uint32_t length,
+                    std::function<bool(uint32_t *)> acquire,
+                    std::function<bool()> release,
+                    bool *ready)
+  {
+    static_layer *layer = new static_layer();
+    layer->texture = get_shared_texture(asset);
+    layer->images = images;
+    layer->length = length;
+    layer->acquire = acquire;
+    layer->release = release;
+    layer->ready = ready;
+
+    layer->texture->layers.push_back(layer);
+    static_layers.emplace_back(layer);
+  }
+
   void
   init_quads()
   {
@@ -308,27 +716,15 @@ public:
       .height = extent.height / ppm,
     };
     xr_quad_init(&xr.quad, xr.session, xr.local_space, extent, pose, size);
+    add_swapchain_estimate(extent, xr.quad.swapchain_length);
 
-    size_t hawk_size;
-
-#ifdef XR_OS_ANDROID
-    const char *hawk_bytes =
-      android_get_asset(&global_android_context, "hawk.ktx", &hawk_size);
-#else
-    const char *hawk_bytes = gio_get_asset("/textures/hawk.ktx", &hawk_size);
-#endif
-
-    for (uint32_t i = 0; i < xr.quad.swapchain_length; i++) {
-      uint32_t buffer_index;
-      if (!xr_quad_acquire_swapchain(&xr.quad, &buffer_index))
-        xrg_log_e("Could not acquire quad swapchain.");
-      vulkan_texture_load_ktx_from_image(
-        &quad_texture[i], xr.quad.images[i].image,
-        (const ktx_uint8_t *)hawk_bytes, hawk_size, vk_device, queue,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-      if (!xr_quad_release_swapchain(&xr.quad))
-        xrg_log_e("Could not release quad swapchain.");
-    }
+    load_static_layer(
+      "hawk.ktx", xr.quad.images, xr.quad.swapchain_length,
+      [this](uint32_t *index) {
+        return xr_quad_acquire_swapchain(&xr.quad, index);
+      },
+      [this]() { return xr_quad_release_swapchain(&xr.quad); },
+      &xr.quad.ready);
 
     XrExtent2Di extent2 = { .width = 2370, .height = 1570 };
     XrPosef pose2 = {
@@ -340,26 +736,15 @@ public:
       .height = extent2.height / ppm,
     };
     xr_quad_init(&xr.quad2, xr.session, xr.local_space, extent2, pose2, size2);
-
-    size_t cat_size;
-#ifdef XR_OS_ANDROID
-    const char *cat_bytes =
-      android_get_asset(&global_android_context, "cat.ktx", &cat_size);
-#else
-    const char *cat_bytes = gio_get_asset("/textures/cat.ktx", &cat_size);
-#endif
-
-    for (uint32_t i = 0; i < xr.quad2.swapchain_length; i++) {
-      uint32_t buffer_index;
-      if (!xr_quad_acquire_swapchain(&xr.quad2, &buffer_index))
-        xrg_log_e("Could not acquire quad swapchain.");
-      vulkan_texture_load_ktx_from_image(
-        &quad_texture[i], xr.quad2.images[i].image,
-        (const ktx_uint8_t *)cat_bytes, cat_size, vk_device, queue,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-      if (!xr_quad_release_swapchain(&xr.quad2))
-        xrg_log_e("Could not release quad swapchain.");
-    }
+    add_swapchain_estimate(extent2, xr.quad2.swapchain_length);
+
+    load_static_layer(
+      "cat.ktx", xr.quad2.images, xr.quad2.swapchain_length,
+      [this](uint32_t *index) {
+        return xr_quad_acquire_swapchain(&xr.quad2, index);
+      },
+      [this]() { return xr_quad_release_swapchain(&xr.quad2); },
+      &xr.quad2.ready);
   }
 
   void
@@ -383,26 +768,16 @@ public:
       return;
     };
 
-    size_t station_size;
-#ifdef XR_OS_ANDROID
-    const char *station_bytes = android_get_asset(
-      &global_android_context, "dresden_station_night_4k.ktx", &station_size);
-#else
-    const char *station_bytes =
-      gio_get_asset("/textures/dresden_station_night_4k.ktx", &station_size);
-#endif
+    add_swapchain_estimate(extent, xr.equirect.swapchain_length);
 
-    for (uint32_t i = 0; i < xr.equirect.swapchain_length; i++) {
-      uint32_t buffer_index;
-      if (!xr_equirect_acquire_swapchain(&xr.equirect, &buffer_index))
-        xrg_log_e("Could not acquire equirect swapchain.");
-      vulkan_texture_load_ktx_from_image(
-        &equirect_texture, xr.equirect.images[i].image,
-        (const ktx_uint8_t *)station_bytes, station_size, vk_device, queue,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-      if (!xr_equirect_release_swapchain(&xr.equirect))
-        xrg_log_e("Could not release equirect swapchain.");
-    }
+    load_static_layer(
+      "dresden_station_night_4k.ktx", xr.equirect.images,
+      xr.equirect.swapchain_length,
+      [this](uint32_t *index) {
+        return xr_equirect_acquire_swapchain(&xr.equirect, index);
+      },
+      [this]() { return xr_equirect_release_swapchain(&xr.equirect); },
+      &xr.equirect.ready);
   }
 
   bool
@@ -444,7 +819,7 @@ public:
       }
 
       // instantiate vulkan_device object
-      vk_device = vulkan_device_create(physical_device);
+      vk_device = vulkan_device_create(context.instance, physical_device);
 
       // create VkDevice
       create_vulkan_device();
@@ -452,8 +827,37 @@ public:
       get_vulkan_device_queue();
     }
 
+#ifdef XR_OS_ANDROID
+    if (!asset_pack_open(&assets, global_android_context.mgr))
+#else
+    if (!asset_pack_open(&assets, NULL))
+#endif
+      return false;
+
+    vulkan_submit_init(&submit, vk_device, queue,
+                       vk_device->graphics_family_index);
+    if (vk_device->transfer_family_index != vk_device->graphics_family_index) {
+      vulkan_submit_init(&transfer_submit, vk_device, transfer_queue,
+                         vk_device->transfer_family_index);
+      vulkan_submit_set_source(&submit, &transfer_submit);
+    }
+    vulkan_texture_loader_init(&loader, vk_device, &submit);
+
+    dynamic_rendering =
+      settings.dynamic_rendering && vk_device->dynamic_rendering;
+    if (settings.dynamic_rendering && !dynamic_rendering)
+      xrg_log_w("VK_KHR_dynamic_rendering not available, using render passes.");
+
+    xr.memory_stats = &vk_device->memory;
+
+    // Clamp before the swapchains are created, MSAA disables depth submission
+    settings.msaa_samples =
+      vulkan_device_get_sample_count(vk_device, settings.msaa_samples);
+    xrg_log_i("Using %d samples for the gears layer.", settings.msaa_samples);
+
     create_pipeline_cache();
     create_command_pool(0);
+    create_frame_fence();
 
     if (!xr_init_post_vk(&xr, context.instance, vk_device->physical_device,
                          vk_device->device, vk_device->graphics_family_index,
@@ -461,60 +865,101 @@ public:
       xrg_log_e("OpenXR initialization failed.");
       return false;
     }
+
+    init_render_passes();
+
+    /*
+     * Pipeline compilation only needs the render passes and the pipeline
+     * cache, so it runs on worker threads while the main thread creates the
+     * swapchains and framebuffers. The render passes depend on the
+     * swapchain formats, which the runtime only lists once the session
+     * exists. Textures keep loading after the first frames.
+     */
+    std::vector<std::thread> pipeline_workers;
+
+    if (settings.enable_gears) {
+      pipeline_gears *gears_pipeline = new pipeline_gears(
+        vk_device, &submit,
+        [this](const char *asset) { return get_sampled_texture(asset); },
+        settings.light_count);
+      gears_pipeline->gamma = (pipeline_gears::gamma_mode)settings.gamma;
+      gears = gears_pipeline;
+      pipeline_workers.emplace_back([this]() {
+        ((pipeline_gears *)gears)
+          ->init_pipeline(gears_render_pass, &gears_pass_info,
+                          pipeline_cache.cache);
+      });
+    }
+
+    if (xr.sky_type == SKY_TYPE_PROJECTION) {
+      pipeline_equirect *sky =
+        new pipeline_equirect(vk_device, &submit, &loader, &assets,
+                              settings.virtual_sky, settings.cube_sky);
+      pipeline_workers.emplace_back([this, sky]() {
+        sky->init_pipeline(sky_render_pass, &sky_pass_info,
+                           pipeline_cache.cache);
+      });
+      equirect = sky;
+    }
+
+    if (!xr_init_swapchains(&xr)) {
+      xrg_log_e("Could not create the OpenXR swapchains.");
+      for (auto &worker : pipeline_workers)
+        worker.join();
+      return false;
+    }
     xrg_log_i("Initialized OpenXR with %d views.", xr.view_count);
 
-    for (uint32_t i = 0; i < xr.view_count; i++) {
+    struct timespec setup_start;
+    clock_gettime(CLOCK_MONOTONIC, &setup_start);
 
-      if (settings.enable_gears) {
-        gears_draw_cmd = (VkCommandBuffer *)malloc(
-          sizeof(VkCommandBuffer) * xr.gears.swapchain_length[i]);
-        gears_buffers[i] = (vulkan_framebuffer **)malloc(
-          sizeof(vulkan_framebuffer *) * xr.gears.swapchain_length[i]);
-        for (uint32_t j = 0; j < xr.gears.swapchain_length[i]; j++) {
-          gears_buffers[i][j] = vulkan_framebuffer_create(vk_device->device);
-          vulkan_framebuffer_init(
-            gears_buffers[i][j], xr.gears.images[i][j].image,
-            (VkFormat)xr.swapchain_format, xr.gears.depth_images[i][j].image,
-            (VkFormat)xr.depth_swapchain_format,
-            xr.configuration_views[i].recommendedImageRectWidth,
-            xr.configuration_views[i].recommendedImageRectHeight);
+    if (settings.enable_gears) {
+      // Allocated when recording, which is deferred with dynamic rendering
+      gears_draw_cmd = (VkCommandBuffer *)calloc(xr.gears.swapchain_length[0],
+                                                 sizeof(VkCommandBuffer));
+      for (uint32_t i = 0; i < xr.view_count; i++) {
+        uint32_t width = xr.configuration_views[i].recommendedImageRectWidth;
+        uint32_t height = xr.configuration_views[i].recommendedImageRectHeight;
+
+        VkImage depth = VK_NULL_HANDLE;
+        if (gears_transient_depth) {
+          vulkan_attachment_init_transient(
+            &gears_depth[i], vk_device, gears_pass_info.depth_format,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+            gears_pass_info.samples, width, height);
+          depth = gears_depth[i].image;
         }
-      }
 
-      if (xr.sky_type == SKY_TYPE_PROJECTION) {
-        sky_draw_cmd = (VkCommandBuffer *)malloc(sizeof(VkCommandBuffer) *
-                                                 xr.sky.swapchain_length[i]);
-
-        sky_buffers[i] = (vulkan_framebuffer **)malloc(
-          sizeof(vulkan_framebuffer *) * xr.sky.swapchain_length[i]);
-        for (uint32_t j = 0; j < xr.sky.swapchain_length[i]; j++) {
-          sky_buffers[i][j] = vulkan_framebuffer_create(vk_device->device);
-          vulkan_framebuffer_init(
-            sky_buffers[i][j], xr.sky.images[i][j].image,
-            (VkFormat)xr.swapchain_format, xr.gears.depth_images[i][j].image,
-            (VkFormat)xr.depth_swapchain_format,
-            xr.configuration_views[i].recommendedImageRectWidth,
-            xr.configuration_views[i].recommendedImageRectHeight);
+        VkImage color = VK_NULL_HANDLE;
+        if (gears_msaa) {
+          vulkan_attachment_init_transient(
+            &gears_color[i], vk_device, gears_pass_info.color_format,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, gears_pass_info.samples,
+            width, height);
+          color = gears_color[i].image;
         }
-      }
-    }
 
-    if (settings.enable_gears) {
-      gears = new pipeline_gears(vk_device, gears_buffers[0][0]->render_pass,
-                                 pipeline_cache);
-      for (uint32_t i = 0; i < xr.gears.swapchain_length[0]; i++)
-        build_command_buffer(&gears_draw_cmd[i], gears_buffers, xr.view_count,
-                             i, gears);
+        init_targets(&gears_buffers[i], &gears_targets[i], gears_render_pass,
+                     &gears_pass_info, xr.gears.images[i],
+                     xr.gears.has_depth ? xr.gears.depth_images[i] : nullptr,
+                     color, depth, xr.gears.swapchain_length[i], i);
+      }
     }
 
     if (xr.sky_type == SKY_TYPE_PROJECTION) {
-      equirect = new pipeline_equirect(
-        vk_device, queue, sky_buffers[0][0]->render_pass, pipeline_cache);
-      for (uint32_t i = 0; i < xr.sky.swapchain_length[0]; i++)
-        build_command_buffer(&sky_draw_cmd[i], sky_buffers, xr.view_count, i,
-                             equirect);
+      sky_draw_cmd = (VkCommandBuffer *)calloc(xr.sky.swapchain_length[0],
+                                               sizeof(VkCommandBuffer));
+      for (uint32_t i = 0; i < xr.view_count; i++)
+        init_targets(&sky_buffers[i], &sky_targets[i], sky_render_pass,
+                     &sky_pass_info, xr.sky.images[i], nullptr,
+                     VK_NULL_HANDLE, VK_NULL_HANDLE,
+                     xr.sky.swapchain_length[i], i);
     }
 
+    xrg_log_d("Set up %s targets in %.2f ms.",
+              dynamic_rendering ? "dynamic rendering" : "framebuffer",
+              _ms_since(setup_start));
+
     if (settings.enable_quad) {
       init_quads();
     }
@@ -522,6 +967,34 @@ public:
     if (xr.sky_type == SKY_TYPE_EQUIRECT1 || xr.sky_type == SKY_TYPE_EQUIRECT2)
       init_equirect();
 
+    // The gears and the static layers requested theirs by now
+    load_shared_textures();
+
+    struct timespec join_start;
+    clock_gettime(CLOCK_MONOTONIC, &join_start);
+    for (auto &worker : pipeline_workers)
+      worker.join();
+    xrg_log_d("Waited %.2f ms for pipeline compilation.",
+              _ms_since(join_start));
+
+    // Persist the freshly built pipelines now, not only on clean shutdown.
+    vulkan_pipeline_cache_save(&pipeline_cache);
+
+    // Frames are submitted to the same queue, so they are ordered after it
+    vulkan_submit_flush(&submit);
+
+    if (settings.enable_gears && !dynamic_rendering)
+      for (uint32_t i = 0; i < xr.gears.swapchain_length[0]; i++)
+        build_command_buffer(&gears_draw_cmd[i], gears_buffers, xr.view_count,
+                             i, gears);
+
+    if (xr.sky_type == SKY_TYPE_PROJECTION && !dynamic_rendering)
+      for (uint32_t i = 0; i < xr.sky.swapchain_length[0]; i++)
+        build_command_buffer(&sky_draw_cmd[i], sky_buffers, xr.view_count, i,
+                             equirect);
+
+    vulkan_memory_report(&vk_device->memory);
+
     is_initialized = true;
 
     return true;
@@ -550,13 +1023,106 @@ public:
   }
 
   void
-  create_pipeline_cache()
+  init_render_passes()
   {
-    VkPipelineCacheCreateInfo info = {
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO
+    vulkan_render_pass_cache_init(&render_passes, vk_device->device);
+
+    // Depth only needs to reach memory when the compositor reads it
+    vulkan_attachment_policy gears_policy = {
+      .covers_target = false,
+      .depth_test = true,
+      .submits_depth = xr.gears.has_depth,
+      .samples = (VkSampleCountFlagBits)settings.msaa_samples,
+    };
+
+    gears_msaa = settings.enable_gears && settings.msaa_samples > 1;
+
+    gears_transient_depth = settings.enable_gears && !xr.gears.has_depth;
+    VkFormat depth_format = gears_transient_depth
+                              ? vulkan_device_get_depth_format(vk_device)
+                              : (VkFormat)xr.depth_swapchain_format;
+
+    gears_pass_info = vulkan_render_pass_info_from_policy(
+      &gears_policy, (VkFormat)xr.swapchain_format, depth_format);
+
+    // The sky is a full screen triangle behind everything else
+    vulkan_attachment_policy sky_policy = {
+      .covers_target = true,
+      .depth_test = false,
+      .submits_depth = false,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
     };
-    vk_check(vkCreatePipelineCache(vk_device->device, &info, nullptr,
-                                   &pipeline_cache));
+
+    sky_pass_info = vulkan_render_pass_info_from_policy(
+      &sky_policy, (VkFormat)xr.swapchain_format, VK_FORMAT_UNDEFINED);
+
+    if (dynamic_rendering)
+      return;
+
+    gears_render_pass =
+      vulkan_render_pass_cache_get(&render_passes, &gears_pass_info);
+    sky_render_pass =
+      vulkan_render_pass_cache_get(&render_passes, &sky_pass_info);
+  }
+
+  /*
+   * Framebuffers are created up front for the render pass path, dynamic
+   * rendering targets only store the images until first use. Depth comes
+   * from the depth swapchain when there is one, otherwise depth is shared by
+   * all images of the view. With shared multisampled color the swapchain
+   * images become resolve targets.
+   */
+  void
+  init_targets(vulkan_framebuffer ***buffers,
+               vulkan_render_target **targets,
+               VkRenderPass render_pass,
+               const vulkan_render_pass_info *info,
+               XrSwapchainImageVulkanKHR *images,
+               XrSwapchainImageVulkanKHR *depth_images,
+               VkImage shared_color,
+               VkImage shared_depth,
+               uint32_t count,
+               uint32_t view)
+  {
+    uint32_t width = xr.configuration_views[view].recommendedImageRectWidth;
+    uint32_t height = xr.configuration_views[view].recommendedImageRectHeight;
+
+    *buffers = nullptr;
+    *targets = nullptr;
+
+    if (dynamic_rendering)
+      *targets = (vulkan_render_target *)malloc(sizeof(vulkan_render_target) *
+                                                count);
+    else
+      *buffers =
+        (vulkan_framebuffer **)malloc(sizeof(vulkan_framebuffer *) * count);
+
+    for (uint32_t j = 0; j < count; j++) {
+      VkImage depth = depth_images ? depth_images[j].image : shared_depth;
+      VkImage color = shared_color ? shared_color : images[j].image;
+      VkImage resolve = shared_color ? images[j].image : VK_NULL_HANDLE;
+
+      if (dynamic_rendering) {
+        vulkan_render_target_init(&(*targets)[j], vk_device, color, resolve,
+                                  info->color_format, depth,
+                                  info->depth_format, width, height);
+      } else {
+        (*buffers)[j] = vulkan_framebuffer_create(vk_device->device);
+        vulkan_framebuffer_init((*buffers)[j], render_pass, color, resolve,
+                                info->color_format, depth, info->depth_format,
+                                width, height);
+      }
+    }
+  }
+
+  void
+  create_pipeline_cache()
+  {
+    const char *cache_dir = nullptr;
+#ifdef XR_OS_ANDROID
+    cache_dir = app->activity->internalDataPath;
+#endif
+    vulkan_pipeline_cache_init(&pipeline_cache, vk_device, cache_dir);
   }
 
   void
@@ -570,7 +1136,8 @@ public:
   void
   create_vulkan_device()
   {
-    VkResult res = vulkan_device_create_device(vk_device);
+    VkResult res =
+      vulkan_device_create_device(vk_device, settings.dynamic_rendering);
     xrg_log_f_if(res != VK_SUCCESS, "Could not create Vulkan device: %s",
                  vk_result_to_string(res));
   }
@@ -581,6 +1148,10 @@ public:
     // Get a graphics queue from the device
     vkGetDeviceQueue(vk_device->device, vk_device->graphics_family_index, 0,
                      &queue);
+
+    if (vk_device->transfer_family_index != vk_device->graphics_family_index)
+      vkGetDeviceQueue(vk_device->device, vk_device->transfer_family_index, 0,
+                       &transfer_queue);
   }
 
   void
@@ -596,6 +1167,19 @@ public:
                                  &cmd_pool));
   }
 
+  // Signaled, the first frame has nothing to wait for
+  void
+  create_frame_fence()
+  {
+    VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    };
+
+    vk_check(
+      vkCreateFence(vk_device->device, &fence_info, nullptr, &frame_fence));
+  }
+
   void
   update_timer()
   {
@@ -618,7 +1202,7 @@ public:
   void
   render()
   {
-    vkDeviceWaitIdle(vk_device->device);
+    wait_frame();
     draw();
     update_timer();
   }
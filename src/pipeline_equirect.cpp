@@ -13,24 +13,25 @@
 #include "log.h"
 #include "vulkan_shader.h"
 
+#include "sky_plane_cube.frag.h"
 #include "sky_plane_equirect.frag.h"
 #include "sky_plane_equirect.vert.h"
-
-#include "textures.h"
+#include "sky_plane_virtual.frag.h"
 
 #include <array>
 #include <vector>
 
 pipeline_equirect::pipeline_equirect(vulkan_device *vulkan_device,
-                                     VkQueue queue,
-                                     VkRenderPass render_pass,
-                                     VkPipelineCache pipeline_cache)
+                                     vulkan_submit *submit,
+                                     vulkan_texture_loader *loader,
+                                     asset_pack *assets,
+                                     bool virtual_sky,
+                                     bool cube_sky)
 {
   this->device = vulkan_device->device;
-  init_texture(vulkan_device, queue);
+  init_texture(vulkan_device, submit, loader, assets, virtual_sky, cube_sky);
   init_uniform_buffers(vulkan_device);
   init_descriptor_set_layouts();
-  init_pipeline(render_pass, pipeline_cache);
   init_descriptor_pool();
   for (uint32_t i = 0; i < 2; i++)
     init_descriptor_sets(i);
@@ -44,25 +45,146 @@ pipeline_equirect::~pipeline_equirect()
   vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
   for (uint32_t i = 0; i < 2; i++)
     vulkan_buffer_destroy(&uniform_buffers.views[i]);
+  if (use_virtual_texture) {
+    vulkan_virtual_texture_destroy(&virtual_texture);
+    return;
+  }
+  if (use_cubemap)
+    vulkan_cubemap_destroy(&cubemap);
   vulkan_texture_destroy(&texture);
+  if (!texture_usable && texture_request.loaded)
+    vulkan_texture_destroy(&texture_request.texture);
 }
 
 void
-pipeline_equirect::init_texture(vulkan_device *vk_device, VkQueue queue)
+pipeline_equirect::init_texture(vulkan_device *vk_device,
+                                vulkan_submit *submit,
+                                vulkan_texture_loader *loader,
+                                asset_pack *assets,
+                                bool virtual_sky,
+                                bool cube_sky)
+{
+  // Only packs with baked textures contain the cube map
+  const char *cube_name = "dresden_station_night_cube.ktx";
+  baked_cube =
+    cube_sky && !virtual_sky && asset_pack_contains(assets, cube_name);
+
+  texture_request.name =
+    baked_cube ? cube_name : "dresden_station_night_4k.ktx";
+  texture_request.bytes =
+    asset_pack_get(assets, texture_request.name, &texture_request.size);
+
+  if (virtual_sky) {
+    use_virtual_texture = vulkan_virtual_texture_init(
+      &this->virtual_texture, texture_request.bytes, texture_request.size,
+      vk_device, submit, VK_FORMAT_R8G8B8A8_SRGB);
+    if (use_virtual_texture)
+      return;
+    xrg_log_w("Loading the sky texture as a whole.");
+  }
+
+  VkClearColorValue black = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+  if (baked_cube) {
+    vulkan_texture_init_solid_cube(&texture, vk_device, submit, black);
+  } else {
+    vulkan_texture_init_solid(&texture, vk_device, submit, black);
+    use_cubemap = cube_sky;
+    if (use_cubemap)
+      vulkan_cubemap_init(&cubemap, vk_device, submit);
+  }
+
+  texture_request.format = VK_FORMAT_R8G8B8A8_SRGB;
+  texture_request.dest_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  texture_request.generate_mipmaps = true;
+  vulkan_texture_loader_load_ktx(loader, &texture_request);
+}
+
+bool
+pipeline_equirect::update_texture(vulkan_submit *submit,
+                                  vulkan_texture_loader *loader)
 {
-  size_t station_size;
-#ifdef XR_OS_ANDROID
-  const char *station_bytes = android_get_asset(
-    &global_android_context, "dresden_station_night_4k.ktx", &station_size);
-#else
-  const char *station_bytes =
-    gio_get_asset("/textures/dresden_station_night_4k.ktx", &station_size);
-#endif
-
-  vulkan_texture_load_ktx(&texture, (const ktx_uint8_t *) station_bytes,
-                          station_size, vk_device, queue,
-                          VK_FORMAT_R8G8B8A8_SRGB,
-                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  if (use_virtual_texture) {
+    vulkan_virtual_texture_update(&virtual_texture);
+    return false;
+  }
+
+  if (texture_usable) {
+    if (!vulkan_texture_update_lod(&texture, submit))
+      return false;
+  } else {
+    if (texture_failed)
+      return false;
+    if (vulkan_texture_loader_has_failed(loader, &texture_request)) {
+      texture_failed = true;
+      return false;
+    }
+    if (!vulkan_texture_loader_is_usable(loader, &texture_request))
+      return false;
+
+    // Frames using the placeholder were submitted before the release
+    vulkan_texture_release(&texture, submit);
+    texture = texture_request.texture;
+    texture_usable = true;
+    vulkan_texture_update_lod(&texture, submit);
+  }
+
+  if (use_cubemap) {
+    vulkan_cubemap_convert(&cubemap, &texture, submit);
+    // Frames are submitted to the same queue after the conversion
+    vulkan_submit_flush(submit);
+  }
+
+  for (uint32_t i = 0; i < 2; i++)
+    write_texture_descriptor(i);
+
+  return true;
+}
+
+bool
+pipeline_equirect::get_reflection(VkDescriptorImageInfo *descriptor)
+{
+  if (use_cubemap)
+    *descriptor = vulkan_cubemap_get_descriptor(&cubemap);
+  else if (baked_cube)
+    *descriptor = vulkan_texture_get_descriptor(&texture);
+  else
+    return false;
+  return true;
+}
+
+void
+pipeline_equirect::stop_streaming()
+{
+  if (use_virtual_texture)
+    vulkan_virtual_texture_stop(&virtual_texture);
+}
+
+void
+pipeline_equirect::request_tiles(uint32_t eye, uint32_t width, uint32_t height)
+{
+  if (use_virtual_texture)
+    vulkan_virtual_texture_request_view(&virtual_texture,
+                                        &ubo_views[eye].vp[0][0], width,
+                                        height);
+}
+
+void
+pipeline_equirect::write_texture_descriptor(uint32_t eye)
+{
+  VkDescriptorImageInfo descriptor =
+    use_cubemap ? vulkan_cubemap_get_descriptor(&cubemap)
+                : vulkan_texture_get_descriptor(&texture);
+
+  VkWriteDescriptorSet write = {
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = descriptor_sets[eye],
+    .dstBinding = 1,
+    .descriptorCount = 1,
+    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+    .pImageInfo = &descriptor,
+  };
+
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
 }
 
 void
@@ -84,7 +206,8 @@ pipeline_equirect::init_descriptor_pool()
 {
   std::vector<VkDescriptorPoolSize> poolSizes = {
     { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 3 },
-    { .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = 3 }
+    { .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = 3 },
+    { .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 2 }
   };
 
   VkDescriptorPoolCreateInfo descriptorPoolInfo = {
@@ -114,6 +237,14 @@ pipeline_equirect::init_descriptor_set_layouts()
       .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT },
   };
 
+  // Binding 2 : Virtual texture page table
+  if (use_virtual_texture)
+    setLayoutBindings.push_back(
+      { .binding = 2,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT });
+
   VkDescriptorSetLayoutCreateInfo descriptorLayout = {
     .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
     .bindingCount = static_cast<uint32_t>(setLayoutBindings.size()),
@@ -142,7 +273,13 @@ pipeline_equirect::init_descriptor_sets(uint32_t eye)
   };
   vk_check(vkAllocateDescriptorSets(device, &allocInfo, &descriptor_sets[eye]));
 
-  VkDescriptorImageInfo descriptor = vulkan_texture_get_descriptor(&texture);
+  VkDescriptorImageInfo descriptor;
+  if (use_virtual_texture)
+    descriptor = vulkan_virtual_texture_get_descriptor(&virtual_texture);
+  else if (use_cubemap)
+    descriptor = vulkan_cubemap_get_descriptor(&cubemap);
+  else
+    descriptor = vulkan_texture_get_descriptor(&texture);
 
   std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
     // Binding 0 : Vertex shader ubo
@@ -163,6 +300,17 @@ pipeline_equirect::init_descriptor_sets(uint32_t eye)
                             .pImageInfo = &descriptor },
   };
 
+  if (use_virtual_texture)
+    writeDescriptorSets.push_back(
+      (VkWriteDescriptorSet){ .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                              .dstSet = descriptor_sets[eye],
+                              .dstBinding = 2,
+                              .descriptorCount = 1,
+                              .descriptorType =
+                                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                              .pBufferInfo =
+                                &virtual_texture.page_table.descriptor });
+
   vkUpdateDescriptorSets(device,
                          static_cast<uint32_t>(writeDescriptorSets.size()),
                          writeDescriptorSets.data(), 0, nullptr);
@@ -170,8 +318,12 @@ pipeline_equirect::init_descriptor_sets(uint32_t eye)
 
 void
 pipeline_equirect::init_pipeline(VkRenderPass render_pass,
+                                 const vulkan_render_pass_info *target,
                                  VkPipelineCache pipeline_cache)
 {
+  if (use_cubemap)
+    vulkan_cubemap_init_pipeline(&cubemap, pipeline_cache);
+
   VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
     .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
@@ -199,7 +351,7 @@ pipeline_equirect::init_pipeline(VkRenderPass render_pass,
 
   VkPipelineDepthStencilStateCreateInfo depthStencilState = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-    .depthTestEnable = VK_TRUE,
+    .depthTestEnable = target->depth_format != VK_FORMAT_UNDEFINED,
     .depthWriteEnable = VK_FALSE,
     .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
     .front = { .compareOp = VK_COMPARE_OP_ALWAYS },
@@ -214,7 +366,7 @@ pipeline_equirect::init_pipeline(VkRenderPass render_pass,
 
   VkPipelineMultisampleStateCreateInfo multisampleState = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+    .rasterizationSamples = target->samples
   };
 
   std::vector<VkDynamicState> dynamicStateEnables = {
@@ -232,17 +384,33 @@ pipeline_equirect::init_pipeline(VkRenderPass render_pass,
     .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
   };
 
+  VkPipelineShaderStageCreateInfo fragmentStage;
+  if (use_virtual_texture)
+    fragmentStage = vulkan_shader_load(device, sky_plane_virtual_frag,
+                                       sizeof(sky_plane_virtual_frag),
+                                       VK_SHADER_STAGE_FRAGMENT_BIT);
+  else if (use_cubemap || baked_cube)
+    fragmentStage = vulkan_shader_load(device, sky_plane_cube_frag,
+                                       sizeof(sky_plane_cube_frag),
+                                       VK_SHADER_STAGE_FRAGMENT_BIT);
+  else
+    fragmentStage = vulkan_shader_load(device, sky_plane_equirect_frag,
+                                       sizeof(sky_plane_equirect_frag),
+                                       VK_SHADER_STAGE_FRAGMENT_BIT);
+
   std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {
     vulkan_shader_load(device, sky_plane_equirect_vert,
                        sizeof(sky_plane_equirect_vert),
                        VK_SHADER_STAGE_VERTEX_BIT),
-    vulkan_shader_load(device, sky_plane_equirect_frag,
-                       sizeof(sky_plane_equirect_frag),
-                       VK_SHADER_STAGE_FRAGMENT_BIT)
+    fragmentStage
   };
 
+  VkPipelineRenderingCreateInfoKHR renderingInfo =
+    vulkan_render_pass_info_get_rendering_info(target);
+
   VkGraphicsPipelineCreateInfo pipelineCreateInfo = {
     .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+    .pNext = render_pass == VK_NULL_HANDLE ? &renderingInfo : nullptr,
     .stageCount = static_cast<uint32_t>(shaderStages.size()),
     .pStages = shaderStages.data(),
     .pVertexInputState = &vertexInputState,
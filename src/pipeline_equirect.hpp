@@ -13,8 +13,13 @@
 #include "glm_inc.hpp"
 
 
+#include "asset_pack.h"
 #include "vulkan_texture.h"
+#include "vulkan_texture_loader.h"
+#include "vulkan_virtual_texture.h"
+#include "vulkan_cubemap.h"
 #include "vulkan_framebuffer.h"
+#include "vulkan_render_pass.h"
 
 #include "vulkan_pipeline.hpp"
 
@@ -23,7 +28,22 @@ class pipeline_equirect : public vulkan_pipeline
 public:
   VkDescriptorSet descriptor_sets[2];
 
+  // A 1x1 placeholder until the smallest level of the loaded one is usable
   vulkan_texture texture;
+  vulkan_texture_request texture_request = {};
+  bool texture_usable = false;
+  // Keeps the placeholder
+  bool texture_failed = false;
+
+  // Streams the panorama in tiles instead, when it supports it
+  vulkan_virtual_texture virtual_texture;
+  bool use_virtual_texture = false;
+
+  // Drawn from a cube map resampled from texture, see vulkan_cubemap
+  vulkan_cubemap cubemap;
+  bool use_cubemap = false;
+  // Or loaded as a cube map baked by xrgears-bake, needing no conversion
+  bool baked_cube = false;
 
   struct
   {
@@ -36,14 +56,48 @@ public:
   } ubo_views[2];
 
   pipeline_equirect(vulkan_device *vulkan_device,
-                    VkQueue queue,
-                    VkRenderPass render_pass,
-                    VkPipelineCache pipeline_cache);
+                    vulkan_submit *submit,
+                    vulkan_texture_loader *loader,
+                    asset_pack *assets,
+                    bool virtual_sky,
+                    bool cube_sky);
 
+  // The loader needs to be destroyed first
   ~pipeline_equirect();
 
   void
-  init_texture(vulkan_device *vk_device, VkQueue queue);
+  init_texture(vulkan_device *vk_device,
+               vulkan_submit *submit,
+               vulkan_texture_loader *loader,
+               asset_pack *assets,
+               bool virtual_sky,
+               bool cube_sky);
+
+  /*
+   * Swaps the placeholder for the loaded texture once its smallest level is
+   * usable and then sharpens it as finer levels land, while no frame is in
+   * flight. Returns true if the texture changed, command buffers drawing the
+   * sky need to be recorded again then. Virtual textures stream the tiles
+   * requested in the last frame instead. The cube map is converted again
+   * whenever the texture sharpened.
+   */
+  bool
+  update_texture(vulkan_submit *submit, vulkan_texture_loader *loader);
+
+  // Returns false unless the sky is drawn from a cube map
+  bool
+  get_reflection(VkDescriptorImageInfo *descriptor);
+
+  // Ends the work recorded on submit from other threads, before it is destroyed
+  void
+  stop_streaming();
+
+  // Asks for the tiles seen with the last update_vp, of a view in pixels
+  void
+  request_tiles(uint32_t eye, uint32_t width, uint32_t height);
+
+  void
+  write_texture_descriptor(uint32_t eye);
 
   void
   init_descriptor_pool();
@@ -54,8 +108,14 @@ public:
   void
   init_descriptor_sets(uint32_t eye);
 
+  /*
+   * Compiles the pipeline, can run on a worker thread. Builds for dynamic
+   * rendering into target when render_pass is VK_NULL_HANDLE.
+   */
   void
-  init_pipeline(VkRenderPass render_pass, VkPipelineCache pipeline_cache);
+  init_pipeline(VkRenderPass render_pass,
+                const vulkan_render_pass_info *target,
+                VkPipelineCache pipeline_cache);
 
   void
   init_uniform_buffers(vulkan_device *vk_device);
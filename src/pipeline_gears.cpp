@@ -8,7 +8,11 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
+#include <random>
+#include <thread>
 
 #include "pipeline_gears.hpp"
 
@@ -60,51 +64,124 @@ public:
 
 
 pipeline_gears::pipeline_gears(vulkan_device* vk_device,
-                               VkRenderPass render_pass,
-                               VkPipelineCache pipeline_cache)
+                               vulkan_submit* submit,
+                               const texture_source& get_texture,
+                               uint32_t extra_light_count)
 {
   this->device = vk_device->device;
 
-  init_gears(vk_device);
+  init_gears(vk_device, submit);
+  init_lights(vk_device, extra_light_count);
   init_uniform_buffers(vk_device);
-  init_descriptor_pool();
-  init_descriptor_set_layout();
-  init_pipeline(render_pass, pipeline_cache);
+  vulkan_texture_init_solid_cube(&reflection_placeholder, vk_device, submit,
+                                 (VkClearColorValue){ { 0, 0, 0, 0 } });
+  vulkan_texture_init_solid(&texture_placeholder, vk_device, submit,
+                            (VkClearColorValue){ { 1, 1, 1, 1 } });
+  init_descriptor_set_layout(vk_device);
   for (uint32_t i = 0; i < 2; i++) {
     vulkan_device_create_and_map(vk_device, &uniform_buffers.camera[i],
                                  sizeof(ubo_camera[i]));
     init_descriptor_sets(i, &uniform_buffers.camera[i].descriptor);
   }
+  init_textures(vk_device, get_texture);
 }
 
 pipeline_gears::~pipeline_gears()
 {
   vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
-  vkDestroyDescriptorSetLayout(device, descriptor_set_layout, nullptr);
 
   vulkan_buffer_destroy(&uniform_buffers.lights);
+  vulkan_buffer_destroy(&uniform_buffers.objects);
+  vulkan_buffer_destroy(&uniform_buffers.materials);
+  delete clusters;
   for (uint32_t i = 0; i < 2; i++)
     vulkan_buffer_destroy(&uniform_buffers.camera[i]);
 
   for (auto& node : nodes)
     delete (node);
 
-  vkDestroyPipeline(device, pipeline, nullptr);
+  // pipeline is the default entry of the variant cache
+  for (auto& it : variants)
+    vkDestroyPipeline(device, it.second, nullptr);
 
-  vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+  vulkan_texture_destroy(&reflection_placeholder);
+  vulkan_texture_destroy(&texture_placeholder);
+
+  vulkan_bindless_destroy(&bindless);
 }
 
 void
 pipeline_gears::draw(VkCommandBuffer command_buffer, uint32_t eye)
 {
-  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  // Bound once, the variants share the pipeline layout
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipeline_layout, 0, 1, &bindless.sets[eye], 0, NULL);
+
+  VkPipeline bound = VK_NULL_HANDLE;
+  for (uint32_t i = 0; i < nodes.size(); i++) {
+    VkPipeline p = get_pipeline(get_variant(nodes[i]->info.material));
+    if (p != bound) {
+      vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, p);
+      bound = p;
+    }
+    nodes[i]->draw(command_buffer, i);
+  }
+}
 
-  for (auto& node : nodes)
-    node->draw(command_buffer, pipeline_layout, eye);
+pipeline_gears::variant
+pipeline_gears::get_variant(const Material& material)
+{
+  return {
+    .max_lights = clusters->max_lights,
+    .metallic_only = material.params.metallic >= 1.0f,
+    .gamma = (uint32_t)gamma,
+    .reflection = has_reflection && material.params.metallic > 0.0f,
+    .texture_capacity = bindless.texture_capacity,
+    .texture_indexing =
+      bindless.device->features.shaderSampledImageArrayDynamicIndexing,
+  };
+}
+
+VkPipeline
+pipeline_gears::get_pipeline(const variant& v)
+{
+  auto it = variants.find(v);
+  if (it != variants.end())
+    return it->second;
+
+  xrg_log_d("Creating gears pipeline variant: max_lights %u metallic_only %u "
+            "gamma %u reflection %u textures %u indexing %u",
+            v.max_lights, v.metallic_only, v.gamma, v.reflection,
+            v.texture_capacity, v.texture_indexing);
+
+  VkPipeline p = create_pipeline(v);
+  variants[v] = p;
+  return p;
+}
+
+/*
+ * Command buffers bind the reflection variants when they are recorded, so
+ * they need to be recorded again after this.
+ */
+void
+pipeline_gears::set_reflection(VkDescriptorImageInfo* descriptor)
+{
+  for (uint32_t i = 0; i < bindless.set_count; i++) {
+    VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = bindless.sets[i],
+      .dstBinding = 3,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = descriptor
+    };
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+  has_reflection = true;
 }
 
 void
-pipeline_gears::init_gears(vulkan_device* vk_device)
+pipeline_gears::init_gears(vulkan_device* vk_device, vulkan_submit* submit)
 {
   // Gear definitions
   std::vector<float> inner_radiuses = { 1.0f, 0.5f, 1.3f };
@@ -116,10 +193,11 @@ pipeline_gears::init_gears(vulkan_device* vk_device)
                                        glm::vec3(3.1, 0.0, -20.0),
                                        glm::vec3(-3.1, -6.2, -20.0) };
 
-  std::vector<Material> materials = {
+  std::vector<Material> gear_materials = {
     Material("Red", glm::vec3(1.0f, 0.0f, 0.0f), 0.3f, 0.7f),
     Material("Green", glm::vec3(0.0f, 1.0f, 0.2f), 0.3f, 0.7f),
-    Material("Blue", glm::vec3(0.0f, 0.0f, 1.0f), 0.3f, 0.7f)
+    // Fully metallic, drawn with the METALLIC_ONLY variant
+    Material("Blue", glm::vec3(0.0f, 0.0f, 1.0f), 0.3f, 1.0f)
   };
 
   std::vector<float> rotation_speeds = { 1.0f, -2.0f, -2.0f };
@@ -137,77 +215,143 @@ pipeline_gears::init_gears(vulkan_device* vk_device)
     Gear::NodeInfo gear_node_info = { .position = positions[i],
                                       .rotation_speed = rotation_speeds[i],
                                       .rotation_offset = rotation_offsets[i],
-                                      .material = materials[i] };
+                                      .material = gear_materials[i] };
 
     nodes[i] = new Gear();
     nodes[i]->setInfo(&gear_node_info);
-    ((Gear*)nodes[i])->generate(vk_device, &gear_info);
+    nodes[i]->material_index = add_material(gear_materials[i]);
+    ((Gear*)nodes[i])->generate(vk_device, submit, &gear_info);
   }
 }
 
+uint32_t
+pipeline_gears::add_material(const Material& material)
+{
+  for (uint32_t i = 0; i < materials.size(); i++)
+    if (materials[i].name == material.name)
+      return i;
+
+  materials.push_back(material);
+  return (uint32_t)materials.size() - 1;
+}
+
 void
-pipeline_gears::init_descriptor_pool()
+pipeline_gears::init_textures(vulkan_device* vk_device,
+                              const texture_source& get_texture)
 {
-  // Example uses two ubos
-  std::vector<VkDescriptorPoolSize> pool_sizes = {
-    { .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 34 },
-    { .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = 6 }
-  };
+  // vulkan_bindless_add_texture would reject them
+  if (!vk_device->features.shaderSampledImageArrayDynamicIndexing) {
+    xrg_log_w("Gears stay untextured without sampled image array indexing.");
+    return;
+  }
 
-  VkDescriptorPoolCreateInfo descriptor_pool_info = {
-    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-    .maxSets = 12,
-    .poolSizeCount = static_cast<uint32_t>(pool_sizes.size()),
-    .pPoolSizes = pool_sizes.data()
-  };
-  vk_check(vkCreateDescriptorPool(device, &descriptor_pool_info, nullptr,
-                                  &descriptor_pool));
+  // The green and the blue gear, the red one shows the untextured path
+  textures[0].request = get_texture("hawk.ktx");
+  textures[0].material = nodes[1]->material_index;
+  textures[1].request = get_texture("cat.ktx");
+  textures[1].material = nodes[2]->material_index;
+}
+
+bool
+pipeline_gears::update_textures(vulkan_submit* submit,
+                                vulkan_texture_loader* loader)
+{
+  Material::Params* params =
+    (Material::Params*)uniform_buffers.materials.mapped;
+
+  bool changed = false;
+  for (auto& t : textures) {
+    if (t.failed || t.request == nullptr)
+      continue;
+
+    if (t.index != VULKAN_BINDLESS_NO_TEXTURE) {
+      if (!vulkan_texture_update_lod(&t.request->texture, submit))
+        continue;
+      VkDescriptorImageInfo descriptor =
+        vulkan_texture_get_descriptor(&t.request->texture);
+      vulkan_bindless_set_texture(&bindless, t.index, &descriptor);
+      changed = true;
+      continue;
+    }
+
+    if (vulkan_texture_loader_has_failed(loader, t.request)) {
+      t.failed = true;
+      continue;
+    }
+    if (!vulkan_texture_loader_is_usable(loader, t.request))
+      continue;
+
+    vulkan_texture_update_lod(&t.request->texture, submit);
+    VkDescriptorImageInfo descriptor =
+      vulkan_texture_get_descriptor(&t.request->texture);
+    t.index = vulkan_bindless_add_texture(&bindless, &descriptor);
+    if (t.index == VULKAN_BINDLESS_NO_TEXTURE) {
+      t.failed = true;
+      continue;
+    }
+    materials[t.material].params.texture = t.index;
+    params[t.material].texture = t.index;
+    changed = true;
+  }
+
+  // Partially bound arrays can be updated while command buffers use them
+  return changed && !bindless.device->descriptor_indexing;
 }
 
 void
-pipeline_gears::init_descriptor_set_layout()
+pipeline_gears::init_descriptor_set_layout(vulkan_device* vk_device)
 {
   std::vector<VkDescriptorSetLayoutBinding> set_layout_bindings = {
-    // ubo model
+    // ssbo objects
     { .binding = 0,
-      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
       .descriptorCount = 1,
       .stageFlags = VK_SHADER_STAGE_VERTEX_BIT },
-    // ubo lights
+    // ssbo lights
     { .binding = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
       .descriptorCount = 1,
       .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT },
     // ubo camera
     { .binding = 2,
       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
       .descriptorCount = 1,
-      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT }
-  };
-
-  VkDescriptorSetLayoutCreateInfo descriptor_layout = {
-    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-    .bindingCount = static_cast<uint32_t>(set_layout_bindings.size()),
-    .pBindings = set_layout_bindings.data()
+      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT },
+    // reflection cube map
+    { .binding = 3,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT },
+    // ssbo light cluster grid
+    { .binding = 4,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT },
+    // ssbo light cluster indices
+    { .binding = 5,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT },
+    // ssbo materials
+    { .binding = 6,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT }
+    // binding 7 is the texture array added by vulkan_bindless
   };
 
-  vk_check(vkCreateDescriptorSetLayout(device, &descriptor_layout, nullptr,
-                                       &descriptor_set_layout));
-  /*
-   * Push Constants
-   */
-  std::vector<VkPushConstantRange> push_constant_ranges = {
-    { .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-      .offset = sizeof(glm::vec3),
-      .size = sizeof(Material::PushBlock) }
-  };
+  VkDescriptorImageInfo placeholder =
+    vulkan_texture_get_descriptor(&texture_placeholder);
+  vulkan_bindless_init(&bindless, vk_device, set_layout_bindings.data(),
+                       (uint32_t)set_layout_bindings.size(), 2, &placeholder);
+  descriptor_pool = bindless.pool;
+  descriptor_set_layout = bindless.layout;
 
+  // Object and material come from the instance index, no push constants
   VkPipelineLayoutCreateInfo pipeline_layout_info = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
     .setLayoutCount = 1,
     .pSetLayouts = &descriptor_set_layout,
-    .pushConstantRangeCount = (uint32_t)push_constant_ranges.size(),
-    .pPushConstantRanges = push_constant_ranges.data()
   };
   vk_check(vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr,
                                   &pipeline_layout));
@@ -217,15 +361,101 @@ void
 pipeline_gears::init_descriptor_sets(uint32_t eye,
                                      VkDescriptorBufferInfo* camera_descriptor)
 {
-  for (auto& node : nodes)
-    node->create_descriptor_set(device, descriptor_pool, descriptor_set_layout,
-                                &uniform_buffers.lights.descriptor,
-                                camera_descriptor, eye);
+  VkDescriptorImageInfo reflection =
+    vulkan_texture_get_descriptor(&reflection_placeholder);
+
+  VkDescriptorSet set = bindless.sets[eye];
+  std::vector<VkWriteDescriptorSet> write_descriptor_sets = {
+    (VkWriteDescriptorSet){
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &uniform_buffers.objects.descriptor },
+    (VkWriteDescriptorSet){
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 1,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &uniform_buffers.lights.descriptor },
+    (VkWriteDescriptorSet){
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 2,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      .pBufferInfo = camera_descriptor },
+    (VkWriteDescriptorSet){
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 3,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &reflection },
+    (VkWriteDescriptorSet){
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 4,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &clusters->grid_buffers[eye].descriptor },
+    (VkWriteDescriptorSet){
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 5,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &clusters->index_buffers[eye].descriptor },
+    (VkWriteDescriptorSet){
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 6,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &uniform_buffers.materials.descriptor }
+  };
+
+  vkUpdateDescriptorSets(device, (uint32_t)write_descriptor_sets.size(),
+                         write_descriptor_sets.data(), 0, nullptr);
 }
 
 void
 pipeline_gears::init_pipeline(VkRenderPass render_pass,
+                              const vulkan_render_pass_info* target,
                               VkPipelineCache pipeline_cache)
+{
+  this->render_pass = render_pass;
+  this->target = *target;
+  this->pipeline_cache = pipeline_cache;
+
+  // Compile the variants of the scene materials up front, in parallel
+  std::vector<variant> keys;
+  for (auto& node : nodes) {
+    variant v = get_variant(node->info.material);
+    if (std::find_if(keys.begin(), keys.end(), [&v](const variant& k) {
+          return !(k < v) && !(v < k);
+        }) == keys.end())
+      keys.push_back(v);
+  }
+
+  std::vector<VkPipeline> built(keys.size());
+  std::vector<std::thread> workers;
+  for (uint32_t i = 0; i < keys.size(); i++)
+    workers.emplace_back(
+      [this, &keys, &built, i]() { built[i] = create_pipeline(keys[i]); });
+  for (auto& worker : workers)
+    worker.join();
+
+  for (uint32_t i = 0; i < keys.size(); i++)
+    variants[keys[i]] = built[i];
+
+  pipeline = get_pipeline(get_variant(nodes[0]->info.material));
+}
+
+VkPipeline
+pipeline_gears::create_pipeline(const variant& v)
 {
   VkPipelineInputAssemblyStateCreateInfo input_assembly_state = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
@@ -269,7 +499,7 @@ pipeline_gears::init_pipeline(VkRenderPass render_pass,
 
   VkPipelineMultisampleStateCreateInfo multisample_state = {
     .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+    .rasterizationSamples = target.samples
   };
 
   std::vector<VkDynamicState> dynamic_state_enables = {
@@ -289,6 +519,35 @@ pipeline_gears::init_pipeline(VkRenderPass render_pass,
                        VK_SHADER_STAGE_FRAGMENT_BIT)
   };
 
+  std::array<VkSpecializationMapEntry, 6> specialization_entries = {
+    (VkSpecializationMapEntry){ .constantID = 0,
+                                .offset = offsetof(variant, max_lights),
+                                .size = sizeof(uint32_t) },
+    (VkSpecializationMapEntry){ .constantID = 1,
+                                .offset = offsetof(variant, metallic_only),
+                                .size = sizeof(VkBool32) },
+    (VkSpecializationMapEntry){ .constantID = 2,
+                                .offset = offsetof(variant, gamma),
+                                .size = sizeof(uint32_t) },
+    (VkSpecializationMapEntry){ .constantID = 3,
+                                .offset = offsetof(variant, reflection),
+                                .size = sizeof(VkBool32) },
+    (VkSpecializationMapEntry){ .constantID = 4,
+                                .offset = offsetof(variant, texture_capacity),
+                                .size = sizeof(uint32_t) },
+    (VkSpecializationMapEntry){ .constantID = 5,
+                                .offset = offsetof(variant, texture_indexing),
+                                .size = sizeof(VkBool32) }
+  };
+
+  VkSpecializationInfo specialization_info = {
+    .mapEntryCount = static_cast<uint32_t>(specialization_entries.size()),
+    .pMapEntries = specialization_entries.data(),
+    .dataSize = sizeof(variant),
+    .pData = &v
+  };
+  shader_stages[1].pSpecializationInfo = &specialization_info;
+
   // Vertex layout for the models
   VertexLayout vertex_layout =
     VertexLayout({ VERTEX_COMPONENT_POSITION, VERTEX_COMPONENT_NORMAL });
@@ -342,35 +601,74 @@ pipeline_gears::init_pipeline(VkRenderPass render_pass,
     .layout = pipeline_layout,
   };
 
+  VkPipelineRenderingCreateInfoKHR rendering_info =
+    vulkan_render_pass_info_get_rendering_info(&target);
 
   // only needs to be compatible
-  pipeline_info.renderPass = render_pass;
+  if (render_pass != VK_NULL_HANDLE)
+    pipeline_info.renderPass = render_pass;
+  else
+    pipeline_info.pNext = &rendering_info;
 
+  VkPipeline p;
   vk_check(vkCreateGraphicsPipelines(device, pipeline_cache, 1, &pipeline_info,
-                                     nullptr, &pipeline));
+                                     nullptr, &p));
 
   vkDestroyShaderModule(device, shader_stages[0].module, nullptr);
   vkDestroyShaderModule(device, shader_stages[1].module, nullptr);
+
+  return p;
 }
 
 void
-pipeline_gears::update_lights()
+pipeline_gears::init_lights(vulkan_device* vk_device,
+                            uint32_t extra_light_count)
 {
-  ubo_lights.lights[0] = glm::vec4(-5, -10, 15, 1.0f);
-  ubo_lights.lights[1] = glm::vec4(5, -10, 10, 1.0f);
-  ubo_lights.lights[2] = glm::vec4(0, 5, 15, 1.0f);
-  ubo_lights.lights[3] = glm::vec4(-10, -20, 15, 1.0f);
+  // Key lights, large radius so they reach the whole scene
+  lights = {
+    { glm::vec4(-5, -10, 15, 100.0f), glm::vec4(1.0f) },
+    { glm::vec4(5, -10, 10, 100.0f), glm::vec4(1.0f) },
+    { glm::vec4(0, 5, 15, 100.0f), glm::vec4(1.0f) },
+    { glm::vec4(-10, -20, 15, 100.0f), glm::vec4(1.0f) },
+  };
+
+  // Small colored lights scattered around the gears, fixed seed
+  std::mt19937 rng(1337);
+  std::uniform_real_distribution<float> x(-12.0f, 12.0f);
+  std::uniform_real_distribution<float> y(-14.0f, 8.0f);
+  std::uniform_real_distribution<float> z(-26.0f, -14.0f);
+  std::uniform_real_distribution<float> radius(2.0f, 6.0f);
+  std::uniform_real_distribution<float> hue(0.0f, 1.0f);
+
+  for (uint32_t i = 0; i < extra_light_count; i++) {
+    // Fully saturated color from hue
+    glm::vec3 color = glm::clamp(
+      glm::abs(glm::mod(hue(rng) * 6.0f + glm::vec3(0, 4, 2), 6.0f) - 3.0f) -
+        1.0f,
+      0.0f, 1.0f);
+    lights.push_back({ glm::vec4(x(rng), y(rng), z(rng), radius(rng)),
+                       glm::vec4(color, 0.5f) });
+  }
+
+  xrg_log_i("Gears scene has %zu point lights.", lights.size());
+
+  vk_check(vulkan_device_create_buffer(
+    vk_device, &uniform_buffers.lights, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    sizeof(point_light) * lights.size(), lights.data()));
 
-  memcpy(uniform_buffers.lights.mapped, &ubo_lights, sizeof(ubo_lights));
+  // The loop bound of gears.frag, no larger than needed
+  clusters = new light_clusters(
+    vk_device,
+    std::min((uint32_t)lights.size(), (uint32_t)LIGHT_CLUSTERS_MAX_LIGHTS));
 }
 
 void
 pipeline_gears::update_time(float animation_timer)
 {
-  for (Gear* node : nodes)
-    node->update_uniform_buffer(animation_timer);
-
-  update_lights();
+  ObjectData* objects = (ObjectData*)uniform_buffers.objects.mapped;
+  for (uint32_t i = 0; i < nodes.size(); i++)
+    nodes[i]->update_object(animation_timer, &objects[i]);
 }
 
 void
@@ -383,15 +681,30 @@ pipeline_gears::update_vp(glm::mat4 projection,
   ubo_camera[eye].position = position;
   memcpy(uniform_buffers.camera[eye].mapped, &ubo_camera[eye],
          sizeof(ubo_camera[eye]));
+
+  clusters->update(eye, lights, projection, view);
 }
 
 
 void
 pipeline_gears::init_uniform_buffers(vulkan_device* vk_device)
 {
-  vulkan_device_create_and_map(vk_device, &uniform_buffers.lights,
-                               sizeof(ubo_lights));
-
-  for (auto& node : nodes)
-    node->init_uniform_buffer(vk_device);
+  VkMemoryPropertyFlags memory_flags =
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  // Written every frame, one entry per gear
+  vk_check(vulkan_device_create_buffer(
+    vk_device, &uniform_buffers.objects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    memory_flags, sizeof(ObjectData) * nodes.size(), NULL));
+  vk_check(vulkan_buffer_map(&uniform_buffers.objects));
+
+  std::vector<Material::Params> params;
+  for (auto& material : materials)
+    params.push_back(material.params);
+
+  vk_check(vulkan_device_create_buffer(
+    vk_device, &uniform_buffers.materials, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    memory_flags, sizeof(Material::Params) * params.size(), params.data()));
+  // Texture indices are written once the textures are resident
+  vk_check(vulkan_buffer_map(&uniform_buffers.materials));
 }
@@ -10,21 +10,77 @@
 
 #pragma once
 
+#include <array>
+#include <functional>
+#include <map>
+#include <tuple>
+
 #include <vulkan/vulkan.h>
 
 #include "gear.hpp"
+#include "light_clusters.hpp"
+#include "vulkan_bindless.h"
+#include "vulkan_render_pass.h"
+#include "vulkan_texture.h"
+#include "vulkan_texture_loader.h"
 
 #include "vulkan_pipeline.hpp"
 
 class pipeline_gears : public vulkan_pipeline
 {
 public:
-  std::vector<Gear *> nodes;
+  enum gamma_mode
+  {
+    GAMMA_NONE = 0,
+    GAMMA_LEGACY = 1,
+    GAMMA_SRGB = 2
+  };
 
-  struct UBOLights
+  // Specialization constants of gears.frag, in constant_id order.
+  struct variant
   {
-    glm::vec4 lights[4];
-  } ubo_lights;
+    uint32_t max_lights;
+    VkBool32 metallic_only;
+    uint32_t gamma;
+    VkBool32 reflection;
+    uint32_t texture_capacity;
+    VkBool32 texture_indexing;
+
+    bool
+    operator<(const variant &other) const
+    {
+      return std::tie(max_lights, metallic_only, gamma, reflection,
+                      texture_capacity, texture_indexing) <
+             std::tie(other.max_lights, other.metallic_only, other.gamma,
+                      other.reflection, other.texture_capacity,
+                      other.texture_indexing);
+    }
+  };
+
+  // Streamed in the background, added to the texture array once usable
+  struct material_texture
+  {
+    uint32_t material;
+    vulkan_texture_request *request = nullptr;
+    uint32_t index = VULKAN_BINDLESS_NO_TEXTURE;
+    bool failed = false;
+  };
+
+  std::vector<Gear *> nodes;
+  std::vector<Material> materials;
+
+  std::map<variant, VkPipeline> variants;
+  gamma_mode gamma = GAMMA_LEGACY;
+  bool has_reflection = false;
+  vulkan_texture reflection_placeholder;
+
+  // One set per eye, shared by all gears
+  vulkan_bindless bindless;
+  vulkan_texture texture_placeholder;
+  std::array<material_texture, 2> textures;
+
+  std::vector<point_light> lights;
+  light_clusters *clusters;
 
   struct
   {
@@ -36,33 +92,72 @@ public:
   {
     vulkan_buffer lights;
     vulkan_buffer camera[2];
+    vulkan_buffer objects;
+    vulkan_buffer materials;
   } uniform_buffers;
 
+  /*
+   * Returns the request of a texture asset shared with other users, which
+   * owns and loads it. Its texture needs to outlive the gears.
+   */
+  typedef std::function<vulkan_texture_request *(const char *asset)>
+    texture_source;
+
   pipeline_gears(vulkan_device *vulkan_device,
-                 VkRenderPass render_pass,
-                 VkPipelineCache pipeline_cache);
+                 vulkan_submit *submit,
+                 const texture_source &get_texture,
+                 uint32_t extra_light_count);
+
   ~pipeline_gears();
 
   void
   draw(VkCommandBuffer command_buffer, uint32_t eye);
 
   void
-  init_gears(vulkan_device *vk_device);
+  init_gears(vulkan_device *vk_device, vulkan_submit *submit);
+
+  uint32_t
+  add_material(const Material &material);
 
   void
-  init_descriptor_pool();
+  init_textures(vulkan_device *vk_device, const texture_source &get_texture);
+
+  /*
+   * Adds textures that became usable to the texture array and points their
+   * materials at them, then rewrites their slots as finer levels land. Call
+   * while no frame is in flight. Returns true if command buffers drawing
+   * the gears need to be recorded again.
+   */
+  bool
+  update_textures(vulkan_submit *submit, vulkan_texture_loader *loader);
 
   void
-  init_descriptor_set_layout();
+  init_descriptor_set_layout(vulkan_device *vk_device);
 
   void
   init_descriptor_sets(uint32_t eye, VkDescriptorBufferInfo *camera_descriptor);
 
+  /*
+   * Compiles the pipelines, not done in the constructor so it can run on a
+   * worker thread. Without render pass the pipelines are built for dynamic
+   * rendering into the attachments described by target.
+   */
   void
-  init_pipeline(VkRenderPass render_pass, VkPipelineCache pipeline_cache);
+  init_pipeline(VkRenderPass render_pass,
+                const vulkan_render_pass_info *target,
+                VkPipelineCache pipeline_cache);
+
+  variant
+  get_variant(const Material &material);
+
+  VkPipeline
+  get_pipeline(const variant &v);
 
   void
-  update_lights();
+  set_reflection(VkDescriptorImageInfo *descriptor);
+
+  void
+  init_lights(vulkan_device *vk_device, uint32_t extra_light_count);
 
   void
   update_time(float animation_timer);
@@ -75,4 +170,12 @@ public:
 
   void
   init_uniform_buffers(vulkan_device *vk_device);
+
+private:
+  VkRenderPass render_pass;
+  vulkan_render_pass_info target;
+  VkPipelineCache pipeline_cache;
+
+  VkPipeline
+  create_pipeline(const variant &v);
 };
@@ -26,6 +26,9 @@ _init(xrg_settings *self)
   self->enable_gears = true;
   self->enable_quad = true;
   self->enable_sky = true;
+  self->light_count = 256;
+  self->msaa_samples = 1;
+  self->gamma = 1;
 }
 
 static const char *
@@ -41,11 +44,20 @@ _help_string()
          "  -q         Disable quad layers\n"
          "  -g         Disable gears layer\n"
          "  -o         Enable overlay support\n"
+         "  -l COUNT   Extra point lights in the gears layer (default: 256)\n"
+         "  -r         Render with VK_KHR_dynamic_rendering instead of "
+         "render passes\n"
+         "  -m SAMPLES MSAA samples for the gears layer (default: 1)\n"
+         "  -t         Stream the sky panorama in tiles as a virtual texture\n"
+         "  -c         Draw the sky from a cube map, baked or converted at load "
+         "time\n"
+         "  -G GAMMA   Gamma of the gears layer: none, legacy or srgb "
+         "(default: legacy)\n"
          "  -h         Show this help\n";
 }
 
-static int
-_parse_id(const char *str)
+int
+settings_parse_id(const char *str)
 {
   if (isdigit(str[0]) == 0) {
     xrg_log_e("%s is not a valid number", str);
@@ -54,11 +66,23 @@ _parse_id(const char *str)
   return atoi(str);
 }
 
+// Names in pipeline_gears::gamma_mode order
+static int
+_parse_gamma(const char *str)
+{
+  static const char *names[] = { "none", "legacy", "srgb" };
+  for (int i = 0; i < 3; i++)
+    if (strcmp(str, names[i]) == 0)
+      return i;
+  xrg_log_e("%s is not a gamma mode", str);
+  return 1;
+}
+
 bool
 settings_parse_args(xrg_settings *self, int argc, char *argv[])
 {
   _init(self);
-  static const char *optstring = "h1d:sqgo";
+  static const char *optstring = "h1d:sqgol:rm:tcG:";
 
   int opt;
   while ((opt = getopt(argc, argv, optstring)) != -1) {
@@ -69,7 +93,7 @@ settings_parse_args(xrg_settings *self, int argc, char *argv[])
       printf("%s\n", _help_string());
       exit(0);
     } else if (opt == 'd') {
-      self->gpu = _parse_id(optarg);
+      self->gpu = settings_parse_id(optarg);
     } else if (opt == '1') {
       self->vulkan_enable2 = false;
     } else if (opt == 's') {
@@ -80,6 +104,18 @@ settings_parse_args(xrg_settings *self, int argc, char *argv[])
       self->enable_gears = false;
     } else if (opt == 'o') {
       self->enable_overlay = true;
+    } else if (opt == 'l') {
+      self->light_count = settings_parse_id(optarg);
+    } else if (opt == 'r') {
+      self->dynamic_rendering = true;
+    } else if (opt == 'm') {
+      self->msaa_samples = settings_parse_id(optarg);
+    } else if (opt == 't') {
+      self->virtual_sky = true;
+    } else if (opt == 'c') {
+      self->cube_sky = true;
+    } else if (opt == 'G') {
+      self->gamma = _parse_gamma(optarg);
     } else {
       xrg_log_f("Unknown option %c", opt);
     }
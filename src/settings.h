@@ -23,11 +23,22 @@ typedef struct
   bool enable_quad;
   bool enable_gears;
   bool enable_overlay;
+  int light_count;
+  bool dynamic_rendering;
+  int msaa_samples;
+  bool virtual_sky;
+  bool cube_sky;
+  // pipeline_gears::gamma_mode
+  int gamma;
 } xrg_settings;
 
 bool
 settings_parse_args(xrg_settings *self, int argc, char *argv[]);
 
+// Logs an error and returns 0 if str does not start with a digit
+int
+settings_parse_id(const char *str);
+
 #ifdef __cplusplus
 }
 #endif
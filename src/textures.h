@@ -14,11 +14,7 @@ extern "C" {
 #endif
 
 
-#ifndef XR_OS_ANDROID
-#include <gio/gio.h>
-const char*
-gio_get_asset(const gchar* path, gsize* size);
-#else
+#ifdef XR_OS_ANDROID
 #include <jni.h>
 #include <android/asset_manager.h>
 
@@ -36,10 +32,6 @@ android_context_init(android_context* context,
                      JavaVM* vm,
                      JNIEnv* env,
                      jobject activity);
-char*
-android_get_asset(android_context* context,
-                  const char* file_name,
-                  size_t* length);
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,75 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_attachment.h"
+
+#include "log.h"
+
+void
+vulkan_attachment_init_transient(vulkan_attachment *self,
+                                 vulkan_device *device,
+                                 VkFormat format,
+                                 VkImageUsageFlags usage,
+                                 VkSampleCountFlagBits samples,
+                                 uint32_t width,
+                                 uint32_t height)
+{
+  self->device = device;
+  self->format = format;
+
+  VkImageCreateInfo image_info = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = format,
+    .extent = { .width = width, .height = height, .depth = 1 },
+    .mipLevels = 1,
+    .arrayLayers = 1,
+    .samples = samples,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+  vk_check(vkCreateImage(device->device, &image_info, NULL, &self->image));
+
+  VkMemoryRequirements mem_reqs;
+  vkGetImageMemoryRequirements(device->device, self->image, &mem_reqs);
+
+  VkMemoryAllocateInfo mem_info = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = mem_reqs.size,
+  };
+
+  self->lazily_allocated = vulkan_device_get_memory_type(
+    device, mem_reqs.memoryTypeBits,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+      VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+    &mem_info.memoryTypeIndex);
+
+  if (!self->lazily_allocated &&
+      !vulkan_device_get_memory_type(device, mem_reqs.memoryTypeBits,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                     &mem_info.memoryTypeIndex))
+    xrg_log_e("Could not find memory type.");
+
+  vk_check(vulkan_device_allocate_memory(device, VULKAN_MEMORY_ATTACHMENT,
+                                         &mem_info, &self->memory));
+  vk_check(vkBindImageMemory(device->device, self->image, self->memory, 0));
+
+  xrg_log_d("Created %dx%d transient attachment (format %d, %d samples, %s).",
+            width, height, format, samples,
+            self->lazily_allocated ? "lazily allocated" : "device local");
+}
+
+void
+vulkan_attachment_destroy(vulkan_attachment *self)
+{
+  vkDestroyImage(self->device->device, self->image, NULL);
+  vulkan_device_free_memory(self->device, self->memory);
+}
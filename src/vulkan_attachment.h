@@ -0,0 +1,51 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An attachment owned by the application instead of the runtime, for
+ * contents that never leave the render pass. Transient images are backed by
+ * lazily allocated memory where the device has it, so tilers can keep them
+ * in tile memory only.
+ */
+typedef struct
+{
+  vulkan_device *device;
+
+  VkImage image;
+  VkDeviceMemory memory;
+  VkFormat format;
+
+  bool lazily_allocated;
+} vulkan_attachment;
+
+void
+vulkan_attachment_init_transient(vulkan_attachment *self,
+                                 vulkan_device *device,
+                                 VkFormat format,
+                                 VkImageUsageFlags usage,
+                                 VkSampleCountFlagBits samples,
+                                 uint32_t width,
+                                 uint32_t height);
+
+void
+vulkan_attachment_destroy(vulkan_attachment *self);
+
+#ifdef __cplusplus
+}
+#endif
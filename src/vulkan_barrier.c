@@ -0,0 +1,263 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_barrier.h"
+
+#include "log.h"
+
+/*
+ * Only writes need to be made available, reads are ordered by the
+ * execution dependency alone.
+ */
+#define WRITE_ACCESS                                                           \
+  (VK_ACCESS_2_HOST_WRITE_BIT_KHR | VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR |       \
+   VK_ACCESS_2_SHADER_WRITE_BIT_KHR |                                          \
+   VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR |                                \
+   VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR)
+
+typedef struct
+{
+  VkPipelineStageFlags2KHR stages;
+  VkAccessFlags2KHR access;
+} _scope;
+
+/*
+ * How this renderer uses images in each layout. Bits are kept to the ones
+ * shared with the legacy flags, so the fallback can use them as they are.
+ */
+static _scope
+_get_scope(VkImageLayout layout)
+{
+  switch (layout) {
+  case VK_IMAGE_LAYOUT_UNDEFINED: return (_scope){ 0, 0 };
+  case VK_IMAGE_LAYOUT_PREINITIALIZED:
+    return (_scope){ VK_PIPELINE_STAGE_2_HOST_BIT_KHR,
+                     VK_ACCESS_2_HOST_WRITE_BIT_KHR };
+  case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+    return (_scope){ VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+                     VK_ACCESS_2_TRANSFER_READ_BIT_KHR };
+  case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+    return (_scope){ VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+                     VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR };
+  // Textures are only sampled in fragment shaders
+  case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+    return (_scope){ VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+                     VK_ACCESS_2_SHADER_READ_BIT_KHR };
+  // Storage images are only written in compute shaders
+  case VK_IMAGE_LAYOUT_GENERAL:
+    return (_scope){ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+                     VK_ACCESS_2_SHADER_READ_BIT_KHR |
+                       VK_ACCESS_2_SHADER_WRITE_BIT_KHR };
+  case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+    return (_scope){ VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+                     VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR |
+                       VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR };
+  case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+    return (_scope){ VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR |
+                       VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR,
+                     VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR |
+                       VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR };
+  default: xrg_log_e("Unhandled barrier scope for layout %d.", layout);
+  }
+  return (_scope){ VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+                   VK_ACCESS_2_MEMORY_READ_BIT_KHR |
+                     VK_ACCESS_2_MEMORY_WRITE_BIT_KHR };
+}
+
+void
+vulkan_barrier_batch_init(vulkan_barrier_batch *self,
+                          vulkan_device *device,
+                          VkCommandBuffer cmd_buffer)
+{
+  self->device = device;
+  self->cmd_buffer = cmd_buffer;
+  self->image_count = 0;
+  self->buffer_count = 0;
+}
+
+static void
+_add(vulkan_barrier_batch *self,
+     VkImage image,
+     VkImageSubresourceRange range,
+     VkImageLayout old_layout,
+     VkImageLayout new_layout,
+     _scope src,
+     _scope dst,
+     uint32_t src_family,
+     uint32_t dst_family)
+{
+  if (self->image_count == VULKAN_BARRIER_MAX_IMAGES)
+    vulkan_barrier_batch_flush(self);
+
+  self->images[self->image_count++] = (VkImageMemoryBarrier2KHR){
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR,
+    .srcStageMask = src.stages,
+    .srcAccessMask = src.access & WRITE_ACCESS,
+    .dstStageMask = dst.stages,
+    .dstAccessMask = dst.access,
+    .oldLayout = old_layout,
+    .newLayout = new_layout,
+    .srcQueueFamilyIndex = src_family,
+    .dstQueueFamilyIndex = dst_family,
+    .image = image,
+    .subresourceRange = range,
+  };
+}
+
+void
+vulkan_barrier_batch_add_image(vulkan_barrier_batch *self,
+                               VkImage image,
+                               VkImageSubresourceRange range,
+                               VkImageLayout old_layout,
+                               VkImageLayout new_layout)
+{
+  _add(self, image, range, old_layout, new_layout, _get_scope(old_layout),
+       _get_scope(new_layout), VK_QUEUE_FAMILY_IGNORED,
+       VK_QUEUE_FAMILY_IGNORED);
+}
+
+void
+vulkan_barrier_batch_discard_image(vulkan_barrier_batch *self,
+                                   VkImage image,
+                                   VkImageSubresourceRange range,
+                                   VkImageLayout previous_layout,
+                                   VkImageLayout new_layout)
+{
+  _add(self, image, range, VK_IMAGE_LAYOUT_UNDEFINED, new_layout,
+       _get_scope(previous_layout), _get_scope(new_layout),
+       VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
+}
+
+void
+vulkan_barrier_batch_release_image(vulkan_barrier_batch *self,
+                                   VkImage image,
+                                   VkImageSubresourceRange range,
+                                   VkImageLayout old_layout,
+                                   VkImageLayout new_layout,
+                                   uint32_t src_family,
+                                   uint32_t dst_family)
+{
+  _add(self, image, range, old_layout, new_layout, _get_scope(old_layout),
+       (_scope){ 0, 0 }, src_family, dst_family);
+}
+
+void
+vulkan_barrier_batch_acquire_image(vulkan_barrier_batch *self,
+                                   VkImage image,
+                                   VkImageSubresourceRange range,
+                                   VkImageLayout old_layout,
+                                   VkImageLayout new_layout,
+                                   uint32_t src_family,
+                                   uint32_t dst_family)
+{
+  _add(self, image, range, old_layout, new_layout, (_scope){ 0, 0 },
+       _get_scope(new_layout), src_family, dst_family);
+}
+
+void
+vulkan_barrier_batch_add_buffer(vulkan_barrier_batch *self,
+                                VkBuffer buffer,
+                                VkPipelineStageFlags2KHR src_stages,
+                                VkAccessFlags2KHR src_access,
+                                VkPipelineStageFlags2KHR dst_stages,
+                                VkAccessFlags2KHR dst_access,
+                                uint32_t src_family,
+                                uint32_t dst_family)
+{
+  if (self->buffer_count == VULKAN_BARRIER_MAX_BUFFERS)
+    vulkan_barrier_batch_flush(self);
+
+  self->buffers[self->buffer_count++] = (VkBufferMemoryBarrier2KHR){
+    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR,
+    .srcStageMask = src_stages,
+    .srcAccessMask = src_access & WRITE_ACCESS,
+    .dstStageMask = dst_stages,
+    .dstAccessMask = dst_access,
+    .srcQueueFamilyIndex = src_family,
+    .dstQueueFamilyIndex = dst_family,
+    .buffer = buffer,
+    .offset = 0,
+    .size = VK_WHOLE_SIZE,
+  };
+}
+
+static void
+_flush_legacy(vulkan_barrier_batch *self)
+{
+  VkImageMemoryBarrier barriers[VULKAN_BARRIER_MAX_IMAGES];
+  VkBufferMemoryBarrier buffer_barriers[VULKAN_BARRIER_MAX_BUFFERS];
+  VkPipelineStageFlags src_stages = 0;
+  VkPipelineStageFlags dst_stages = 0;
+
+  for (uint32_t i = 0; i < self->image_count; i++) {
+    const VkImageMemoryBarrier2KHR *b = &self->images[i];
+    barriers[i] = (VkImageMemoryBarrier){
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = (VkAccessFlags)b->srcAccessMask,
+      .dstAccessMask = (VkAccessFlags)b->dstAccessMask,
+      .oldLayout = b->oldLayout,
+      .newLayout = b->newLayout,
+      .srcQueueFamilyIndex = b->srcQueueFamilyIndex,
+      .dstQueueFamilyIndex = b->dstQueueFamilyIndex,
+      .image = b->image,
+      .subresourceRange = b->subresourceRange,
+    };
+    src_stages |= (VkPipelineStageFlags)b->srcStageMask;
+    dst_stages |= (VkPipelineStageFlags)b->dstStageMask;
+  }
+
+  for (uint32_t i = 0; i < self->buffer_count; i++) {
+    const VkBufferMemoryBarrier2KHR *b = &self->buffers[i];
+    buffer_barriers[i] = (VkBufferMemoryBarrier){
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      .srcAccessMask = (VkAccessFlags)b->srcAccessMask,
+      .dstAccessMask = (VkAccessFlags)b->dstAccessMask,
+      .srcQueueFamilyIndex = b->srcQueueFamilyIndex,
+      .dstQueueFamilyIndex = b->dstQueueFamilyIndex,
+      .buffer = b->buffer,
+      .offset = b->offset,
+      .size = b->size,
+    };
+    src_stages |= (VkPipelineStageFlags)b->srcStageMask;
+    dst_stages |= (VkPipelineStageFlags)b->dstStageMask;
+  }
+
+  // Empty stage masks are not allowed without synchronization2
+  if (!src_stages)
+    src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  if (!dst_stages)
+    dst_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+  vkCmdPipelineBarrier(self->cmd_buffer, src_stages, dst_stages, 0, 0, NULL,
+                       self->buffer_count, buffer_barriers, self->image_count,
+                       barriers);
+}
+
+void
+vulkan_barrier_batch_flush(vulkan_barrier_batch *self)
+{
+  if (self->image_count == 0 && self->buffer_count == 0)
+    return;
+
+  if (self->device->synchronization2) {
+    VkDependencyInfoKHR info = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
+      .bufferMemoryBarrierCount = self->buffer_count,
+      .pBufferMemoryBarriers = self->buffers,
+      .imageMemoryBarrierCount = self->image_count,
+      .pImageMemoryBarriers = self->images,
+    };
+    self->device->cmd_pipeline_barrier2(self->cmd_buffer, &info);
+  } else {
+    _flush_legacy(self);
+  }
+
+  self->image_count = 0;
+  self->buffer_count = 0;
+}
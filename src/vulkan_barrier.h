@@ -0,0 +1,113 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VULKAN_BARRIER_MAX_IMAGES 8
+#define VULKAN_BARRIER_MAX_BUFFERS 4
+
+/*
+ * Collects image layout transitions and records them with one barrier.
+ * Stages and accesses are derived from the layouts, so each transition only
+ * waits for the work that last used the image and only blocks the stages
+ * that use it next.
+ *
+ * Recorded with vkCmdPipelineBarrier2KHR when VK_KHR_synchronization2 is
+ * enabled, otherwise the per image scopes are merged into one legacy
+ * vkCmdPipelineBarrier.
+ */
+typedef struct
+{
+  vulkan_device *device;
+  VkCommandBuffer cmd_buffer;
+
+  VkImageMemoryBarrier2KHR images[VULKAN_BARRIER_MAX_IMAGES];
+  uint32_t image_count;
+
+  VkBufferMemoryBarrier2KHR buffers[VULKAN_BARRIER_MAX_BUFFERS];
+  uint32_t buffer_count;
+} vulkan_barrier_batch;
+
+void
+vulkan_barrier_batch_init(vulkan_barrier_batch *self,
+                          vulkan_device *device,
+                          VkCommandBuffer cmd_buffer);
+
+// Keeps the contents, waits for the last use in old_layout
+void
+vulkan_barrier_batch_add_image(vulkan_barrier_batch *self,
+                               VkImage image,
+                               VkImageSubresourceRange range,
+                               VkImageLayout old_layout,
+                               VkImageLayout new_layout);
+
+/*
+ * Discards the contents, but still waits for the last use in
+ * previous_layout, e.g. attachments reused every frame.
+ */
+void
+vulkan_barrier_batch_discard_image(vulkan_barrier_batch *self,
+                                   VkImage image,
+                                   VkImageSubresourceRange range,
+                                   VkImageLayout previous_layout,
+                                   VkImageLayout new_layout);
+
+/*
+ * Queue family ownership transfer of an image. The same transition is
+ * recorded as release on the source queue and as acquire on the destination
+ * queue, which needs to wait for the release with a semaphore.
+ */
+void
+vulkan_barrier_batch_release_image(vulkan_barrier_batch *self,
+                                   VkImage image,
+                                   VkImageSubresourceRange range,
+                                   VkImageLayout old_layout,
+                                   VkImageLayout new_layout,
+                                   uint32_t src_family,
+                                   uint32_t dst_family);
+
+void
+vulkan_barrier_batch_acquire_image(vulkan_barrier_batch *self,
+                                   VkImage image,
+                                   VkImageSubresourceRange range,
+                                   VkImageLayout old_layout,
+                                   VkImageLayout new_layout,
+                                   uint32_t src_family,
+                                   uint32_t dst_family);
+
+/*
+ * Buffers have no layout to derive the scopes from. Families can be
+ * VK_QUEUE_FAMILY_IGNORED, otherwise the release leaves the destination
+ * scope empty and the acquire the source scope.
+ */
+void
+vulkan_barrier_batch_add_buffer(vulkan_barrier_batch *self,
+                                VkBuffer buffer,
+                                VkPipelineStageFlags2KHR src_stages,
+                                VkAccessFlags2KHR src_access,
+                                VkPipelineStageFlags2KHR dst_stages,
+                                VkAccessFlags2KHR dst_access,
+                                uint32_t src_family,
+                                uint32_t dst_family);
+
+// Records the collected barriers, the batch can be reused afterwards
+void
+vulkan_barrier_batch_flush(vulkan_barrier_batch *self);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,250 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_bindless.h"
+
+#include "log.h"
+
+// One pool size per descriptor type used by the caller, plus the textures
+#define MAX_POOL_SIZES 8
+
+static void
+_add_pool_size(VkDescriptorPoolSize *sizes,
+               uint32_t *size_count,
+               VkDescriptorType type,
+               uint32_t count)
+{
+  for (uint32_t i = 0; i < *size_count; i++) {
+    if (sizes[i].type == type) {
+      sizes[i].descriptorCount += count;
+      return;
+    }
+  }
+
+  xrg_log_f_if(*size_count == MAX_POOL_SIZES, "Too many descriptor types.");
+  sizes[(*size_count)++] = (VkDescriptorPoolSize){
+    .type = type,
+    .descriptorCount = count,
+  };
+}
+
+static void
+_create_pool(vulkan_bindless *self,
+             const VkDescriptorSetLayoutBinding *bindings,
+             uint32_t binding_count)
+{
+  VkDescriptorPoolSize sizes[MAX_POOL_SIZES];
+  uint32_t size_count = 0;
+
+  for (uint32_t i = 0; i < binding_count; i++)
+    _add_pool_size(sizes, &size_count, bindings[i].descriptorType,
+                   bindings[i].descriptorCount * self->set_count);
+  _add_pool_size(sizes, &size_count, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                 self->texture_capacity * self->set_count);
+
+  VkDescriptorPoolCreateInfo pool_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .maxSets = self->set_count,
+    .poolSizeCount = size_count,
+    .pPoolSizes = sizes,
+  };
+
+  if (self->device->descriptor_indexing)
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+
+  vk_check(
+    vkCreateDescriptorPool(self->device->device, &pool_info, NULL, &self->pool));
+}
+
+static void
+_create_layout(vulkan_bindless *self,
+               const VkDescriptorSetLayoutBinding *bindings,
+               uint32_t binding_count)
+{
+  uint32_t count = binding_count + 1;
+  VkDescriptorSetLayoutBinding *all =
+    malloc(sizeof(VkDescriptorSetLayoutBinding) * count);
+  VkDescriptorBindingFlagsEXT *flags =
+    calloc(count, sizeof(VkDescriptorBindingFlagsEXT));
+
+  self->texture_binding = 0;
+  for (uint32_t i = 0; i < binding_count; i++) {
+    all[i] = bindings[i];
+    if (bindings[i].binding >= self->texture_binding)
+      self->texture_binding = bindings[i].binding + 1;
+  }
+
+  // Variable descriptor counts are only allowed on the highest binding
+  all[binding_count] = (VkDescriptorSetLayoutBinding){
+    .binding = self->texture_binding,
+    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+    .descriptorCount = self->texture_capacity,
+    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+  };
+  flags[binding_count] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+                         VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+                         VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flags_info = {
+    .sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+    .bindingCount = count,
+    .pBindingFlags = flags,
+  };
+
+  VkDescriptorSetLayoutCreateInfo layout_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = count,
+    .pBindings = all,
+  };
+
+  if (self->device->descriptor_indexing) {
+    layout_info.pNext = &flags_info;
+    layout_info.flags =
+      VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+  }
+
+  vk_check(vkCreateDescriptorSetLayout(self->device->device, &layout_info,
+                                       NULL, &self->layout));
+
+  free(all);
+  free(flags);
+}
+
+static void
+_allocate_sets(vulkan_bindless *self)
+{
+  VkDescriptorSetLayout layouts[VULKAN_BINDLESS_MAX_SETS];
+  uint32_t counts[VULKAN_BINDLESS_MAX_SETS];
+  for (uint32_t i = 0; i < self->set_count; i++) {
+    layouts[i] = self->layout;
+    counts[i] = self->texture_capacity;
+  }
+
+  VkDescriptorSetVariableDescriptorCountAllocateInfoEXT count_info = {
+    .sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT,
+    .descriptorSetCount = self->set_count,
+    .pDescriptorCounts = counts,
+  };
+
+  VkDescriptorSetAllocateInfo alloc_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    .pNext = self->device->descriptor_indexing ? &count_info : NULL,
+    .descriptorPool = self->pool,
+    .descriptorSetCount = self->set_count,
+    .pSetLayouts = layouts,
+  };
+
+  vk_check(
+    vkAllocateDescriptorSets(self->device->device, &alloc_info, self->sets));
+}
+
+// Every element of a fixed array counts as used by dynamic indexing
+static void
+_fill_placeholder(vulkan_bindless *self,
+                  const VkDescriptorImageInfo *placeholder)
+{
+  VkDescriptorImageInfo *infos =
+    malloc(sizeof(VkDescriptorImageInfo) * self->texture_capacity);
+  for (uint32_t i = 0; i < self->texture_capacity; i++)
+    infos[i] = *placeholder;
+
+  for (uint32_t i = 0; i < self->set_count; i++) {
+    VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = self->sets[i],
+      .dstBinding = self->texture_binding,
+      .dstArrayElement = 0,
+      .descriptorCount = self->texture_capacity,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = infos,
+    };
+    vkUpdateDescriptorSets(self->device->device, 1, &write, 0, NULL);
+  }
+
+  free(infos);
+}
+
+void
+vulkan_bindless_init(vulkan_bindless *self,
+                     vulkan_device *device,
+                     const VkDescriptorSetLayoutBinding *bindings,
+                     uint32_t binding_count,
+                     uint32_t set_count,
+                     const VkDescriptorImageInfo *placeholder)
+{
+  xrg_log_f_if(set_count > VULKAN_BINDLESS_MAX_SETS,
+               "Too many bindless descriptor sets.");
+
+  self->device = device;
+  self->set_count = set_count;
+  self->texture_count = 0;
+  self->texture_capacity = device->descriptor_indexing
+                             ? VULKAN_BINDLESS_MAX_TEXTURES
+                             : VULKAN_BINDLESS_FALLBACK_TEXTURES;
+
+  _create_pool(self, bindings, binding_count);
+  _create_layout(self, bindings, binding_count);
+  _allocate_sets(self);
+
+  if (!device->descriptor_indexing)
+    _fill_placeholder(self, placeholder);
+
+  xrg_log_d("Bindless sets have room for %d textures (%s).",
+            self->texture_capacity,
+            device->descriptor_indexing ? "descriptor indexing" : "fixed");
+}
+
+uint32_t
+vulkan_bindless_add_texture(vulkan_bindless *self,
+                            const VkDescriptorImageInfo *texture)
+{
+  if (!self->device->features.shaderSampledImageArrayDynamicIndexing) {
+    xrg_log_w("Textured materials need sampled image array indexing.");
+    return VULKAN_BINDLESS_NO_TEXTURE;
+  }
+
+  if (self->texture_count == self->texture_capacity) {
+    xrg_log_w("Bindless texture array is full.");
+    return VULKAN_BINDLESS_NO_TEXTURE;
+  }
+
+  uint32_t index = self->texture_count++;
+  vulkan_bindless_set_texture(self, index, texture);
+
+  return index;
+}
+
+void
+vulkan_bindless_set_texture(vulkan_bindless *self,
+                            uint32_t index,
+                            const VkDescriptorImageInfo *texture)
+{
+  for (uint32_t i = 0; i < self->set_count; i++) {
+    VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = self->sets[i],
+      .dstBinding = self->texture_binding,
+      .dstArrayElement = index,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = texture,
+    };
+    vkUpdateDescriptorSets(self->device->device, 1, &write, 0, NULL);
+  }
+}
+
+void
+vulkan_bindless_destroy(vulkan_bindless *self)
+{
+  // Frees the sets too
+  vkDestroyDescriptorPool(self->device->device, self->pool, NULL);
+  vkDestroyDescriptorSetLayout(self->device->device, self->layout, NULL);
+}
@@ -0,0 +1,79 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VULKAN_BINDLESS_MAX_SETS 2
+
+// Textures per set with VK_EXT_descriptor_indexing
+#define VULKAN_BINDLESS_MAX_TEXTURES 256
+
+// Fixed array size without it, stays below maxPerStageDescriptorSamplers
+#define VULKAN_BINDLESS_FALLBACK_TEXTURES 8
+
+#define VULKAN_BINDLESS_NO_TEXTURE UINT32_MAX
+
+/*
+ * Global descriptor sets that do not depend on the object count. The caller
+ * provides the buffer bindings, objects and materials are indices into them.
+ * A sampled image array is appended as the highest binding, so shaders pick
+ * textures by index instead of by set.
+ *
+ * With VK_EXT_descriptor_indexing the array is partially bound and textures
+ * can be added while command buffers using the sets are recorded. Otherwise
+ * it is a fixed size array filled with a placeholder, and textures need to be
+ * added before recording.
+ */
+typedef struct
+{
+  vulkan_device *device;
+
+  VkDescriptorPool pool;
+  VkDescriptorSetLayout layout;
+  VkDescriptorSet sets[VULKAN_BINDLESS_MAX_SETS];
+  uint32_t set_count;
+
+  uint32_t texture_binding;
+  uint32_t texture_capacity;
+  uint32_t texture_count;
+} vulkan_bindless;
+
+void
+vulkan_bindless_init(vulkan_bindless *self,
+                     vulkan_device *device,
+                     const VkDescriptorSetLayoutBinding *bindings,
+                     uint32_t binding_count,
+                     uint32_t set_count,
+                     const VkDescriptorImageInfo *placeholder);
+
+// Returns the array index for shaders, or VULKAN_BINDLESS_NO_TEXTURE
+uint32_t
+vulkan_bindless_add_texture(vulkan_bindless *self,
+                            const VkDescriptorImageInfo *texture);
+
+// Points an added index at another view, e.g. once a texture sharpened
+void
+vulkan_bindless_set_texture(vulkan_bindless *self,
+                            uint32_t index,
+                            const VkDescriptorImageInfo *texture);
+
+void
+vulkan_bindless_destroy(vulkan_bindless *self);
+
+#ifdef __cplusplus
+}
+#endif
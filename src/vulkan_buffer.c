@@ -48,6 +48,8 @@ vulkan_buffer_destroy(vulkan_buffer *self)
 {
   if (self->buffer)
     vkDestroyBuffer(self->device, self->buffer, NULL);
-  if (self->memory)
+  if (self->memory && self->memory_stats)
+    vulkan_memory_free(self->memory_stats, self->device, self->memory);
+  else if (self->memory)
     vkFreeMemory(self->device, self->memory, NULL);
 }
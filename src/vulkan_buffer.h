@@ -13,6 +13,8 @@
 
 #include "vulkan/vulkan.h"
 
+#include "vulkan_memory.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -29,6 +31,9 @@ typedef struct
 
   VkBufferUsageFlags usage_flags;
   VkMemoryPropertyFlags memory_property_flags;
+
+  // Accounting the memory was allocated from, NULL if untracked
+  vulkan_memory_stats *memory_stats;
 } vulkan_buffer;
 
 VkResult
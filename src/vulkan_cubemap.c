@@ -0,0 +1,339 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_cubemap.h"
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "vulkan_barrier.h"
+#include "vulkan_shader.h"
+
+#include "equirect_to_cube.comp.h"
+
+// Matches local_size of equirect_to_cube.comp
+#define GROUP_SIZE 8
+
+void
+vulkan_cubemap_init(vulkan_cubemap *self,
+                    vulkan_device *device,
+                    vulkan_submit *submit)
+{
+  self->device = device;
+  self->converted = false;
+  self->level_views = NULL;
+  self->descriptor_sets = NULL;
+  self->descriptor_pool = VK_NULL_HANDLE;
+  self->pipeline = VK_NULL_HANDLE;
+
+  vulkan_texture_init_solid_cube(&self->texture, device, submit,
+                                 (VkClearColorValue){ { 0, 0, 0, 1 } });
+
+  VkDescriptorSetLayoutBinding bindings[] = {
+    { .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT },
+    { .binding = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT },
+  };
+
+  VkDescriptorSetLayoutCreateInfo layout_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = 2,
+    .pBindings = bindings,
+  };
+  vk_check(vkCreateDescriptorSetLayout(device->device, &layout_info, NULL,
+                                       &self->descriptor_set_layout));
+
+  VkPipelineLayoutCreateInfo pipeline_layout_info = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &self->descriptor_set_layout,
+  };
+  vk_check(vkCreatePipelineLayout(device->device, &pipeline_layout_info, NULL,
+                                  &self->pipeline_layout));
+}
+
+void
+vulkan_cubemap_init_pipeline(vulkan_cubemap *self,
+                             VkPipelineCache pipeline_cache)
+{
+  VkComputePipelineCreateInfo info = {
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = vulkan_shader_load(self->device->device, equirect_to_cube_comp,
+                                sizeof(equirect_to_cube_comp),
+                                VK_SHADER_STAGE_COMPUTE_BIT),
+    .layout = self->pipeline_layout,
+    .basePipelineHandle = VK_NULL_HANDLE,
+    .basePipelineIndex = -1,
+  };
+
+  vk_check(vkCreateComputePipelines(self->device->device, pipeline_cache, 1,
+                                    &info, NULL, &self->pipeline));
+
+  vkDestroyShaderModule(self->device->device, info.stage.module, NULL);
+}
+
+void
+vulkan_cubemap_destroy(vulkan_cubemap *self)
+{
+  VkDevice device = self->device->device;
+
+  if (self->converted) {
+    for (uint32_t i = 0; i < self->texture.mip_levels; i++)
+      vkDestroyImageView(device, self->level_views[i], NULL);
+    vkDestroyDescriptorPool(device, self->descriptor_pool, NULL);
+  }
+  free(self->level_views);
+  free(self->descriptor_sets);
+
+  if (self->pipeline)
+    vkDestroyPipeline(device, self->pipeline, NULL);
+  vkDestroyPipelineLayout(device, self->pipeline_layout, NULL);
+  vkDestroyDescriptorSetLayout(device, self->descriptor_set_layout, NULL);
+
+  vulkan_texture_destroy(&self->texture);
+}
+
+VkDescriptorImageInfo
+vulkan_cubemap_get_descriptor(vulkan_cubemap *self)
+{
+  return vulkan_texture_get_descriptor(&self->texture);
+}
+
+static void
+_create_image(vulkan_cubemap *self, uint32_t size)
+{
+  vulkan_device *device = self->device;
+  vulkan_texture *texture = &self->texture;
+
+  uint32_t mip_levels = 1;
+  while ((size >> mip_levels) > 0)
+    mip_levels++;
+
+  *texture = (vulkan_texture){
+    .device = device,
+    .image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    .view_type = VK_IMAGE_VIEW_TYPE_CUBE,
+    .format = VULKAN_CUBEMAP_FORMAT,
+    .width = size,
+    .height = size,
+    .mip_levels = mip_levels,
+    .layer_count = 6,
+    .level_tickets = NULL,
+    .base_level = 0,
+  };
+
+  VkImageCreateInfo image_info = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = texture->format,
+    .extent = { .width = size, .height = size, .depth = 1 },
+    .mipLevels = mip_levels,
+    .arrayLayers = 6,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  vk_check(vkCreateImage(device->device, &image_info, NULL, &texture->image));
+
+  VkMemoryRequirements mem_reqs;
+  vkGetImageMemoryRequirements(device->device, texture->image, &mem_reqs);
+  VkMemoryAllocateInfo mem_info = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = mem_reqs.size,
+  };
+  vulkan_device_get_memory_type(device, mem_reqs.memoryTypeBits,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                &mem_info.memoryTypeIndex);
+  vk_check(vulkan_device_allocate_memory(device, VULKAN_MEMORY_TEXTURE,
+                                         &mem_info, &texture->device_memory));
+  vk_check(vkBindImageMemory(device->device, texture->image,
+                             texture->device_memory, 0));
+
+  VkImageViewCreateInfo view_info = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = texture->image,
+    .viewType = VK_IMAGE_VIEW_TYPE_CUBE,
+    .format = texture->format,
+    .subresourceRange = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = 0,
+      .levelCount = mip_levels,
+      .baseArrayLayer = 0,
+      .layerCount = 6,
+    },
+  };
+  vk_check(
+    vkCreateImageView(device->device, &view_info, NULL, &texture->view));
+
+  // The compute shader writes each level as an array of faces
+  self->level_views = malloc(sizeof(VkImageView) * mip_levels);
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+  view_info.subresourceRange.levelCount = 1;
+  for (uint32_t i = 0; i < mip_levels; i++) {
+    view_info.subresourceRange.baseMipLevel = i;
+    vk_check(vkCreateImageView(device->device, &view_info, NULL,
+                               &self->level_views[i]));
+  }
+
+  // Edges are filtered within a face, seams are not sampled across
+  VkSamplerCreateInfo sampler_info = {
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_LINEAR,
+    .minFilter = VK_FILTER_LINEAR,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .compareOp = VK_COMPARE_OP_NEVER,
+    .minLod = 0.0f,
+    .maxLod = (float)mip_levels,
+    .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK,
+  };
+  vk_check(vkCreateSampler(device->device, &sampler_info, NULL,
+                           &texture->sampler));
+
+  VkDescriptorPoolSize pool_sizes[] = {
+    { .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = mip_levels },
+    { .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .descriptorCount = mip_levels },
+  };
+  VkDescriptorPoolCreateInfo pool_info = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .maxSets = mip_levels,
+    .poolSizeCount = 2,
+    .pPoolSizes = pool_sizes,
+  };
+  vk_check(vkCreateDescriptorPool(device->device, &pool_info, NULL,
+                                  &self->descriptor_pool));
+
+  self->descriptor_sets = malloc(sizeof(VkDescriptorSet) * mip_levels);
+  for (uint32_t i = 0; i < mip_levels; i++) {
+    VkDescriptorSetAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = self->descriptor_pool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &self->descriptor_set_layout,
+    };
+    vk_check(vkAllocateDescriptorSets(device->device, &alloc_info,
+                                      &self->descriptor_sets[i]));
+
+    VkDescriptorImageInfo level = {
+      .imageView = self->level_views[i],
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = self->descriptor_sets[i],
+      .dstBinding = 1,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .pImageInfo = &level,
+    };
+    vkUpdateDescriptorSets(device->device, 1, &write, 0, NULL);
+  }
+
+  xrg_log_i("Converting the sky to a %dx%d cube map with %d levels, %.1f MB.",
+            size, size, mip_levels, (double)mem_reqs.size / (1024.0 * 1024.0));
+}
+
+// Binds the panorama, sampled in the general layout during the conversion
+static void
+_write_equirect_descriptors(vulkan_cubemap *self, vulkan_texture *equirect)
+{
+  VkDescriptorImageInfo descriptor = vulkan_texture_get_descriptor(equirect);
+  descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  for (uint32_t i = 0; i < self->texture.mip_levels; i++) {
+    VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = self->descriptor_sets[i],
+      .dstBinding = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &descriptor,
+    };
+    vkUpdateDescriptorSets(self->device->device, 1, &write, 0, NULL);
+  }
+}
+
+vulkan_submit_ticket
+vulkan_cubemap_convert(vulkan_cubemap *self,
+                       vulkan_texture *equirect,
+                       vulkan_submit *submit)
+{
+  VkImageLayout cube_layout = self->texture.image_layout;
+  if (!self->converted) {
+    // Frames using the placeholder were submitted before the release
+    vulkan_texture_release(&self->texture, submit);
+    _create_image(self, MAX(1, equirect->width / 4));
+    self->converted = true;
+    cube_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  }
+
+  _write_equirect_descriptors(self, equirect);
+
+  // Finer levels of the panorama can still be in transfer
+  VkImageSubresourceRange equirect_range = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .baseMipLevel = equirect->base_level,
+    .levelCount = equirect->mip_levels - equirect->base_level,
+    .baseArrayLayer = 0,
+    .layerCount = 1,
+  };
+  VkImageSubresourceRange cube_range = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .baseMipLevel = 0,
+    .levelCount = self->texture.mip_levels,
+    .baseArrayLayer = 0,
+    .layerCount = 6,
+  };
+
+  VkCommandBuffer cmd = vulkan_submit_begin(submit);
+
+  vulkan_barrier_batch barriers;
+  vulkan_barrier_batch_init(&barriers, self->device, cmd);
+  vulkan_barrier_batch_add_image(&barriers, equirect->image, equirect_range,
+                                 equirect->image_layout,
+                                 VK_IMAGE_LAYOUT_GENERAL);
+  // Every texel is written again
+  vulkan_barrier_batch_discard_image(&barriers, self->texture.image,
+                                     cube_range, cube_layout,
+                                     VK_IMAGE_LAYOUT_GENERAL);
+  vulkan_barrier_batch_flush(&barriers);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, self->pipeline);
+  for (uint32_t i = 0; i < self->texture.mip_levels; i++) {
+    uint32_t size = MAX(1, self->texture.width >> i);
+    uint32_t groups = (size + GROUP_SIZE - 1) / GROUP_SIZE;
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            self->pipeline_layout, 0, 1,
+                            &self->descriptor_sets[i], 0, NULL);
+    vkCmdDispatch(cmd, groups, groups, 6);
+  }
+
+  vulkan_barrier_batch_add_image(&barriers, equirect->image, equirect_range,
+                                 VK_IMAGE_LAYOUT_GENERAL,
+                                 equirect->image_layout);
+  vulkan_barrier_batch_add_image(&barriers, self->texture.image, cube_range,
+                                 VK_IMAGE_LAYOUT_GENERAL,
+                                 self->texture.image_layout);
+  vulkan_barrier_batch_flush(&barriers);
+
+  self->texture.upload_ticket = vulkan_submit_end(submit, NULL, NULL);
+  return self->texture.upload_ticket;
+}
@@ -0,0 +1,84 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+#include "vulkan_submit.h"
+#include "vulkan_texture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Half floats are storable on all devices, unlike sRGB
+#define VULKAN_CUBEMAP_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+
+/*
+ * A mipmapped cube map resampled from an equirectangular panorama with a
+ * compute shader, so the sky is drawn with one cube lookup per pixel
+ * instead of the trigonometry. Every level is resampled from the panorama
+ * directly, at the panorama level matching its texel size.
+ */
+typedef struct
+{
+  vulkan_device *device;
+
+  // A black 1x1 cube until the first conversion
+  vulkan_texture texture;
+  bool converted;
+
+  // Storage view and descriptor set of each level
+  VkImageView *level_views;
+  VkDescriptorSet *descriptor_sets;
+
+  VkDescriptorSetLayout descriptor_set_layout;
+  VkDescriptorPool descriptor_pool;
+  VkPipelineLayout pipeline_layout;
+  VkPipeline pipeline;
+} vulkan_cubemap;
+
+void
+vulkan_cubemap_init(vulkan_cubemap *self,
+                    vulkan_device *device,
+                    vulkan_submit *submit);
+
+// Compiles the compute pipeline, can run on a worker thread
+void
+vulkan_cubemap_init_pipeline(vulkan_cubemap *self,
+                             VkPipelineCache pipeline_cache);
+
+void
+vulkan_cubemap_destroy(vulkan_cubemap *self);
+
+VkDescriptorImageInfo
+vulkan_cubemap_get_descriptor(vulkan_cubemap *self);
+
+/*
+ * Resamples the levels in view of equirect into all faces and levels,
+ * recorded on the graphics queue of submit. The cube map is created on the
+ * first call, with faces a quarter of the panorama wide, descriptors using
+ * the placeholder need to be written again then. The placeholder is
+ * destroyed once the work recorded on submit so far completed.
+ *
+ * Needs to be called while no frame sampling the cube map and no previous
+ * conversion is in flight.
+ */
+vulkan_submit_ticket
+vulkan_cubemap_convert(vulkan_cubemap *self,
+                       vulkan_texture *equirect,
+                       vulkan_submit *submit);
+
+#ifdef __cplusplus
+}
+#endif
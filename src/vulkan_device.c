@@ -10,6 +10,8 @@
 
 #include "vulkan_device.h"
 
+#include <string.h>
+
 static bool
 _get_graphics_queue_index(vulkan_device *self)
 {
@@ -24,12 +26,40 @@ _get_graphics_queue_index(vulkan_device *self)
   return false;
 }
 
+/*
+ * Families with only transfer support are the DMA engines of discrete GPUs,
+ * which copy without taking time from rendering. Coarser transfer
+ * granularity would not fit small mip levels.
+ */
+static void
+_get_transfer_queue_index(vulkan_device *self)
+{
+  self->transfer_family_index = self->graphics_family_index;
+
+  for (uint32_t i = 0; i < self->queue_family_count; i++) {
+    const VkQueueFamilyProperties *family = &self->queue_family_properties[i];
+    VkExtent3D granularity = family->minImageTransferGranularity;
+
+    VkQueueFlags flags = family->queueFlags;
+
+    if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+        !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+        granularity.width == 1 && granularity.height == 1 &&
+        granularity.depth == 1) {
+      self->transfer_family_index = i;
+      xrg_log_i("Using queue family %d for transfers.", i);
+      return;
+    }
+  }
+}
+
 vulkan_device *
-vulkan_device_create(VkPhysicalDevice physical_device)
+vulkan_device_create(VkInstance instance, VkPhysicalDevice physical_device)
 {
   vulkan_device *self = malloc(sizeof(vulkan_device));
 
   assert(physical_device);
+  self->instance = instance;
   self->physical_device = physical_device;
 
   vkGetPhysicalDeviceProperties(physical_device, &self->properties);
@@ -47,8 +77,18 @@ vulkan_device_create(VkPhysicalDevice physical_device)
 
   if (!_get_graphics_queue_index(self))
     xrg_log_e("Could not find graphics queue.");
+  _get_transfer_queue_index(self);
+
+  self->dynamic_rendering = false;
+  self->cmd_begin_rendering = NULL;
+  self->cmd_end_rendering = NULL;
 
-  self->cmd_pool = NULL;
+  self->memory_budget = false;
+  self->descriptor_indexing = false;
+  self->synchronization2 = false;
+  self->cmd_pipeline_barrier2 = NULL;
+  vulkan_memory_stats_init(&self->memory, physical_device,
+                           &self->memory_properties);
 
   return self;
 }
@@ -56,10 +96,9 @@ vulkan_device_create(VkPhysicalDevice physical_device)
 void
 vulkan_device_destroy(vulkan_device *self)
 {
-  if (self->cmd_pool)
-    vkDestroyCommandPool(self->device, self->cmd_pool, NULL);
   if (self->device)
     vkDestroyDevice(self->device, NULL);
+  vulkan_memory_stats_destroy(&self->memory);
   free(self);
 }
 
@@ -84,54 +123,290 @@ vulkan_device_get_memory_type(vulkan_device *self,
   return false;
 }
 
-static VkCommandPool
-_create_cmd_pool(vulkan_device *self)
+VkResult
+vulkan_device_allocate_memory(vulkan_device *self,
+                              vulkan_memory_category category,
+                              const VkMemoryAllocateInfo *info,
+                              VkDeviceMemory *memory)
 {
-  VkCommandPoolCreateFlags createFlags =
-    VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  return vulkan_memory_allocate(&self->memory, self->device, category, info,
+                                memory);
+}
 
-  VkCommandPoolCreateInfo cmdPoolInfo = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-    .flags = createFlags,
-    .queueFamilyIndex = self->graphics_family_index,
-  };
+void
+vulkan_device_free_memory(vulkan_device *self, VkDeviceMemory memory)
+{
+  vulkan_memory_free(&self->memory, self->device, memory);
+}
+
+// Prefers D32 like the depth swapchains, D16 support is mandatory
+VkFormat
+vulkan_device_get_depth_format(vulkan_device *self)
+{
+  VkFormat formats[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM };
+
+  for (uint32_t i = 0; i < 2; i++) {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(self->physical_device, formats[i],
+                                        &props);
+    if (props.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+      return formats[i];
+  }
 
-  VkCommandPool cmdPool;
-  vk_check(vkCreateCommandPool(self->device, &cmdPoolInfo, NULL, &cmdPool));
-  return cmdPool;
+  return VK_FORMAT_D16_UNORM;
+}
+
+// Highest sample count up to requested usable for color and depth
+VkSampleCountFlagBits
+vulkan_device_get_sample_count(vulkan_device *self, uint32_t requested)
+{
+  VkSampleCountFlags supported =
+    self->properties.limits.framebufferColorSampleCounts &
+    self->properties.limits.framebufferDepthSampleCounts;
+
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  for (uint32_t count = 2; count <= requested && count <= 64; count <<= 1)
+    if (supported & count)
+      samples = (VkSampleCountFlagBits)count;
+
+  return samples;
 }
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
-VkResult
-vulkan_device_create_device(vulkan_device *self)
+bool
+vulkan_device_has_extension(vulkan_device *self, const char *name)
 {
-  VkDeviceQueueCreateInfo queue_info = {
+  uint32_t count = 0;
+  vk_check(vkEnumerateDeviceExtensionProperties(self->physical_device, NULL,
+                                                &count, NULL));
+
+  VkExtensionProperties *props = malloc(sizeof(VkExtensionProperties) * count);
+  vk_check(vkEnumerateDeviceExtensionProperties(self->physical_device, NULL,
+                                                &count, props));
+
+  bool found = false;
+  for (uint32_t i = 0; i < count; i++) {
+    if (strcmp(props[i].extensionName, name) == 0) {
+      found = true;
+      break;
+    }
+  }
+
+  free(props);
+  return found;
+}
+
+// Unlike dynamic rendering the features we use are optional in the extension
+static bool
+_has_descriptor_indexing(vulkan_device *self)
+{
+  if (!vulkan_device_has_extension(self,
+                                   VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+    return false;
+
+  PFN_vkGetPhysicalDeviceFeatures2KHR get_features2 =
+    (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+      self->instance, "vkGetPhysicalDeviceFeatures2KHR");
+  if (!get_features2) {
+    xrg_log_w("Could not load vkGetPhysicalDeviceFeatures2KHR.");
+    return false;
+  }
+
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+  };
+  VkPhysicalDeviceFeatures2KHR features = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+    .pNext = &indexing,
+  };
+  get_features2(self->physical_device, &features);
+
+  return indexing.descriptorBindingSampledImageUpdateAfterBind &&
+         indexing.descriptorBindingPartiallyBound &&
+         indexing.descriptorBindingVariableDescriptorCount;
+}
+
+static void
+_add_extension(vulkan_device_create_info *info, const char *name)
+{
+  xrg_log_f_if(info->extension_count == VULKAN_DEVICE_MAX_EXTENSIONS,
+               "Too many device extensions.");
+  info->extensions[info->extension_count++] = name;
+}
+
+static bool
+_add_extensions(vulkan_device *self,
+                vulkan_device_create_info *info,
+                const char *const *names,
+                uint32_t count)
+{
+  for (uint32_t i = 0; i < count; i++) {
+    if (!vulkan_device_has_extension(self, names[i])) {
+      xrg_log_w("Device extension %s is not supported.", names[i]);
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < count; i++)
+    _add_extension(info, names[i]);
+
+  return true;
+}
+
+void
+vulkan_device_init_create_info(vulkan_device *self,
+                               vulkan_device_create_info *info,
+                               bool dynamic_rendering)
+{
+  *info = (vulkan_device_create_info){
+    .features = {
+      .samplerAnisotropy = VK_TRUE,
+    },
+  };
+
+  static const float priority = 0.0f;
+
+  info->queues[info->queue_count++] = (VkDeviceQueueCreateInfo){
     .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
     .queueFamilyIndex = self->graphics_family_index,
     .queueCount = 1,
-    .pQueuePriorities = (float[]){ 0.0f },
+    .pQueuePriorities = &priority,
   };
 
-  char *enabled_extensions[] = {
-    VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
-    VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
-    VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME,
-    VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
-    VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME,
-  };
+  if (self->transfer_family_index != self->graphics_family_index)
+    info->queues[info->queue_count++] = (VkDeviceQueueCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = self->transfer_family_index,
+      .queueCount = 1,
+      .pQueuePriorities = &priority,
+    };
+
+  if (dynamic_rendering) {
+    // Our instance is 1.0, so the promoted dependencies need enabling too
+    const char *names[] = {
+      VK_KHR_MULTIVIEW_EXTENSION_NAME,
+      VK_KHR_MAINTENANCE2_EXTENSION_NAME,
+      VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+      VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+      VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+    };
+
+    // The feature is mandatory when the extension is exposed
+    if (_add_extensions(self, info, names, ARRAY_SIZE(names))) {
+      info->dynamic_rendering = true;
+      info->dynamic_rendering_features =
+        (VkPhysicalDeviceDynamicRenderingFeaturesKHR){
+          .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+          .pNext = info->next,
+          .dynamicRendering = VK_TRUE,
+        };
+      info->next = &info->dynamic_rendering_features;
+    }
+  }
 
-  VkPhysicalDeviceFeatures enabled_features = {
-    .samplerAnisotropy = VK_TRUE,
-  };
+  // Only used for reporting, so enable it whenever it is there
+  if (vulkan_device_has_extension(self, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+    _add_extension(info, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    info->memory_budget = true;
+  }
+
+  // Indexing into sampled image arrays, needed for textured materials
+  info->features.shaderSampledImageArrayDynamicIndexing =
+    self->features.shaderSampledImageArrayDynamicIndexing;
+
+  // Compressed KTX textures are uploaded as is, in whichever family we have
+  info->features.textureCompressionBC = self->features.textureCompressionBC;
+  info->features.textureCompressionETC2 =
+    self->features.textureCompressionETC2;
+  info->features.textureCompressionASTC_LDR =
+    self->features.textureCompressionASTC_LDR;
+  info->features.imageCubeArray = self->features.imageCubeArray;
+
+  if (_has_descriptor_indexing(self)) {
+    const char *names[] = {
+      VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+      VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+    };
+
+    if (_add_extensions(self, info, names, ARRAY_SIZE(names))) {
+      info->descriptor_indexing = true;
+      info->descriptor_indexing_features =
+        (VkPhysicalDeviceDescriptorIndexingFeaturesEXT){
+          .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+          .pNext = info->next,
+          .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+          .descriptorBindingPartiallyBound = VK_TRUE,
+          .descriptorBindingVariableDescriptorCount = VK_TRUE,
+        };
+      info->next = &info->descriptor_indexing_features;
+    }
+  }
+
+  // Finer barriers when available, the feature is mandatory for it
+  if (vulkan_device_has_extension(self,
+                                  VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+    _add_extension(info, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+    info->synchronization2 = true;
+    info->synchronization2_features =
+      (VkPhysicalDeviceSynchronization2FeaturesKHR){
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
+        .pNext = info->next,
+        .synchronization2 = VK_TRUE,
+      };
+    info->next = &info->synchronization2_features;
+  }
+}
+
+void
+vulkan_device_init_functions(vulkan_device *self,
+                             const vulkan_device_create_info *info)
+{
+  self->memory_budget = info->memory_budget;
+  if (self->memory_budget)
+    vulkan_memory_stats_enable_budget(&self->memory, self->instance);
+
+  self->descriptor_indexing = info->descriptor_indexing;
+
+  if (info->synchronization2) {
+    self->cmd_pipeline_barrier2 = (PFN_vkCmdPipelineBarrier2KHR)
+      vkGetDeviceProcAddr(self->device, "vkCmdPipelineBarrier2KHR");
+    self->synchronization2 = self->cmd_pipeline_barrier2 != NULL;
+  }
+
+  if (info->dynamic_rendering) {
+    self->cmd_begin_rendering = (PFN_vkCmdBeginRenderingKHR)
+      vkGetDeviceProcAddr(self->device, "vkCmdBeginRenderingKHR");
+    self->cmd_end_rendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(
+      self->device, "vkCmdEndRenderingKHR");
+    self->dynamic_rendering =
+      self->cmd_begin_rendering != NULL && self->cmd_end_rendering != NULL;
+  }
+}
+
+VkResult
+vulkan_device_create_device(vulkan_device *self, bool dynamic_rendering)
+{
+  vulkan_device_create_info info;
+  vulkan_device_init_create_info(self, &info, dynamic_rendering);
+
+  _add_extension(&info, VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+  _add_extension(&info, VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME);
+  _add_extension(&info, VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME);
+  _add_extension(&info, VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME);
+  _add_extension(&info, VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
 
   VkDeviceCreateInfo device_info = {
     .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-    .queueCreateInfoCount = 1,
-    .pQueueCreateInfos = &queue_info,
-    .pEnabledFeatures = &enabled_features,
-    .enabledExtensionCount = ARRAY_SIZE(enabled_extensions),
-    .ppEnabledExtensionNames = (const char *const *)enabled_extensions,
+    .pNext = info.next,
+    .queueCreateInfoCount = info.queue_count,
+    .pQueueCreateInfos = info.queues,
+    .pEnabledFeatures = &info.features,
+    .enabledExtensionCount = info.extension_count,
+    .ppEnabledExtensionNames = info.extensions,
   };
 
   VkResult result =
@@ -142,6 +417,8 @@ vulkan_device_create_device(vulkan_device *self)
     return result;
   }
 
+  vulkan_device_init_functions(self, &info);
+
   return result;
 }
 
@@ -160,6 +437,18 @@ vulkan_device_create_and_map(vulkan_device *self,
   vk_check(vulkan_buffer_map(buffer));
 }
 
+static vulkan_memory_category
+_category_from_usage(VkBufferUsageFlags usage)
+{
+  if (usage &
+      (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT))
+    return VULKAN_MEMORY_GEOMETRY;
+  if (usage &
+      (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
+    return VULKAN_MEMORY_UNIFORM;
+  return VULKAN_MEMORY_STAGING;
+}
+
 VkResult
 vulkan_device_create_buffer(vulkan_device *self,
                             vulkan_buffer *buffer,
@@ -193,7 +482,9 @@ vulkan_device_create_buffer(vulkan_device *self,
                                      &memAlloc.memoryTypeIndex))
     xrg_log_e("Could not find memory type.");
 
-  vk_check(vkAllocateMemory(self->device, &memAlloc, NULL, &buffer->memory));
+  vk_check(vulkan_device_allocate_memory(self, _category_from_usage(usage),
+                                         &memAlloc, &buffer->memory));
+  buffer->memory_stats = &self->memory;
 
   buffer->alignment = memReqs.alignment;
   buffer->size = memAlloc.allocationSize;
@@ -214,66 +505,3 @@ vulkan_device_create_buffer(vulkan_device *self,
   // Attach the memory to the buffer object
   return vulkan_buffer_bind(buffer);
 }
-
-VkCommandBuffer
-vulkan_device_create_cmd_buffer(vulkan_device *self)
-{
-  if (!self->cmd_pool) {
-    self->cmd_pool = _create_cmd_pool(self);
-  };
-
-  VkCommandBufferAllocateInfo cmdBufAllocateInfo = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-    .commandPool = self->cmd_pool,
-    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-    .commandBufferCount = 1
-  };
-
-  VkCommandBuffer cmdBuffer;
-  vk_check(
-    vkAllocateCommandBuffers(self->device, &cmdBufAllocateInfo, &cmdBuffer));
-
-  VkCommandBufferBeginInfo cmdBufInfo = {
-    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
-  };
-  vk_check(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo));
-
-  return cmdBuffer;
-}
-
-void
-vulkan_device_flush_cmd_buffer(vulkan_device *self,
-                               VkCommandBuffer commandBuffer,
-                               VkQueue queue)
-{
-  if (commandBuffer == VK_NULL_HANDLE)
-    return;
-
-  if (!self->cmd_pool) {
-    return;
-  }
-
-  vk_check(vkEndCommandBuffer(commandBuffer));
-
-  VkSubmitInfo submitInfo = {
-    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-    .commandBufferCount = 1,
-    .pCommandBuffers = &commandBuffer,
-  };
-
-  // Create fence to ensure that the command buffer has finished executing
-  VkFenceCreateInfo fenceInfo = {
-    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-  };
-  VkFence fence;
-  vk_check(vkCreateFence(self->device, &fenceInfo, NULL, &fence));
-
-  // Submit to the queue
-  vk_check(vkQueueSubmit(queue, 1, &submitInfo, fence));
-  // Wait for the fence to signal that command buffer has finished executing
-  vk_check(vkWaitForFences(self->device, 1, &fence, VK_TRUE, INT64_MAX));
-
-  vkDestroyFence(self->device, fence, NULL);
-
-  vkFreeCommandBuffers(self->device, self->cmd_pool, 1, &commandBuffer);
-}
@@ -15,6 +15,7 @@
 #include <vulkan/vulkan.h>
 
 #include "vulkan_buffer.h"
+#include "vulkan_memory.h"
 #include "log.h"
 
 #ifdef __cplusplus
@@ -23,6 +24,7 @@ extern "C" {
 
 typedef struct
 {
+  VkInstance instance;
   VkPhysicalDevice physical_device;
   VkDevice device;
   VkPhysicalDeviceProperties properties;
@@ -31,13 +33,64 @@ typedef struct
   VkQueueFamilyProperties *queue_family_properties;
   uint32_t queue_family_count;
 
-  VkCommandPool cmd_pool;
-
   uint32_t graphics_family_index;
+
+  // Dedicated copy engine, equals graphics_family_index when there is none
+  uint32_t transfer_family_index;
+
+  // VK_KHR_dynamic_rendering, only set when enabled on the device
+  bool dynamic_rendering;
+  PFN_vkCmdBeginRenderingKHR cmd_begin_rendering;
+  PFN_vkCmdEndRenderingKHR cmd_end_rendering;
+
+  // VK_EXT_memory_budget is enabled on the device
+  bool memory_budget;
+
+  // VK_EXT_descriptor_indexing with update after bind for sampled images
+  bool descriptor_indexing;
+
+  // VK_KHR_synchronization2, only set when enabled on the device
+  bool synchronization2;
+  PFN_vkCmdPipelineBarrier2KHR cmd_pipeline_barrier2;
+
+  vulkan_memory_stats memory;
 } vulkan_device;
 
+#define VULKAN_DEVICE_MAX_EXTENSIONS 16
+
+/*
+ * Optional device extensions and their feature structs, shared by our own
+ * vkCreateDevice and the device the runtime creates with vulkan_enable2.
+ * Feature structs are chained into next, which must stay valid until the
+ * device is created.
+ */
+typedef struct
+{
+  const char *extensions[VULKAN_DEVICE_MAX_EXTENSIONS];
+  uint32_t extension_count;
+
+  // Graphics, then the transfer family if it is a separate one
+  VkDeviceQueueCreateInfo queues[2];
+  uint32_t queue_count;
+
+  VkPhysicalDeviceFeatures features;
+
+  bool dynamic_rendering;
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features;
+
+  bool memory_budget;
+
+  bool descriptor_indexing;
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptor_indexing_features;
+
+  bool synchronization2;
+  VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2_features;
+
+  void *next;
+} vulkan_device_create_info;
+
 vulkan_device *
-vulkan_device_create(VkPhysicalDevice physical_device);
+vulkan_device_create(VkInstance instance, VkPhysicalDevice physical_device);
 
 void
 vulkan_device_destroy(vulkan_device *self);
@@ -48,8 +101,20 @@ vulkan_device_get_memory_type(vulkan_device *self,
                               VkMemoryPropertyFlags properties,
                               uint32_t *out_index);
 
+bool
+vulkan_device_has_extension(vulkan_device *self, const char *name);
+
+void
+vulkan_device_init_create_info(vulkan_device *self,
+                               vulkan_device_create_info *info,
+                               bool dynamic_rendering);
+
+void
+vulkan_device_init_functions(vulkan_device *self,
+                             const vulkan_device_create_info *info);
+
 VkResult
-vulkan_device_create_device(vulkan_device *self);
+vulkan_device_create_device(vulkan_device *self, bool dynamic_rendering);
 
 VkResult
 vulkan_device_create_buffer(vulkan_device *self,
@@ -64,13 +129,20 @@ vulkan_device_create_and_map(vulkan_device *self,
                              vulkan_buffer *buffer,
                              VkDeviceSize size);
 
-VkCommandBuffer
-vulkan_device_create_cmd_buffer(vulkan_device *self);
+VkResult
+vulkan_device_allocate_memory(vulkan_device *self,
+                              vulkan_memory_category category,
+                              const VkMemoryAllocateInfo *info,
+                              VkDeviceMemory *memory);
 
 void
-vulkan_device_flush_cmd_buffer(vulkan_device *self,
-                               VkCommandBuffer commandBuffer,
-                               VkQueue queue);
+vulkan_device_free_memory(vulkan_device *self, VkDeviceMemory memory);
+
+VkFormat
+vulkan_device_get_depth_format(vulkan_device *self);
+
+VkSampleCountFlagBits
+vulkan_device_get_sample_count(vulkan_device *self, uint32_t requested);
 
 #ifdef __cplusplus
 }
@@ -23,16 +23,19 @@ vulkan_framebuffer_destroy(vulkan_framebuffer* self)
 {
   // Color attachments
   vkDestroyImageView(self->device, self->color_view, NULL);
-  vkDestroyImageView(self->device, self->depth_view, NULL);
+  if (self->depth_view)
+    vkDestroyImageView(self->device, self->depth_view, NULL);
+  if (self->resolve_view)
+    vkDestroyImageView(self->device, self->resolve_view, NULL);
 
   vkDestroyFramebuffer(self->device, self->frame_buffer, NULL);
-
-  vkDestroyRenderPass(self->device, self->render_pass, NULL);
 }
 
 void
 vulkan_framebuffer_init(vulkan_framebuffer* self,
+                        VkRenderPass render_pass,
                         VkImage color_image,
+                        VkImage resolve_image,
                         VkFormat color_format,
                         VkImage depth_image,
                         VkFormat depth_format,
@@ -42,85 +45,8 @@ vulkan_framebuffer_init(vulkan_framebuffer* self,
   self->width = width;
   self->height = height;
 
-  // Set up separate renderpass with references to the color and depth
-  // attachments
-  VkAttachmentDescription* attachmentDescs =
-    malloc(sizeof(VkAttachmentDescription) * 2);
-
-  // Init attachment properties
-  for (uint32_t i = 0; i < 2; ++i) {
-    attachmentDescs[i].flags = 0;
-    attachmentDescs[i].samples = VK_SAMPLE_COUNT_1_BIT;
-    attachmentDescs[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachmentDescs[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    attachmentDescs[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    attachmentDescs[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    if (i == 1) {
-      attachmentDescs[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-      attachmentDescs[i].finalLayout =
-        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    } else {
-      attachmentDescs[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-      attachmentDescs[i].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    }
-  }
-
-  // Formats
-  attachmentDescs[0].format = color_format;
-  attachmentDescs[1].format = depth_format;
-
-  VkAttachmentReference colorReferences[1] = {
-    { .attachment = 0, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL }
-  };
-
-  VkAttachmentReference depthReference = {
-    .attachment = 1,
-    .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-  };
-
-  VkSubpassDescription subpass = {
-    .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-    .colorAttachmentCount = ARRAY_SIZE(colorReferences),
-    .pColorAttachments = colorReferences,
-    .pDepthStencilAttachment = &depthReference,
-  };
-
-  // Use subpass dependencies for attachment layput transitions
-  VkSubpassDependency dependencies[2] = {
-    (VkSubpassDependency){
-      .srcSubpass = VK_SUBPASS_EXTERNAL,
-      .dstSubpass = 0,
-      .srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-      .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-      .srcAccessMask = VK_ACCESS_MEMORY_READ_BIT,
-      .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-                       VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-      .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
-    },
-    (VkSubpassDependency){
-      .srcSubpass = 0,
-      .dstSubpass = VK_SUBPASS_EXTERNAL,
-      .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-      .dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-      .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-                       VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-      .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
-      .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
-    }
-  };
-
-  VkRenderPassCreateInfo renderPassInfo = {
-    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-    .attachmentCount = 2,
-    .pAttachments = attachmentDescs,
-    .subpassCount = 1,
-    .pSubpasses = &subpass,
-    .dependencyCount = 2,
-    .pDependencies = dependencies,
-  };
-
-  vk_check(vkCreateRenderPass(self->device, &renderPassInfo, NULL,
-                              &self->render_pass));
+  // Shared with other framebuffers, owned by vulkan_render_pass_cache
+  self->render_pass = render_pass;
 
   VkImageViewCreateInfo imageView = {
     .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -141,30 +67,45 @@ vulkan_framebuffer_init(vulkan_framebuffer* self,
     vkCreateImageView(self->device, &imageView, NULL, &self->color_view));
 
 
-  VkImageViewCreateInfo depthImageView = {
-    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-    .image = depth_image,
-    .viewType = VK_IMAGE_VIEW_TYPE_2D,
-    .format = depth_format,
-    .subresourceRange =
-    {
-      .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
-      .baseMipLevel = 0,
-      .levelCount = 1,
-      .baseArrayLayer = 0,
-      .layerCount = 1,
-    },
-  };
-
-  vk_check(
-    vkCreateImageView(self->device, &depthImageView, NULL, &self->depth_view));
+  VkImageView attachments[3] = { self->color_view, VK_NULL_HANDLE,
+                               VK_NULL_HANDLE };
+  uint32_t attachment_count = 1;
+
+  self->depth_view = VK_NULL_HANDLE;
+  if (depth_image != VK_NULL_HANDLE) {
+    VkImageViewCreateInfo depthImageView = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = depth_image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = depth_format,
+      .subresourceRange =
+      {
+        .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+        .baseMipLevel = 0,
+        .levelCount = 1,
+        .baseArrayLayer = 0,
+        .layerCount = 1,
+      },
+    };
+
+    vk_check(vkCreateImageView(self->device, &depthImageView, NULL,
+                               &self->depth_view));
+    attachments[attachment_count++] = self->depth_view;
+  }
 
-  VkImageView attachments[2] = { self->color_view, self->depth_view };
+  // Same attachment order as vulkan_render_pass_cache passes
+  self->resolve_view = VK_NULL_HANDLE;
+  if (resolve_image != VK_NULL_HANDLE) {
+    imageView.image = resolve_image;
+    vk_check(vkCreateImageView(self->device, &imageView, NULL,
+                               &self->resolve_view));
+    attachments[attachment_count++] = self->resolve_view;
+  }
 
   VkFramebufferCreateInfo fbufCreateInfo = {
     .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
     .renderPass = self->render_pass,
-    .attachmentCount = ARRAY_SIZE(attachments),
+    .attachmentCount = attachment_count,
     .pAttachments = attachments,
     .width = width,
     .height = height,
@@ -28,6 +28,9 @@ typedef struct
 
   VkImageView depth_view;
 
+  // Single sampled target of multisampled color, or VK_NULL_HANDLE
+  VkImageView resolve_view;
+
   uint32_t width, height;
   VkFramebuffer frame_buffer;
   VkRenderPass render_pass;
@@ -42,7 +45,9 @@ vulkan_framebuffer_destroy(vulkan_framebuffer* self);
 
 void
 vulkan_framebuffer_init(vulkan_framebuffer* self,
+                        VkRenderPass render_pass,
                         VkImage color_image,
+                        VkImage resolve_image,
                         VkFormat color_format,
                         VkImage depth_image,
                         VkFormat depth_format,
@@ -0,0 +1,255 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_memory.h"
+
+#include <stdlib.h>
+
+#include "log.h"
+
+// Warn once a heap uses this much of its budget
+#define BUDGET_WARNING_PERCENT 90
+
+static const char *
+_category_name(vulkan_memory_category category)
+{
+  switch (category) {
+  case VULKAN_MEMORY_TEXTURE: return "textures";
+  case VULKAN_MEMORY_GEOMETRY: return "geometry";
+  case VULKAN_MEMORY_UNIFORM: return "uniforms";
+  case VULKAN_MEMORY_STAGING: return "staging";
+  case VULKAN_MEMORY_ATTACHMENT: return "attachments";
+  case VULKAN_MEMORY_SWAPCHAIN: return "swapchains (estimated)";
+  default: return "unknown";
+  }
+}
+
+static double
+_mib(VkDeviceSize size)
+{
+  return (double)size / (1024.0 * 1024.0);
+}
+
+void
+vulkan_memory_stats_init(vulkan_memory_stats *self,
+                         VkPhysicalDevice physical_device,
+                         const VkPhysicalDeviceMemoryProperties *properties)
+{
+  *self = (vulkan_memory_stats){
+    .physical_device = physical_device,
+    .properties = *properties,
+  };
+  pthread_mutex_init(&self->mutex, NULL);
+}
+
+void
+vulkan_memory_stats_enable_budget(vulkan_memory_stats *self,
+                                  VkInstance instance)
+{
+  self->get_properties2 =
+    (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(
+      instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+  if (!self->get_properties2)
+    xrg_log_w("Could not load vkGetPhysicalDeviceMemoryProperties2KHR.");
+}
+
+void
+vulkan_memory_stats_destroy(vulkan_memory_stats *self)
+{
+  if (self->allocation_count > 0)
+    xrg_log_w("%d device memory allocations were not freed.",
+              self->allocation_count);
+  free(self->allocations);
+  self->allocations = NULL;
+  pthread_mutex_destroy(&self->mutex);
+}
+
+/*
+ * Without VK_EXT_memory_budget usage is what we allocated and the budget is
+ * the full heap, which is optimistic on shared memory devices.
+ */
+static void
+_get_heap_budget(vulkan_memory_stats *self,
+                 VkDeviceSize *usage,
+                 VkDeviceSize *budget)
+{
+  uint32_t heap_count = self->properties.memoryHeapCount;
+
+  if (self->get_properties2) {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_props = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceMemoryProperties2KHR props = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR,
+      .pNext = &budget_props,
+    };
+    self->get_properties2(self->physical_device, &props);
+
+    for (uint32_t i = 0; i < heap_count; i++) {
+      usage[i] = budget_props.heapUsage[i];
+      budget[i] = budget_props.heapBudget[i];
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&self->mutex);
+  for (uint32_t i = 0; i < heap_count; i++) {
+    usage[i] = self->heap_size[i];
+    budget[i] = self->properties.memoryHeaps[i].size;
+  }
+  pthread_mutex_unlock(&self->mutex);
+}
+
+// Queries and reports outside the lock, only the first thread to warn logs
+static void
+_check_budget(vulkan_memory_stats *self, uint32_t heap)
+{
+  pthread_mutex_lock(&self->mutex);
+  bool warned = self->budget_warned[heap];
+  pthread_mutex_unlock(&self->mutex);
+  if (warned)
+    return;
+
+  VkDeviceSize usage[VK_MAX_MEMORY_HEAPS];
+  VkDeviceSize budget[VK_MAX_MEMORY_HEAPS];
+  _get_heap_budget(self, usage, budget);
+
+  if (usage[heap] * 100 < budget[heap] * BUDGET_WARNING_PERCENT)
+    return;
+
+  pthread_mutex_lock(&self->mutex);
+  warned = self->budget_warned[heap];
+  self->budget_warned[heap] = true;
+  pthread_mutex_unlock(&self->mutex);
+  if (warned)
+    return;
+
+  xrg_log_w("Memory heap %d is at %.1f of %.1f MiB budget.", heap,
+            _mib(usage[heap]), _mib(budget[heap]));
+  vulkan_memory_report(self);
+}
+
+VkResult
+vulkan_memory_allocate(vulkan_memory_stats *self,
+                       VkDevice device,
+                       vulkan_memory_category category,
+                       const VkMemoryAllocateInfo *info,
+                       VkDeviceMemory *memory)
+{
+  VkResult res = vkAllocateMemory(device, info, NULL, memory);
+  if (res != VK_SUCCESS) {
+    xrg_log_e("Failed to allocate %.2f MiB of %s: %s",
+              _mib(info->allocationSize), _category_name(category),
+              vk_result_to_string(res));
+    vulkan_memory_report(self);
+    return res;
+  }
+
+  uint32_t heap =
+    self->properties.memoryTypes[info->memoryTypeIndex].heapIndex;
+
+  pthread_mutex_lock(&self->mutex);
+
+  if (self->allocation_count == self->allocation_capacity) {
+    self->allocation_capacity =
+      self->allocation_capacity ? self->allocation_capacity * 2 : 64;
+    self->allocations =
+      realloc(self->allocations, sizeof(vulkan_memory_allocation) *
+                                   self->allocation_capacity);
+  }
+
+  self->allocations[self->allocation_count++] = (vulkan_memory_allocation){
+    .memory = *memory,
+    .size = info->allocationSize,
+    .heap = heap,
+    .category = category,
+  };
+
+  self->category_size[category] += info->allocationSize;
+  self->category_count[category]++;
+  if (self->category_size[category] > self->category_peak[category])
+    self->category_peak[category] = self->category_size[category];
+  self->heap_size[heap] += info->allocationSize;
+
+  pthread_mutex_unlock(&self->mutex);
+
+  _check_budget(self, heap);
+
+  return res;
+}
+
+void
+vulkan_memory_free(vulkan_memory_stats *self,
+                   VkDevice device,
+                   VkDeviceMemory memory)
+{
+  if (memory == VK_NULL_HANDLE)
+    return;
+
+  vkFreeMemory(device, memory, NULL);
+
+  pthread_mutex_lock(&self->mutex);
+  for (uint32_t i = 0; i < self->allocation_count; i++) {
+    vulkan_memory_allocation *a = &self->allocations[i];
+    if (a->memory != memory)
+      continue;
+
+    self->category_size[a->category] -= a->size;
+    self->category_count[a->category]--;
+    self->heap_size[a->heap] -= a->size;
+
+    self->allocations[i] = self->allocations[--self->allocation_count];
+    break;
+  }
+  pthread_mutex_unlock(&self->mutex);
+}
+
+void
+vulkan_memory_add_estimate(vulkan_memory_stats *self,
+                           vulkan_memory_category category,
+                           VkDeviceSize size)
+{
+  pthread_mutex_lock(&self->mutex);
+  self->category_size[category] += size;
+  self->category_count[category]++;
+  if (self->category_size[category] > self->category_peak[category])
+    self->category_peak[category] = self->category_size[category];
+  pthread_mutex_unlock(&self->mutex);
+}
+
+void
+vulkan_memory_report(vulkan_memory_stats *self)
+{
+  VkDeviceSize usage[VK_MAX_MEMORY_HEAPS];
+  VkDeviceSize budget[VK_MAX_MEMORY_HEAPS];
+  _get_heap_budget(self, usage, budget);
+
+  pthread_mutex_lock(&self->mutex);
+
+  xrg_log_i("GPU memory footprint:");
+  VkDeviceSize total = 0;
+  for (uint32_t i = 0; i < VULKAN_MEMORY_CATEGORY_COUNT; i++) {
+    xrg_log_i("  %-24s %8.2f MiB in %3d allocations (peak %.2f MiB)",
+              _category_name(i), _mib(self->category_size[i]),
+              self->category_count[i], _mib(self->category_peak[i]));
+    total += self->category_size[i];
+  }
+  xrg_log_i("  %-24s %8.2f MiB", "total", _mib(total));
+
+  for (uint32_t i = 0; i < self->properties.memoryHeapCount; i++) {
+    bool device_local = self->properties.memoryHeaps[i].flags &
+                        VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+    xrg_log_i("  heap %d%s: xrgears %.2f MiB, usage %.2f / %.2f MiB%s", i,
+              device_local ? " (device local)" : "", _mib(self->heap_size[i]),
+              _mib(usage[i]), _mib(budget[i]),
+              self->get_properties2 ? "" : " (no budget extension)");
+  }
+
+  pthread_mutex_unlock(&self->mutex);
+}
@@ -0,0 +1,106 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+  VULKAN_MEMORY_TEXTURE = 0,
+  VULKAN_MEMORY_GEOMETRY,
+  VULKAN_MEMORY_UNIFORM,
+  VULKAN_MEMORY_STAGING,
+  VULKAN_MEMORY_ATTACHMENT,
+  // Allocated by the OpenXR runtime, only estimated
+  VULKAN_MEMORY_SWAPCHAIN,
+  VULKAN_MEMORY_CATEGORY_COUNT
+} vulkan_memory_category;
+
+typedef struct
+{
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  uint32_t heap;
+  vulkan_memory_category category;
+} vulkan_memory_allocation;
+
+/*
+ * Accounting of all device memory allocated by xrgears, per category and per
+ * heap. Heap usage and budget come from VK_EXT_memory_budget when the device
+ * has it, otherwise from our own allocations and the heap sizes.
+ */
+typedef struct vulkan_memory_stats
+{
+  pthread_mutex_t mutex;
+
+  VkPhysicalDevice physical_device;
+  VkPhysicalDeviceMemoryProperties properties;
+  PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_properties2;
+
+  vulkan_memory_allocation *allocations;
+  uint32_t allocation_count;
+  uint32_t allocation_capacity;
+
+  VkDeviceSize category_size[VULKAN_MEMORY_CATEGORY_COUNT];
+  VkDeviceSize category_peak[VULKAN_MEMORY_CATEGORY_COUNT];
+  uint32_t category_count[VULKAN_MEMORY_CATEGORY_COUNT];
+  VkDeviceSize heap_size[VK_MAX_MEMORY_HEAPS];
+
+  // Guarded by mutex like the sizes
+  bool budget_warned[VK_MAX_MEMORY_HEAPS];
+} vulkan_memory_stats;
+
+void
+vulkan_memory_stats_init(vulkan_memory_stats *self,
+                         VkPhysicalDevice physical_device,
+                         const VkPhysicalDeviceMemoryProperties *properties);
+
+/*
+ * Use VK_EXT_memory_budget for heap usage and budget. Needs the device
+ * extension and VK_KHR_get_physical_device_properties2 on the instance.
+ */
+void
+vulkan_memory_stats_enable_budget(vulkan_memory_stats *self,
+                                  VkInstance instance);
+
+void
+vulkan_memory_stats_destroy(vulkan_memory_stats *self);
+
+VkResult
+vulkan_memory_allocate(vulkan_memory_stats *self,
+                       VkDevice device,
+                       vulkan_memory_category category,
+                       const VkMemoryAllocateInfo *info,
+                       VkDeviceMemory *memory);
+
+void
+vulkan_memory_free(vulkan_memory_stats *self,
+                   VkDevice device,
+                   VkDeviceMemory memory);
+
+// Memory we do not allocate ourselves, like runtime owned swapchains
+void
+vulkan_memory_add_estimate(vulkan_memory_stats *self,
+                           vulkan_memory_category category,
+                           VkDeviceSize size);
+
+void
+vulkan_memory_report(vulkan_memory_stats *self);
+
+#ifdef __cplusplus
+}
+#endif
@@ -15,7 +15,7 @@ class vulkan_pipeline
 {
 public:
   VkDevice device;
-  VkPipeline pipeline;
+  VkPipeline pipeline = VK_NULL_HANDLE;
   VkPipelineLayout pipeline_layout;
 
   VkDescriptorPool descriptor_pool;
@@ -0,0 +1,222 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_pipeline_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+static char *
+_default_cache_dir()
+{
+  const char *xdg_cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+
+  char dir[4096];
+  if (xdg_cache && xdg_cache[0] != '\0')
+    snprintf(dir, sizeof(dir), "%s/xrgears", xdg_cache);
+  else if (home && home[0] != '\0')
+    snprintf(dir, sizeof(dir), "%s/.cache/xrgears", home);
+  else
+    return NULL;
+
+  return strdup(dir);
+}
+
+// mkdir -p
+static bool
+_create_dir(const char *dir)
+{
+  char path[4096];
+  snprintf(path, sizeof(path), "%s", dir);
+
+  for (char *p = path + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir(path, 0755) != 0 && errno != EEXIST)
+      return false;
+    *p = '/';
+  }
+
+  return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+static bool
+_validate_header(vulkan_device *device, const void *data, size_t size)
+{
+  VkPipelineCacheHeaderVersionOne header;
+  if (size < sizeof(header)) {
+    xrg_log_w("Pipeline cache file is too small (%zu bytes).", size);
+    return false;
+  }
+
+  memcpy(&header, data, sizeof(header));
+
+  if (header.headerSize < sizeof(header) || header.headerSize > size) {
+    xrg_log_w("Pipeline cache has invalid header size %d.",
+              header.headerSize);
+    return false;
+  }
+
+  if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+    xrg_log_w("Pipeline cache has unknown header version %d.",
+              header.headerVersion);
+    return false;
+  }
+
+  VkPhysicalDeviceProperties *props = &device->properties;
+  if (header.vendorID != props->vendorID ||
+      header.deviceID != props->deviceID) {
+    xrg_log_w("Pipeline cache is for device %04x:%04x, not %04x:%04x.",
+              header.vendorID, header.deviceID, props->vendorID,
+              props->deviceID);
+    return false;
+  }
+
+  if (memcmp(header.pipelineCacheUUID, props->pipelineCacheUUID,
+             VK_UUID_SIZE) != 0) {
+    xrg_log_w("Pipeline cache UUID does not match the driver.");
+    return false;
+  }
+
+  return true;
+}
+
+static void *
+_read_file(const char *path, size_t *size)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  if (length <= 0) {
+    fclose(file);
+    return NULL;
+  }
+
+  void *data = malloc(length);
+  if (fread(data, 1, length, file) != (size_t)length) {
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+
+  fclose(file);
+  *size = length;
+  return data;
+}
+
+void
+vulkan_pipeline_cache_init(vulkan_pipeline_cache *self,
+                           vulkan_device *device,
+                           const char *cache_dir)
+{
+  self->device = device->device;
+  self->path = NULL;
+
+  char *dir = cache_dir ? strdup(cache_dir) : _default_cache_dir();
+  if (dir && _create_dir(dir)) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/pipeline_cache_%04x_%04x.bin", dir,
+             device->properties.vendorID, device->properties.deviceID);
+    self->path = strdup(path);
+  } else {
+    xrg_log_w("No pipeline cache directory, pipelines will not persist.");
+  }
+  free(dir);
+
+  size_t size = 0;
+  void *data = self->path ? _read_file(self->path, &size) : NULL;
+
+  VkPipelineCacheCreateInfo info = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+  };
+
+  if (data && _validate_header(device, data, size)) {
+    info.initialDataSize = size;
+    info.pInitialData = data;
+    xrg_log_i("Loaded pipeline cache %s (%zu bytes).", self->path, size);
+  } else if (data) {
+    xrg_log_w("Discarding pipeline cache %s.", self->path);
+  }
+
+  VkResult res = vkCreatePipelineCache(self->device, &info, NULL, &self->cache);
+  if (res != VK_SUCCESS && info.pInitialData) {
+    xrg_log_w("Driver rejected pipeline cache data: %s",
+              vk_result_to_string(res));
+    info.initialDataSize = 0;
+    info.pInitialData = NULL;
+    res = vkCreatePipelineCache(self->device, &info, NULL, &self->cache);
+  }
+  vk_check(res);
+
+  free(data);
+}
+
+bool
+vulkan_pipeline_cache_save(vulkan_pipeline_cache *self)
+{
+  if (!self->path)
+    return false;
+
+  size_t size;
+  vk_check(vkGetPipelineCacheData(self->device, self->cache, &size, NULL));
+
+  void *data = malloc(size);
+  VkResult res = vkGetPipelineCacheData(self->device, self->cache, &size, data);
+  if (res != VK_SUCCESS) {
+    xrg_log_e("Could not get pipeline cache data: %s",
+              vk_result_to_string(res));
+    free(data);
+    return false;
+  }
+
+  // Write to a temporary file first so a crash can't leave a truncated cache
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", self->path);
+
+  FILE *file = fopen(tmp_path, "wb");
+  if (!file) {
+    xrg_log_e("Could not open %s for writing.", tmp_path);
+    free(data);
+    return false;
+  }
+
+  bool written = fwrite(data, 1, size, file) == size;
+  written = fclose(file) == 0 && written;
+  free(data);
+
+  if (!written || rename(tmp_path, self->path) != 0) {
+    xrg_log_e("Could not write pipeline cache %s.", self->path);
+    remove(tmp_path);
+    return false;
+  }
+
+  xrg_log_d("Saved pipeline cache %s (%zu bytes).", self->path, size);
+
+  return true;
+}
+
+void
+vulkan_pipeline_cache_destroy(vulkan_pipeline_cache *self)
+{
+  vulkan_pipeline_cache_save(self);
+  vkDestroyPipelineCache(self->device, self->cache, NULL);
+  free(self->path);
+}
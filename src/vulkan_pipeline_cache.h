@@ -0,0 +1,50 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * VkPipelineCache backed by a file per physical device, so pipelines built
+ * on a previous launch are cache hits.
+ */
+typedef struct
+{
+  VkDevice device;
+  VkPipelineCache cache;
+  char *path;
+} vulkan_pipeline_cache;
+
+/*
+ * cache_dir may be NULL, in which case $XDG_CACHE_HOME/xrgears or
+ * $HOME/.cache/xrgears is used.
+ */
+void
+vulkan_pipeline_cache_init(vulkan_pipeline_cache *self,
+                           vulkan_device *device,
+                           const char *cache_dir);
+
+bool
+vulkan_pipeline_cache_save(vulkan_pipeline_cache *self);
+
+void
+vulkan_pipeline_cache_destroy(vulkan_pipeline_cache *self);
+
+#ifdef __cplusplus
+}
+#endif
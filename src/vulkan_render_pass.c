@@ -0,0 +1,228 @@
+/*
+ * xrgears
+ *
+ * Copyright 2016 Sascha Willems - www.saschawillems.de
+ * Copyright 2017-2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_render_pass.h"
+
+#include "log.h"
+
+static bool
+_info_equal(const vulkan_render_pass_info *a, const vulkan_render_pass_info *b)
+{
+  return a->color_format == b->color_format &&
+         a->color_load_op == b->color_load_op &&
+         a->color_store_op == b->color_store_op &&
+         a->depth_format == b->depth_format &&
+         a->depth_load_op == b->depth_load_op &&
+         a->depth_store_op == b->depth_store_op && a->samples == b->samples;
+}
+
+static VkRenderPass
+_create_render_pass(VkDevice device, const vulkan_render_pass_info *info)
+{
+  bool has_depth = info->depth_format != VK_FORMAT_UNDEFINED;
+  bool has_resolve = info->samples != VK_SAMPLE_COUNT_1_BIT;
+
+  // Color, then optional depth and resolve
+  VkAttachmentDescription attachments[3] = {
+    {
+      .format = info->color_format,
+      .samples = info->samples,
+      .loadOp = info->color_load_op,
+      .storeOp = info->color_store_op,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    },
+  };
+  uint32_t attachment_count = 1;
+
+  VkAttachmentReference color_reference = {
+    .attachment = 0,
+    .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+
+  VkAttachmentReference depth_reference = {
+    .attachment = attachment_count,
+    .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+  };
+
+  if (has_depth) {
+    attachments[attachment_count++] = (VkAttachmentDescription){
+      .format = info->depth_format,
+      .samples = info->samples,
+      .loadOp = info->depth_load_op,
+      .storeOp = info->depth_store_op,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+  }
+
+  // Samples are averaged into the swapchain image at the end of the subpass
+  VkAttachmentReference resolve_reference = {
+    .attachment = attachment_count,
+    .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+
+  if (has_resolve) {
+    attachments[attachment_count++] = (VkAttachmentDescription){
+      .format = info->color_format,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+  }
+
+  VkSubpassDescription subpass = {
+    .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+    .colorAttachmentCount = 1,
+    .pColorAttachments = &color_reference,
+    .pResolveAttachments = has_resolve ? &resolve_reference : NULL,
+    .pDepthStencilAttachment = has_depth ? &depth_reference : NULL,
+  };
+
+  // Use subpass dependencies for attachment layout transitions
+  VkSubpassDependency dependencies[3] = {
+    {
+      .srcSubpass = VK_SUBPASS_EXTERNAL,
+      .dstSubpass = 0,
+      .srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      .srcAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+      .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                       VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+    },
+    // Depth can be shared between frames when it is not submitted
+    {
+      .srcSubpass = VK_SUBPASS_EXTERNAL,
+      .dstSubpass = 0,
+      .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                       VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+    },
+    {
+      .srcSubpass = 0,
+      .dstSubpass = VK_SUBPASS_EXTERNAL,
+      .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                       VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+      .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+    }
+  };
+
+  VkRenderPassCreateInfo render_pass_info = {
+    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+    .attachmentCount = attachment_count,
+    .pAttachments = attachments,
+    .subpassCount = 1,
+    .pSubpasses = &subpass,
+    .dependencyCount = 3,
+    .pDependencies = dependencies,
+  };
+
+  VkRenderPass render_pass;
+  vk_check(vkCreateRenderPass(device, &render_pass_info, NULL, &render_pass));
+
+  return render_pass;
+}
+
+vulkan_render_pass_info
+vulkan_render_pass_info_from_policy(const vulkan_attachment_policy *policy,
+                                    VkFormat color_format,
+                                    VkFormat depth_format)
+{
+  vulkan_render_pass_info info = {
+    .color_format = color_format,
+    .color_load_op = policy->covers_target ? VK_ATTACHMENT_LOAD_OP_DONT_CARE
+                                           : VK_ATTACHMENT_LOAD_OP_CLEAR,
+    .color_store_op = VK_ATTACHMENT_STORE_OP_STORE,
+    .depth_format = VK_FORMAT_UNDEFINED,
+    .depth_load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+    .depth_store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+    .samples = policy->samples,
+  };
+
+  // Only the resolved samples leave the tile
+  if (policy->samples != VK_SAMPLE_COUNT_1_BIT)
+    info.color_store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+  if (policy->depth_test) {
+    info.depth_format = depth_format;
+    info.depth_load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    if (policy->submits_depth)
+      info.depth_store_op = VK_ATTACHMENT_STORE_OP_STORE;
+  }
+
+  return info;
+}
+
+void
+vulkan_render_pass_cache_init(vulkan_render_pass_cache *self, VkDevice device)
+{
+  self->device = device;
+  self->entry_count = 0;
+}
+
+VkRenderPass
+vulkan_render_pass_cache_get(vulkan_render_pass_cache *self,
+                             const vulkan_render_pass_info *info)
+{
+  for (uint32_t i = 0; i < self->entry_count; i++)
+    if (_info_equal(&self->entries[i].info, info))
+      return self->entries[i].render_pass;
+
+  xrg_log_f_if(self->entry_count == VULKAN_RENDER_PASS_CACHE_SIZE,
+               "Render pass cache is full.");
+
+  VkRenderPass render_pass = _create_render_pass(self->device, info);
+
+  self->entries[self->entry_count].info = *info;
+  self->entries[self->entry_count].render_pass = render_pass;
+  self->entry_count++;
+
+  xrg_log_d("Created render pass %d (color %d, depth %d, %d samples).",
+            self->entry_count, info->color_format, info->depth_format,
+            info->samples);
+
+  return render_pass;
+}
+
+void
+vulkan_render_pass_cache_destroy(vulkan_render_pass_cache *self)
+{
+  for (uint32_t i = 0; i < self->entry_count; i++)
+    vkDestroyRenderPass(self->device, self->entries[i].render_pass, NULL);
+  self->entry_count = 0;
+}
+
+VkPipelineRenderingCreateInfoKHR
+vulkan_render_pass_info_get_rendering_info(const vulkan_render_pass_info *info)
+{
+  return (VkPipelineRenderingCreateInfoKHR){
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+    .colorAttachmentCount = 1,
+    .pColorAttachmentFormats = &info->color_format,
+    .depthAttachmentFormat = info->depth_format,
+    .stencilAttachmentFormat = VK_FORMAT_UNDEFINED,
+  };
+}
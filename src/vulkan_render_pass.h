@@ -0,0 +1,97 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VULKAN_RENDER_PASS_CACHE_SIZE 16
+
+typedef struct
+{
+  VkFormat color_format;
+  VkAttachmentLoadOp color_load_op;
+  VkAttachmentStoreOp color_store_op;
+
+  // VK_FORMAT_UNDEFINED for passes without depth attachment
+  VkFormat depth_format;
+  VkAttachmentLoadOp depth_load_op;
+  VkAttachmentStoreOp depth_store_op;
+
+  /*
+   * With more than one sample the color and depth attachments are
+   * multisampled and color is resolved into an additional single sampled
+   * attachment, which is always stored.
+   */
+  VkSampleCountFlagBits samples;
+} vulkan_render_pass_info;
+
+/*
+ * What a layer does with its attachments, used to pick load and store ops
+ * that avoid needless clears and writes back to memory.
+ */
+typedef struct
+{
+  // Every pixel of the color target is written, so no clear is needed
+  bool covers_target;
+  // The layer renders with depth testing
+  bool depth_test;
+  // Depth is submitted to the compositor and has to be stored
+  bool submits_depth;
+  // Multisampled layers keep their samples in transient attachments
+  VkSampleCountFlagBits samples;
+} vulkan_attachment_policy;
+
+/*
+ * Render passes shared by all framebuffers with the same attachment setup.
+ * Passes are owned by the cache and live until it is destroyed.
+ */
+typedef struct
+{
+  VkDevice device;
+
+  struct
+  {
+    vulkan_render_pass_info info;
+    VkRenderPass render_pass;
+  } entries[VULKAN_RENDER_PASS_CACHE_SIZE];
+  uint32_t entry_count;
+} vulkan_render_pass_cache;
+
+void
+vulkan_render_pass_cache_init(vulkan_render_pass_cache *self, VkDevice device);
+
+VkRenderPass
+vulkan_render_pass_cache_get(vulkan_render_pass_cache *self,
+                             const vulkan_render_pass_info *info);
+
+void
+vulkan_render_pass_cache_destroy(vulkan_render_pass_cache *self);
+
+vulkan_render_pass_info
+vulkan_render_pass_info_from_policy(const vulkan_attachment_policy *policy,
+                                    VkFormat color_format,
+                                    VkFormat depth_format);
+
+/*
+ * Attachment formats for pipelines used with VK_KHR_dynamic_rendering.
+ * Points into info, which needs to outlive the returned struct.
+ */
+VkPipelineRenderingCreateInfoKHR
+vulkan_render_pass_info_get_rendering_info(const vulkan_render_pass_info *info);
+
+#ifdef __cplusplus
+}
+#endif
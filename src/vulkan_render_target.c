@@ -0,0 +1,212 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_render_target.h"
+
+#include "log.h"
+#include "vulkan_barrier.h"
+
+static VkImageView
+_create_view(VkDevice device,
+             VkImage image,
+             VkFormat format,
+             VkImageAspectFlags aspect)
+{
+  VkImageViewCreateInfo info = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = image,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+    .format = format,
+    .subresourceRange =
+    {
+      .aspectMask = aspect,
+      .baseMipLevel = 0,
+      .levelCount = 1,
+      .baseArrayLayer = 0,
+      .layerCount = 1,
+    },
+  };
+
+  VkImageView view;
+  vk_check(vkCreateImageView(device, &info, NULL, &view));
+  return view;
+}
+
+void
+vulkan_render_target_init(vulkan_render_target *self,
+                          vulkan_device *device,
+                          VkImage color_image,
+                          VkImage resolve_image,
+                          VkFormat color_format,
+                          VkImage depth_image,
+                          VkFormat depth_format,
+                          uint32_t width,
+                          uint32_t height)
+{
+  self->device = device;
+  self->color_image = color_image;
+  self->color_format = color_format;
+  self->color_view = VK_NULL_HANDLE;
+  self->resolve_image = resolve_image;
+  self->resolve_view = VK_NULL_HANDLE;
+  self->depth_image = depth_image;
+  self->depth_format = depth_format;
+  self->depth_view = VK_NULL_HANDLE;
+  self->width = width;
+  self->height = height;
+}
+
+void
+vulkan_render_target_destroy(vulkan_render_target *self)
+{
+  if (self->color_view)
+    vkDestroyImageView(self->device->device, self->color_view, NULL);
+  if (self->depth_view)
+    vkDestroyImageView(self->device->device, self->depth_view, NULL);
+  if (self->resolve_view)
+    vkDestroyImageView(self->device->device, self->resolve_view, NULL);
+  self->color_view = VK_NULL_HANDLE;
+  self->resolve_view = VK_NULL_HANDLE;
+  self->depth_view = VK_NULL_HANDLE;
+}
+
+static void
+_create_views(vulkan_render_target *self)
+{
+  VkDevice device = self->device->device;
+
+  if (!self->color_view)
+    self->color_view = _create_view(device, self->color_image,
+                                    self->color_format,
+                                    VK_IMAGE_ASPECT_COLOR_BIT);
+
+  if (self->resolve_image && !self->resolve_view)
+    self->resolve_view = _create_view(device, self->resolve_image,
+                                      self->color_format,
+                                      VK_IMAGE_ASPECT_COLOR_BIT);
+
+  if (self->depth_image && !self->depth_view)
+    self->depth_view = _create_view(device, self->depth_image,
+                                    self->depth_format,
+                                    VK_IMAGE_ASPECT_DEPTH_BIT);
+}
+
+/*
+ * Previous contents are discarded, but writes from the last frame that used
+ * the attachments still need to finish first.
+ */
+static void
+_transition_attachments(vulkan_render_target *self, VkCommandBuffer cmd_buffer)
+{
+  VkImageSubresourceRange color_range = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .levelCount = 1,
+    .layerCount = 1,
+  };
+
+  vulkan_barrier_batch barriers;
+  vulkan_barrier_batch_init(&barriers, self->device, cmd_buffer);
+
+  vulkan_barrier_batch_discard_image(&barriers, self->color_image, color_range,
+                                     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+  if (self->depth_image) {
+    VkImageSubresourceRange depth_range = {
+      .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+      .levelCount = 1,
+      .layerCount = 1,
+    };
+    vulkan_barrier_batch_discard_image(
+      &barriers, self->depth_image, depth_range,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+  }
+
+  if (self->resolve_image)
+    vulkan_barrier_batch_discard_image(
+      &barriers, self->resolve_image, color_range,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+  vulkan_barrier_batch_flush(&barriers);
+}
+
+void
+vulkan_render_target_begin(vulkan_render_target *self,
+                           VkCommandBuffer cmd_buffer,
+                           const vulkan_render_pass_info *info)
+{
+  _create_views(self);
+  _transition_attachments(self, cmd_buffer);
+
+  VkRenderingAttachmentInfoKHR color_attachment = {
+    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+    .imageView = self->color_view,
+    .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    .loadOp = info->color_load_op,
+    .storeOp = info->color_store_op,
+    .clearValue = { .color = { { 0.0f, 0.0f, 0.0f, 0.0f } } },
+  };
+
+  if (self->resolve_view) {
+    color_attachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT_KHR;
+    color_attachment.resolveImageView = self->resolve_view;
+    color_attachment.resolveImageLayout =
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  }
+
+  VkRenderingAttachmentInfoKHR depth_attachment = {
+    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+    .imageView = self->depth_view,
+    .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    .loadOp = info->depth_load_op,
+    .storeOp = info->depth_store_op,
+    .clearValue = { .depthStencil = { 1.0f, 0 } },
+  };
+
+  VkRenderingInfoKHR rendering_info = {
+    .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+    .renderArea = { .extent = { .width = self->width,
+                                .height = self->height } },
+    .layerCount = 1,
+    .colorAttachmentCount = 1,
+    .pColorAttachments = &color_attachment,
+    .pDepthAttachment = self->depth_view ? &depth_attachment : NULL,
+  };
+
+  self->device->cmd_begin_rendering(cmd_buffer, &rendering_info);
+}
+
+void
+vulkan_render_target_end(vulkan_render_target *self,
+                         VkCommandBuffer cmd_buffer)
+{
+  /*
+   * Attachments stay in attachment layout, which is what the runtime expects
+   * on xrReleaseSwapchainImage.
+   */
+  self->device->cmd_end_rendering(cmd_buffer);
+}
+
+void
+vulkan_render_target_set_viewport_and_scissor(vulkan_render_target *self,
+                                              VkCommandBuffer cmd_buffer)
+{
+  VkViewport viewport = { .width = (float)self->width,
+                          .height = (float)self->height,
+                          .minDepth = 0.0f,
+                          .maxDepth = 1.0f };
+  vkCmdSetViewport(cmd_buffer, 0, 1, &viewport);
+
+  VkRect2D scissor = { .offset = { .x = 0, .y = 0 },
+                       .extent = { .width = self->width,
+                                   .height = self->height } };
+  vkCmdSetScissor(cmd_buffer, 0, 1, &scissor);
+}
@@ -0,0 +1,75 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+#include "vulkan_render_pass.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A swapchain image rendered with VK_KHR_dynamic_rendering, the replacement
+ * for vulkan_framebuffer when no VkRenderPass is used. Image views are only
+ * created when the target is first recorded into.
+ */
+typedef struct
+{
+  vulkan_device *device;
+
+  VkImage color_image;
+  VkFormat color_format;
+  VkImageView color_view;
+
+  // Swapchain image multisampled color resolves to, or VK_NULL_HANDLE
+  VkImage resolve_image;
+  VkImageView resolve_view;
+
+  // VK_NULL_HANDLE for targets without depth attachment
+  VkImage depth_image;
+  VkFormat depth_format;
+  VkImageView depth_view;
+
+  uint32_t width, height;
+} vulkan_render_target;
+
+void
+vulkan_render_target_init(vulkan_render_target *self,
+                          vulkan_device *device,
+                          VkImage color_image,
+                          VkImage resolve_image,
+                          VkFormat color_format,
+                          VkImage depth_image,
+                          VkFormat depth_format,
+                          uint32_t width,
+                          uint32_t height);
+
+void
+vulkan_render_target_destroy(vulkan_render_target *self);
+
+void
+vulkan_render_target_begin(vulkan_render_target *self,
+                           VkCommandBuffer cmd_buffer,
+                           const vulkan_render_pass_info *info);
+
+void
+vulkan_render_target_end(vulkan_render_target *self,
+                         VkCommandBuffer cmd_buffer);
+
+void
+vulkan_render_target_set_viewport_and_scissor(vulkan_render_target *self,
+                                              VkCommandBuffer cmd_buffer);
+
+#ifdef __cplusplus
+}
+#endif
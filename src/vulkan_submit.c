@@ -0,0 +1,483 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_submit.h"
+
+#include <string.h>
+
+#include "vulkan_barrier.h"
+#include "log.h"
+
+void
+vulkan_submit_init(vulkan_submit *self,
+                   vulkan_device *device,
+                   VkQueue queue,
+                   uint32_t family_index)
+{
+  self->device = device;
+  self->queue = queue;
+  self->family_index = family_index;
+  self->source = NULL;
+  self->open = NULL;
+  self->last_ticket = 0;
+  self->completed_ticket = 0;
+
+  self->staging.buffer = VK_NULL_HANDLE;
+  self->staging_head = 0;
+  self->staging_tail = 0;
+
+  pthread_mutex_init(&self->mutex, NULL);
+  pthread_mutex_init(&self->queue_mutex, NULL);
+
+  VkCommandPoolCreateInfo pool_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+             VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = family_index,
+  };
+  vk_check(
+    vkCreateCommandPool(device->device, &pool_info, NULL, &self->cmd_pool));
+
+  VkCommandBufferAllocateInfo cmd_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = self->cmd_pool,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1,
+  };
+
+  VkFenceCreateInfo fence_info = {
+    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+  };
+
+  for (uint32_t i = 0; i < VULKAN_SUBMIT_MAX_BATCHES; i++) {
+    vulkan_submit_batch *batch = &self->batches[i];
+    vk_check(vkAllocateCommandBuffers(device->device, &cmd_info,
+                                      &batch->cmd_buffer));
+    vk_check(vkCreateFence(device->device, &fence_info, NULL, &batch->fence));
+    batch->wait_semaphore = VK_NULL_HANDLE;
+    batch->ticket = 0;
+    batch->submitted = false;
+    batch->staging_end = 0;
+    batch->cleanups = NULL;
+    batch->cleanup_count = 0;
+    batch->cleanup_capacity = 0;
+  }
+}
+
+static void
+_retire(vulkan_submit *self, vulkan_submit_batch *batch)
+{
+  for (uint32_t i = 0; i < batch->cleanup_count; i++)
+    batch->cleanups[i].func(batch->cleanups[i].data);
+  batch->cleanup_count = 0;
+
+  if (batch->wait_semaphore != VK_NULL_HANDLE) {
+    vkDestroySemaphore(self->device->device, batch->wait_semaphore, NULL);
+    batch->wait_semaphore = VK_NULL_HANDLE;
+  }
+
+  vk_check(vkResetFences(self->device->device, 1, &batch->fence));
+
+  self->completed_ticket = batch->ticket;
+  self->staging_tail = batch->staging_end;
+  batch->ticket = 0;
+  batch->submitted = false;
+}
+
+static vulkan_submit_batch *
+_get_oldest_submitted(vulkan_submit *self)
+{
+  vulkan_submit_batch *oldest = NULL;
+  for (uint32_t i = 0; i < VULKAN_SUBMIT_MAX_BATCHES; i++) {
+    vulkan_submit_batch *batch = &self->batches[i];
+    if (batch->submitted && (!oldest || batch->ticket < oldest->ticket))
+      oldest = batch;
+  }
+  return oldest;
+}
+
+// Retires in submission order, optionally blocking until ticket is done
+static void
+_retire_completed(vulkan_submit *self, vulkan_submit_ticket wait_ticket)
+{
+  vulkan_submit_batch *batch;
+  while ((batch = _get_oldest_submitted(self))) {
+    if (batch->ticket <= wait_ticket)
+      vk_check(vkWaitForFences(self->device->device, 1, &batch->fence,
+                               VK_TRUE, UINT64_MAX));
+    else if (vkGetFenceStatus(self->device->device, batch->fence) !=
+             VK_SUCCESS)
+      break;
+    _retire(self, batch);
+  }
+}
+
+static vulkan_submit_batch *
+_get_free_batch(vulkan_submit *self)
+{
+  _retire_completed(self, 0);
+
+  for (uint32_t i = 0; i < VULKAN_SUBMIT_MAX_BATCHES; i++)
+    if (self->batches[i].ticket == 0)
+      return &self->batches[i];
+
+  // All batches in flight, wait for the oldest
+  vulkan_submit_batch *oldest = _get_oldest_submitted(self);
+  _retire_completed(self, oldest->ticket);
+  return oldest;
+}
+
+static void
+_open_batch(vulkan_submit *self)
+{
+  vulkan_submit_batch *batch = _get_free_batch(self);
+
+  VkCommandBufferBeginInfo begin_info = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vk_check(vkBeginCommandBuffer(batch->cmd_buffer, &begin_info));
+
+  batch->ticket = ++self->last_ticket;
+  self->open = batch;
+}
+
+static void
+_submit_open(vulkan_submit *self, VkSemaphore signal_semaphore)
+{
+  vulkan_submit_batch *batch = self->open;
+
+  vk_check(vkEndCommandBuffer(batch->cmd_buffer));
+
+  // Ownership acquires may run in any stage
+  VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+  VkSubmitInfo submit_info = {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .waitSemaphoreCount = batch->wait_semaphore != VK_NULL_HANDLE ? 1 : 0,
+    .pWaitSemaphores = &batch->wait_semaphore,
+    .pWaitDstStageMask = &wait_stage,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &batch->cmd_buffer,
+    .signalSemaphoreCount = signal_semaphore != VK_NULL_HANDLE ? 1 : 0,
+    .pSignalSemaphores = &signal_semaphore,
+  };
+  pthread_mutex_lock(&self->queue_mutex);
+  vk_check(vkQueueSubmit(self->queue, 1, &submit_info, batch->fence));
+  pthread_mutex_unlock(&self->queue_mutex);
+
+  batch->staging_end = self->staging_head;
+  batch->submitted = true;
+  self->open = NULL;
+}
+
+static void
+_flush(vulkan_submit *self)
+{
+  if (self->source) {
+    pthread_mutex_lock(&self->source->mutex);
+    if (self->source->open) {
+      // Keeps the semaphore wait even if nothing was recorded here
+      if (!self->open)
+        _open_batch(self);
+
+      VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      };
+      vk_check(vkCreateSemaphore(self->device->device, &semaphore_info, NULL,
+                                 &self->open->wait_semaphore));
+
+      _submit_open(self->source, self->open->wait_semaphore);
+    }
+    pthread_mutex_unlock(&self->source->mutex);
+  }
+
+  if (self->open)
+    _submit_open(self, VK_NULL_HANDLE);
+}
+
+void
+vulkan_submit_set_source(vulkan_submit *self, vulkan_submit *source)
+{
+  pthread_mutex_lock(&self->mutex);
+  self->source = source;
+  pthread_mutex_unlock(&self->mutex);
+}
+
+// Contiguous bytes up to size at start, which must not cross into the next lap
+static VkDeviceSize
+_staging_fit(vulkan_submit *self, uint64_t start, VkDeviceSize size)
+{
+  uint64_t lap_end =
+    (start / VULKAN_SUBMIT_STAGING_SIZE + 1) * VULKAN_SUBMIT_STAGING_SIZE;
+  uint64_t limit = self->staging_tail + VULKAN_SUBMIT_STAGING_SIZE;
+  if (lap_end < limit)
+    limit = lap_end;
+  if (start >= limit)
+    return 0;
+  return limit - start < size ? limit - start : size;
+}
+
+// Regions do not wrap, skips the end of the lap when the start fits more
+static VkDeviceSize
+_staging_reserve(vulkan_submit *self, VkDeviceSize size, uint64_t *start)
+{
+  uint64_t head = (self->staging_head + VULKAN_SUBMIT_STAGING_ALIGNMENT - 1) &
+                  ~(uint64_t)(VULKAN_SUBMIT_STAGING_ALIGNMENT - 1);
+  uint64_t wrapped =
+    (head / VULKAN_SUBMIT_STAGING_SIZE + 1) * VULKAN_SUBMIT_STAGING_SIZE;
+
+  VkDeviceSize fit = _staging_fit(self, head, size);
+  VkDeviceSize wrapped_fit = _staging_fit(self, wrapped, size);
+
+  *start = wrapped_fit > fit ? wrapped : head;
+  return wrapped_fit > fit ? wrapped_fit : fit;
+}
+
+static void
+_init_staging(vulkan_submit *self)
+{
+  vk_check(vulkan_device_create_buffer(
+    self->device, &self->staging, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    VULKAN_SUBMIT_STAGING_SIZE, NULL));
+  vk_check(vulkan_buffer_map(&self->staging));
+}
+
+VkCommandBuffer
+vulkan_submit_begin_staging(vulkan_submit *self,
+                            VkDeviceSize size,
+                            vulkan_submit_staging *staging)
+{
+  VkCommandBuffer cmd_buffer = vulkan_submit_begin(self);
+
+  if (self->staging.buffer == VK_NULL_HANDLE)
+    _init_staging(self);
+
+  if (size > VULKAN_SUBMIT_STAGING_SIZE / 2)
+    size = VULKAN_SUBMIT_STAGING_SIZE / 2;
+
+  uint64_t start;
+  VkDeviceSize fit;
+  vulkan_submit_batch *oldest;
+  while ((fit = _staging_reserve(self, size, &start)) < size &&
+         (oldest = _get_oldest_submitted(self)))
+    _retire_completed(self, oldest->ticket);
+
+  self->staging_head = start + fit;
+
+  VkDeviceSize offset = start % VULKAN_SUBMIT_STAGING_SIZE;
+  *staging = (vulkan_submit_staging){
+    .buffer = self->staging.buffer,
+    .offset = offset,
+    .size = fit,
+    .data = (uint8_t *)self->staging.mapped + offset,
+  };
+
+  return cmd_buffer;
+}
+
+VkCommandBuffer
+vulkan_submit_begin(vulkan_submit *self)
+{
+  pthread_mutex_lock(&self->mutex);
+
+  if (!self->open)
+    _open_batch(self);
+
+  return self->open->cmd_buffer;
+}
+
+vulkan_submit_ticket
+vulkan_submit_end(vulkan_submit *self,
+                  vulkan_submit_cleanup_func cleanup,
+                  void *data)
+{
+  vulkan_submit_batch *batch = self->open;
+
+  if (cleanup) {
+    if (batch->cleanup_count == batch->cleanup_capacity) {
+      batch->cleanup_capacity =
+        batch->cleanup_capacity ? batch->cleanup_capacity * 2 : 8;
+      batch->cleanups =
+        realloc(batch->cleanups,
+                sizeof(vulkan_submit_cleanup) * batch->cleanup_capacity);
+    }
+    batch->cleanups[batch->cleanup_count++] = (vulkan_submit_cleanup){
+      .func = cleanup,
+      .data = data,
+    };
+  }
+
+  vulkan_submit_ticket ticket = batch->ticket;
+
+  pthread_mutex_unlock(&self->mutex);
+
+  return ticket;
+}
+
+VkCommandBuffer
+vulkan_submit_begin_transfer(vulkan_submit *self, VkCommandBuffer *release_cmd)
+{
+  // Same lock order as _flush
+  VkCommandBuffer acquire_cmd = vulkan_submit_begin(self);
+  *release_cmd = vulkan_submit_begin(self->source);
+  return acquire_cmd;
+}
+
+vulkan_submit_ticket
+vulkan_submit_end_transfer(vulkan_submit *self)
+{
+  vulkan_submit_end(self->source, NULL, NULL);
+  return vulkan_submit_end(self, NULL, NULL);
+}
+
+vulkan_submit_ticket
+vulkan_submit_upload_buffer(vulkan_submit *self,
+                            vulkan_buffer *buffer,
+                            const void *data,
+                            VkDeviceSize size,
+                            VkPipelineStageFlags2KHR dst_stages,
+                            VkAccessFlags2KHR dst_access)
+{
+  vulkan_submit *copy_submit = self->source ? self->source : self;
+  uint32_t src_family = VK_QUEUE_FAMILY_IGNORED;
+  uint32_t dst_family = VK_QUEUE_FAMILY_IGNORED;
+  if (copy_submit != self) {
+    src_family = copy_submit->family_index;
+    dst_family = self->family_index;
+  }
+
+  VkDeviceSize offset = 0;
+  vulkan_barrier_batch barriers;
+
+  while (true) {
+    vulkan_submit_staging staging;
+    VkCommandBuffer copy_cmd =
+      vulkan_submit_begin_staging(copy_submit, size - offset, &staging);
+
+    if (staging.size > 0) {
+      memcpy(staging.data, (const uint8_t *)data + offset, staging.size);
+      VkBufferCopy region = {
+        .srcOffset = staging.offset,
+        .dstOffset = offset,
+        .size = staging.size,
+      };
+      vkCmdCopyBuffer(copy_cmd, staging.buffer, buffer->buffer, 1, &region);
+      offset += staging.size;
+    }
+
+    if (offset == size && copy_submit == self) {
+      vulkan_barrier_batch_init(&barriers, self->device, copy_cmd);
+      vulkan_barrier_batch_add_buffer(
+        &barriers, buffer->buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, dst_stages, dst_access,
+        src_family, dst_family);
+      vulkan_barrier_batch_flush(&barriers);
+      return vulkan_submit_end(self, NULL, NULL);
+    }
+
+    vulkan_submit_end(copy_submit, NULL, NULL);
+    if (offset == size)
+      break;
+
+    // Submits this part so its staging memory can be reused
+    vulkan_submit_flush(self);
+  }
+
+  // The release follows the copies on the same queue
+  VkCommandBuffer release_cmd;
+  VkCommandBuffer acquire_cmd =
+    vulkan_submit_begin_transfer(self, &release_cmd);
+
+  // A release leaves the destination scope to the acquire
+  vulkan_barrier_batch_init(&barriers, self->device, release_cmd);
+  vulkan_barrier_batch_add_buffer(&barriers, buffer->buffer,
+                                  VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+                                  VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, 0, 0,
+                                  src_family, dst_family);
+  vulkan_barrier_batch_flush(&barriers);
+
+  vulkan_barrier_batch_init(&barriers, self->device, acquire_cmd);
+  vulkan_barrier_batch_add_buffer(&barriers, buffer->buffer, 0, 0, dst_stages,
+                                  dst_access, src_family, dst_family);
+  vulkan_barrier_batch_flush(&barriers);
+  return vulkan_submit_end_transfer(self);
+}
+
+void
+vulkan_submit_flush(vulkan_submit *self)
+{
+  pthread_mutex_lock(&self->mutex);
+  _flush(self);
+  pthread_mutex_unlock(&self->mutex);
+}
+
+void
+vulkan_submit_poll(vulkan_submit *self)
+{
+  pthread_mutex_lock(&self->mutex);
+  _retire_completed(self, 0);
+  pthread_mutex_unlock(&self->mutex);
+
+  // Frees the source's staging memory without waiting for its next batch
+  if (self->source)
+    vulkan_submit_poll(self->source);
+}
+
+void
+vulkan_submit_lock_queue(vulkan_submit *self)
+{
+  pthread_mutex_lock(&self->queue_mutex);
+}
+
+void
+vulkan_submit_unlock_queue(vulkan_submit *self)
+{
+  pthread_mutex_unlock(&self->queue_mutex);
+}
+
+bool
+vulkan_submit_is_done(vulkan_submit *self, vulkan_submit_ticket ticket)
+{
+  pthread_mutex_lock(&self->mutex);
+  _retire_completed(self, 0);
+  bool done = ticket <= self->completed_ticket;
+  pthread_mutex_unlock(&self->mutex);
+  return done;
+}
+
+void
+vulkan_submit_wait(vulkan_submit *self, vulkan_submit_ticket ticket)
+{
+  pthread_mutex_lock(&self->mutex);
+  if (self->open && self->open->ticket <= ticket)
+    _flush(self);
+  _retire_completed(self, ticket);
+  pthread_mutex_unlock(&self->mutex);
+}
+
+void
+vulkan_submit_destroy(vulkan_submit *self)
+{
+  vulkan_submit_wait(self, self->last_ticket);
+
+  for (uint32_t i = 0; i < VULKAN_SUBMIT_MAX_BATCHES; i++) {
+    vkDestroyFence(self->device->device, self->batches[i].fence, NULL);
+    free(self->batches[i].cleanups);
+  }
+
+  if (self->staging.buffer != VK_NULL_HANDLE)
+    vulkan_buffer_destroy(&self->staging);
+
+  // Frees the command buffers too
+  vkDestroyCommandPool(self->device->device, self->cmd_pool, NULL);
+  pthread_mutex_destroy(&self->queue_mutex);
+  pthread_mutex_destroy(&self->mutex);
+}
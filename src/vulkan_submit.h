@@ -0,0 +1,217 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Batches in flight before recording waits for the oldest one
+#define VULKAN_SUBMIT_MAX_BATCHES 4
+
+/*
+ * Persistently mapped staging memory shared by all uploads. A single upload
+ * takes at most half of it, so the next one can be filled while the
+ * previous copy is in flight.
+ */
+#define VULKAN_SUBMIT_STAGING_SIZE (16 * 1024 * 1024)
+#define VULKAN_SUBMIT_STAGING_ALIGNMENT 16
+
+/*
+ * Identifies the batch a caller recorded into. Batches complete in
+ * submission order, so a ticket is done once the completed ticket reached it.
+ */
+typedef uint64_t vulkan_submit_ticket;
+
+// Runs on whichever thread notices the batch has completed
+typedef void (*vulkan_submit_cleanup_func)(void *data);
+
+typedef struct
+{
+  vulkan_submit_cleanup_func func;
+  void *data;
+} vulkan_submit_cleanup;
+
+typedef struct
+{
+  VkCommandBuffer cmd_buffer;
+  VkFence fence;
+
+  // Signaled by the source's batch flushed along with this one
+  VkSemaphore wait_semaphore;
+
+  // 0 while the batch is free
+  vulkan_submit_ticket ticket;
+  bool submitted;
+
+  // Staging ring position when submitted, everything before is free after
+  uint64_t staging_end;
+
+  vulkan_submit_cleanup *cleanups;
+  uint32_t cleanup_count;
+  uint32_t cleanup_capacity;
+} vulkan_submit_batch;
+
+/*
+ * Immediate submission of one shot work like uploads. Callers append to a
+ * shared command buffer and get a ticket instead of blocking, the batch is
+ * submitted when flushed. Command buffers and fences are recycled once their
+ * batch has completed, together with the resources callers attached to it.
+ *
+ * Recording is serialized by the mutex held between begin and end. Batches
+ * can be submitted from any thread, so everything else using the queue,
+ * like frame submission and the OpenXR runtime, takes the queue lock.
+ */
+typedef struct vulkan_submit
+{
+  vulkan_device *device;
+  VkQueue queue;
+  uint32_t family_index;
+  VkCommandPool cmd_pool;
+
+  /*
+   * Submit on another queue family whose open batch is flushed before this
+   * one's, which waits for it. NULL when everything runs on this queue.
+   */
+  struct vulkan_submit *source;
+
+  pthread_mutex_t mutex;
+  // Held while submitting to queue, taken after mutex
+  pthread_mutex_t queue_mutex;
+
+  vulkan_submit_batch batches[VULKAN_SUBMIT_MAX_BATCHES];
+  // Batch callers record into, or NULL
+  vulkan_submit_batch *open;
+
+  vulkan_submit_ticket last_ticket;
+  vulkan_submit_ticket completed_ticket;
+
+  /*
+   * Created on first use. Positions grow monotonically, modulo the size
+   * they are offsets into the buffer.
+   */
+  vulkan_buffer staging;
+  uint64_t staging_head;
+  uint64_t staging_tail;
+} vulkan_submit;
+
+// Part of the staging ring reserved for the open batch
+typedef struct
+{
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  VkDeviceSize size;
+  void *data;
+} vulkan_submit_staging;
+
+void
+vulkan_submit_init(vulkan_submit *self,
+                   vulkan_device *device,
+                   VkQueue queue,
+                   uint32_t family_index);
+
+/*
+ * Work recorded on source, like a copy on the transfer queue followed by
+ * an ownership release, becomes visible to batches flushed here afterwards.
+ * Only this submit may flush source.
+ */
+void
+vulkan_submit_set_source(vulkan_submit *self, vulkan_submit *source);
+
+void
+vulkan_submit_destroy(vulkan_submit *self);
+
+// Returns a recording command buffer, must be followed by vulkan_submit_end
+VkCommandBuffer
+vulkan_submit_begin(vulkan_submit *self);
+
+/*
+ * vulkan_submit_begin with up to size bytes of staging memory, waiting for
+ * batches in flight if the ring is full. Less is returned for large
+ * uploads, which continue in following batches. The size is 0 when the
+ * open batch itself holds the ring, callers then end and flush first.
+ */
+VkCommandBuffer
+vulkan_submit_begin_staging(vulkan_submit *self,
+                            VkDeviceSize size,
+                            vulkan_submit_staging *staging);
+
+/*
+ * Finishes the caller's recording. cleanup is called with data after the
+ * work completed, e.g. to free staging buffers, and can be NULL.
+ */
+vulkan_submit_ticket
+vulkan_submit_end(vulkan_submit *self,
+                  vulkan_submit_cleanup_func cleanup,
+                  void *data);
+
+/*
+ * Begins a queue family ownership transfer from source. The release is
+ * recorded into release_cmd on source, the acquire into the returned
+ * command buffer. Both stay open until vulkan_submit_end_transfer, so no
+ * flush can submit the release without the acquire waiting for it.
+ */
+VkCommandBuffer
+vulkan_submit_begin_transfer(vulkan_submit *self,
+                             VkCommandBuffer *release_cmd);
+
+// Returns the ticket of the acquire
+vulkan_submit_ticket
+vulkan_submit_end_transfer(vulkan_submit *self);
+
+/*
+ * Fills a device local buffer created with VK_BUFFER_USAGE_TRANSFER_DST_BIT
+ * from a staging copy of data, recorded on the source queue if there is one.
+ * dst_stages and dst_access describe the buffer's first use on this queue.
+ */
+vulkan_submit_ticket
+vulkan_submit_upload_buffer(vulkan_submit *self,
+                            vulkan_buffer *buffer,
+                            const void *data,
+                            VkDeviceSize size,
+                            VkPipelineStageFlags2KHR dst_stages,
+                            VkAccessFlags2KHR dst_access);
+
+// Submits the open batch without waiting for it
+void
+vulkan_submit_flush(vulkan_submit *self);
+
+// Recycles completed batches, cheap enough to call every frame
+void
+vulkan_submit_poll(vulkan_submit *self);
+
+/*
+ * Guards other uses of the queue against batches flushed on other threads.
+ * Must not be held while calling other vulkan_submit functions.
+ */
+void
+vulkan_submit_lock_queue(vulkan_submit *self);
+
+void
+vulkan_submit_unlock_queue(vulkan_submit *self);
+
+// Does not flush, an unsubmitted ticket is never done
+bool
+vulkan_submit_is_done(vulkan_submit *self, vulkan_submit_ticket ticket);
+
+// Flushes if needed and blocks until the ticket's batch completed
+void
+vulkan_submit_wait(vulkan_submit *self, vulkan_submit_ticket ticket);
+
+#ifdef __cplusplus
+}
+#endif
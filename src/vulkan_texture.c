@@ -10,50 +10,7 @@
 #include "vulkan_texture.h"
 
 #include "log.h"
-
-static VkAccessFlags
-_get_access_flags(VkImageLayout layout)
-{
-  switch (layout) {
-  case VK_IMAGE_LAYOUT_UNDEFINED: return 0;
-  case VK_IMAGE_LAYOUT_PREINITIALIZED: return VK_ACCESS_HOST_WRITE_BIT;
-  case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-    return VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-    return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-  case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: return VK_ACCESS_TRANSFER_READ_BIT;
-  case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-    return VK_ACCESS_TRANSFER_WRITE_BIT;
-  case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-    return VK_ACCESS_SHADER_READ_BIT;
-  default: xrg_log_e("Unhandled access mask case for layout %d.", layout);
-  }
-  return 0;
-}
-
-static void
-_set_image_layout(VkCommandBuffer cmd_buffer,
-                  VkImage image,
-                  VkImageLayout src_layout,
-                  VkImageLayout dst_layout,
-                  VkImageSubresourceRange subresource_range)
-{
-  VkImageMemoryBarrier imageMemoryBarrier = {
-    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-    .srcAccessMask = _get_access_flags(src_layout),
-    .dstAccessMask = _get_access_flags(dst_layout),
-    .oldLayout = src_layout,
-    .newLayout = dst_layout,
-    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-    .image = image,
-    .subresourceRange = subresource_range,
-  };
-
-  vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL,
-                       1, &imageMemoryBarrier);
-}
+#include "vulkan_barrier.h"
 
 VkDescriptorImageInfo
 vulkan_texture_get_descriptor(vulkan_texture *self)
@@ -71,27 +28,30 @@ vulkan_texture_destroy(vulkan_texture *self)
 {
   if (self->view)
     vkDestroyImageView(self->device->device, self->view, NULL);
-  if (!self->created_from_image)
-    vkDestroyImage(self->device->device, self->image, NULL);
+  vkDestroyImage(self->device->device, self->image, NULL);
   if (self->sampler)
     vkDestroySampler(self->device->device, self->sampler, NULL);
   if (self->device_memory)
-    vkFreeMemory(self->device->device, self->device_memory, NULL);
+    vulkan_device_free_memory(self->device, self->device_memory);
+  free(self->level_tickets);
 }
 
 static void
-_create_image(vulkan_texture *self, VkFormat format)
+_create_image(vulkan_texture *self, bool cube)
 {
   VkImageCreateInfo info = {
     .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .flags = cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0,
     .imageType = VK_IMAGE_TYPE_2D,
-    .format = format,
+    .format = self->format,
     .extent = { .width = self->width, .height = self->height, .depth = 1 },
     .mipLevels = self->mip_levels,
-    .arrayLayers = 1,
+    .arrayLayers = self->layer_count,
     .samples = VK_SAMPLE_COUNT_1_BIT,
     .tiling = VK_IMAGE_TILING_OPTIMAL,
-    .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    // Source of copies into swapchain images
+    .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+             VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
     .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
   };
@@ -100,150 +60,404 @@ _create_image(vulkan_texture *self, VkFormat format)
 }
 
 static void
-_load_ktx_to_staging_mem(vulkan_texture *self,
-                         ktxTexture *tex,
-                         VkMemoryRequirements *out_mem_reqs,
-                         VkMemoryAllocateInfo *out_mem_info,
-                         VkBuffer *out_staging_buffer,
-                         VkDeviceMemory *out_staging_memory,
-                         VkBufferImageCopy *buffer_image_copies)
+_allocate_image_memory(VkImage image,
+                       vulkan_device *device,
+                       VkMemoryRequirements *mem_reqs,
+                       VkMemoryAllocateInfo *mem_info,
+                       VkDeviceMemory *out_memory)
 {
-  VkBufferCreateInfo bufferCreateInfo = {
-    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-    .size = ktxTexture_GetSize(tex),
-    .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
-  };
-
-  vk_check(vkCreateBuffer(self->device->device, &bufferCreateInfo, NULL,
-                          out_staging_buffer));
-
-  vkGetBufferMemoryRequirements(self->device->device, *out_staging_buffer,
-                                out_mem_reqs);
-
-  uint32_t type_index;
-  vulkan_device_get_memory_type(self->device, out_mem_reqs->memoryTypeBits,
-                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                &type_index);
+  vkGetImageMemoryRequirements(device->device, image, mem_reqs);
 
-  *out_mem_info = (VkMemoryAllocateInfo){
-    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-    .allocationSize = out_mem_reqs->size,
-    .memoryTypeIndex = type_index,
-  };
+  mem_info->allocationSize = mem_reqs->size;
 
-  vk_check(vkAllocateMemory(self->device->device, out_mem_info, NULL,
-                            out_staging_memory));
-  vk_check(vkBindBufferMemory(self->device->device, *out_staging_buffer,
-                              *out_staging_memory, 0));
+  vulkan_device_get_memory_type(device, mem_reqs->memoryTypeBits,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                &mem_info->memoryTypeIndex);
+  vk_check(vulkan_device_allocate_memory(device, VULKAN_MEMORY_TEXTURE,
+                                         mem_info, out_memory));
+  vk_check(vkBindImageMemory(device->device, image, *out_memory, 0));
+}
 
-  uint8_t *data;
-  vk_check(vkMapMemory(self->device->device, *out_staging_memory, 0,
-                       out_mem_reqs->size, 0, (void **)&data));
+/*
+ * Next block row to stage, layers count the faces of all array elements.
+ * Levels are staged smallest first, so the texture becomes usable early,
+ * step counts the levels staged completely.
+ */
+typedef struct
+{
+  uint32_t step;
+  uint32_t layer;
+  uint32_t row;
+} _stage_position;
 
-  KTX_error_code kResult;
-  kResult = ktxTexture_LoadImageData(tex, data, (ktx_size_t)out_mem_reqs->size);
-  if (kResult != KTX_SUCCESS)
-    xrg_log_f("Could not load image data: %d", kResult);
+static uint32_t
+_step_level(ktxTexture *tex, uint32_t step)
+{
+  return tex->numLevels - 1 - step;
+}
 
-  vkUnmapMemory(self->device->device, *out_staging_memory);
+// Bytes of the images from position on, including the KTX row padding
+static VkDeviceSize
+_remaining_size(vulkan_texture *self,
+                ktxTexture *tex,
+                const _stage_position *pos)
+{
+  uint32_t level = _step_level(tex, pos->step);
+  VkDeviceSize size = 0;
+  for (uint32_t i = 0; i <= level; i++)
+    size += ktxTexture_GetImageSize(tex, i) * self->layer_count;
+  return size - pos->layer * ktxTexture_GetImageSize(tex, level) -
+         pos->row * ktxTexture_GetRowPitch(tex, level);
+}
 
-  for (uint32_t i = 0; i < self->mip_levels; i++) {
-    ktx_size_t offset;
-    ktxTexture_GetImageOffset(tex, i, 0, 0, &offset);
-    buffer_image_copies[i] = (VkBufferImageCopy) {
-      .bufferOffset = offset,
+/*
+ * Fills the staging ring with as many of the remaining images as fit, in
+ * bands of block rows when an image does not fit whole. Rows are packed
+ * tightly, without the KTX row padding. Supercompressed levels are decoded
+ * straight into the ring, band after band. Returns the number of copies.
+ */
+static uint32_t
+_stage_levels(vulkan_texture *self,
+              ktxTexture *tex,
+              const vulkan_submit_staging *staging,
+              _stage_position *pos,
+              VkBufferImageCopy *copies)
+{
+  uint32_t block_width, block_height;
+  ktxTexture_GetBlockExtent(tex, &block_width, &block_height);
+  VkDeviceSize element_size = ktxTexture_GetElementSize(tex);
+
+  // Offsets need to be multiples of the block size and of 4
+  VkDeviceSize alignment = element_size;
+  while (alignment % 4 != 0)
+    alignment += element_size;
+
+  uint32_t copy_count = 0;
+  VkDeviceSize used = 0;
+
+  while (pos->step < tex->numLevels) {
+    uint32_t level = _step_level(tex, pos->step);
+    uint32_t width = MAX(1, self->width >> level);
+    uint32_t height = MAX(1, self->height >> level);
+    uint32_t block_rows = (height + block_height - 1) / block_height;
+    VkDeviceSize row_size =
+      (width + block_width - 1) / block_width * element_size;
+    VkDeviceSize row_pitch = ktxTexture_GetRowPitch(tex, level);
+
+    VkDeviceSize offset = (staging->offset + used + alignment - 1) /
+                            alignment * alignment -
+                          staging->offset;
+    if (offset >= staging->size)
+      break;
+
+    uint32_t rows = block_rows - pos->row;
+    if (rows * row_size > staging->size - offset)
+      rows = (uint32_t)((staging->size - offset) / row_size);
+    if (rows == 0)
+      break;
+
+    uint32_t layer = pos->layer / tex->numFaces;
+    uint32_t face = pos->layer % tex->numFaces;
+    uint8_t *dst = (uint8_t *)staging->data + offset;
+
+    KTX_error_code result;
+    if (row_pitch == row_size) {
+      result = ktxTexture_ReadImageData(tex, level, layer, face,
+                                        pos->row * row_pitch, dst,
+                                        rows * row_size);
+    } else {
+      result = KTX_SUCCESS;
+      for (uint32_t i = 0; i < rows && result == KTX_SUCCESS; i++)
+        result = ktxTexture_ReadImageData(tex, level, layer, face,
+                                          (pos->row + i) * row_pitch,
+                                          dst + i * row_size, row_size);
+    }
+    if (result != KTX_SUCCESS)
+      xrg_log_e("Reading level %d of the texture failed: %d", level, result);
+
+    // The last band may end in a partial block at the edge of the level
+    uint32_t y = pos->row * block_height;
+    uint32_t band_height = rows * block_height;
+    if (band_height > height - y)
+      band_height = height - y;
+    copies[copy_count++] = (VkBufferImageCopy) {
+      .bufferOffset = staging->offset + offset,
       .imageSubresource =
       {
         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .mipLevel = i,
-        .baseArrayLayer = 0,
+        .mipLevel = level,
+        .baseArrayLayer = pos->layer,
         .layerCount = 1,
       },
+      .imageOffset = { .y = (int32_t)y },
       .imageExtent = {
-        .width = tex->baseWidth >> i,
-        .height = tex->baseHeight >> i,
-        .depth = tex->baseDepth  >> i,
+        .width = width,
+        .height = band_height,
+        .depth = 1,
       },
     };
+
+    used = offset + rows * row_size;
+
+    pos->row += rows;
+    if (pos->row == block_rows) {
+      pos->row = 0;
+      if (++pos->layer == self->layer_count) {
+        pos->layer = 0;
+        pos->step++;
+      }
+    }
   }
+
+  return copy_count;
 }
 
+/*
+ * Fills all levels after the base level with a chain of blits, each level
+ * downsampled from the previous one. Expects all levels in
+ * VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL and leaves them in dest_layout.
+ */
 static void
-_allocate_image_memory(VkImage image,
-                       vulkan_device *device,
-                       VkMemoryRequirements *mem_reqs,
-                       VkMemoryAllocateInfo *mem_info,
-                       VkDeviceMemory *out_memory)
+_generate_mipmaps(vulkan_texture *self,
+                  VkCommandBuffer cmd,
+                  VkImageLayout dest_layout)
 {
-  vkGetImageMemoryRequirements(device->device, image, mem_reqs);
+  VkFormatProperties format_properties;
+  vkGetPhysicalDeviceFormatProperties(self->device->physical_device,
+                                      self->format, &format_properties);
+  VkFilter filter = (format_properties.optimalTilingFeatures &
+                     VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+                      ? VK_FILTER_LINEAR
+                      : VK_FILTER_NEAREST;
+
+  VkImageSubresourceRange range = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .levelCount = 1,
+    .baseArrayLayer = 0,
+    .layerCount = self->layer_count,
+  };
 
-  mem_info->allocationSize = mem_reqs->size;
+  vulkan_barrier_batch barriers;
+  vulkan_barrier_batch_init(&barriers, self->device, cmd);
 
-  vulkan_device_get_memory_type(device, mem_reqs->memoryTypeBits,
-                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                &mem_info->memoryTypeIndex);
-  vk_check(vkAllocateMemory(device->device, mem_info, NULL, out_memory));
-  vk_check(vkBindImageMemory(device->device, image, *out_memory, 0));
+  for (uint32_t level = 1; level < self->mip_levels; level++) {
+    range.baseMipLevel = level - 1;
+    vulkan_barrier_batch_add_image(&barriers, self->image, range,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    vulkan_barrier_batch_flush(&barriers);
+
+    VkImageBlit blit = {
+      .srcSubresource = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .mipLevel = level - 1,
+        .baseArrayLayer = 0,
+        .layerCount = self->layer_count,
+      },
+      .srcOffsets[1] = {
+        .x = (int32_t)MAX(1, self->width >> (level - 1)),
+        .y = (int32_t)MAX(1, self->height >> (level - 1)),
+        .z = 1,
+      },
+      .dstSubresource = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .mipLevel = level,
+        .baseArrayLayer = 0,
+        .layerCount = self->layer_count,
+      },
+      .dstOffsets[1] = {
+        .x = (int32_t)MAX(1, self->width >> level),
+        .y = (int32_t)MAX(1, self->height >> level),
+        .z = 1,
+      },
+    };
+    vkCmdBlitImage(cmd, self->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   self->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   filter);
+  }
+
+  // The last level was only written to
+  range.baseMipLevel = 0;
+  range.levelCount = self->mip_levels - 1;
+  vulkan_barrier_batch_add_image(&barriers, self->image, range,
+                                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                 dest_layout);
+  range.baseMipLevel = self->mip_levels - 1;
+  range.levelCount = 1;
+  vulkan_barrier_batch_add_image(&barriers, self->image, range,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                 dest_layout);
+  vulkan_barrier_batch_flush(&barriers);
+}
+
+// Hands levels over in dest_layout, on the graphics queue
+static vulkan_submit_ticket
+_finish_levels(vulkan_texture *self,
+               vulkan_submit *submit,
+               vulkan_submit *copy_submit,
+               vulkan_barrier_batch *barriers,
+               VkImageSubresourceRange range,
+               VkImageLayout dest_layout)
+{
+  if (copy_submit == submit) {
+    vulkan_barrier_batch_add_image(barriers, self->image, range,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   dest_layout);
+    vulkan_barrier_batch_flush(barriers);
+    return vulkan_submit_end(submit, NULL, NULL);
+  }
+
+  vulkan_submit_end(copy_submit, NULL, NULL);
+
+  // Flushing submit flushes the release first and waits for it
+  VkCommandBuffer release_cmd;
+  VkCommandBuffer acquire_cmd =
+    vulkan_submit_begin_transfer(submit, &release_cmd);
+
+  vulkan_barrier_batch_init(barriers, self->device, release_cmd);
+  vulkan_barrier_batch_release_image(
+    barriers, self->image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    dest_layout, copy_submit->family_index, submit->family_index);
+  vulkan_barrier_batch_flush(barriers);
+
+  vulkan_barrier_batch_init(barriers, self->device, acquire_cmd);
+  vulkan_barrier_batch_acquire_image(
+    barriers, self->image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    dest_layout, copy_submit->family_index, submit->family_index);
+  vulkan_barrier_batch_flush(barriers);
+  return vulkan_submit_end_transfer(submit);
 }
 
 static void
 _transfer_image(vulkan_texture *self,
-                VkQueue copy_queue,
-                VkBuffer staging_buffer,
-                VkImageLayout dest_layout,
-                VkBufferImageCopy *buffer_image_copies)
+                ktxTexture *tex,
+                vulkan_submit *submit,
+                VkImageLayout dest_layout)
 {
   VkImageSubresourceRange subresource_range = {
     .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
     .baseMipLevel = 0,
     .levelCount = self->mip_levels,
-    .layerCount = 1,
+    .layerCount = self->layer_count,
   };
 
-  VkCommandBuffer copy_cmd = vulkan_device_create_cmd_buffer(self->device);
-  _set_image_layout(copy_cmd, self->image, VK_IMAGE_LAYOUT_UNDEFINED,
-                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresource_range);
+  // Copy on the transfer queue when there is one, graphics takes it over
+  vulkan_submit *copy_submit = submit->source ? submit->source : submit;
+
+  // Levels not in the file are blitted on the graphics queue afterwards
+  bool generate = self->mip_levels > tex->numLevels;
 
-  vkCmdCopyBufferToImage(copy_cmd, staging_buffer, self->image,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, self->mip_levels,
-                         buffer_image_copies);
+  // Each image is copied at most once per part
+  VkBufferImageCopy *copies =
+    malloc(sizeof(VkBufferImageCopy) * tex->numLevels * self->layer_count);
+
+  vulkan_barrier_batch barriers;
+  VkCommandBuffer copy_cmd;
+  _stage_position pos = { 0 };
+  uint32_t finished_steps = 0;
+  bool first = true;
 
   self->image_layout = dest_layout;
-  _set_image_layout(copy_cmd, self->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    dest_layout, subresource_range);
 
-  vulkan_device_flush_cmd_buffer(self->device, copy_cmd, copy_queue);
+  while (true) {
+    vulkan_submit_staging staging;
+    copy_cmd = vulkan_submit_begin_staging(
+      copy_submit, _remaining_size(self, tex, &pos), &staging);
+
+    vulkan_barrier_batch_init(&barriers, self->device, copy_cmd);
+    if (first) {
+      vulkan_barrier_batch_add_image(&barriers, self->image, subresource_range,
+                                     VK_IMAGE_LAYOUT_UNDEFINED,
+                                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+      vulkan_barrier_batch_flush(&barriers);
+      first = false;
+    }
+
+    uint32_t copy_count = _stage_levels(self, tex, &staging, &pos, copies);
+    if (copy_count > 0)
+      vkCmdCopyBufferToImage(copy_cmd, staging.buffer, self->image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy_count,
+                             copies);
+
+    bool done = pos.step == tex->numLevels;
+    if (generate && done)
+      break;
+
+    // Levels completed in this part can be sampled before the finer ones
+    if (!generate && pos.step > finished_steps) {
+      VkImageSubresourceRange range = subresource_range;
+      range.baseMipLevel = _step_level(tex, pos.step - 1);
+      range.levelCount = pos.step - finished_steps;
+      vulkan_submit_ticket ticket = _finish_levels(
+        self, submit, copy_submit, &barriers, range, dest_layout);
+      for (; finished_steps < pos.step; finished_steps++)
+        self->level_tickets[_step_level(tex, finished_steps)] = ticket;
+    } else {
+      vulkan_submit_end(copy_submit, NULL, NULL);
+    }
+
+    if (done)
+      break;
+
+    // Submits this part so its staging memory can be reused
+    vulkan_submit_flush(submit);
+  }
+
+  free(copies);
+
+  if (!generate) {
+    self->upload_ticket = self->level_tickets[0];
+    return;
+  }
+
+  if (copy_submit == submit) {
+    _generate_mipmaps(self, copy_cmd, dest_layout);
+    self->upload_ticket = vulkan_submit_end(submit, NULL, NULL);
+  } else {
+    vulkan_submit_end(copy_submit, NULL, NULL);
+
+    VkCommandBuffer release_cmd;
+    VkCommandBuffer acquire_cmd =
+      vulkan_submit_begin_transfer(submit, &release_cmd);
+
+    vulkan_barrier_batch_init(&barriers, self->device, release_cmd);
+    vulkan_barrier_batch_release_image(
+      &barriers, self->image, subresource_range,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy_submit->family_index,
+      submit->family_index);
+    vulkan_barrier_batch_flush(&barriers);
+
+    vulkan_barrier_batch_init(&barriers, self->device, acquire_cmd);
+    vulkan_barrier_batch_acquire_image(
+      &barriers, self->image, subresource_range,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy_submit->family_index,
+      submit->family_index);
+    vulkan_barrier_batch_flush(&barriers);
+    _generate_mipmaps(self, acquire_cmd, dest_layout);
+    self->upload_ticket = vulkan_submit_end_transfer(submit);
+  }
+
+  // Blitted levels are only complete together
+  for (uint32_t i = 0; i < self->mip_levels; i++)
+    self->level_tickets[i] = self->upload_ticket;
 }
 
 static void
 _upload(vulkan_texture *self,
         ktxTexture *tex,
-        VkQueue copy_queue,
-        bool alloc_mem,
+        vulkan_submit *submit,
         VkImageLayout dest_layout)
 {
   VkMemoryRequirements mem_reqs;
-  VkMemoryAllocateInfo mem_info;
-  VkBuffer staging_buffer;
-  VkDeviceMemory staging_memory;
-
-  VkBufferImageCopy *buffer_image_copies =
-    malloc(sizeof(VkBufferImageCopy) * self->mip_levels);
-
-  _load_ktx_to_staging_mem(self, tex, &mem_reqs, &mem_info, &staging_buffer,
-                           &staging_memory, buffer_image_copies);
-
-  if (alloc_mem)
-    _allocate_image_memory(self->image, self->device, &mem_reqs, &mem_info,
-                           &self->device_memory);
-
-  _transfer_image(self, copy_queue, staging_buffer, dest_layout,
-                  buffer_image_copies);
+  VkMemoryAllocateInfo mem_info = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+  };
+  _allocate_image_memory(self->image, self->device, &mem_reqs, &mem_info,
+                         &self->device_memory);
 
-  vkFreeMemory(self->device->device, staging_memory, NULL);
-  vkDestroyBuffer(self->device->device, staging_buffer, NULL);
+  _transfer_image(self, tex, submit, dest_layout);
 }
 
 static void
@@ -270,13 +484,13 @@ _create_sampler(vulkan_texture *self)
 }
 
 static void
-_create_image_view(vulkan_texture *self, VkFormat format)
+_create_image_view(vulkan_texture *self)
 {
   VkImageViewCreateInfo info = {
   .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
   .image = self->image,
-  .viewType = VK_IMAGE_VIEW_TYPE_2D,
-  .format = format,
+  .viewType = self->view_type,
+  .format = self->format,
   .components = {
     .r = VK_COMPONENT_SWIZZLE_R,
     .g = VK_COMPONENT_SWIZZLE_G,
@@ -285,79 +499,353 @@ _create_image_view(vulkan_texture *self, VkFormat format)
   },
   .subresourceRange = {
     .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-    .baseMipLevel = 0,
-    .levelCount = self->mip_levels,
+    .baseMipLevel = self->base_level,
+    .levelCount = self->mip_levels - self->base_level,
     .baseArrayLayer = 0,
-    .layerCount = 1,
+    .layerCount = self->layer_count,
   },
 };
 
   vk_check(vkCreateImageView(self->device->device, &info, NULL, &self->view));
 }
 
-void
+bool
 vulkan_texture_load_ktx(vulkan_texture *self,
                         const ktx_uint8_t *bytes,
                         ktx_size_t size,
                         vulkan_device *device,
-                        VkQueue copy_queue,
+                        vulkan_submit *submit,
                         VkFormat format,
-                        VkImageLayout dest_layout)
+                        VkImageLayout dest_layout,
+                        bool generate_mipmaps)
 {
   ktxTexture *kTexture;
   KTX_error_code ktxresult;
-  ktxresult = ktxTexture_CreateFromMemory(
-    bytes, size, KTX_TEXTURE_CREATE_NO_FLAGS, &kTexture);
+  ktxresult = ktxTexture_CreateFromMemory(bytes, size,
+                                          KTX_TEXTURE_CREATE_NO_FLAGS,
+                                          &kTexture);
+
+  /*
+   * Images are staged straight from bytes when they can be read in place
+   * or decompressed on the way.
+   */
+  if (KTX_SUCCESS == ktxresult && !ktxTexture_CanReadImageData(kTexture))
+    ktxresult = ktxTexture_LoadImageData(kTexture, NULL, 0);
 
   if (KTX_SUCCESS != ktxresult) {
     xrg_log_e("Creation of ktxTexture failed: %d", ktxresult);
-    return;
+    if (kTexture)
+      ktxTexture_Destroy(kTexture);
+    return false;
+  }
+
+  if (kTexture->numDimensions == 3) {
+    xrg_log_e("3D KTX textures are not supported.");
+    ktxTexture_Destroy(kTexture);
+    return false;
+  }
+
+  // Compressed data can not be reinterpreted in an other format
+  if (kTexture->isCompressed || format == VK_FORMAT_UNDEFINED)
+    format = ktxTexture_GetVkFormat(kTexture);
+
+  VkFormatProperties format_properties;
+  vkGetPhysicalDeviceFormatProperties(device->physical_device, format,
+                                      &format_properties);
+  if (!(format_properties.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+    xrg_log_e("KTX texture format %d can not be sampled on this device.",
+              format);
+    ktxTexture_Destroy(kTexture);
+    return false;
   }
 
+  bool cube = kTexture->numFaces == 6;
+  if (cube)
+    self->view_type = kTexture->isArray ? VK_IMAGE_VIEW_TYPE_CUBE_ARRAY
+                                        : VK_IMAGE_VIEW_TYPE_CUBE;
+  else
+    self->view_type = kTexture->isArray ? VK_IMAGE_VIEW_TYPE_2D_ARRAY
+                                        : VK_IMAGE_VIEW_TYPE_2D;
+
   self->device = device;
+  self->format = format;
   self->width = kTexture->baseWidth;
   self->height = kTexture->baseHeight;
   self->mip_levels = kTexture->numLevels;
+  self->layer_count = kTexture->numLayers * kTexture->numFaces;
+
+  // Only complete a lone base level, partial chains are used as they are
+  generate_mipmaps |= kTexture->generateMipmaps;
+  if (generate_mipmaps && kTexture->numLevels == 1) {
+    VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                VK_FORMAT_FEATURE_BLIT_DST_BIT;
+    if ((format_properties.optimalTilingFeatures & blit) == blit) {
+      uint32_t max_dim = MAX(self->width, self->height);
+      while (max_dim >>= 1)
+        self->mip_levels++;
+    } else {
+      xrg_log_w("Can not blit format %d, not generating mip maps.", format);
+    }
+  }
+
+  // The view starts with the smallest level and grows as finer ones land
+  bool generate = self->mip_levels > kTexture->numLevels;
+  self->base_level = generate ? 0 : self->mip_levels - 1;
+  self->level_tickets =
+    malloc(sizeof(vulkan_submit_ticket) * self->mip_levels);
 
-  _create_image(self, format);
-  _upload(self, kTexture, copy_queue, true, dest_layout);
+  _create_image(self, cube);
+  _upload(self, kTexture, submit, dest_layout);
   _create_sampler(self);
-  _create_image_view(self, format);
+  _create_image_view(self);
 
   ktxTexture_Destroy(kTexture);
 
-  self->created_from_image = false;
+  return true;
 }
 
-void
-vulkan_texture_load_ktx_from_image(vulkan_texture *self,
-                                   VkImage image,
-                                   const ktx_uint8_t *bytes,
-                                   ktx_size_t size,
-                                   vulkan_device *device,
-                                   VkQueue copy_queue,
-                                   VkImageLayout dest_layout)
+typedef struct
 {
-  ktxTexture *kTexture;
-  KTX_error_code ktxresult;
-  ktxresult = ktxTexture_CreateFromMemory(
-    bytes, size, KTX_TEXTURE_CREATE_NO_FLAGS, &kTexture);
+  VkDevice device;
+  VkImageView view;
+} _released_view;
 
-  if (KTX_SUCCESS != ktxresult) {
-    xrg_log_e("Creation of ktxTexture failed: %d", ktxresult);
-    return;
+static void
+_destroy_released_view(void *data)
+{
+  _released_view *released = data;
+  vkDestroyImageView(released->device, released->view, NULL);
+  free(released);
+}
+
+bool
+vulkan_texture_update_lod(vulkan_texture *self, vulkan_submit *submit)
+{
+  uint32_t level = self->base_level;
+  while (level > 0 &&
+         vulkan_submit_is_done(submit, self->level_tickets[level - 1]))
+    level--;
+
+  if (level == self->base_level)
+    return false;
+
+  _released_view *released = malloc(sizeof(_released_view));
+  released->device = self->device->device;
+  released->view = self->view;
+  vulkan_submit_begin(submit);
+  vulkan_submit_end(submit, _destroy_released_view, released);
+
+  self->base_level = level;
+  _create_image_view(self);
+
+  return true;
+}
+
+bool
+vulkan_texture_copy_to_image(vulkan_texture *self,
+                             vulkan_submit *submit,
+                             VkImage image,
+                             VkImageLayout dest_layout)
+{
+  // Block compressed texels can only be copied into RGBA8 by decoding them
+  bool compressed = self->format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK &&
+                    self->format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK;
+  if (compressed) {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(self->device->physical_device,
+                                        self->format, &props);
+    if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT)) {
+      xrg_log_e("Can not decode texture format %d by blitting it.",
+                self->format);
+      return false;
+    }
+  }
+
+  VkImageSubresourceRange subresource_range = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .baseMipLevel = 0,
+    .levelCount = 1,
+    .baseArrayLayer = 0,
+    .layerCount = 1,
+  };
+
+  VkCommandBuffer cmd = vulkan_submit_begin(submit);
+
+  vulkan_barrier_batch barriers;
+  vulkan_barrier_batch_init(&barriers, self->device, cmd);
+  vulkan_barrier_batch_add_image(&barriers, image, subresource_range,
+                                 VK_IMAGE_LAYOUT_UNDEFINED,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  // Sampled textures only leave their layout for the copy
+  bool transition = self->image_layout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  if (transition)
+    vulkan_barrier_batch_add_image(&barriers, self->image, subresource_range,
+                                   self->image_layout,
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+  vulkan_barrier_batch_flush(&barriers);
+
+  VkImageSubresourceLayers layers = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .mipLevel = 0,
+    .baseArrayLayer = 0,
+    .layerCount = 1,
+  };
+  if (compressed) {
+    VkOffset3D extent = {
+      .x = (int32_t)self->width,
+      .y = (int32_t)self->height,
+      .z = 1,
+    };
+    VkImageBlit blit = {
+      .srcSubresource = layers,
+      .srcOffsets = { { 0, 0, 0 }, extent },
+      .dstSubresource = layers,
+      .dstOffsets = { { 0, 0, 0 }, extent },
+    };
+    vkCmdBlitImage(cmd, self->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   VK_FILTER_NEAREST);
+  } else {
+    VkImageCopy region = {
+      .srcSubresource = layers,
+      .dstSubresource = layers,
+      .extent = { .width = self->width, .height = self->height, .depth = 1 },
+    };
+    vkCmdCopyImage(cmd, self->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
   }
 
+  vulkan_barrier_batch_add_image(&barriers, image, subresource_range,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                 dest_layout);
+  if (transition)
+    vulkan_barrier_batch_add_image(&barriers, self->image, subresource_range,
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                   self->image_layout);
+  vulkan_barrier_batch_flush(&barriers);
+
+  vulkan_submit_end(submit, NULL, NULL);
+
+  return true;
+}
+
+static void
+_destroy_released(void *data)
+{
+  vulkan_texture *texture = data;
+  vulkan_texture_destroy(texture);
+  free(texture);
+}
+
+void
+vulkan_texture_release(vulkan_texture *self, vulkan_submit *submit)
+{
+  vulkan_texture *released = malloc(sizeof(vulkan_texture));
+  *released = *self;
+
+  vulkan_submit_begin(submit);
+  vulkan_submit_end(submit, _destroy_released, released);
+}
+
+// 1x1 texture with all layers cleared to color, 6 layers make a cube map
+static void
+_init_solid(vulkan_texture *self,
+            vulkan_device *device,
+            vulkan_submit *submit,
+            VkClearColorValue color,
+            uint32_t layer_count)
+{
+  VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+  bool cube = layer_count == 6;
+
   self->device = device;
-  self->width = kTexture->baseWidth;
-  self->height = kTexture->baseHeight;
-  self->mip_levels = kTexture->numLevels;
+  self->format = format;
+  self->width = 1;
+  self->height = 1;
+  self->mip_levels = 1;
+  self->layer_count = layer_count;
+  self->view_type = cube ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D;
+  self->base_level = 0;
+  self->level_tickets = NULL;
+
+  VkImageCreateInfo image_info = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .flags = cube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = format,
+    .extent = { .width = 1, .height = 1, .depth = 1 },
+    .mipLevels = 1,
+    .arrayLayers = self->layer_count,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  vk_check(vkCreateImage(device->device, &image_info, NULL, &self->image));
 
-  self->image = image;
+  VkMemoryRequirements mem_reqs;
+  VkMemoryAllocateInfo mem_info = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+  };
+  _allocate_image_memory(self->image, device, &mem_reqs, &mem_info,
+                         &self->device_memory);
+
+  VkImageSubresourceRange subresource_range = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .baseMipLevel = 0,
+    .levelCount = 1,
+    .baseArrayLayer = 0,
+    .layerCount = self->layer_count,
+  };
 
-  _upload(self, kTexture, copy_queue, false, dest_layout);
+  VkCommandBuffer cmd = vulkan_submit_begin(submit);
 
-  ktxTexture_Destroy(kTexture);
+  vulkan_barrier_batch barriers;
+  vulkan_barrier_batch_init(&barriers, device, cmd);
+  vulkan_barrier_batch_add_image(&barriers, self->image, subresource_range,
+                                 VK_IMAGE_LAYOUT_UNDEFINED,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  vulkan_barrier_batch_flush(&barriers);
+
+  vkCmdClearColorImage(cmd, self->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       &color, 1, &subresource_range);
+
+  self->image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vulkan_barrier_batch_add_image(&barriers, self->image, subresource_range,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                 self->image_layout);
+  vulkan_barrier_batch_flush(&barriers);
+
+  self->upload_ticket = vulkan_submit_end(submit, NULL, NULL);
+
+  _create_sampler(self);
+
+  VkImageViewCreateInfo view_info = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = self->image,
+    .viewType = self->view_type,
+    .format = format,
+    .subresourceRange = subresource_range,
+  };
+  vk_check(vkCreateImageView(device->device, &view_info, NULL, &self->view));
+}
 
-  self->created_from_image = true;
+void
+vulkan_texture_init_solid(vulkan_texture *self,
+                          vulkan_device *device,
+                          vulkan_submit *submit,
+                          VkClearColorValue color)
+{
+  _init_solid(self, device, submit, color, 1);
+}
+
+void
+vulkan_texture_init_solid_cube(vulkan_texture *self,
+                               vulkan_device *device,
+                               vulkan_submit *submit,
+                               VkClearColorValue color)
+{
+  _init_solid(self, device, submit, color, 6);
 }
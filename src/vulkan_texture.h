@@ -16,6 +16,7 @@
 
 #include "vulkan_device.h"
 #include "vulkan_buffer.h"
+#include "vulkan_submit.h"
 #include "log.h"
 #include "ktx_texture.h"
 
@@ -32,12 +33,20 @@ typedef struct
   VkDeviceMemory device_memory;
   VkSampler sampler;
   VkImageView view;
+  VkImageViewType view_type;
+  VkFormat format;
 
   uint32_t width, height;
   uint32_t mip_levels;
   uint32_t layer_count;
 
-  bool created_from_image;
+  // All levels are valid once this is done, see vulkan_submit
+  vulkan_submit_ticket upload_ticket;
+
+  // Per level upload, coarser levels complete first. NULL without uploads
+  vulkan_submit_ticket *level_tickets;
+  // Finest level in view, finer ones can still be in transfer
+  uint32_t base_level;
 } vulkan_texture;
 
 VkDescriptorImageInfo
@@ -46,23 +55,66 @@ vulkan_texture_get_descriptor(vulkan_texture *self);
 void
 vulkan_texture_destroy(vulkan_texture *self);
 
-void
+/*
+ * Loads all levels, array layers and cube faces of a KTX file. Levels are
+ * uploaded smallest first, the view only covers the smallest one until
+ * vulkan_texture_update_lod widens it. Compressed
+ * data is always uploaded in the format of the file, format only overrides
+ * the one of uncompressed data, e.g. to sample it as sRGB, and needs the
+ * same texel size. VK_FORMAT_UNDEFINED uses the format of the file.
+ *
+ * With generate_mipmaps, files with only a base level get a full mip chain
+ * blitted on the GPU, when the format supports blits.
+ *
+ * Returns false without creating anything if the file can not be loaded.
+ */
+bool
 vulkan_texture_load_ktx(vulkan_texture *self,
                         const ktx_uint8_t *bytes,
                         ktx_size_t size,
                         vulkan_device *device,
-                        VkQueue copy_queue,
+                        vulkan_submit *submit,
                         VkFormat format,
-                        VkImageLayout dest_layout);
+                        VkImageLayout dest_layout,
+                        bool generate_mipmaps);
+
+/*
+ * Records a copy of the base level into image, e.g. a swapchain image of
+ * the same size and a size compatible format. Block compressed textures are
+ * blitted instead, which decodes them. Returns false without recording if
+ * the device can not blit from their format. The base level is moved to
+ * VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL for the copy and back afterwards.
+ */
+bool
+vulkan_texture_copy_to_image(vulkan_texture *self,
+                             vulkan_submit *submit,
+                             VkImage image,
+                             VkImageLayout dest_layout);
+
+/*
+ * Widens the view to the finer levels whose upload completed, so the
+ * texture sharpens while it streams in. Returns true if the view changed,
+ * descriptors using it need to be written again then. The old view is
+ * destroyed once the work recorded on submit so far completed.
+ */
+bool
+vulkan_texture_update_lod(vulkan_texture *self, vulkan_submit *submit);
+
+// Destroys the texture once the work recorded on submit so far completed
+void
+vulkan_texture_release(vulkan_texture *self, vulkan_submit *submit);
+
+void
+vulkan_texture_init_solid(vulkan_texture *self,
+                          vulkan_device *device,
+                          vulkan_submit *submit,
+                          VkClearColorValue color);
 
 void
-vulkan_texture_load_ktx_from_image(vulkan_texture *self,
-                                   VkImage image,
-                                   const ktx_uint8_t *bytes,
-                                   ktx_size_t size,
-                                   vulkan_device *device,
-                                   VkQueue copy_queue,
-                                   VkImageLayout dest_layout);
+vulkan_texture_init_solid_cube(vulkan_texture *self,
+                               vulkan_device *device,
+                               vulkan_submit *submit,
+                               VkClearColorValue color);
 
 #ifdef __cplusplus
 }
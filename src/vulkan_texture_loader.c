@@ -0,0 +1,154 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_texture_loader.h"
+
+#include "log.h"
+
+static vulkan_texture_request *
+_pop(vulkan_texture_loader *self)
+{
+  pthread_mutex_lock(&self->mutex);
+  while (!self->head && !self->quit)
+    pthread_cond_wait(&self->cond, &self->mutex);
+
+  vulkan_texture_request *request = NULL;
+  if (!self->quit) {
+    request = self->head;
+    self->head = request->next;
+    if (!self->head)
+      self->tail = NULL;
+  }
+  pthread_mutex_unlock(&self->mutex);
+
+  return request;
+}
+
+static void *
+_worker(void *data)
+{
+  vulkan_texture_loader *self = data;
+  vulkan_texture_request *request;
+
+  while ((request = _pop(self))) {
+    bool loaded = vulkan_texture_load_ktx(
+      &request->texture, request->bytes, request->size, self->device,
+      self->submit, request->format, request->dest_layout,
+      request->generate_mipmaps);
+
+    if (loaded && request->uploaded)
+      request->uploaded(&request->texture, request->data);
+    else if (!loaded)
+      xrg_log_e("Could not load texture %s.", request->name);
+
+    pthread_mutex_lock(&self->mutex);
+    request->loaded = loaded;
+    request->failed = !loaded;
+    pthread_mutex_unlock(&self->mutex);
+  }
+
+  return NULL;
+}
+
+void
+vulkan_texture_loader_init(vulkan_texture_loader *self,
+                           vulkan_device *device,
+                           vulkan_submit *submit)
+{
+  self->device = device;
+  self->submit = submit;
+  self->head = NULL;
+  self->tail = NULL;
+  self->quit = false;
+
+  pthread_mutex_init(&self->mutex, NULL);
+  pthread_cond_init(&self->cond, NULL);
+
+  self->thread_count = 0;
+  for (uint32_t i = 0; i < VULKAN_TEXTURE_LOADER_THREADS; i++) {
+    if (pthread_create(&self->threads[self->thread_count], NULL, _worker,
+                       self) == 0)
+      self->thread_count++;
+  }
+
+  xrg_log_f_if(self->thread_count == 0,
+               "Could not start a texture loader thread.");
+}
+
+void
+vulkan_texture_loader_destroy(vulkan_texture_loader *self)
+{
+  pthread_mutex_lock(&self->mutex);
+  self->quit = true;
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+
+  for (uint32_t i = 0; i < self->thread_count; i++)
+    pthread_join(self->threads[i], NULL);
+
+  pthread_cond_destroy(&self->cond);
+  pthread_mutex_destroy(&self->mutex);
+}
+
+void
+vulkan_texture_loader_load_ktx(vulkan_texture_loader *self,
+                               vulkan_texture_request *request)
+{
+  request->loaded = false;
+  request->failed = false;
+  request->next = NULL;
+
+  pthread_mutex_lock(&self->mutex);
+  if (self->tail)
+    self->tail->next = request;
+  else
+    self->head = request;
+  self->tail = request;
+  pthread_cond_signal(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+}
+
+static bool
+_is_loaded(vulkan_texture_loader *self, vulkan_texture_request *request)
+{
+  pthread_mutex_lock(&self->mutex);
+  bool loaded = request->loaded;
+  pthread_mutex_unlock(&self->mutex);
+  return loaded;
+}
+
+bool
+vulkan_texture_loader_is_resident(vulkan_texture_loader *self,
+                                  vulkan_texture_request *request)
+{
+  return _is_loaded(self, request) &&
+         vulkan_submit_is_done(self->submit, request->texture.upload_ticket);
+}
+
+bool
+vulkan_texture_loader_is_usable(vulkan_texture_loader *self,
+                                vulkan_texture_request *request)
+{
+  if (!_is_loaded(self, request))
+    return false;
+
+  vulkan_texture *texture = &request->texture;
+  return vulkan_submit_is_done(self->submit,
+                               texture->level_tickets[texture->base_level]);
+}
+
+bool
+vulkan_texture_loader_has_failed(vulkan_texture_loader *self,
+                                 vulkan_texture_request *request)
+{
+  pthread_mutex_lock(&self->mutex);
+  bool failed = request->failed;
+  pthread_mutex_unlock(&self->mutex);
+  return failed;
+}
@@ -0,0 +1,116 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "vulkan_texture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decoding is mostly memory bound, more threads rarely help
+#define VULKAN_TEXTURE_LOADER_THREADS 2
+
+// Runs on the loader thread that recorded the upload of texture
+typedef void (*vulkan_texture_loader_func)(vulkan_texture *texture,
+                                           void *data);
+
+/*
+ * A KTX file to load into texture. Owned by the caller, who keeps it and
+ * the bytes alive until the loader is destroyed or the request resident.
+ */
+typedef struct vulkan_texture_request
+{
+  vulkan_texture texture;
+
+  // For log messages
+  const char *name;
+  const uint8_t *bytes;
+  size_t size;
+  VkFormat format;
+  VkImageLayout dest_layout;
+  bool generate_mipmaps;
+
+  // Called once the upload is recorded, e.g. to copy texture on. Can be NULL
+  vulkan_texture_loader_func uploaded;
+  void *data;
+
+  // Set by the loader under its mutex once the upload is recorded
+  bool loaded;
+  // Set instead of loaded if the file could not be loaded
+  bool failed;
+
+  struct vulkan_texture_request *next;
+} vulkan_texture_request;
+
+/*
+ * Decodes and stages textures on worker threads, in the order they were
+ * requested. Uploads are recorded on submit, which the main thread needs
+ * to flush every frame so they reach the GPU.
+ */
+typedef struct
+{
+  vulkan_device *device;
+  vulkan_submit *submit;
+
+  pthread_t threads[VULKAN_TEXTURE_LOADER_THREADS];
+  uint32_t thread_count;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  vulkan_texture_request *head;
+  vulkan_texture_request *tail;
+  bool quit;
+} vulkan_texture_loader;
+
+void
+vulkan_texture_loader_init(vulkan_texture_loader *self,
+                           vulkan_device *device,
+                           vulkan_submit *submit);
+
+/*
+ * Drops requests not started yet and waits for the running ones. Textures
+ * of loaded requests stay with their owners.
+ */
+void
+vulkan_texture_loader_destroy(vulkan_texture_loader *self);
+
+// Queues request, its inputs need to be set
+void
+vulkan_texture_loader_load_ktx(vulkan_texture_loader *self,
+                               vulkan_texture_request *request);
+
+/*
+ * True once the texture is loaded and its upload completed on the GPU.
+ * Stays false if loading failed, see vulkan_texture_loader_has_failed.
+ */
+bool
+vulkan_texture_loader_is_resident(vulkan_texture_loader *self,
+                                  vulkan_texture_request *request);
+
+/*
+ * True once the smallest level of the texture can be sampled, usually long
+ * before it is resident. See vulkan_texture_update_lod.
+ */
+bool
+vulkan_texture_loader_is_usable(vulkan_texture_loader *self,
+                                vulkan_texture_request *request);
+
+// True if loading failed, the request is not touched by the loader anymore
+bool
+vulkan_texture_loader_has_failed(vulkan_texture_loader *self,
+                                 vulkan_texture_request *request);
+
+#ifdef __cplusplus
+}
+#endif
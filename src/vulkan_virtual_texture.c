@@ -0,0 +1,692 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vulkan_virtual_texture.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "vulkan_barrier.h"
+
+#define TILE_SIZE VULKAN_VIRTUAL_TEXTURE_TILE_SIZE
+#define BORDER VULKAN_VIRTUAL_TEXTURE_TILE_BORDER
+#define SLOT_SIZE (TILE_SIZE + 2 * BORDER)
+#define MAX_JOBS VULKAN_VIRTUAL_TEXTURE_MAX_JOBS
+#define GRID VULKAN_VIRTUAL_TEXTURE_COVERAGE_GRID
+
+#define RESIDENT_BIT 0x80000000u
+
+static void
+_tile_position(vulkan_virtual_texture *self,
+               uint32_t tile,
+               uint32_t *level,
+               uint32_t *x,
+               uint32_t *y)
+{
+  uint32_t i = self->level_count - 1;
+  while (tile < self->levels[i].first_tile)
+    i--;
+
+  uint32_t index = tile - self->levels[i].first_tile;
+  *level = i;
+  *x = index % self->levels[i].tiles_x;
+  *y = index / self->levels[i].tiles_x;
+}
+
+static VkDeviceSize
+_staged_tile_size(vulkan_virtual_texture *self)
+{
+  VkDeviceSize size = (VkDeviceSize)SLOT_SIZE * SLOT_SIZE * self->element_size;
+  return (size + VULKAN_SUBMIT_STAGING_ALIGNMENT - 1) /
+         VULKAN_SUBMIT_STAGING_ALIGNMENT * VULKAN_SUBMIT_STAGING_ALIGNMENT;
+}
+
+/*
+ * Copies the tile with its border into dst, rows packed tightly. The border
+ * wraps around horizontally like the panorama and is clamped vertically.
+ */
+static void
+_read_tile(vulkan_virtual_texture *self,
+           uint32_t level,
+           uint32_t x0,
+           uint32_t y0,
+           uint32_t width,
+           uint32_t height,
+           uint8_t *dst)
+{
+  vulkan_virtual_texture_level *info = &self->levels[level];
+  const ktx_uint8_t *data;
+  ktxTexture_GetImageData(self->ktx, level, 0, 0, &data);
+  ktx_uint32_t row_pitch = ktxTexture_GetRowPitch(self->ktx, level);
+  uint32_t texel = self->element_size;
+
+  for (int32_t r = -BORDER; r < (int32_t)height + BORDER; r++) {
+    int32_t y = (int32_t)y0 + r;
+    if (y < 0)
+      y = 0;
+    else if (y >= (int32_t)info->height)
+      y = (int32_t)info->height - 1;
+    const uint8_t *src = data + (VkDeviceSize)y * row_pitch;
+
+    for (int32_t c = -BORDER; c < (int32_t)width + BORDER; c++) {
+      // The inner run is copied at once below
+      if (c == 0) {
+        memcpy(dst, src + (VkDeviceSize)x0 * texel, (size_t)width * texel);
+        dst += (size_t)width * texel;
+        c = (int32_t)width - 1;
+        continue;
+      }
+      uint32_t x = ((int32_t)x0 + c + info->width) % info->width;
+      memcpy(dst, src + (VkDeviceSize)x * texel, texel);
+      dst += texel;
+    }
+  }
+}
+
+/*
+ * Records the copies of the jobs from first on that fit into one part of
+ * the staging ring. Returns how many were recorded and their ticket.
+ */
+static uint32_t
+_stage_jobs(vulkan_virtual_texture *self,
+            uint32_t first,
+            uint32_t last,
+            vulkan_submit_ticket *ticket)
+{
+  VkDeviceSize tile_size = _staged_tile_size(self);
+  vulkan_submit_staging staging;
+  VkCommandBuffer cmd = vulkan_submit_begin_staging(
+    self->submit, tile_size * (last - first), &staging);
+
+  uint32_t count = (uint32_t)(staging.size / tile_size);
+  if (count == 0) {
+    // The open batch holds the ring
+    vulkan_submit_end(self->submit, NULL, NULL);
+    vulkan_submit_flush(self->submit);
+    return 0;
+  }
+
+  VkImageSubresourceRange range = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .levelCount = 1,
+    .layerCount = 1,
+  };
+
+  /*
+   * Waits for frames sampling the cache, the slots written here are no
+   * longer in their page table.
+   */
+  vulkan_barrier_batch barriers;
+  vulkan_barrier_batch_init(&barriers, self->device, cmd);
+  vulkan_barrier_batch_add_image(&barriers, self->image, range,
+                                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  vulkan_barrier_batch_flush(&barriers);
+
+  VkBufferImageCopy regions[MAX_JOBS];
+  for (uint32_t i = 0; i < count; i++) {
+    vulkan_virtual_texture_job *job = &self->jobs[(first + i) % MAX_JOBS];
+
+    uint32_t level, tx, ty;
+    _tile_position(self, job->tile, &level, &tx, &ty);
+    vulkan_virtual_texture_level *info = &self->levels[level];
+    uint32_t x0 = tx * TILE_SIZE;
+    uint32_t y0 = ty * TILE_SIZE;
+    uint32_t width = info->width - x0 < TILE_SIZE ? info->width - x0
+                                                  : TILE_SIZE;
+    uint32_t height = info->height - y0 < TILE_SIZE ? info->height - y0
+                                                    : TILE_SIZE;
+
+    _read_tile(self, level, x0, y0, width, height,
+               (uint8_t *)staging.data + i * tile_size);
+
+    regions[i] = (VkBufferImageCopy) {
+      .bufferOffset = staging.offset + i * tile_size,
+      .imageSubresource = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .layerCount = 1,
+      },
+      .imageOffset = {
+        .x = (int32_t)(job->slot % self->slots_per_side * SLOT_SIZE),
+        .y = (int32_t)(job->slot / self->slots_per_side * SLOT_SIZE),
+      },
+      .imageExtent = {
+        .width = width + 2 * BORDER,
+        .height = height + 2 * BORDER,
+        .depth = 1,
+      },
+    };
+  }
+
+  vkCmdCopyBufferToImage(cmd, staging.buffer, self->image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, count, regions);
+
+  vulkan_barrier_batch_add_image(&barriers, self->image, range,
+                                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  vulkan_barrier_batch_flush(&barriers);
+
+  *ticket = vulkan_submit_end(self->submit, NULL, NULL);
+
+  return count;
+}
+
+static void *
+_worker(void *data)
+{
+  vulkan_virtual_texture *self = data;
+
+  pthread_mutex_lock(&self->mutex);
+  while (true) {
+    while (self->job_next == self->job_tail && !self->quit)
+      pthread_cond_wait(&self->cond, &self->mutex);
+    if (self->quit)
+      break;
+
+    // Jobs are only added behind the tail, the ones up to it stay as they are
+    uint32_t first = self->job_next;
+    uint32_t last = self->job_tail;
+    pthread_mutex_unlock(&self->mutex);
+
+    vulkan_submit_ticket ticket = 0;
+    uint32_t count = _stage_jobs(self, first, last, &ticket);
+
+    pthread_mutex_lock(&self->mutex);
+    for (uint32_t i = first; i < first + count; i++) {
+      self->jobs[i % MAX_JOBS].ticket = ticket;
+      self->jobs[i % MAX_JOBS].staged = true;
+    }
+    self->job_next = first + count;
+  }
+  pthread_mutex_unlock(&self->mutex);
+
+  return NULL;
+}
+
+static bool
+_init_levels(vulkan_virtual_texture *self, ktxTexture *tex)
+{
+  self->tile_count = 0;
+  self->level_count = 0;
+
+  uint32_t width = tex->baseWidth;
+  uint32_t height = tex->baseHeight;
+  while (self->level_count < VULKAN_VIRTUAL_TEXTURE_MAX_LEVELS) {
+    vulkan_virtual_texture_level *level = &self->levels[self->level_count++];
+    level->width = width;
+    level->height = height;
+    level->tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    level->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    level->first_tile = self->tile_count;
+    self->tile_count += level->tiles_x * level->tiles_y;
+
+    // Coarser levels than one tile are not needed
+    if (level->tiles_x == 1 && level->tiles_y == 1)
+      return self->level_count <= tex->numLevels;
+
+    width = MAX(1, width >> 1);
+    height = MAX(1, height >> 1);
+  }
+
+  return false;
+}
+
+static bool
+_is_supported(vulkan_virtual_texture *self, ktxTexture *tex)
+{
+  uint32_t block_width, block_height;
+  ktxTexture_GetBlockExtent(tex, &block_width, &block_height);
+
+  const ktx_uint8_t *data;
+  if (tex->numDimensions != 2 || tex->numFaces != 1 || tex->isArray ||
+      tex->isCompressed || block_width != 1 || block_height != 1) {
+    xrg_log_w("Virtual textures need to be uncompressed and 2D.");
+    return false;
+  }
+  if (ktxTexture_GetImageData(tex, 0, 0, 0, &data) != KTX_SUCCESS) {
+    xrg_log_w("Virtual textures need to be readable in place, "
+              "without supercompression.");
+    return false;
+  }
+  if (!_init_levels(self, tex)) {
+    xrg_log_w("Virtual textures need levels down to a single %dx%d tile.",
+              TILE_SIZE, TILE_SIZE);
+    return false;
+  }
+  return true;
+}
+
+static void
+_create_cache(vulkan_virtual_texture *self)
+{
+  vulkan_device *device = self->device;
+  uint32_t max_dimension =
+    device->properties.limits.maxImageDimension2D;
+
+  self->slots_per_side = max_dimension / SLOT_SIZE;
+  if (self->slots_per_side > VULKAN_VIRTUAL_TEXTURE_MAX_SLOTS_PER_SIDE)
+    self->slots_per_side = VULKAN_VIRTUAL_TEXTURE_MAX_SLOTS_PER_SIDE;
+  self->slot_count = self->slots_per_side * self->slots_per_side;
+  uint32_t size = self->slots_per_side * SLOT_SIZE;
+
+  VkImageCreateInfo image_info = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = self->format,
+    .extent = { .width = size, .height = size, .depth = 1 },
+    .mipLevels = 1,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  vk_check(vkCreateImage(device->device, &image_info, NULL, &self->image));
+
+  VkMemoryRequirements mem_reqs;
+  vkGetImageMemoryRequirements(device->device, self->image, &mem_reqs);
+  VkMemoryAllocateInfo mem_info = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = mem_reqs.size,
+  };
+  vulkan_device_get_memory_type(device, mem_reqs.memoryTypeBits,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                &mem_info.memoryTypeIndex);
+  vk_check(vulkan_device_allocate_memory(device, VULKAN_MEMORY_TEXTURE,
+                                         &mem_info, &self->device_memory));
+  vk_check(vkBindImageMemory(device->device, self->image,
+                             self->device_memory, 0));
+
+  VkImageSubresourceRange range = {
+    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+    .levelCount = 1,
+    .layerCount = 1,
+  };
+
+  // Slots are only sampled once the page table points to them
+  VkCommandBuffer cmd = vulkan_submit_begin(self->submit);
+  vulkan_barrier_batch barriers;
+  vulkan_barrier_batch_init(&barriers, device, cmd);
+  vulkan_barrier_batch_add_image(&barriers, self->image, range,
+                                 VK_IMAGE_LAYOUT_UNDEFINED,
+                                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  vulkan_barrier_batch_flush(&barriers);
+  vulkan_submit_end(self->submit, NULL, NULL);
+
+  VkImageViewCreateInfo view_info = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = self->image,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+    .format = self->format,
+    .subresourceRange = range,
+  };
+  vk_check(vkCreateImageView(device->device, &view_info, NULL, &self->view));
+
+  // Anisotropic footprints would reach past the tile borders
+  VkSamplerCreateInfo sampler_info = {
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_LINEAR,
+    .minFilter = VK_FILTER_LINEAR,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .compareOp = VK_COMPARE_OP_NEVER,
+    .maxLod = 0.0f,
+    .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK,
+  };
+  vk_check(
+    vkCreateSampler(device->device, &sampler_info, NULL, &self->sampler));
+
+  xrg_log_i("Virtual texture cache has %d slots, %.1f MB.", self->slot_count,
+            (double)mem_reqs.size / (1024.0 * 1024.0));
+}
+
+static void
+_create_page_table(vulkan_virtual_texture *self)
+{
+  vk_check(vulkan_device_create_buffer(
+    self->device, &self->page_table, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    sizeof(vulkan_virtual_texture_header) +
+      sizeof(uint32_t) * self->tile_count,
+    NULL));
+  // Map persistent
+  vk_check(vulkan_buffer_map(&self->page_table));
+
+  vulkan_virtual_texture_header *header = self->page_table.mapped;
+  memset(header, 0, sizeof(*header));
+  header->level_count = self->level_count;
+  header->tile_size = TILE_SIZE;
+  header->slot_size = SLOT_SIZE;
+  header->slots_per_side = self->slots_per_side;
+  for (uint32_t i = 0; i < self->level_count; i++) {
+    header->levels[i][0] = self->levels[i].width;
+    header->levels[i][1] = self->levels[i].height;
+    header->levels[i][2] = self->levels[i].tiles_x;
+    header->levels[i][3] = self->levels[i].first_tile;
+  }
+
+  self->page_table_dirty = true;
+}
+
+bool
+vulkan_virtual_texture_init(vulkan_virtual_texture *self,
+                            const ktx_uint8_t *bytes,
+                            ktx_size_t size,
+                            vulkan_device *device,
+                            vulkan_submit *submit,
+                            VkFormat format)
+{
+  KTX_error_code result = ktxTexture_CreateFromMemory(
+    bytes, size, KTX_TEXTURE_CREATE_NO_FLAGS, &self->ktx);
+  if (result != KTX_SUCCESS) {
+    xrg_log_e("Creation of ktxTexture failed: %d", result);
+    return false;
+  }
+
+  if (!_is_supported(self, self->ktx)) {
+    ktxTexture_Destroy(self->ktx);
+    return false;
+  }
+
+  self->device = device;
+  self->submit = submit;
+  self->format =
+    format == VK_FORMAT_UNDEFINED ? ktxTexture_GetVkFormat(self->ktx) : format;
+  self->width = self->ktx->baseWidth;
+  self->height = self->ktx->baseHeight;
+  self->element_size = ktxTexture_GetElementSize(self->ktx);
+  self->frame = 1;
+
+  self->tiles = calloc(self->tile_count, sizeof(vulkan_virtual_texture_tile));
+  for (uint32_t i = 0; i < self->tile_count; i++)
+    self->tiles[i].slot = -1;
+
+  _create_cache(self);
+  _create_page_table(self);
+
+  self->slots = malloc(sizeof(uint32_t) * self->slot_count);
+  for (uint32_t i = 0; i < self->slot_count; i++)
+    self->slots[i] = UINT32_MAX;
+
+  self->job_head = 0;
+  self->job_next = 0;
+  self->job_tail = 0;
+  self->quit = false;
+  pthread_mutex_init(&self->mutex, NULL);
+  pthread_cond_init(&self->cond, NULL);
+  xrg_log_f_if(pthread_create(&self->thread, NULL, _worker, self) != 0,
+               "Could not start the virtual texture thread.");
+
+  xrg_log_i("Streaming %dx%d texture in %d tiles over %d levels.",
+            self->width, self->height, self->tile_count, self->level_count);
+
+  return true;
+}
+
+void
+vulkan_virtual_texture_stop(vulkan_virtual_texture *self)
+{
+  pthread_mutex_lock(&self->mutex);
+  bool running = !self->quit;
+  self->quit = true;
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+  if (!running)
+    return;
+
+  pthread_join(self->thread, NULL);
+
+  // Recorded copies may not be submitted yet
+  if (self->job_next != self->job_head)
+    vulkan_submit_wait(self->submit,
+                       self->jobs[(self->job_next - 1) % MAX_JOBS].ticket);
+}
+
+void
+vulkan_virtual_texture_destroy(vulkan_virtual_texture *self)
+{
+  vulkan_virtual_texture_stop(self);
+
+  pthread_cond_destroy(&self->cond);
+  pthread_mutex_destroy(&self->mutex);
+
+  vulkan_buffer_destroy(&self->page_table);
+  vkDestroySampler(self->device->device, self->sampler, NULL);
+  vkDestroyImageView(self->device->device, self->view, NULL);
+  vkDestroyImage(self->device->device, self->image, NULL);
+  vulkan_device_free_memory(self->device, self->device_memory);
+
+  free(self->slots);
+  free(self->tiles);
+  ktxTexture_Destroy(self->ktx);
+}
+
+VkDescriptorImageInfo
+vulkan_virtual_texture_get_descriptor(vulkan_virtual_texture *self)
+{
+  VkDescriptorImageInfo descriptor = {
+    .sampler = self->sampler,
+    .imageView = self->view,
+    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
+  return descriptor;
+}
+
+static void
+_mark(vulkan_virtual_texture *self, uint32_t level, float u, float v)
+{
+  for (; level < self->level_count; level++) {
+    vulkan_virtual_texture_level *info = &self->levels[level];
+    uint32_t x = (uint32_t)(u * (float)info->width) / TILE_SIZE;
+    uint32_t y = (uint32_t)(v * (float)info->height) / TILE_SIZE;
+    if (x >= info->tiles_x)
+      x = info->tiles_x - 1;
+    if (y >= info->tiles_y)
+      y = info->tiles_y - 1;
+
+    vulkan_virtual_texture_tile *tile =
+      &self->tiles[info->first_tile + y * info->tiles_x + x];
+
+    // The parent was marked along with it, its ancestors too
+    if (tile->last_used == self->frame)
+      return;
+    tile->last_used = self->frame;
+  }
+}
+
+// Same mapping as sky_plane_equirect.frag
+static void
+_equirect_uv(const float m[16], float x, float y, float *u, float *v)
+{
+  float d[4];
+  for (uint32_t i = 0; i < 4; i++)
+    d[i] = m[i] * x + m[4 + i] * y + m[8 + i] + m[12 + i];
+
+  float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2] + d[3] * d[3]);
+  *u = atan2f(d[0], -d[2]) / (2.0f * (float)M_PI) + 0.5f;
+  *v = acosf(-d[1] / length) / (float)M_PI;
+}
+
+// Difference across the seam of the panorama
+static float
+_wrap(float du)
+{
+  return du - roundf(du);
+}
+
+void
+vulkan_virtual_texture_request_view(vulkan_virtual_texture *self,
+                                    const float inverse_vp[16],
+                                    uint32_t width,
+                                    uint32_t height)
+{
+  // Pixels between samples, derivatives are taken across them
+  float step_x = (float)width / (float)(GRID - 1);
+  float step_y = (float)height / (float)(GRID - 1);
+
+  float uv[GRID + 1][GRID + 1][2];
+  for (uint32_t j = 0; j <= GRID; j++)
+    for (uint32_t i = 0; i <= GRID; i++)
+      _equirect_uv(inverse_vp, (float)i / (float)(GRID - 1) * 2.0f - 1.0f,
+                   (float)j / (float)(GRID - 1) * 2.0f - 1.0f, &uv[j][i][0],
+                   &uv[j][i][1]);
+
+  float size_u = (float)self->width;
+  float size_v = (float)self->height;
+  float max_level = (float)(self->level_count - 1);
+
+  for (uint32_t j = 0; j < GRID; j++) {
+    for (uint32_t i = 0; i < GRID; i++) {
+      float *p = uv[j][i];
+      float dx_u = _wrap(uv[j][i + 1][0] - p[0]) * size_u / step_x;
+      float dx_v = (uv[j][i + 1][1] - p[1]) * size_v / step_x;
+      float dy_u = _wrap(uv[j + 1][i][0] - p[0]) * size_u / step_y;
+      float dy_v = (uv[j + 1][i][1] - p[1]) * size_v / step_y;
+
+      float footprint = fmaxf(sqrtf(dx_u * dx_u + dx_v * dx_v),
+                              sqrtf(dy_u * dy_u + dy_v * dy_v));
+      float lod = floorf(log2f(footprint));
+      if (!(lod >= 0.0f))
+        lod = 0.0f;
+      else if (lod > max_level)
+        lod = max_level;
+
+      _mark(self, (uint32_t)lod, p[0], p[1]);
+    }
+  }
+}
+
+// Least recently used slot whose tile was not needed in this frame
+static int32_t
+_find_slot(vulkan_virtual_texture *self)
+{
+  int32_t best = -1;
+  uint64_t best_used = UINT64_MAX;
+  for (uint32_t i = 0; i < self->slot_count; i++) {
+    if (self->slots[i] == UINT32_MAX)
+      return (int32_t)i;
+
+    vulkan_virtual_texture_tile *tile = &self->tiles[self->slots[i]];
+    if (!tile->loading && tile->last_used < self->frame &&
+        tile->last_used < best_used) {
+      best = (int32_t)i;
+      best_used = tile->last_used;
+    }
+  }
+
+  if (best >= 0) {
+    vulkan_virtual_texture_tile *evicted = &self->tiles[self->slots[best]];
+    evicted->slot = -1;
+    evicted->resident = false;
+    self->page_table_dirty = true;
+  }
+
+  return best;
+}
+
+static void
+_write_page_table(vulkan_virtual_texture *self)
+{
+  uint32_t *entries = (uint32_t *)((uint8_t *)self->page_table.mapped +
+                                   sizeof(vulkan_virtual_texture_header));
+
+  // Coarse to fine, so fallbacks can be taken from the parent
+  for (int32_t l = (int32_t)self->level_count - 1; l >= 0; l--) {
+    vulkan_virtual_texture_level *info = &self->levels[l];
+    for (uint32_t y = 0; y < info->tiles_y; y++) {
+      for (uint32_t x = 0; x < info->tiles_x; x++) {
+        uint32_t index = info->first_tile + y * info->tiles_x + x;
+        vulkan_virtual_texture_tile *tile = &self->tiles[index];
+
+        if (tile->resident) {
+          entries[index] =
+            RESIDENT_BIT | (uint32_t)l << 16 | (uint32_t)tile->slot;
+        } else if (l == (int32_t)self->level_count - 1) {
+          entries[index] = 0;
+        } else {
+          vulkan_virtual_texture_level *parent = &self->levels[l + 1];
+          uint32_t px = x / 2 < parent->tiles_x ? x / 2 : parent->tiles_x - 1;
+          uint32_t py = y / 2 < parent->tiles_y ? y / 2 : parent->tiles_y - 1;
+          entries[index] =
+            entries[parent->first_tile + py * parent->tiles_x + px];
+        }
+      }
+    }
+  }
+}
+
+void
+vulkan_virtual_texture_update(vulkan_virtual_texture *self)
+{
+  // The coarsest tile always stays in the cache
+  self->tiles[self->tile_count - 1].last_used = self->frame;
+
+  // Jobs complete in order
+  while (true) {
+    pthread_mutex_lock(&self->mutex);
+    bool staged = self->job_head != self->job_next;
+    vulkan_virtual_texture_job job = self->jobs[self->job_head % MAX_JOBS];
+    pthread_mutex_unlock(&self->mutex);
+
+    if (!staged || !vulkan_submit_is_done(self->submit, job.ticket))
+      break;
+
+    vulkan_virtual_texture_tile *tile = &self->tiles[job.tile];
+    tile->loading = false;
+    tile->resident = true;
+    self->page_table_dirty = true;
+    self->job_head++;
+  }
+
+  pthread_mutex_lock(&self->mutex);
+  uint32_t tail = self->job_tail;
+  pthread_mutex_unlock(&self->mutex);
+
+  // Coarse tiles first, they cover more of the view
+  for (int32_t i = (int32_t)self->tile_count - 1;
+       i >= 0 && tail - self->job_head < MAX_JOBS; i--) {
+    vulkan_virtual_texture_tile *tile = &self->tiles[i];
+    if (tile->last_used != self->frame || tile->slot >= 0)
+      continue;
+
+    int32_t slot = _find_slot(self);
+    if (slot < 0)
+      break;
+
+    self->slots[slot] = (uint32_t)i;
+    tile->slot = slot;
+    tile->loading = true;
+
+    self->jobs[tail % MAX_JOBS] = (vulkan_virtual_texture_job){
+      .tile = (uint32_t)i,
+      .slot = (uint32_t)slot,
+    };
+    tail++;
+  }
+
+  // Evicted slots leave the page table before they are written again
+  if (self->page_table_dirty) {
+    _write_page_table(self);
+    self->page_table_dirty = false;
+  }
+
+  pthread_mutex_lock(&self->mutex);
+  if (self->job_tail != tail) {
+    self->job_tail = tail;
+    pthread_cond_signal(&self->cond);
+  }
+  pthread_mutex_unlock(&self->mutex);
+
+  self->frame++;
+}
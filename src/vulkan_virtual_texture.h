@@ -0,0 +1,182 @@
+/*
+ * xrgears
+ *
+ * Copyright 2020 Collabora Ltd.
+ *
+ * Authors: Lubosz Sarnecki <lubosz.sarnecki@collabora.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+#include "vulkan_buffer.h"
+#include "vulkan_submit.h"
+#include "ktx_texture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Texels of a tile, without the border shared with its neighbours
+#define VULKAN_VIRTUAL_TEXTURE_TILE_SIZE 128
+// Lets the cache be sampled bilinearly up to the tile edges
+#define VULKAN_VIRTUAL_TEXTURE_TILE_BORDER 1
+#define VULKAN_VIRTUAL_TEXTURE_MAX_LEVELS 16
+// 48x48 RGBA8 slots of 130x130 texels are about 150 MB
+#define VULKAN_VIRTUAL_TEXTURE_MAX_SLOTS_PER_SIDE 48
+// Tiles streamed at once, bounds the work per frame
+#define VULKAN_VIRTUAL_TEXTURE_MAX_JOBS 32
+// Samples across each view when looking for the tiles it needs
+#define VULKAN_VIRTUAL_TEXTURE_COVERAGE_GRID 64
+
+/*
+ * Header of the page table, as read by sky_plane_virtual.frag. Each level
+ * stores width, height, tiles per row and the index of its first entry.
+ * Entries are the cache slot in the low 16 bits, the level of the tile in
+ * the slot above and bit 31 if there is one. Tiles that are not resident
+ * point to their closest resident ancestor.
+ */
+typedef struct
+{
+  uint32_t level_count;
+  uint32_t tile_size;
+  uint32_t slot_size;
+  uint32_t slots_per_side;
+  uint32_t levels[VULKAN_VIRTUAL_TEXTURE_MAX_LEVELS][4];
+} vulkan_virtual_texture_header;
+
+typedef struct
+{
+  uint32_t width, height;
+  uint32_t tiles_x, tiles_y;
+  // Index of the first tile of the level
+  uint32_t first_tile;
+} vulkan_virtual_texture_level;
+
+typedef struct
+{
+  // -1 while not in the cache
+  int32_t slot;
+  bool loading;
+  bool resident;
+  // Frame it was last needed in
+  uint64_t last_used;
+} vulkan_virtual_texture_tile;
+
+typedef struct
+{
+  uint32_t tile;
+  uint32_t slot;
+  // Set by the worker once the copy is recorded
+  vulkan_submit_ticket ticket;
+  bool staged;
+} vulkan_virtual_texture_job;
+
+/*
+ * A 2D texture too large to be resident, like a 16k panorama. It is split
+ * into tiles per level, which are streamed on a worker thread from the KTX
+ * data into slots of a fixed cache image, as views need them. The page
+ * table maps each tile to the slot holding it, or to a coarser tile. The
+ * coarsest level fits into one tile and always stays in the cache.
+ *
+ * The cache is only written on the graphics queue of submit, the page table
+ * from the host, while no frame reading it is in flight.
+ */
+typedef struct
+{
+  vulkan_device *device;
+  vulkan_submit *submit;
+  ktxTexture *ktx;
+
+  VkImage image;
+  VkDeviceMemory device_memory;
+  VkImageView view;
+  VkSampler sampler;
+  VkFormat format;
+  uint32_t slots_per_side;
+
+  uint32_t width, height;
+  uint32_t element_size;
+  vulkan_virtual_texture_level levels[VULKAN_VIRTUAL_TEXTURE_MAX_LEVELS];
+  uint32_t level_count;
+
+  vulkan_virtual_texture_tile *tiles;
+  uint32_t tile_count;
+  // Tile index held by each slot, UINT32_MAX if free
+  uint32_t *slots;
+  uint32_t slot_count;
+
+  // Host visible, written when tiles come and go
+  vulkan_buffer page_table;
+  bool page_table_dirty;
+
+  uint64_t frame;
+
+  // Jobs from head to tail are in flight, the worker is at next
+  vulkan_virtual_texture_job jobs[VULKAN_VIRTUAL_TEXTURE_MAX_JOBS];
+  uint32_t job_head, job_next, job_tail;
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool quit;
+} vulkan_virtual_texture;
+
+/*
+ * Reads the layout of the KTX file in bytes, which need to stay valid until
+ * the texture is destroyed. Only uncompressed 2D files with all levels down
+ * to a single tile, which can be read in place, are supported. format
+ * overrides the one of the file like in vulkan_texture_load_ktx. Returns
+ * false without creating anything otherwise.
+ */
+bool
+vulkan_virtual_texture_init(vulkan_virtual_texture *self,
+                            const ktx_uint8_t *bytes,
+                            ktx_size_t size,
+                            vulkan_device *device,
+                            vulkan_submit *submit,
+                            VkFormat format);
+
+/*
+ * Stops the worker and waits for the tiles it staged. Needs to be called
+ * before submit is destroyed, tiles are not streamed afterwards.
+ */
+void
+vulkan_virtual_texture_stop(vulkan_virtual_texture *self);
+
+// Stops the worker if needed, the cache is destroyed right away
+void
+vulkan_virtual_texture_destroy(vulkan_virtual_texture *self);
+
+// Sampler and view of the cache
+VkDescriptorImageInfo
+vulkan_virtual_texture_get_descriptor(vulkan_virtual_texture *self);
+
+/*
+ * Marks the tiles seen by a view of an equirectangular projection of the
+ * texture. inverse_vp is the column major inverse of the view projection,
+ * with the translation removed, extent the view size in pixels.
+ */
+void
+vulkan_virtual_texture_request_view(vulkan_virtual_texture *self,
+                                    const float inverse_vp[16],
+                                    uint32_t width,
+                                    uint32_t height);
+
+/*
+ * Maps tiles that finished streaming, queues the ones requested since the
+ * last update and writes the page table. Needs to be called while no frame
+ * is in flight.
+ */
+void
+vulkan_virtual_texture_update(vulkan_virtual_texture *self);
+
+#ifdef __cplusplus
+}
+#endif
@@ -140,8 +140,9 @@ _check_xr_extensions(xr_example* self, const char* vulkan_extension)
               XR_EXTX_OVERLAY_EXTENSION_NAME, self->extensions.overlay);
   }
 
-  if (!is_extension_supported(XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME, props, count)) {
-    self->extensions.depth_layer = true;;
+  self->extensions.depth_layer = is_extension_supported(
+    XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME, props, count);
+  if (!self->extensions.depth_layer) {
     xrg_log_i("Runtime does not support depth layer extension %s",
               XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME);
     // not fatal
@@ -402,12 +403,17 @@ _create_vk_instance2(xr_example* self, VkInstance* instance)
     .apiVersion = VK_MAKE_VERSION(1, 0, 2),
   };
 
+  // needed by optional device extensions like VK_KHR_dynamic_rendering
+  const char* extensions[] = {
+    VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+  };
+
   // runtime will add extensions it requires
   VkInstanceCreateInfo instance_info = {
     .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
     .pApplicationInfo = &app_info,
-    .enabledExtensionCount = 0,
-    .ppEnabledExtensionNames = NULL,
+    .enabledExtensionCount = ARRAY_SIZE(extensions),
+    .ppEnabledExtensionNames = extensions,
   };
 
   XrVulkanInstanceCreateInfoKHR xr_vk_instance_info = {
@@ -545,11 +551,12 @@ _get_vk_device2(xr_example* self,
 
 static bool
 _create_vk_device2(xr_example* self,
+                   VkInstance instance,
                    VkPhysicalDevice physical_device,
                    vulkan_device** device)
 {
 
-  *device = vulkan_device_create(physical_device);
+  *device = vulkan_device_create(instance, physical_device);
 
   vulkan_device* d = *device;
 
@@ -561,26 +568,19 @@ _create_vk_device2(xr_example* self,
     return false;
 
 
-  //! @todo merge with vulkan_device_create_device()
-  VkDeviceQueueCreateInfo queue_info = {
-    .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-    .queueFamilyIndex = d->graphics_family_index,
-    .queueCount = 1,
-    .pQueuePriorities = (float[]){ 0.0f },
-  };
-
-  VkPhysicalDeviceFeatures enabled_features = {
-    .samplerAnisotropy = VK_TRUE,
-  };
+  vulkan_device_create_info create_info;
+  vulkan_device_init_create_info(d, &create_info,
+                                 self->settings->dynamic_rendering);
 
   // runtime will add extensions it requires
   VkDeviceCreateInfo device_info = {
     .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-    .queueCreateInfoCount = 1,
-    .pQueueCreateInfos = &queue_info,
-    .pEnabledFeatures = &enabled_features,
-    .enabledExtensionCount = 0,
-    .ppEnabledExtensionNames = NULL,
+    .pNext = create_info.next,
+    .queueCreateInfoCount = create_info.queue_count,
+    .pQueueCreateInfos = create_info.queues,
+    .pEnabledFeatures = &create_info.features,
+    .enabledExtensionCount = create_info.extension_count,
+    .ppEnabledExtensionNames = create_info.extensions,
   };
 
 
@@ -607,6 +607,8 @@ _create_vk_device2(xr_example* self,
     return false;
   }
 
+  vulkan_device_init_functions(d, &create_info);
+
   return true;
 }
 
@@ -697,8 +699,44 @@ _begin_session(xr_example* self)
   return true;
 }
 
+static uint32_t
+_format_size(int64_t format)
+{
+  switch (format) {
+  case VK_FORMAT_D16_UNORM: return 2;
+  case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+  default: return 4;
+  }
+}
+
+/*
+ * Swapchain images are allocated by the runtime, so only an estimate of
+ * their size ends up in the memory accounting.
+ */
+static void
+_add_swapchain_estimate(xr_example* self,
+                        int64_t format,
+                        uint32_t view,
+                        uint32_t length)
+{
+  if (!self->memory_stats)
+    return;
+
+  VkDeviceSize size =
+    (VkDeviceSize)self->configuration_views[view].recommendedImageRectWidth *
+    self->configuration_views[view].recommendedImageRectHeight *
+    _format_size(format) * length;
+
+  vulkan_memory_add_estimate(self->memory_stats, VULKAN_MEMORY_SWAPCHAIN,
+                             size);
+}
+
+/*
+ * Pipelines only depend on the formats, so they can be compiled while the
+ * swapchains are created. A depth format of 0 keeps depth in the app.
+ */
 static bool
-_create_swapchains(xr_example* self, xr_proj* proj)
+_select_swapchain_formats(xr_example* self)
 {
   XrResult result;
   uint32_t swapchainFormatCount;
@@ -713,6 +751,32 @@ _create_swapchains(xr_example* self, xr_proj* proj)
   if (!xr_result(result, "Failed to enumerate swapchain formats"))
     return false;
 
+  // just use the first enumerated format
+  self->swapchain_format = swapchainFormats[0];
+
+  self->depth_swapchain_format = 0;
+
+  int64_t preference1 = VK_FORMAT_D32_SFLOAT;
+  int64_t preference2 = VK_FORMAT_D16_UNORM;
+
+  for (uint32_t i = 0; i < swapchainFormatCount; i++) {
+    if (swapchainFormats[i] == preference1) {
+      self->depth_swapchain_format = preference1;
+    } else if (swapchainFormats[i] == preference2) {
+      if (self->depth_swapchain_format == 0) {
+        self->depth_swapchain_format = preference2;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool
+_create_swapchains(xr_example* self, xr_proj* proj)
+{
+  XrResult result;
+
   /* First create swapchains and query the length for each swapchain. */
   proj->swapchains =
     (XrSwapchain*)malloc(sizeof(XrSwapchain) * self->view_count);
@@ -722,16 +786,13 @@ _create_swapchains(xr_example* self, xr_proj* proj)
 
   proj->last_acquired = (uint32_t*)malloc(sizeof(uint32_t) * self->view_count);
 
-  self->swapchain_format = swapchainFormats[0];
-
   for (uint32_t i = 0; i < self->view_count; i++) {
     XrSwapchainCreateInfo swapchainCreateInfo = {
       .type = XR_TYPE_SWAPCHAIN_CREATE_INFO,
       .createFlags = 0,
       .usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT |
                     XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT,
-      // just use the first enumerated format
-      .format = swapchainFormats[0],
+      .format = self->swapchain_format,
       .sampleCount = 1,
       .width = self->configuration_views[i].recommendedImageRectWidth,
       .height = self->configuration_views[i].recommendedImageRectHeight,
@@ -777,6 +838,8 @@ _create_swapchains(xr_example* self, xr_proj* proj)
       return false;
     xrg_log_d("xrEnumerateSwapchainImages: swapchain_length[%d] %d", i,
               proj->swapchain_length[i]);
+    _add_swapchain_estimate(self, self->swapchain_format, i,
+                            proj->swapchain_length[i]);
   }
 
   return true;
@@ -787,17 +850,6 @@ static bool
 _create_depth_swapchains(xr_example* self, xr_proj* proj)
 {
   XrResult result;
-  uint32_t swapchainFormatCount;
-  result =
-    xrEnumerateSwapchainFormats(self->session, 0, &swapchainFormatCount, NULL);
-  if (!xr_result(result, "Failed to get number of supported swapchain formats"))
-    return false;
-
-  int64_t swapchainFormats[swapchainFormatCount];
-  result = xrEnumerateSwapchainFormats(self->session, swapchainFormatCount,
-                                       &swapchainFormatCount, swapchainFormats);
-  if (!xr_result(result, "Failed to enumerate swapchain formats"))
-    return false;
 
   /* First create swapchains and query the length for each swapchain. */
   proj->depth_swapchains =
@@ -809,25 +861,6 @@ _create_depth_swapchains(xr_example* self, xr_proj* proj)
   proj->depth_last_acquired =
     (uint32_t*)malloc(sizeof(uint32_t) * self->view_count);
 
-  self->depth_swapchain_format = 0;
-
-  int64_t preference1 = VK_FORMAT_D32_SFLOAT;
-  int64_t preference2 = VK_FORMAT_D16_UNORM;
-
-  for (uint32_t i = 0; i < swapchainFormatCount; i++) {
-    if (swapchainFormats[i] == preference1) {
-      self->depth_swapchain_format = preference1;
-    } else if (swapchainFormats[i] == preference2) {
-      if (self->depth_swapchain_format == 0) {
-        self->depth_swapchain_format = preference2;
-      }
-    }
-  }
-
-  if (self->depth_swapchain_format == 0) {
-    xrg_log_e("None of our preferred depth swapchain formats are supported");
-    return false;
-  }
   xrg_log_i("Using depth swapchain format 0x%x", self->depth_swapchain_format);
 
   for (uint32_t i = 0; i < self->view_count; i++) {
@@ -835,7 +868,6 @@ _create_depth_swapchains(xr_example* self, xr_proj* proj)
       .type = XR_TYPE_SWAPCHAIN_CREATE_INFO,
       .createFlags = 0,
       .usageFlags = XR_SWAPCHAIN_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-      // just use the first enumerated format
       .format = self->depth_swapchain_format,
       .sampleCount = 1,
       .width = self->configuration_views[i].recommendedImageRectWidth,
@@ -883,6 +915,8 @@ _create_depth_swapchains(xr_example* self, xr_proj* proj)
       return false;
     xrg_log_d("xrEnumerateSwapchainImages: depth swapchain_length[%d] %d", i,
               proj->depth_swapchain_length[i]);
+    _add_swapchain_estimate(self, self->depth_swapchain_format, i,
+                            proj->depth_swapchain_length[i]);
   }
 
   return true;
@@ -914,7 +948,7 @@ _create_projection_views(xr_example* self, xr_proj* proj)
     };
 
     if (proj->has_depth) {
-      proj->depth_layer.subImage = (XrSwapchainSubImage){
+      proj->depth_layers[i].subImage = (XrSwapchainSubImage){
         .swapchain = proj->depth_swapchains[i],
         .imageRect = {
           .extent = {
@@ -1102,12 +1136,14 @@ _select_layers(xr_example* self)
         (const XrCompositionLayerBaseHeader* const)&self->sky.layer;
       break;
     case SKY_TYPE_EQUIRECT1:
-      self->layers[self->num_layers++] =
-        (const XrCompositionLayerBaseHeader* const)&self->equirect.layer_v1;
+      if (self->equirect.ready)
+        self->layers[self->num_layers++] =
+          (const XrCompositionLayerBaseHeader* const)&self->equirect.layer_v1;
       break;
     case SKY_TYPE_EQUIRECT2:
-      self->layers[self->num_layers++] =
-        (const XrCompositionLayerBaseHeader* const)&self->equirect.layer_v2;
+      if (self->equirect.ready)
+        self->layers[self->num_layers++] =
+          (const XrCompositionLayerBaseHeader* const)&self->equirect.layer_v2;
       break;
     default: break;
     }
@@ -1122,22 +1158,25 @@ _select_layers(xr_example* self)
       self->gears.views[i].fov = self->views[i].fov;
 
       if (self->gears.has_depth) {
-        self->gears.views[i].next = &self->gears.depth_layer;
+        XrCompositionLayerDepthInfoKHR* depth = &self->gears.depth_layers[i];
+        self->gears.views[i].next = depth;
 
-        self->gears.depth_layer.nearZ = self->near_z;
-        self->gears.depth_layer.farZ = self->far_z;
+        depth->nearZ = self->near_z;
+        depth->farZ = self->far_z;
 
-        self->gears.depth_layer.minDepth = 0.0;
-        self->gears.depth_layer.maxDepth = 1.0;
+        depth->minDepth = 0.0;
+        depth->maxDepth = 1.0;
       }
     }
   }
 
   if (self->settings->enable_quad) {
-    self->layers[self->num_layers++] =
-      (const XrCompositionLayerBaseHeader* const)&self->quad.layer;
-    self->layers[self->num_layers++] =
-      (const XrCompositionLayerBaseHeader* const)&self->quad2.layer;
+    if (self->quad.ready)
+      self->layers[self->num_layers++] =
+        (const XrCompositionLayerBaseHeader* const)&self->quad.layer;
+    if (self->quad2.ready)
+      self->layers[self->num_layers++] =
+        (const XrCompositionLayerBaseHeader* const)&self->quad2.layer;
   }
 }
 
@@ -1169,8 +1208,13 @@ _cleanup_proj(xr_example* self, xr_proj* proj)
 {
   for (uint32_t i = 0; i < self->view_count; i++) {
     xrDestroySwapchain(proj->swapchains[i]);
+    if (proj->has_depth)
+      xrDestroySwapchain(proj->depth_swapchains[i]);
   }
   free(proj->swapchains);
+  if (proj->has_depth)
+    free(proj->depth_swapchains);
+  free(proj->depth_layers);
 }
 
 void
@@ -1207,9 +1251,12 @@ _init_proj(xr_example* self,
   }
 
   // has to be initialized before _create_projection_views
-  proj->depth_layer = (XrCompositionLayerDepthInfoKHR){
-    .type = XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR,
-  };
+  proj->depth_layers = (XrCompositionLayerDepthInfoKHR*)malloc(
+    sizeof(XrCompositionLayerDepthInfoKHR) * self->view_count);
+  for (uint32_t i = 0; i < self->view_count; i++)
+    proj->depth_layers[i] = (XrCompositionLayerDepthInfoKHR){
+      .type = XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR,
+    };
 
   _create_projection_views(self, proj);
   proj->layer = (XrCompositionLayerProjection){
@@ -1256,7 +1303,7 @@ _init_vulkan_enable2(xr_example* self,
   if (!_get_vk_device2(self, *instance, &physical_device))
     return false;
 
-  if (!_create_vk_device2(self, physical_device, vulkan_device))
+  if (!_create_vk_device2(self, *instance, physical_device, vulkan_device))
     return false;
 
   return true;
@@ -1345,14 +1392,39 @@ xr_init_post_vk(xr_example* self,
   if (!_begin_session(self))
     return false;
 
+  if (!_select_swapchain_formats(self))
+    return false;
+
+  /*
+   * Without the depth layer extension depth stays inside the application.
+   * Multisampled depth is not submitted either, as that would need a depth
+   * resolve.
+   */
   if (self->settings->enable_gears) {
-    _init_proj(self, XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT,
-               &self->gears, true);
+    bool submit_depth =
+      self->extensions.depth_layer && self->settings->msaa_samples <= 1;
+    if (submit_depth && self->depth_swapchain_format == 0) {
+      xrg_log_w("None of our preferred depth swapchain formats are supported");
+      submit_depth = false;
+    }
+    self->gears.has_depth = submit_depth;
   }
 
-  if (self->sky_type == SKY_TYPE_PROJECTION)
-    _init_proj(self, XR_COMPOSITION_LAYER_UNPREMULTIPLIED_ALPHA_BIT, &self->sky,
-               false);
+  return true;
+}
+
+bool
+xr_init_swapchains(xr_example* self)
+{
+  if (self->settings->enable_gears &&
+      !_init_proj(self, XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT,
+                  &self->gears, self->gears.has_depth))
+    return false;
+
+  if (self->sky_type == SKY_TYPE_PROJECTION &&
+      !_init_proj(self, XR_COMPOSITION_LAYER_UNPREMULTIPLIED_ALPHA_BIT,
+                  &self->sky, false))
+    return false;
 
   return true;
 }
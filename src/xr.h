@@ -38,7 +38,7 @@ extern "C" {
 typedef struct xr_proj
 {
   XrCompositionLayerProjection layer;
-  XrCompositionLayerDepthInfoKHR depth_layer;
+  XrCompositionLayerDepthInfoKHR* depth_layers; // One per view
   XrCompositionLayerProjectionView* views;
   XrSwapchain* swapchains;
   uint32_t* swapchain_length; // One length per view
@@ -119,6 +119,9 @@ typedef struct xr_example
 
   xrg_settings* settings;
 
+  // Swapchain memory estimates are added here when set
+  vulkan_memory_stats* memory_stats;
+
 #ifdef XR_OS_ANDROID
   XrInstanceCreateInfoAndroidKHR instanceCreateInfoAndroid;
 #endif
@@ -133,6 +136,7 @@ xr_init(xr_example* self,
 bool
 xr_init2(xr_example* self, VkInstance* instance, vulkan_device** vulkan_device);
 
+// Creates the session and picks the swapchain formats
 bool
 xr_init_post_vk(xr_example* self,
                 VkInstance instance,
@@ -141,6 +145,10 @@ xr_init_post_vk(xr_example* self,
                 uint32_t queue_family_index,
                 uint32_t queue_index);
 
+// Creates the projection layer swapchains in the formats picked before
+bool
+xr_init_swapchains(xr_example* self);
+
 void
 xr_cleanup(xr_example* self);
 
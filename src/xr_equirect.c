@@ -35,7 +35,8 @@ _create_equirect_swapchain(xr_equirect* self,
     .usageFlags = XR_SWAPCHAIN_USAGE_TRANSFER_DST_BIT |
                   XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT |
                   XR_SWAPCHAIN_USAGE_SAMPLED_BIT,
-    .createFlags = 0,
+    // Written once, so the runtime does not need to buffer it
+    .createFlags = XR_SWAPCHAIN_CREATE_STATIC_IMAGE_BIT,
     // just use the first enumerated format
     .format = VK_FORMAT_R8G8B8A8_SRGB,
     .sampleCount = 1,
@@ -47,6 +48,12 @@ _create_equirect_swapchain(xr_equirect* self,
   };
 
   result = xrCreateSwapchain(session, &swapchainCreateInfo, &self->swapchain);
+  if (result == XR_ERROR_FEATURE_UNSUPPORTED) {
+    xrg_log_w("Static swapchains are not supported, using a regular one.");
+    swapchainCreateInfo.createFlags = 0;
+    result =
+      xrCreateSwapchain(session, &swapchainCreateInfo, &self->swapchain);
+  }
   if (!xr_result(result, "Failed to create quad swapchain!"))
     return false;
 
@@ -126,6 +133,7 @@ xr_equirect_init_v2(xr_equirect* self,
   bool res = _create_equirect_swapchain(self, session, &extent);
   xrg_log_i("Initialized equirect swapchain: %d", res);
 
+  self->ready = false;
   self->layer_v2 = (XrCompositionLayerEquirect2KHR){
     .type = XR_TYPE_COMPOSITION_LAYER_EQUIRECT2_KHR,
     .layerFlags = XR_COMPOSITION_LAYER_CORRECT_CHROMATIC_ABERRATION_BIT,
@@ -163,6 +171,7 @@ xr_equirect_init_v1(xr_equirect* self,
   bool res = _create_equirect_swapchain(self, session, &extent);
   xrg_log_i("Initialized equirect swapchain: %d", res);
 
+  self->ready = false;
   self->layer_v1 = (XrCompositionLayerEquirectKHR){
     .type = XR_TYPE_COMPOSITION_LAYER_EQUIRECT_KHR,
     .layerFlags = XR_COMPOSITION_LAYER_CORRECT_CHROMATIC_ABERRATION_BIT,
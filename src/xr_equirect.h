@@ -31,6 +31,8 @@ typedef struct xr_equirect
   XrSwapchain swapchain;
   uint32_t swapchain_length;
   XrSwapchainImageVulkanKHR* images;
+  // Only submitted once the swapchain has content
+  bool ready;
 } xr_equirect;
 
 void
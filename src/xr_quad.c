@@ -33,7 +33,8 @@ _create_quad_swapchain(xr_quad* self, XrSession session, XrExtent2Di* extent)
     .usageFlags = XR_SWAPCHAIN_USAGE_TRANSFER_DST_BIT |
                   XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT |
                   XR_SWAPCHAIN_USAGE_SAMPLED_BIT,
-    .createFlags = 0,
+    // Written once, so the runtime does not need to buffer it
+    .createFlags = XR_SWAPCHAIN_CREATE_STATIC_IMAGE_BIT,
     // just use the first enumerated format
     .format = VK_FORMAT_R8G8B8A8_SRGB,
     .sampleCount = 1,
@@ -45,6 +46,12 @@ _create_quad_swapchain(xr_quad* self, XrSession session, XrExtent2Di* extent)
   };
 
   result = xrCreateSwapchain(session, &swapchainCreateInfo, &self->swapchain);
+  if (result == XR_ERROR_FEATURE_UNSUPPORTED) {
+    xrg_log_w("Static swapchains are not supported, using a regular one.");
+    swapchainCreateInfo.createFlags = 0;
+    result =
+      xrCreateSwapchain(session, &swapchainCreateInfo, &self->swapchain);
+  }
   if (!xr_result(result, "Failed to create quad swapchain!"))
     return false;
 
@@ -124,6 +131,7 @@ xr_quad_init(xr_quad* self,
 {
   bool res = _create_quad_swapchain(self, session, &extent);
   xrg_log_i("Quad Swapchain %d", res);
+  self->ready = false;
 
   self->layer = (XrCompositionLayerQuad){
     .type = XR_TYPE_COMPOSITION_LAYER_QUAD,
@@ -30,6 +30,8 @@ typedef struct xr_quad
   XrSwapchain swapchain;
   uint32_t swapchain_length;
   XrSwapchainImageVulkanKHR* images;
+  // Only submitted once the swapchain has content
+  bool ready;
 } xr_quad;
 
 void